@@ -3,15 +3,55 @@
  ************************************************************/
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binfile.h"
 
-#define MAXTOKENS 50000
 #define MAXLINE 1024
 #define TOKFILE "tokens.txt"
 
+/* Where the lexer writes the token stream. Only interactive and --verbose
+ * runs write it; other runs set it to NULL and keep the tokens in memory,
+ * so compiles in one directory do not overwrite each other's. */
+const char *token_file = TOKFILE;
+
+/* Interactive mode narrates every phase; command-line runs stay quiet */
+bool verbose = true;
+
+static void verbose_printf(const char *fmt, ...) {
+  if (!verbose)
+    return;
+  va_list ap;
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 #define NUM_STATES 84
 #define NUM_INPUTS 36
 #define DEAD 83
@@ -32,6 +72,58 @@
 #define T_OP 'O'
 #define T_STMT 'S'
 
+/* --- STATISTICS --- */
+
+/* Counters on the front end's hot paths and wall time per phase, printed
+ * by --stats. Building with -DNO_STATS turns every STAT_ macro into
+ * nothing, so the instrumentation costs nothing in that build. */
+#ifndef NO_STATS
+#define STATS 1
+#endif
+
+#define STAT_PHASES(X)                                                         \
+  X(lex)                                                                       \
+  X(load)                                                                      \
+  X(parse)                                                                     \
+  X(check)                                                                     \
+  X(compile)                                                                   \
+  X(run)
+
+#define STAT_ENUM(phase) ST_##phase,
+#define STAT_NAME(phase) #phase,
+enum { STAT_PHASES(STAT_ENUM) STAT_NUM_PHASES };
+
+#define STAT_MAX_PROD 32 /* above every prod_id */
+
+typedef struct {
+  long long dfa_transitions;   /* next_state lookups in dfa_classify */
+  long long dfa_dead_exits;    /* lexemes that ran into DEAD */
+  long long keyword_fallbacks; /* classify_keyword_or_identifier calls */
+  long long allocations;       /* lexer and token buffer growth */
+  long long dfa_heat[NUM_STATES][NUM_INPUTS]; /* next_state lookups */
+  long long tokens[128];       /* emitted, by kind */
+  long long productions[STAT_MAX_PROD]; /* applied, by prod_id */
+  int max_stack_depth;                  /* of the LL(1) parser */
+  double seconds[STAT_NUM_PHASES];
+} Stats;
+
+#ifdef STATS
+Stats stats;
+static const char *stat_phase_names[] = {STAT_PHASES(STAT_NAME)};
+#define STAT_INC(field) (stats.field++)
+#define STAT_MAX(field, v)                                                     \
+  (stats.field = (v) > stats.field ? (v) : stats.field)
+/* STAT_LAP adds the time since t to phase and restarts t */
+#define STAT_TIMER(t) double t = now_seconds()
+#define STAT_LAP(phase, t)                                                     \
+  (stats.seconds[ST_##phase] += now_seconds() - (t), (t) = now_seconds())
+#else
+#define STAT_INC(field) ((void)0)
+#define STAT_MAX(field, v) ((void)0)
+#define STAT_TIMER(t) (void)0
+#define STAT_LAP(phase, t) ((void)0)
+#endif
+
 /* DFA states */
 enum {
   D0,
@@ -260,16 +352,17 @@ char accepting_tokens[NUM_STATES] = {
     /* D49 */ 'P',
     /* D50 */ 0,
     /* D51..D54 */ 0, 0, 0, 0,
-    /* D55 */ 'F',
+    /* D55 */ 'V',
     /* D56 */ 0,
-    /* D57 */ 'F',
-    /* D58..D59 */ 0, 0,
+    /* D57 */ 0,
+    /* D58 */ 0,
+    /* D59 */ 'F',
     /* D60..D63 */ 0, 0, 0, 0,
     /* D64..D66 */ 0, 0, 0,
     /* D67 */ 0,
     /* D68 */ 0,
     /* D69 */ 'V',
-    /* D70 */ 0,
+    /* D70 */ 'N',
     /* D71 */ 'N',
     /* D72..D73 */ 0, 0,
     /* D74..D80 */ 0, 0, 0, 0, 0, 0, 0,
@@ -499,9 +592,9 @@ int next_state[NUM_STATES][NUM_INPUTS] = {
                D55,  D55,  D55,  DEAD, D55,  DEAD, D55,  D55,  D55,
                D55,  D55,  D55,  D55,  D55,  D55,  DEAD, DEAD, D55,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-    /* D55 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
+    /* D55 */ {DEAD, D55,  D55,  D55,  D55,  D55,  D55,  D55,  DEAD,
+               D55,  D55,  D55,  DEAD, D55,  DEAD, D55,  D55,  D55,
+               D55,  D55,  D55,  D55,  D55,  D55,  DEAD, DEAD, D55,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
     /* D56 */ {DEAD, D57,  D57,  D57,  D57,  D57,  D57,  D57,  DEAD,
                D57,  D57,  D57,  DEAD, D57,  DEAD, D57,  D57,  D57,
@@ -511,13 +604,13 @@ int next_state[NUM_STATES][NUM_INPUTS] = {
                D57,  D57,  D57,  DEAD, D57,  DEAD, D57,  D57,  D57,
                D57,  D57,  D57,  D57,  D57,  D58,  DEAD, DEAD, D57,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-    /* D58 */ {DEAD, DEAD, D59,  DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
+    /* D58 */ {DEAD, D57,  D59,  D57,  D57,  D57,  D57,  D57,  DEAD,
+               D57,  D57,  D57,  DEAD, D57,  DEAD, D57,  D57,  D57,
+               D57,  D57,  D57,  D57,  D57,  D58,  DEAD, DEAD, D57,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
-    /* D59 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
+    /* D59 */ {DEAD, D57,  D57,  D57,  D57,  D57,  D57,  D57,  DEAD,
+               D57,  D57,  D57,  DEAD, D57,  DEAD, D57,  D57,  D57,
+               D57,  D57,  D57,  D57,  D57,  D58,  DEAD, DEAD, D57,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
     /* D60 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
@@ -561,11 +654,11 @@ int next_state[NUM_STATES][NUM_INPUTS] = {
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
     /* D70 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, D71,  DEAD, DEAD,
+               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, D71,  DEAD,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
     /* D71 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
-               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, D71,  DEAD, DEAD,
+               DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, D71,  DEAD,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD},
     /* D72 */ {DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
                DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD, DEAD,
@@ -689,32 +782,55 @@ bool is_loop_label(const char *word, int len) {
   return true;
 }
 
-/* DFA-based classification of a token string into a single-character token
- * symbol */
-char dfa_classify(const char *word, int len, bool is_first_line) {
-  if (is_first_line)
-    return T_INCLUDE;
-  if (len == 2 && word[0] == '.' && word[1] == '.')
-    return T_STMT;
-  if (is_loop_label(word, len))
-    return T_LOOP;
-
+/* Counting next_state lookups costs a store per character, so it is off
+ * unless --dfa-heatmap asks for it */
+#ifdef STATS
+bool dfa_heat_on = false;
+#define DFA_HEAT stats.dfa_heat
+#else
+#define dfa_heat_on false
+#define DFA_HEAT NULL
+#endif
+
+/* Walks the DFA over word and returns the last accepting state, -1 if none.
+ * heat, unless NULL, counts every lookup; dfa_classify inlines one copy
+ * with and one without, so the default loop does no counting. */
+static inline __attribute__((always_inline)) int
+dfa_walk(const char *word, int len, long long (*heat)[NUM_INPUTS]) {
   int state = 0;
   int last_accepting_state = -1;
-  char last_token = 0;
-
   for (int i = 0; i < len; ++i) {
     int idx = get_input(word[i]);
     if (idx < 0 || idx >= NUM_INPUTS)
       idx = OTHER_INPUT;
+    if (heat)
+      heat[state][idx]++;
     state = next_state[state][idx];
-    if (state == DEAD)
+    STAT_INC(dfa_transitions);
+    if (state == DEAD) {
+      STAT_INC(dfa_dead_exits);
       break;
-    if (accepting_tokens[state] != 0) {
-      last_accepting_state = state;
-      last_token = accepting_tokens[state];
     }
+    if (accepting_tokens[state] != 0)
+      last_accepting_state = state;
   }
+  return last_accepting_state;
+}
+
+/* DFA-based classification of a token string into a single-character token
+ * symbol */
+char dfa_classify(const char *word, int len, bool is_first_line) {
+  if (is_first_line)
+    return T_INCLUDE;
+  if (len == 2 && word[0] == '.' && word[1] == '.')
+    return T_STMT;
+  if (is_loop_label(word, len))
+    return T_LOOP;
+
+  int last_accepting_state = dfa_heat_on ? dfa_walk(word, len, DFA_HEAT)
+                                         : dfa_walk(word, len, NULL);
+  char last_token =
+      last_accepting_state != -1 ? accepting_tokens[last_accepting_state] : 0;
 
   if (last_accepting_state != -1 && last_token != 0) {
     // Check for keywords
@@ -744,6 +860,7 @@ char dfa_classify(const char *word, int len, bool is_first_line) {
   }
 
   // Check manually for keywords using helper
+  STAT_INC(keyword_fallbacks);
   char k = classify_keyword_or_identifier(word, len);
   if (k != 'O')
     return k;
@@ -753,85 +870,310 @@ char dfa_classify(const char *word, int len, bool is_first_line) {
   return T_OP;
 }
 
-/* --- LEXER --- */
-int run_lexer(const char *input_filename) {
-  FILE *fin = fopen(input_filename, "r");
-  if (!fin) {
-    fprintf(stderr, "Cannot open input file '%s'\n", input_filename);
-    return 1;
+/* --- IDENTIFIER INTERNING --- */
+
+/* Every lexeme is interned once: the text lives in a single growable arena
+ * and an open-addressing table (linear probing, power-of-two capacity) maps
+ * it to a dense id, so later phases compare names as integers. */
+char *name_arena = NULL;
+int name_arena_len = 0, name_arena_cap = 0;
+int *name_off = NULL; /* id -> offset of NUL-terminated text in name_arena */
+int *name_len = NULL;
+int name_count = 0, name_cap = 0;
+int *intern_slots = NULL; /* id + 1, 0 = empty */
+int intern_cap = 0;
+
+static unsigned hash_bytes(const char *s, int len) {
+  unsigned h = 2166136261u; /* FNV-1a */
+  for (int i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void intern_grow(void) {
+  int ncap = intern_cap ? intern_cap * 2 : 1024;
+  int *nslots = calloc(ncap, sizeof(int));
+  if (!nslots) {
+    perror("intern");
+    exit(1);
+  }
+  STAT_INC(allocations);
+  for (int id = 0; id < name_count; id++) {
+    unsigned h = hash_bytes(name_arena + name_off[id], name_len[id]);
+    unsigned k = h & (ncap - 1);
+    while (nslots[k])
+      k = (k + 1) & (ncap - 1);
+    nslots[k] = id + 1;
+  }
+  free(intern_slots);
+  intern_slots = nslots;
+  intern_cap = ncap;
+}
+
+int intern(const char *s, int len) {
+  if ((name_count + 1) * 2 > intern_cap)
+    intern_grow();
+  unsigned k = hash_bytes(s, len) & (intern_cap - 1);
+  while (intern_slots[k]) {
+    int id = intern_slots[k] - 1;
+    if (name_len[id] == len && memcmp(name_arena + name_off[id], s, len) == 0)
+      return id;
+    k = (k + 1) & (intern_cap - 1);
+  }
+  if (name_arena_len + len + 1 > name_arena_cap) {
+    name_arena_cap = (name_arena_cap + len + 1) * 2;
+    name_arena = realloc(name_arena, name_arena_cap);
+    STAT_INC(allocations);
   }
+  if (name_count == name_cap) {
+    name_cap = name_cap ? name_cap * 2 : 512;
+    name_off = realloc(name_off, name_cap * sizeof(int));
+    name_len = realloc(name_len, name_cap * sizeof(int));
+    STAT_INC(allocations);
+  }
+  if (!name_arena || !name_off || !name_len) {
+    perror("intern");
+    exit(1);
+  }
+  memcpy(name_arena + name_arena_len, s, len);
+  name_arena[name_arena_len + len] = '\0';
+  name_off[name_count] = name_arena_len;
+  name_len[name_count] = len;
+  name_arena_len += len + 1;
+  intern_slots[k] = name_count + 1;
+  return name_count++;
+}
+
+const char *name_of(int id) { return name_arena + name_off[id]; }
+
+/* Forget every name and free the table; ids start over from 0. Only for
+ * unrelated inputs in one process, such as the fuzzer's, with nothing
+ * holding an id across the reset. */
+void intern_reset(void) {
+  free(name_arena);
+  free(name_off);
+  free(name_len);
+  free(intern_slots);
+  name_arena = NULL;
+  name_off = name_len = intern_slots = NULL;
+  name_arena_len = name_arena_cap = name_count = name_cap = intern_cap = 0;
+}
+
+/* Per-token side table written by the lexer alongside tokens.txt: the
+ * interned lexeme and its source position, used by semantic analysis. */
+typedef struct {
+  char kind;
+  int name; /* interned lexeme id */
+  int line, col;
+  int file; /* interned name of its source file */
+} TokenInfo;
+
+TokenInfo *lexed = NULL;
+int lexed_count = 0, lexed_cap = 0;
+
+/* lexed[splice_from, splice_to) are the tokens of included modules that
+ * link_includes spliced in; the others are the file's own */
+int splice_from = 0, splice_to = 0;
+
+static int own_token_count(void) {
+  return lexed_count - (splice_to - splice_from);
+}
+
+/* The lexed[] index of the file's own token i */
+static int own_token(int i) {
+  return i < splice_from ? i : i + splice_to - splice_from;
+}
+
+static int lex_file = 0; /* the file being lexed, for emit_token */
+
+/* An #include "file" line of the last lex */
+typedef struct {
+  int name; /* interned file name, without the quotes */
+  int line;
+} IncludeLine;
+
+IncludeLine *lexed_includes = NULL;
+int lexed_include_count = 0, lexed_include_cap = 0;
+
+static void emit_token(FILE *ftok, char kind, const char *text, int len,
+                       int line, int col) {
+  if (ftok)
+    fprintf(ftok, "%c ", kind);
+  STAT_INC(tokens[(unsigned char)kind & 127]);
+  verbose_printf("%-20.*s -> %c\n", len, text, kind);
+  if (lexed_count == lexed_cap) {
+    lexed_cap = lexed_cap ? lexed_cap * 2 : 1024;
+    lexed = realloc(lexed, lexed_cap * sizeof(TokenInfo));
+    STAT_INC(allocations);
+    if (!lexed) {
+      perror("lexer");
+      exit(1);
+    }
+  }
+  TokenInfo *t = &lexed[lexed_count++];
+  t->kind = kind;
+  t->name = intern(text, len);
+  t->line = line;
+  t->col = col;
+  t->file = lex_file;
+}
+
+/* Remove // and block comments in place; block comments may span lines, in
+ * which case *in_comment carries over to the next line. */
+static void strip_comments(char *s, bool *in_comment) {
+  char *p = s;
+  while (*p) {
+    if (*in_comment) {
+      char *end = strstr(p, "*/");
+      if (!end) {
+        *p = '\0';
+        return;
+      }
+      memmove(p, end + 2, strlen(end + 2) + 1);
+      *in_comment = false;
+      continue;
+    }
+    if (p[0] == '/' && p[1] == '/') {
+      *p = '\0';
+      return;
+    }
+    if (p[0] == '/' && p[1] == '*') {
+      *in_comment = true;
+      *p++ = ' ';
+      memmove(p, p + 1, strlen(p + 1) + 1);
+      continue;
+    }
+    p++;
+  }
+}
+
+/* An #include "file" or #include <file> line with nothing after it */
+static bool is_include_line(const char *s) {
+  if (!starts_with(s, "#include"))
+    return false;
+  s += strlen("#include");
+  while (isspace((unsigned char)*s))
+    s++;
+  char close = *s == '"' ? '"' : *s == '<' ? '>' : 0;
+  const char *end = close ? strchr(s + 1, close) : NULL;
+  if (!end || end == s + 1)
+    return false;
+  while (isspace((unsigned char)*++end))
+    ;
+  return *end == '\0';
+}
+
+/* The I tokens of the #include lines that open toks */
+int leading_includes(const TokenInfo *toks, int n) {
+  int k = 0;
+  while (k < n && toks[k].kind == T_INCLUDE)
+    k++;
+  return k;
+}
+
+/* Record an #include "file" line; <file> includes name no module */
+static void note_include(const char *text, int line) {
+  const char *p = text + strlen("#include");
+  while (isspace((unsigned char)*p))
+    p++;
+  const char *end = *p == '"' ? strchr(p + 1, '"') : NULL;
+  if (!end || end == p + 1)
+    return;
+  if (lexed_include_count == lexed_include_cap) {
+    lexed_include_cap = lexed_include_cap ? lexed_include_cap * 2 : 16;
+    lexed_includes =
+        realloc(lexed_includes, lexed_include_cap * sizeof(IncludeLine));
+    if (!lexed_includes) {
+      perror("lexer");
+      exit(1);
+    }
+  }
+  lexed_includes[lexed_include_count++] =
+      (IncludeLine){intern(p + 1, (int)(end - p - 1)), line};
+}
 
-  FILE *ftok = fopen(TOKFILE, "w");
-  if (!ftok) {
-    fclose(fin);
-    fprintf(stderr, "Cannot open token output file '%s'\n", TOKFILE);
+/* --- LEXER --- */
+/* Lex an open stream (a file, or memory when fuzzing) into lexed[] and
+ * token_file; a NULL token_file keeps the tokens in memory only. name is
+ * the file diagnostics give for its tokens. */
+int run_lexer_stream(FILE *fin, const char *name) {
+  FILE *ftok = token_file ? fopen(token_file, "w") : NULL;
+  if (token_file && !ftok) {
+    fprintf(stderr, "Cannot open token output file '%s'\n", token_file);
     return 1;
   }
 
   char line[MAXLINE];
-  int lineno = 0;
+  int srcline = 0; /* physical line number for diagnostics */
   bool in_comment = false;
+  bool in_header = true; /* no code seen yet */
+  /* A "loop_xxxNN" word that ended its line; its ':' may start the next */
+  char pending_label[MAXLINE];
+  int pending_len = 0, pending_line = 0, pending_col = 0;
+
+  lexed_count = 0;
+  lexed_include_count = 0;
+  splice_from = splice_to = 0;
+  lex_file = intern(name, strlen(name));
 
-  printf("Lexer DFA Output:\n");
-  printf("=================\n");
+  verbose_printf("Lexer DFA Output:\n");
+  verbose_printf("=================\n");
 
   while (fgets(line, sizeof(line), fin)) {
+    srcline++;
     line[strcspn(line, "\n\r")] = '\0';
+
+    /* Remove comments: // and block comments */
+    strip_comments(line, &in_comment);
+
     char *trim = line;
     while (*trim && isspace((unsigned char)*trim))
       trim++;
     if (*trim == '\0')
       continue;
 
-    lineno++;
-
-    /* Remove comments: // and /* ... *\/ */
-    if (!in_comment) {
-      char *comment_start = strstr(trim, "//");
-      if (comment_start)
-        *comment_start = '\0';
-      char *block_start = strstr(trim, "/*");
-      if (block_start) {
-        *block_start = '\0';
-        in_comment = true;
-      }
+    /* one I per #include line; after code, the parser rejects it */
+    if (is_include_line(trim)) {
+      if (in_header)
+        note_include(trim, srcline);
+      emit_token(ftok, T_INCLUDE, trim, strlen(trim), srcline,
+                 (int)(trim - line) + 1);
+      continue;
     }
+    in_header = false;
 
-    if (in_comment) {
-      char *block_end = strstr(trim, "*/");
-      if (block_end) {
-        memmove(trim, block_end + 2, strlen(block_end + 2) + 1);
-        in_comment = false;
-      } else
-        continue; /* skip until comment closes */
-    }
+    int i = 0, len = strlen(trim);
 
-    if (lineno == 1) {
-      fprintf(ftok, "%c ", T_INCLUDE);
-      printf("%-20s -> %c\n", "#include <stdio.h>", T_INCLUDE);
-      continue;
+    if (pending_len > 0) {
+      if (trim[0] == ':') {
+        pending_label[pending_len++] = ':';
+        i = 1;
+      }
+      emit_token(ftok, dfa_classify(pending_label, pending_len, false),
+                 pending_label, pending_len, pending_line, pending_col);
+      pending_len = 0;
     }
 
-    int i = 0, len = strlen(trim);
     while (i < len) {
       if (isspace((unsigned char)trim[i])) {
         i++;
         continue;
       }
 
+      int col = (int)(trim - line) + i + 1;
+
       /* Handle two-dot statement terminator ".." explicitly */
       if (i + 1 < len && trim[i] == '.' && trim[i + 1] == '.') {
-        fprintf(ftok, "%c ", T_STMT);
-        printf("%-20s -> %c\n", "..", T_STMT);
+        emit_token(ftok, T_STMT, trim + i, 2, srcline, col);
         i += 2;
         continue;
       }
 
       /* Single-character brackets */
       if (strchr("(){}", trim[i])) {
-        char s[2] = {trim[i], '\0'};
-        fprintf(ftok, "%c ", T_BRACKET);
-        printf("%-20s -> %c\n", s, T_BRACKET);
+        emit_token(ftok, T_BRACKET, trim + i, 1, srcline, col);
         i++;
         continue;
       }
@@ -839,9 +1181,7 @@ int run_lexer(const char *input_filename) {
       /* Single-character operators/punctuators (including ';', ',', '+', '-',
        * '<', '=', '*', '/', ':') */
       if (strchr(";,=+<-*/:", trim[i])) {
-        char s[2] = {trim[i], '\0'};
-        fprintf(ftok, "%c ", T_OP);
-        printf("%-20s -> %c\n", s, T_OP);
+        emit_token(ftok, T_OP, trim + i, 1, srcline, col);
         i++;
         continue;
       }
@@ -856,10 +1196,8 @@ int run_lexer(const char *input_filename) {
       if (i == start) {
         /* If we didn't advance, this char was unrecognized; consume as operator
          */
-        char c = trim[i++];
-        char s[2] = {c, '\0'};
-        fprintf(ftok, "%c ", T_OP);
-        printf("%-20s -> %c\n", s, T_OP);
+        emit_token(ftok, T_OP, trim + i, 1, srcline, col);
+        i++;
         continue;
       }
 
@@ -882,7 +1220,7 @@ int run_lexer(const char *input_filename) {
       }
 
       /* Also check for whitespace before colon for loop labels */
-      if (starts_with(token, "loop_")) {
+      if (starts_with(token, "loop_") && token[token_len - 1] != ':') {
         int j = i;
         while (j < len && isspace((unsigned char)trim[j]))
           j++;
@@ -895,45 +1233,33 @@ int run_lexer(const char *input_filename) {
             token_len = newlen;
             i = j + 1; /* Skip past the colon */
           }
+        } else if (j == len) {
+          /* Label at end of line: the colon may open the next line */
+          memcpy(pending_label, token, token_len);
+          pending_len = token_len;
+          pending_line = srcline;
+          pending_col = col;
+          i = j;
+          continue;
         }
       }
 
       char token_type = dfa_classify(token, token_len, false);
-
-      /* Translate DFA outputs to parser token chars */
-      if (token_type == T_VAR) {
-        fprintf(ftok, "%c ", T_VAR);
-        printf("%-20s -> %c\n", token, T_VAR);
-      } else if (token_type == T_NUM) {
-        fprintf(ftok, "%c ", T_NUM);
-        printf("%-20s -> %c\n", token, T_NUM);
-      } else if (token_type == T_PRINTF) {
-        fprintf(ftok, "%c ", T_PRINTF);
-        printf("%-20s -> %c\n", token, T_PRINTF);
-      } else if (token_type == T_TYPE) {
-        fprintf(ftok, "%c ", T_TYPE);
-        printf("%-20s -> %c\n", token, T_TYPE);
-      } else if (token_type == T_FUNC) {
-        fprintf(ftok, "%c ", T_FUNC);
-        printf("%-20s -> %c\n", token, T_FUNC);
-      } else if (token_type == T_LOOP) {
-        fprintf(ftok, "%c ", T_LOOP);
-        printf("%-20s -> %c\n", token, T_LOOP);
-      } else {
-        /* default single-character token mappings */
-        fprintf(ftok, "%c ", token_type);
-        printf("%-20s -> %c\n", token, token_type);
-      }
+      emit_token(ftok, token_type, token, token_len, srcline, col);
     }
   }
 
-  fclose(fin);
-  fclose(ftok);
+  if (pending_len > 0)
+    emit_token(ftok, dfa_classify(pending_label, pending_len, false),
+               pending_label, pending_len, pending_line, pending_col);
+
+  if (ftok)
+    fclose(ftok);
 
   /* Print compact token stream */
-  printf("\nCompact Token Stream:\n");
-  printf("=====================\n");
-  FILE *ftok_read = fopen(TOKFILE, "r");
+  verbose_printf("\nCompact Token Stream:\n");
+  verbose_printf("=====================\n");
+  FILE *ftok_read = verbose && ftok ? fopen(token_file, "r") : NULL;
   if (ftok_read) {
     char token[4];
     while (fscanf(ftok_read, "%s", token) == 1)
@@ -945,9 +1271,19 @@ int run_lexer(const char *input_filename) {
   return 0;
 }
 
+int run_lexer(const char *input_filename) {
+  FILE *fin = fopen(input_filename, "r");
+  if (!fin) {
+    fprintf(stderr, "Cannot open input file '%s'\n", input_filename);
+    return 1;
+  }
+  int rc = run_lexer_stream(fin, input_filename);
+  fclose(fin);
+  return rc;
+}
+
 /* --- PARSER WITH VISUALIZATION --- */
 
-#define MAX_STACK 100
 #define MAX_PROD 22
 
 typedef struct {
@@ -958,8 +1294,12 @@ typedef struct {
 
 /* Grammar for your language */
 Production grammar[] = {
-    // S -> I Q A
-    {'S', "I Q A", 1}, // Q = OptFuncs, A = Main
+    // Z -> J Q A; the start symbol, as 'S' is the ".." token
+    {'Z', "J Q A", 1}, // J = Includes, Q = OptFuncs, A = Main
+
+    // J -> I J | epsilon: one I per #include line
+    {'J', "I J", 21},
+    {'J', "", 22},
 
     // Q -> U Q | epsilon
     {'Q', "U Q", 2},
@@ -999,9 +1339,9 @@ Production grammar[] = {
 
 // Updated LL(1) Parsing Table - W added for while keyword
 // Terminals order: I, T, F, V, N, P, R, K, M, B, O, S, W, L, $
-int parsing_table[9][15] = {
+int parsing_table[10][15] = {
     // S row
-    {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
 
     // Q row (OptFuncs)
     {0, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3},
@@ -1019,18 +1359,21 @@ int parsing_table[9][15] = {
     {0, 8, 0, 9, 0, 11, 10, 12, 0, 0, 20, 0, 0, 20, 0},
 
     // E row (Exp)
-    {0, 0, 18, 13, 13, 0, 0, 0, 0, 13, 0, 0, 0, 0, 0},
+    {0, 0, 13, 13, 13, 0, 0, 0, 0, 13, 0, 0, 0, 0, 0},
 
     // H row (Exp') - allow epsilon on B, S, L, $ ; O leads to 14
     {0, 0, 0, 0, 0, 0, 0, 0, 0, 15, 14, 15, 15, 0, 15},
 
     // G row (Term)
-    {0, 0, 18, 16, 17, 0, 0, 0, 0, 19, 0, 0, 0, 0, 0}};
+    {0, 0, 18, 16, 17, 0, 0, 0, 0, 19, 0, 0, 0, 0, 0},
+
+    // J row (Includes) - epsilon once the functions start
+    {21, 22, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
 
 // Map characters to table indices (updated with L and $ at end)
 int get_nonterm_index(char nt) {
   switch (nt) {
-  case 'S':
+  case 'Z':
     return 0;
   case 'Q':
     return 1;
@@ -1048,6 +1391,8 @@ int get_nonterm_index(char nt) {
     return 7;
   case 'G':
     return 8;
+  case 'J':
+    return 9;
   default:
     return -1;
   }
@@ -1090,14 +1435,22 @@ int get_term_index(char term) {
   }
 }
 
-// Stack for parsing
-char stack[MAX_STACK];
-int stack_top = -1;
+// Stack for parsing; grows with the nesting of the input
+char *stack = NULL;
+int stack_top = -1, stack_cap = 0;
 
 void push(char c) {
-  if (stack_top < MAX_STACK - 1) {
-    stack[++stack_top] = c;
+  if (stack_top + 1 == stack_cap) {
+    stack_cap = stack_cap ? 2 * stack_cap : 256;
+    stack = realloc(stack, stack_cap);
+    STAT_INC(allocations);
+    if (!stack) {
+      perror("parse stack");
+      exit(1);
+    }
   }
+  stack[++stack_top] = c;
+  STAT_MAX(max_stack_depth, stack_top + 1);
 }
 
 char pop() {
@@ -1115,7 +1468,8 @@ char peek_stack() {
 }
 
 // Token management
-char tokens[MAXTOKENS];
+char *tokens = NULL; /* grows with the input */
+int tokens_cap = 0;
 int tcount = 0;
 int tpos = 0;
 
@@ -1128,15 +1482,41 @@ void load_tokens(const char *fname) {
   char buf[4096];
   int idx = 0;
   while (fscanf(f, " %1s", buf) == 1) {
+    if (idx + 1 >= tokens_cap) {
+      tokens_cap = tokens_cap ? tokens_cap * 2 : 4096;
+      tokens = realloc(tokens, tokens_cap);
+      STAT_INC(allocations);
+      if (!tokens) {
+        perror("load tokens");
+        exit(1);
+      }
+    }
     tokens[idx++] = buf[0];
-    if (idx >= MAXTOKENS)
-      break;
   }
+  if (!tokens)
+    tokens = calloc(1, 1);
   tokens[idx] = '\0';
   tcount = idx;
   fclose(f);
 }
 
+/* The tokens straight from lexed[], for a lex without a token file */
+void load_lexed_tokens(void) {
+  if (lexed_count + 1 > tokens_cap) {
+    tokens_cap = lexed_count + 1 > 4096 ? lexed_count + 1 : 4096;
+    tokens = realloc(tokens, tokens_cap);
+    STAT_INC(allocations);
+    if (!tokens) {
+      perror("load tokens");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < lexed_count; i++)
+    tokens[i] = lexed[i].kind;
+  tokens[lexed_count] = '\0';
+  tcount = lexed_count;
+}
+
 char peek_token() {
   if (tpos >= tcount)
     return '$';
@@ -1156,50 +1536,180 @@ char peek_next_token() {
   return tokens[tpos + 1];
 }
 
-// LL(1) Parser with visualization
-int parse_with_visualization() {
+long long parse_steps = 0; /* steps taken by the last parse */
+
+/* --- Syntax error recovery --- */
+
+#define PARSE_MAX_ERRORS 50 /* syntax errors reported per file */
+
+/* FOLLOW sets, indexed by get_nonterm_index */
+static const char *follow_sets[] = {"$",        "T",   "T",  "$",   "B",
+                                    "TVRPKLOB", "SBO", "SB", "SBO", "T"};
+
+int parse_errors = 0; /* syntax errors in the last parse */
+
+/* With record_derivation set, the parser logs each production it applies.
+ * The log of an accepted parse is its parse tree in preorder. */
+bool record_derivation = false;
+unsigned char *derivation = NULL;
+int derivation_count = 0, derivation_cap = 0;
+
+/* Tokens [parse_skip_from, parse_skip_to) are included modules that
+ * parsed on their own; an OptFuncs there steps over them. Only the next
+ * parse uses them. */
+int parse_skip_from = -1, parse_skip_to = -1;
+
+static void record_production(int prod_id) {
+  if (derivation_count == derivation_cap) {
+    derivation_cap = derivation_cap ? 2 * derivation_cap : 1024;
+    derivation = realloc(derivation, derivation_cap);
+    if (!derivation) {
+      perror("parse");
+      exit(1);
+    }
+  }
+  derivation[derivation_count++] = (unsigned char)prod_id;
+}
+
+/* The lookahead as written in the source, quoted */
+static const char *lookahead_text(void) {
+  static char text[64];
+  if (tpos >= tcount || tpos >= lexed_count)
+    return "end of input";
+  snprintf(text, sizeof(text), "'%s'", name_of(lexed[tpos].name));
+  return text;
+}
+
+static void syntax_error(const char *fmt, ...) {
+  int tok = tpos < lexed_count ? tpos : lexed_count - 1;
+  if (verbose)
+    printf("\n");
+  if (tok >= 0)
+    printf("%s:%d:%d: ", name_of(lexed[tok].file), lexed[tok].line,
+           lexed[tok].col);
+  printf("syntax error: ");
+  va_list ap;
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf("\n");
+  parse_errors++;
+}
+
+/* Panic mode, entered only after an error. Inside a block the rest of the
+ * statement goes: the stack unwinds to the enclosing statement list (C)
+ * and the input to just past the next "..", or up to a closing brace or a
+ * statement keyword or name that opens its line (a forgotten ".."). An
+ * error in the header of a function or loop skips to just past its '{'.
+ * Outside any block, input is dropped until the nonterminal on top has a
+ * production for it, or popped once the lookahead is in its FOLLOW set; a
+ * missing terminal is taken as present. Every call consumes a token or
+ * pops the stack. Returns false once PARSE_MAX_ERRORS are reported. */
+static bool parse_recover(void) {
+  if (parse_errors >= PARSE_MAX_ERRORS) {
+    printf("too many syntax errors, giving up\n");
+    return false;
+  }
+  if (peek_token() == '$') {
+    stack_top = 0; /* just the bottom '$' */
+    return true;
+  }
+  int c = stack_top;
+  while (c > 0 && stack[c] != 'C')
+    c--;
+  if (c > 0) {
+    /* the block's '{' is still on the stack above its statement list */
+    bool header = c < stack_top && stack[c + 1] == T_BRACKET;
+    stack_top = c;
+    for (char la; (la = peek_token()) != '$'; next_token()) {
+      char bracket = la == T_BRACKET ? lookahead_text()[1] : 0;
+      if ((la == T_STMT && !header) || (bracket == '{' && header)) {
+        next_token();
+        break;
+      }
+      if (bracket == '}')
+        break;
+      if (strchr("TVRPKL", la) && tpos > 0 && tpos < lexed_count &&
+          (lexed[tpos - 1].line < lexed[tpos].line ||
+           lexed[tpos - 1].file != lexed[tpos].file))
+        break;
+    }
+    return true;
+  }
+  int nt = get_nonterm_index(peek_stack());
+  if (nt < 0) {
+    pop();
+    return true;
+  }
+  for (;; next_token()) {
+    char la = peek_token();
+    int t = get_term_index(la);
+    if (la == '$' || strchr(follow_sets[nt], la)) {
+      pop();
+      return true;
+    }
+    if (t >= 0 && parsing_table[nt][t] > 0)
+      return true;
+  }
+}
+
+// LL(1) Parser with visualization, from the sentential form start
+static int parse_symbols(const char *start) {
   // Initialize stack
   stack_top = -1;
   push('$');
-  push('S'); // Start symbol
-
-  printf("\n=== LL(1) PARSING TABLE VISUALIZATION ===\n");
-  printf("Tokens: ");
-  for (int i = 0; i < tcount; i++)
-    printf("%c ", tokens[i]);
-  printf("$\n\n");
+  for (int i = strlen(start) - 1; i >= 0; i--)
+    push(start[i]);
+  int skip_from = parse_skip_from, skip_to = parse_skip_to;
+  parse_skip_from = parse_skip_to = -1;
+
+  if (verbose) {
+    printf("\n=== LL(1) PARSING TABLE VISUALIZATION ===\n");
+    printf("Tokens: ");
+    for (int i = 0; i < tcount; i++)
+      printf("%c ", tokens[i]);
+    printf("$\n\n");
 
-  printf("%-20s %-15s %-8s %-25s %-10s\n", "Stack", "Lookahead", "Top",
-         "Production", "Action");
-  printf("-------------------- --------------- -------- "
-         "------------------------- ----------\n");
+    printf("%-20s %-15s %-8s %-25s %-10s\n", "Stack", "Lookahead", "Top",
+           "Production", "Action");
+    printf("-------------------- --------------- -------- "
+           "------------------------- ----------\n");
+  }
 
-  int step = 0;
+  parse_steps = 0;
+  parse_errors = 0;
+  derivation_count = 0;
 
   while (stack_top >= 0) {
     char top = peek_stack();
     char lookahead = peek_token();
 
-    // Create stack string
-    char stack_str[200] = "";
-    for (int i = 0; i <= stack_top; i++) {
-      char temp[3] = {stack[i], '\0'};
-      strcat(stack_str, temp);
-      if (i < stack_top)
-        strcat(stack_str, " ");
+    if (verbose) {
+      // Print the stack, however deep, padded to its column
+      int width = 0;
+      for (int i = 0; i <= stack_top; i++)
+        width += printf(i < stack_top ? "%c " : "%c", stack[i]);
+      printf("%*s %-15c %-8c", width < 20 ? 20 - width : 0, "", lookahead,
+             top);
     }
 
-    printf("%-20s %-15c %-8c", stack_str, lookahead, top);
-
     if (top == '$' && lookahead == '$') {
-      printf("%-25s %-10s\n", "", "ACCEPT");
+      if (parse_errors)
+        return 0;
+      verbose_printf("%-25s %-10s\n", "", "ACCEPT");
       return 1;
     }
 
     if (top == lookahead) {
       pop();
       next_token();
-      printf("%-25s %-10s\n", "", "match");
+      verbose_printf("%-25s %-10s\n", "", "match");
+      continue;
+    }
+
+    if (top == 'Q' && tpos == skip_from) {
+      tpos = skip_to;
+      verbose_printf("%-25s %-10s\n", "", "modules");
       continue;
     }
 
@@ -1219,14 +1729,22 @@ int parse_with_visualization() {
         } else if (next == 'M') {
           prod_id = 3; // epsilon
         } else {
-          printf("\nERROR: After T, expected F or M, got %c\n", next);
-          return 0;
+          /* drop the stray type and look again */
+          next_token();
+          syntax_error("expected a function name or main, got %s",
+                       lookahead_text());
+          if (parse_errors >= PARSE_MAX_ERRORS)
+            return 0;
+          continue;
         }
       }
 
       if (prod_id == 0) {
-        printf("\nERROR: No production for %c on %c\n", top, lookahead);
-        return 0;
+        syntax_error("unexpected %s (%c) while parsing %c", lookahead_text(),
+                     lookahead, top);
+        if (!parse_recover())
+          return 0;
+        continue;
       }
 
       // Find the production
@@ -1243,14 +1761,20 @@ int parse_with_visualization() {
         return 0;
       }
 
+      STAT_INC(productions[prod_id]);
+      if (record_derivation)
+        record_production(prod_id);
+
       // Print production
-      char prod_str[200];
-      if (strlen(prod->rhs) == 0) {
-        strcpy(prod_str, "epsilon");
-        printf("%-25s", prod_str);
-      } else {
-        sprintf(prod_str, "%c -> %s", top, prod->rhs);
-        printf("%-25s", prod_str);
+      if (verbose) {
+        char prod_str[200];
+        if (strlen(prod->rhs) == 0) {
+          strcpy(prod_str, "epsilon");
+          printf("%-25s", prod_str);
+        } else {
+          sprintf(prod_str, "%c -> %s", top, prod->rhs);
+          printf("%-25s", prod_str);
+        }
       }
 
       // Apply production
@@ -1276,16 +1800,21 @@ int parse_with_visualization() {
         }
       }
 
-      printf(" %-10s\n", "apply");
+      verbose_printf(" %-10s\n", "apply");
     } else {
-      printf("\nERROR: Invalid parse (top=%c, lookahead=%c, nt_idx=%d, "
-             "t_idx=%d)\n",
-             top, lookahead, nt_idx, t_idx);
-      return 0;
+      if (nt_idx < 0 && top != '$')
+        syntax_error("expected %c, got %s (%c)", top, lookahead_text(),
+                     lookahead);
+      else
+        syntax_error("unexpected %s (%c)", lookahead_text(), lookahead);
+      if (!parse_recover())
+        return 0;
+      continue;
     }
 
-    step++;
-    if (step > 5000) {
+    parse_steps++;
+    /* a derivation takes a bounded number of steps per token */
+    if (parse_steps > 5000 + 32LL * tcount) {
       printf("\nERROR: Too many steps (possible infinite loop)\n");
       return 0;
     }
@@ -1294,74 +1823,9168 @@ int parse_with_visualization() {
   return 0;
 }
 
-// --- DISPLAY FUNCTIONS ---
+int parse_with_visualization() { return parse_symbols("Z"); }
 
-void display_nfa_rules() {
-  printf("\n=== NFA PATTERN RULES ===\n");
-  printf("Token Type    | Pattern\n");
-  printf("------------- | -------\n");
-  printf("VARIABLE      | _[a-zA-Z]+[0-9][a-zA-Z]\n");
-  printf("FUNCTION      | [a-zA-Z]+Fn\n");
-  printf("LOOP_LABEL    | loop_[a-zA-Z]+[0-9][0-9]:\n");
-  printf("NUMBER        | [0-9]+\n");
-  printf("KEYWORD       | int|dec|printf|while|break|return|main\n");
-  printf("STATEMENT_END | ..\n");
-  printf("BRACKET       | ( | ) | { | }\n");
-  printf("OPERATOR      | ; | , | = | + | < | - | * | / | :\n");
-  printf("\n");
-}
+/* --- SYMBOL TABLE & SEMANTIC ANALYSIS --- */
 
-void display_dfa_matrix() {
-  printf("\n=== UNIFIED DFA TRANSITION MATRIX ===\n");
-  printf("Input Categories: 0=alpha, 1=digit, 2=_, 3=\", 4=., 5=bracket, 6=:, "
-         "7=other\n\n");
-  printf("State | alpha digit  _    \"    .    brkt :    othr | Accept\n");
-  printf("------+-------------------------------------------+-------\n");
+/* Value types of the language */
+#define TY_INT 'i'
+#define TY_DEC 'd'
 
-  const char *state_desc[] = {"START",      "alpha",   "digit",    "underscore",
-                              "dot1",       "bracket", "operator", "..",
-                              "unused",     "alpha+",  "id+digit", "_+alpha",
-                              "_alpha+dig", "VARIABLE"};
+enum { SYM_VAR, SYM_PARAM, SYM_FUNC };
 
-  for (int i = 0; i < 14; i++) {
-    printf("%2d %-10s|", i, state_desc[i]);
-    for (int j = 0; j < NUM_INPUTS; j++) {
-      int next = next_state[i][j];
-      if (next == DEAD)
-        printf("  --  ");
-      else
-        printf("  %2d  ", next);
-    }
-    printf("| ");
-    if (accepting_tokens[i] != '\0')
-      printf("%c", accepting_tokens[i]);
-    printf("\n");
-  }
+/* Symbols are never freed: leaving a scope only unbinds them, so the
+ * per-token references below stay valid for later phases. Lookup is O(1):
+ * name_binding[name] is the innermost visible symbol and each symbol keeps
+ * the binding it shadowed. */
+typedef struct {
+  int name;
+  int kind;
+  char type;
+  int depth;   /* scope depth it was declared at */
+  int shadows; /* previous binding of the same name, -1 if none */
+  int func;    /* owning function (SYM_FUNC: its own index) */
+  int slot;    /* variables: frame slot within the owning function */
+  int tok;     /* declaring token */
+} Symbol;
+
+typedef struct {
+  int name;
+  char ret_type;
+  char param_type; /* 0 for main */
+  int param_sym;   /* -1 for main */
+  int nslots;      /* params + locals (including loop variables) */
+  int first_tok;   /* 'T' of the header */
+  int body_tok;    /* '{' of the body */
+  int end_tok;     /* closing '}' */
+  int first_sym;   /* its symbols are syms[first_sym..end_sym), */
+  int end_sym;     /* its own SYM_FUNC entry, if any, first */
+  bool is_main;
+} FuncInfo;
+
+Symbol *syms = NULL;
+int sym_count = 0, sym_cap = 0;
+FuncInfo *funcs = NULL;
+int func_count = 0, func_cap = 0;
+int *name_binding = NULL; /* name id -> innermost symbol, -1 if unbound */
+int binding_cap = 0;
+int *scope_marks = NULL; /* sym_stack height at each scope entry */
+int *sym_stack = NULL;   /* currently bound symbols, innermost last */
+int scope_depth = 0, sym_stack_top = 0, scope_cap = 0, sym_stack_cap = 0;
+
+/* tok_ref[i]: for V tokens the resolved symbol, for F tokens the function
+ * index, -1 if unresolved */
+int *tok_ref = NULL;
+/* tok_type[i]: static type of the term or expression starting at token i */
+char *tok_type = NULL;
+
+int sema_errors = 0;
+int sema_pos = 0;
+int sema_func = -1;
+int sema_loop_depth = 0;
+
+static void sema_error(int tok, const char *fmt, ...) {
+  va_list ap;
+  printf("%s:%d:%d: semantic error: ", name_of(lexed[tok].file),
+         lexed[tok].line, lexed[tok].col);
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
   printf("\n");
+  sema_errors++;
 }
 
-void display_first_follow_sets() {
-  printf("\n=== FIRST AND FOLLOW SETS ===\n");
-  printf("Non-Terminal | FIRST Set           | FOLLOW Set\n");
-  printf("------------ | ------------------- | -------------------\n");
-  printf("S            | {I}                 | {$}\n");
-  printf("Q            | {T, epsilon}        | {T}\n");
-  printf("U            | {T}                 | {T}\n");
-  printf("A            | {T}                 | {$}\n");
-  printf("C            | {T,V,R,P,K,O,eps}   | {B}\n");
-  printf("D            | {T,V,R,P,K,O}       | {T,V,R,P,K,O,B}\n");
-  printf("E            | {V,N,F,B}           | {S,B,O}\n");
-  printf("H            | {O, epsilon}        | {S,B}\n");
-  printf("G            | {V,N,F,B}           | {S,B,O}\n");
-  printf("\n");
+static void *grow_array(void *p, int *cap, int need, size_t elem) {
+  if (need <= *cap)
+    return p;
+  int ncap = *cap ? *cap : 64;
+  while (ncap < need)
+    ncap *= 2;
+  p = realloc(p, ncap * elem);
+  if (!p) {
+    perror("sema");
+    exit(1);
+  }
+  *cap = ncap;
+  return p;
 }
 
-void display_parsing_table() {
-  printf("\n=== LL(1) PARSING TABLE ===\n");
-  printf("Rows: Non-terminals (S,Q,U,A,C,D,E,H,G)\n");
+static void scope_enter(void) {
+  scope_marks =
+      grow_array(scope_marks, &scope_cap, scope_depth + 1, sizeof(int));
+  scope_marks[scope_depth++] = sym_stack_top;
+}
+
+static void scope_leave(void) {
+  int mark = scope_marks[--scope_depth];
+  while (sym_stack_top > mark) {
+    Symbol *s = &syms[sym_stack[--sym_stack_top]];
+    name_binding[s->name] = s->shadows;
+  }
+}
+
+static int sema_lookup(int name) { return name_binding[name]; }
+
+/* Declare a name in the innermost scope; reports redeclarations there. */
+static int sema_declare(int tok, int kind, char type) {
+  int name = lexed[tok].name;
+  int prev = name_binding[name];
+  if (prev >= 0 && syms[prev].depth == scope_depth)
+    sema_error(tok, "redeclaration of '%s'", name_of(name));
+
+  syms = grow_array(syms, &sym_cap, sym_count + 1, sizeof(Symbol));
+  Symbol *s = &syms[sym_count];
+  s->name = name;
+  s->kind = kind;
+  s->type = type;
+  s->depth = scope_depth;
+  s->shadows = prev;
+  s->func = sema_func;
+  s->slot = -1;
+  s->tok = tok;
+  if (kind != SYM_FUNC)
+    s->slot = funcs[sema_func].nslots++;
+
+  sym_stack =
+      grow_array(sym_stack, &sym_stack_cap, sym_stack_top + 1, sizeof(int));
+  sym_stack[sym_stack_top++] = sym_count;
+  name_binding[name] = sym_count;
+  tok_ref[tok] = sym_count;
+  return sym_count++;
+}
+
+static char type_of_keyword(int tok) {
+  return name_of(lexed[tok].name)[0] == 'i' ? TY_INT : TY_DEC;
+}
+
+static const char *type_name(char t) { return t == TY_INT ? "int" : "dec"; }
+
+static char sema_peek(void) {
+  return sema_pos < lexed_count ? lexed[sema_pos].kind : '$';
+}
+
+static char sema_op(int tok) { return name_of(lexed[tok].name)[0]; }
+
+/* Binary operator precedence inside E -> G H chains (0 = not allowed) */
+int op_precedence(char op) {
+  switch (op) {
+  case '<':
+    return 1;
+  case '+':
+  case '-':
+    return 2;
+  case '*':
+  case '/':
+    return 3;
+  default:
+    return 0;
+  }
+}
+
+static char sema_expr(int min_prec);
+
+/* G -> V | N | F B E B | B E B */
+static char sema_term(void) {
+  int tok = sema_pos++;
+  char t = TY_INT;
+  switch (lexed[tok].kind) {
+  case T_VAR: {
+    int s = sema_lookup(lexed[tok].name);
+    if (s < 0 || syms[s].kind == SYM_FUNC) {
+      sema_error(tok, "undeclared variable '%s'", name_of(lexed[tok].name));
+    } else {
+      tok_ref[tok] = s;
+      t = syms[s].type;
+    }
+    break;
+  }
+  case T_NUM:
+    break;
+  case T_FUNC: {
+    int s = sema_lookup(lexed[tok].name);
+    sema_pos++; /* ( */
+    int arg_tok = sema_pos;
+    char arg = sema_expr(1);
+    sema_pos++; /* ) */
+    if (s < 0 || syms[s].kind != SYM_FUNC) {
+      sema_error(tok, "call to unknown function '%s'",
+                 name_of(lexed[tok].name));
+      break;
+    }
+    FuncInfo *f = &funcs[syms[s].func];
+    tok_ref[tok] = syms[s].func;
+    if (arg == TY_DEC && f->param_type == TY_INT)
+      sema_error(arg_tok, "passing dec argument to int parameter of '%s'",
+                 name_of(f->name));
+    t = f->ret_type;
+    break;
+  }
+  default: /* ( E ) */
+    t = sema_expr(1);
+    sema_pos++;
+    break;
+  }
+  tok_type[tok] = t;
+  return t;
+}
+
+/* Precedence climbing over the flat H -> O G H chain */
+static char sema_expr(int min_prec) {
+  int start = sema_pos;
+  char t = sema_term();
+  while (sema_peek() == T_OP) {
+    char op = sema_op(sema_pos);
+    int prec = op_precedence(op);
+    if (prec == 0) {
+      if (min_prec > 1)
+        break; /* reported by the outermost level */
+      sema_error(sema_pos, "operator '%s' is not allowed in an expression",
+                 name_of(lexed[sema_pos].name));
+      prec = 1;
+    }
+    if (prec < min_prec)
+      break;
+    sema_pos++;
+    char rhs = sema_expr(prec + 1);
+    if (op == '<')
+      t = TY_INT;
+    else if (rhs == TY_DEC)
+      t = TY_DEC;
+  }
+  tok_type[start] = t;
+  return t;
+}
+
+static void sema_check_assign(int tok, char target, char value) {
+  if (target == TY_INT && value == TY_DEC)
+    sema_error(tok, "type mismatch: dec value assigned to int '%s'",
+               name_of(lexed[tok].name));
+}
+
+static void sema_expect_op(int tok, char op, const char *what) {
+  if (sema_op(tok) != op)
+    sema_error(tok, "expected '%c' in %s", op, what);
+}
+
+static void sema_stmts(void);
+
+static void sema_stmt(void) {
+  int tok = sema_pos;
+  switch (lexed[tok].kind) {
+  case T_TYPE: { /* T V O E S */
+    char type = type_of_keyword(tok);
+    sema_expect_op(tok + 2, '=', "declaration");
+    sema_pos += 3;
+    /* the initializer is checked before the name becomes visible */
+    char value = sema_expr(1);
+    sema_declare(tok + 1, SYM_VAR, type);
+    sema_check_assign(tok + 1, type, value);
+    sema_pos++;
+    break;
+  }
+  case T_VAR: { /* V O E S */
+    int s = sema_lookup(lexed[tok].name);
+    sema_expect_op(tok + 1, '=', "assignment");
+    sema_pos += 2;
+    char value = sema_expr(1);
+    if (s < 0 || syms[s].kind == SYM_FUNC) {
+      sema_error(tok, "assignment to undeclared variable '%s'",
+                 name_of(lexed[tok].name));
+    } else {
+      tok_ref[tok] = s;
+      sema_check_assign(tok, syms[s].type, value);
+    }
+    sema_pos++;
+    break;
+  }
+  case T_RETURN: { /* R E S */
+    sema_pos++;
+    char value = sema_expr(1);
+    if (value == TY_DEC && funcs[sema_func].ret_type == TY_INT)
+      sema_error(tok, "type mismatch: returning dec from int function '%s'",
+                 name_of(funcs[sema_func].name));
+    sema_pos++;
+    break;
+  }
+  case T_PRINTF: { /* P B V B S */
+    int v = tok + 2;
+    int s = sema_lookup(lexed[v].name);
+    if (s < 0 || syms[s].kind == SYM_FUNC)
+      sema_error(v, "undeclared variable '%s'", name_of(lexed[v].name));
+    else
+      tok_ref[v] = s;
+    sema_pos += 5;
+    break;
+  }
+  case T_BREAK: /* K S */
+    if (sema_loop_depth == 0)
+      sema_error(tok, "'break' outside of a loop");
+    sema_pos += 2;
+    break;
+  case T_LOOP: /* L W B T V O N S B B C B */
+    scope_enter();
+    sema_expect_op(tok + 5, '<', "loop condition");
+    sema_declare(tok + 4, SYM_VAR, type_of_keyword(tok + 3));
+    sema_pos += 10;
+    sema_loop_depth++;
+    sema_stmts();
+    sema_loop_depth--;
+    sema_pos++; /* } */
+    scope_leave();
+    break;
+  default:
+    sema_pos++;
+    break;
+  }
+}
+
+/* C -> D C | epsilon, terminated by the closing '}' */
+static void sema_stmts(void) {
+  while (sema_pos < lexed_count && lexed[sema_pos].kind != T_BRACKET)
+    sema_stmt();
+}
+
+static int sema_new_func(int tok) {
+  funcs = grow_array(funcs, &func_cap, func_count + 1, sizeof(FuncInfo));
+  FuncInfo *f = &funcs[func_count];
+  memset(f, 0, sizeof(*f));
+  f->ret_type = type_of_keyword(tok);
+  f->param_sym = -1;
+  f->first_tok = tok;
+  f->first_sym = sym_count;
+  return func_count++;
+}
+
+/* Walks an accepted token stream (S -> I Q A) once, resolving every name
+ * through the scope stack. Returns the number of semantic errors. */
+int run_semantic_checks(void) {
+  sym_count = func_count = 0;
+  scope_depth = sym_stack_top = 0;
+  sema_errors = 0;
+  sema_loop_depth = 0;
+  name_binding = grow_array(name_binding, &binding_cap, name_count, sizeof(int));
+  for (int i = 0; i < name_count; i++)
+    name_binding[i] = -1;
+  free(tok_ref);
+  free(tok_type);
+  tok_ref = malloc((lexed_count + 1) * sizeof(int));
+  tok_type = calloc(lexed_count + 1, 1);
+  if (!tok_ref || !tok_type) {
+    perror("sema");
+    exit(1);
+  }
+  for (int i = 0; i < lexed_count; i++)
+    tok_ref[i] = -1;
+
+  scope_enter(); /* global scope: function names */
+  sema_pos = leading_includes(lexed, lexed_count);
+  while (sema_pos + 1 < lexed_count && lexed[sema_pos + 1].kind == T_FUNC) {
+    /* T F B T V B B C B */
+    int tok = sema_pos;
+    sema_func = sema_new_func(tok);
+    FuncInfo *f = &funcs[sema_func];
+    f->name = lexed[tok + 1].name;
+    sema_declare(tok + 1, SYM_FUNC, f->ret_type);
+    syms[sym_count - 1].func = sema_func;
+    tok_ref[tok + 1] = sema_func;
+
+    scope_enter();
+    funcs[sema_func].param_type = type_of_keyword(tok + 3);
+    funcs[sema_func].param_sym =
+        sema_declare(tok + 4, SYM_PARAM, funcs[sema_func].param_type);
+    funcs[sema_func].body_tok = tok + 6;
+    sema_pos = tok + 7;
+    sema_stmts();
+    funcs[sema_func].end_tok = sema_pos++;
+    funcs[sema_func].end_sym = sym_count;
+    scope_leave();
+  }
+
+  /* A -> T M B B B C B */
+  int tok = sema_pos;
+  sema_func = sema_new_func(tok);
+  funcs[sema_func].name = lexed[tok + 1].name;
+  funcs[sema_func].is_main = true;
+  funcs[sema_func].body_tok = tok + 4;
+  scope_enter();
+  sema_pos = tok + 5;
+  sema_stmts();
+  funcs[sema_func].end_tok = sema_pos;
+  funcs[sema_func].end_sym = sym_count;
+  scope_leave();
+  scope_leave();
+  return sema_errors;
+}
+
+/* --- BYTECODE COMPILER --- */
+
+/* Values are untyped 8-byte slots; every instruction knows the static type
+ * of its operands, so nothing is tagged at run time. */
+typedef union {
+  long long i;
+  double d;
+} Value;
+
+/* Register bytecode: four 16-bit fields per instruction. Jumps keep their
+ * 32-bit absolute target in b:c. */
+typedef struct {
+  uint16_t op, a, b, c;
+} Instr;
+
+#define BC_OPCODES(X)                                                          \
+  X(OP_LOADK)  /* R[a] = K[b] */                                               \
+  X(OP_MOV)    /* R[a] = R[b] */                                               \
+  X(OP_I2D)    /* R[a].d = (double)R[b].i */                                   \
+  X(OP_ADDI)   /* R[a] = R[b] op R[c], int */                                  \
+  X(OP_SUBI)                                                                   \
+  X(OP_MULI)                                                                   \
+  X(OP_DIVI)                                                                   \
+  X(OP_LTI)                                                                    \
+  X(OP_ADDD)   /* R[a] = R[b] op R[c], dec (LTD yields an int) */              \
+  X(OP_SUBD)                                                                   \
+  X(OP_MULD)                                                                   \
+  X(OP_DIVD)                                                                   \
+  X(OP_LTD)                                                                    \
+  X(OP_JMP)    /* pc = b:c */                                                  \
+  X(OP_JMPF)   /* if (!R[a].i) pc = b:c */                                     \
+  X(OP_CALL)   /* R[a] = func[next word's b:c](R[c]) */                        \
+  X(OP_RET)    /* return R[a] */                                               \
+  X(OP_PRINTI) /* printf(R[a]) */                                              \
+  X(OP_PRINTD)                                                                 \
+  /* superinstructions produced by bc_fuse() */                                \
+  X(OP_ADDIK)  /* R[a] = R[b] op K[c], int */                                  \
+  X(OP_SUBIK)                                                                  \
+  X(OP_MULIK)                                                                  \
+  X(OP_DIVIK)  /* K[c] is never 0 or -1 */                                     \
+  X(OP_LTIK)                                                                   \
+  X(OP_ADDDK)  /* R[a] = R[b] op K[c], dec */                                  \
+  X(OP_SUBDK)                                                                  \
+  X(OP_MULDK)                                                                  \
+  X(OP_DIVDK)                                                                  \
+  X(OP_LTDK)                                                                   \
+  X(OP_JNLTI)  /* if (!(R[a] < R[b])) pc = next word's b:c */                  \
+  X(OP_JNLTIK) /* if (!(R[a] < K[b])) pc = next word's b:c */                  \
+  X(OP_JNLTD)                                                                  \
+  X(OP_JNLTDK)
+
+#define BC_ENUM(op) op,
+#define BC_NAME(op) #op,
+enum { BC_OPCODES(BC_ENUM) NUM_OPCODES };
+const char *opcode_names[] = {BC_OPCODES(BC_NAME)};
+
+#define JMP_TARGET(in) ((int)((uint32_t)(in)->b | ((uint32_t)(in)->c << 16)))
+
+typedef struct {
+  char *name;
+  int entry; /* first instruction */
+  int nlocals; /* registers below this hold variables */
+  int nregs;   /* frame size: locals, then temporaries */
+  char ret_type;
+  char param_type; /* 0 for main */
+} BcFunc;
+
+/* A labeled loop: the first instruction of its header and its label
+ * without the colon */
+typedef struct {
+  int head;
+  char *label;
+} BcLoop;
+
+/* A compiled program owns all of its data, so it outlives the front end's
+ * global token and symbol tables. */
+typedef struct {
+  Instr *code;
+  int ncode, code_cap;
+  Value *consts;
+  int nconsts, const_cap;
+  int *const_slots; /* open-addressing dedup of constants: index + 1 */
+  int const_slot_cap;
+  BcFunc *funcs;
+  int nfuncs;
+  int main_func;
+  BcLoop *loops; /* for the profiler */
+  int nloops, loop_cap;
+} BcProgram;
+
+/* program being compiled; per thread, see ir_codegen */
+_Thread_local BcProgram *bc = NULL;
+int bc_pos = 0;       /* token cursor */
+int bc_func = -1;
+int bc_temp = 0; /* next free temporary register */
+/* pending break jumps of the enclosing loops */
+int *bc_breaks = NULL;
+int bc_break_count = 0, bc_break_cap = 0;
+
+static int bc_emit(int op, int a, int b, int c) {
+  if (bc->ncode == bc->code_cap) {
+    bc->code_cap = bc->code_cap ? bc->code_cap * 2 : 256;
+    bc->code = realloc(bc->code, bc->code_cap * sizeof(Instr));
+    if (!bc->code) {
+      perror("bytecode");
+      exit(1);
+    }
+  }
+  Instr *in = &bc->code[bc->ncode];
+  in->op = op;
+  in->a = a;
+  in->b = b;
+  in->c = c;
+  return bc->ncode++;
+}
+
+static void bc_add_loop(int head, const char *label) {
+  bc->loops =
+      grow_array(bc->loops, &bc->loop_cap, bc->nloops + 1, sizeof(BcLoop));
+  size_t len = strlen(label);
+  if (len > 0 && label[len - 1] == ':')
+    len--;
+  bc->loops[bc->nloops].head = head;
+  bc->loops[bc->nloops].label = strndup(label, len);
+  bc->nloops++;
+}
+
+static void bc_patch(int at, int target) {
+  bc->code[at].b = (uint16_t)(target & 0xffff);
+  bc->code[at].c = (uint16_t)((uint32_t)target >> 16);
+}
+
+/* The callee goes in a second word, as b:c like a jump target, so a
+ * program may have more than 65535 functions */
+static void bc_emit_call(int dst, int func, int arg) {
+  bc_emit(OP_CALL, dst, 0, arg);
+  bc_patch(bc_emit(OP_CALL, 0, 0, 0), func);
+}
+
+static int bc_const(Value v) {
+  if ((bc->nconsts + 1) * 2 > bc->const_slot_cap) {
+    int ncap = bc->const_slot_cap ? bc->const_slot_cap * 2 : 64;
+    int *slots = calloc(ncap, sizeof(int));
+    if (!slots) {
+      perror("bytecode");
+      exit(1);
+    }
+    for (int i = 0; i < bc->nconsts; i++) {
+      unsigned k = hash_bytes((char *)&bc->consts[i], sizeof(Value)) &
+                   (ncap - 1);
+      while (slots[k])
+        k = (k + 1) & (ncap - 1);
+      slots[k] = i + 1;
+    }
+    free(bc->const_slots);
+    bc->const_slots = slots;
+    bc->const_slot_cap = ncap;
+  }
+  unsigned k =
+      hash_bytes((char *)&v, sizeof(Value)) & (bc->const_slot_cap - 1);
+  while (bc->const_slots[k]) {
+    int i = bc->const_slots[k] - 1;
+    if (bc->consts[i].i == v.i)
+      return i;
+    k = (k + 1) & (bc->const_slot_cap - 1);
+  }
+  if (bc->nconsts >= 0xffff) {
+    fprintf(stderr, "bytecode: too many constants\n");
+    exit(1);
+  }
+  if (bc->nconsts == bc->const_cap) {
+    bc->const_cap = bc->const_cap ? bc->const_cap * 2 : 64;
+    bc->consts = realloc(bc->consts, bc->const_cap * sizeof(Value));
+  }
+  bc->consts[bc->nconsts] = v;
+  bc->const_slots[k] = bc->nconsts + 1;
+  return bc->nconsts++;
+}
+
+static int bc_new_temp(void) {
+  int r = bc_temp++;
+  if (r > 0xffff) {
+    fprintf(stderr, "bytecode: function needs too many registers\n");
+    exit(1);
+  }
+  if (bc_temp > bc->funcs[bc_func].nregs)
+    bc->funcs[bc_func].nregs = bc_temp;
+  return r;
+}
+
+static int bc_load_number(int tok, char type) {
+  Value v;
+  long long n = strtoll(name_of(lexed[tok].name), NULL, 10);
+  if (type == TY_DEC)
+    v.d = (double)n;
+  else
+    v.i = n;
+  int r = bc_new_temp();
+  bc_emit(OP_LOADK, r, bc_const(v), 0);
+  return r;
+}
+
+/* Widen an int register to dec when the context needs it */
+static int bc_convert(int reg, char from, char to) {
+  if (from == to || to == TY_INT)
+    return reg;
+  int r = bc_new_temp();
+  bc_emit(OP_I2D, r, reg, 0);
+  return r;
+}
+
+static int bc_expr(int min_prec, char *type);
+
+/* G -> V | N | F B E B | B E B */
+static int bc_term(char *type) {
+  int tok = bc_pos++;
+  switch (lexed[tok].kind) {
+  case T_VAR:
+    *type = syms[tok_ref[tok]].type;
+    return syms[tok_ref[tok]].slot;
+  case T_NUM:
+    *type = TY_INT;
+    return bc_load_number(tok, TY_INT);
+  case T_FUNC: {
+    int f = tok_ref[tok];
+    char at;
+    bc_pos++; /* ( */
+    int arg = bc_expr(1, &at);
+    bc_pos++; /* ) */
+    arg = bc_convert(arg, at, funcs[f].param_type);
+    int r = bc_new_temp();
+    bc_emit_call(r, f, arg);
+    *type = funcs[f].ret_type;
+    return r;
+  }
+  default: { /* ( E ) */
+    int r = bc_expr(1, type);
+    bc_pos++;
+    return r;
+  }
+  }
+}
+
+static int bc_arith_op(char op, char type) {
+  int base = type == TY_DEC ? OP_ADDD : OP_ADDI;
+  switch (op) {
+  case '+':
+    return base;
+  case '-':
+    return base + 1;
+  case '*':
+    return base + 2;
+  case '/':
+    return base + 3;
+  default:
+    return base + 4; /* '<' */
+  }
+}
+
+/* Same precedence climbing as sema_expr; returns the register holding the
+ * value, which may be a variable's own slot and must not be written. */
+static int bc_expr(int min_prec, char *type) {
+  int lhs = bc_term(type);
+  while (bc_pos < lexed_count && lexed[bc_pos].kind == T_OP) {
+    char op = sema_op(bc_pos);
+    int prec = op_precedence(op);
+    if (prec < min_prec)
+      break;
+    bc_pos++;
+    char rt;
+    int rhs = bc_expr(prec + 1, &rt);
+    char t = (*type == TY_DEC || rt == TY_DEC) ? TY_DEC : TY_INT;
+    lhs = bc_convert(lhs, *type, t);
+    rhs = bc_convert(rhs, rt, t);
+    int r = bc_new_temp();
+    bc_emit(bc_arith_op(op, t), r, lhs, rhs);
+    lhs = r;
+    *type = op == '<' ? TY_INT : t;
+  }
+  return lhs;
+}
+
+/* Evaluate E into variable symbol s */
+static void bc_store_expr(int s) {
+  char t;
+  int r = bc_expr(1, &t);
+  r = bc_convert(r, t, syms[s].type);
+  if (r != syms[s].slot)
+    bc_emit(OP_MOV, syms[s].slot, r, 0);
+}
+
+static void bc_stmts(void);
+
+static void bc_stmt(void) {
+  int tok = bc_pos;
+  bc_temp = funcs[bc_func].nslots;
+  switch (lexed[tok].kind) {
+  case T_TYPE: /* T V O E S */
+    bc_pos += 3;
+    bc_store_expr(tok_ref[tok + 1]);
+    bc_pos++;
+    break;
+  case T_VAR: /* V O E S */
+    bc_pos += 2;
+    bc_store_expr(tok_ref[tok]);
+    bc_pos++;
+    break;
+  case T_RETURN: { /* R E S */
+    char t;
+    bc_pos++;
+    int r = bc_expr(1, &t);
+    r = bc_convert(r, t, funcs[bc_func].ret_type);
+    bc_emit(OP_RET, r, 0, 0);
+    bc_pos++;
+    break;
+  }
+  case T_PRINTF: { /* P B V B S */
+    Symbol *s = &syms[tok_ref[tok + 2]];
+    bc_emit(s->type == TY_DEC ? OP_PRINTD : OP_PRINTI, s->slot, 0, 0);
+    bc_pos += 5;
+    break;
+  }
+  case T_BREAK: /* K S */
+    bc_breaks = grow_array(bc_breaks, &bc_break_cap, bc_break_count + 1,
+                           sizeof(int));
+    bc_breaks[bc_break_count++] = bc_emit(OP_JMP, 0, 0, 0);
+    bc_pos += 2;
+    break;
+  case T_LOOP: { /* L W B T V O N S B B C B */
+    Symbol *v = &syms[tok_ref[tok + 4]];
+    Value zero;
+    zero.i = 0;
+    if (v->type == TY_DEC)
+      zero.d = 0.0;
+    bc_emit(OP_LOADK, v->slot, bc_const(zero), 0);
+    int top = bc->ncode;
+    bc_add_loop(top, name_of(lexed[tok].name));
+    int limit = bc_load_number(tok + 6, v->type);
+    int cond = bc_new_temp();
+    bc_emit(v->type == TY_DEC ? OP_LTD : OP_LTI, cond, v->slot, limit);
+    int exit_jump = bc_emit(OP_JMPF, cond, 0, 0);
+    int outer_breaks = bc_break_count;
+    bc_pos += 10;
+    bc_stmts();
+    bc_pos++; /* } */
+    int back = bc_emit(OP_JMP, 0, 0, 0);
+    bc_patch(back, top);
+    bc_patch(exit_jump, bc->ncode);
+    while (bc_break_count > outer_breaks)
+      bc_patch(bc_breaks[--bc_break_count], bc->ncode);
+    break;
+  }
+  default:
+    bc_pos++;
+    break;
+  }
+}
+
+static void bc_stmts(void) {
+  while (bc_pos < lexed_count && lexed[bc_pos].kind != T_BRACKET)
+    bc_stmt();
+}
+
+/* Compile the checked token stream into a self-contained program. Function
+ * indices match funcs[] so calls resolve without a name lookup. */
+BcProgram *bc_compile(void) {
+  bc = calloc(1, sizeof(BcProgram));
+  bc->funcs = calloc(func_count, sizeof(BcFunc));
+  bc->nfuncs = func_count;
+  for (int f = 0; f < func_count; f++) {
+    bc_func = f;
+    BcFunc *bf = &bc->funcs[f];
+    bf->name = strdup(name_of(funcs[f].name));
+    bf->entry = bc->ncode;
+    bf->nlocals = funcs[f].nslots;
+    bf->nregs = funcs[f].nslots;
+    bf->ret_type = funcs[f].ret_type;
+    bf->param_type = funcs[f].param_type;
+    if (funcs[f].is_main)
+      bc->main_func = f;
+    bc_pos = funcs[f].body_tok + 1;
+    bc_break_count = 0;
+    bc_stmts();
+    /* falling off the end returns 0 */
+    bc_temp = funcs[f].nslots;
+    Value zero;
+    zero.i = 0;
+    if (bf->ret_type == TY_DEC)
+      zero.d = 0.0;
+    int r = bc_new_temp();
+    bc_emit(OP_LOADK, r, bc_const(zero), 0);
+    bc_emit(OP_RET, r, 0, 0);
+  }
+  BcProgram *p = bc;
+  bc = NULL;
+  return p;
+}
+
+/* --- SUPERINSTRUCTIONS --- */
+
+/* Conditional jumps fused with their comparison take a second word that
+ * holds the target in b:c, and calls one that holds the callee. */
+static bool bc_fused_jump(const Instr *in) {
+  return in->op >= OP_JNLTI && in->op <= OP_JNLTDK;
+}
+
+static int bc_width(const Instr *in) {
+  return bc_fused_jump(in) || in->op == OP_CALL ? 2 : 1;
+}
+
+static const Instr *bc_jump_word(const Instr *in) {
+  if (in->op == OP_JMP || in->op == OP_JMPF)
+    return in;
+  if (bc_fused_jump(in))
+    return in + 1;
+  return NULL;
+}
+
+static bool bc_writes_a(int op) {
+  return op == OP_LOADK || op == OP_MOV || op == OP_I2D || op == OP_CALL ||
+         (op >= OP_ADDI && op <= OP_LTD) || (op >= OP_ADDIK && op <= OP_LTDK);
+}
+
+/* Try to fuse x and the one-word y after it into *out (one or two words).
+ * Relies on the
+ * compiler's invariant that a temporary (register >= nlocals) is written
+ * once and read exactly once, by a later instruction of the same
+ * statement. */
+static int bc_fuse_pair(const Instr *x, const Instr *y, int nlocals,
+                        Instr *out) {
+  bool x_temp = bc_writes_a(x->op) && x->a >= nlocals;
+
+  /* LOADK t, K ; I2D u, t  =>  LOADK u, (dec)K */
+  if (x->op == OP_LOADK && x_temp && y->op == OP_I2D && y->b == x->a) {
+    Value v;
+    v.d = (double)bc->consts[x->b].i;
+    *out = (Instr){OP_LOADK, y->a, (uint16_t)bc_const(v), 0};
+    return 1;
+  }
+
+  /* LOADK t, K ; OP r, b, t  =>  OPK r, b, K */
+  if (x->op == OP_LOADK && x_temp &&
+      ((y->op >= OP_ADDI && y->op <= OP_LTI) ||
+       (y->op >= OP_ADDD && y->op <= OP_LTD))) {
+    bool dec = y->op >= OP_ADDD;
+    int kop = dec ? y->op - OP_ADDD + OP_ADDDK : y->op - OP_ADDI + OP_ADDIK;
+    int other = -1;
+    if (y->c == x->a && y->b != x->a)
+      other = y->b;
+    else if (y->b == x->a && y->c != x->a &&
+             (kop == OP_ADDIK || kop == OP_MULIK || kop == OP_ADDDK ||
+              kop == OP_MULDK))
+      other = y->c; /* commutative: K op R == R op K */
+    long long k = bc->consts[x->b].i;
+    if (kop == OP_DIVIK && (k == 0 || k == -1))
+      other = -1; /* keep the checked division */
+    if (other >= 0) {
+      *out = (Instr){(uint16_t)kop, y->a, (uint16_t)other, x->b};
+      return 1;
+    }
+  }
+
+  /* OP t, ... ; MOV x, t  =>  OP x, ... */
+  if (x_temp && y->op == OP_MOV && y->b == x->a) {
+    int w = bc_width(x);
+    memcpy(out, x, w * sizeof(Instr));
+    out->a = y->a;
+    return w;
+  }
+
+  /* LT t, v, w ; JMPF t, L  =>  JNLT v, w ; [L] */
+  if ((x->op == OP_LTI || x->op == OP_LTIK || x->op == OP_LTD ||
+       x->op == OP_LTDK) &&
+      x_temp && y->op == OP_JMPF && y->a == x->a) {
+    int jop = x->op == OP_LTI    ? OP_JNLTI
+              : x->op == OP_LTIK ? OP_JNLTIK
+              : x->op == OP_LTD  ? OP_JNLTD
+                                 : OP_JNLTDK;
+    out[0] = (Instr){(uint16_t)jop, x->b, x->c, 0};
+    out[1] = (Instr){OP_JMP, 0, y->b, y->c};
+    return 2;
+  }
+  return 0;
+}
+
+/* One left-to-right sweep; returns the number of fused pairs. Jump targets
+ * and function entries are never folded into a preceding instruction. */
+static int bc_fuse_pass(BcProgram *p) {
+  int n = p->ncode;
+  bool *target = calloc(n + 1, sizeof(bool));
+  int *map = malloc((n + 1) * sizeof(int));
+  Instr *out = malloc((n + 1) * sizeof(Instr));
+  if (!target || !map || !out) {
+    perror("bytecode");
+    exit(1);
+  }
+  for (int pc = 0; pc < n; pc += bc_width(&p->code[pc])) {
+    const Instr *j = bc_jump_word(&p->code[pc]);
+    if (j)
+      target[JMP_TARGET(j)] = true;
+  }
+  for (int f = 0; f < p->nfuncs; f++)
+    target[p->funcs[f].entry] = true;
+
+  int nout = 0, fused = 0, f = 0;
+  for (int pc = 0; pc < n;) {
+    while (f + 1 < p->nfuncs && pc >= p->funcs[f + 1].entry)
+      f++;
+    const Instr *x = &p->code[pc];
+    int w = bc_width(x);
+    map[pc] = nout;
+    if (pc + w < n && !target[pc + w] && bc_width(&p->code[pc + w]) == 1) {
+      int k = bc_fuse_pair(x, x + w, p->funcs[f].nlocals, &out[nout]);
+      if (k > 0) {
+        for (int i = 1; i <= w; i++)
+          map[pc + i] = nout;
+        nout += k;
+        pc += w + 1;
+        fused++;
+        continue;
+      }
+    }
+    for (int i = 0; i < w; i++) {
+      map[pc + i] = nout;
+      out[nout++] = p->code[pc + i];
+    }
+    pc += w;
+  }
+  map[n] = nout;
+
+  for (int pc = 0; pc < nout; pc += bc_width(&out[pc])) {
+    Instr *j = (Instr *)bc_jump_word(&out[pc]);
+    if (j) {
+      int t = map[JMP_TARGET(j)];
+      j->b = (uint16_t)(t & 0xffff);
+      j->c = (uint16_t)((uint32_t)t >> 16);
+    }
+  }
+  for (int i = 0; i < p->nfuncs; i++)
+    p->funcs[i].entry = map[p->funcs[i].entry];
+  for (int i = 0; i < p->nloops; i++)
+    p->loops[i].head = map[p->loops[i].head];
+
+  free(p->code);
+  p->code = out;
+  p->ncode = nout;
+  p->code_cap = n + 1;
+  free(target);
+  free(map);
+  return fused;
+}
+
+/* Peephole pass: repeatedly fuse adjacent pairs into superinstructions
+ * (constant operands, destination forwarding, compare-and-branch) until
+ * nothing changes. Returns the total number of fusions. */
+int bc_fuse(BcProgram *p) {
+  int total = 0, k;
+  bc = p;
+  while ((k = bc_fuse_pass(p)) > 0)
+    total += k;
+  bc = NULL;
+  return total;
+}
+
+void bc_free(BcProgram *p) {
+  if (!p)
+    return;
+  for (int f = 0; f < p->nfuncs; f++)
+    free(p->funcs[f].name);
+  free(p->funcs);
+  free(p->code);
+  free(p->consts);
+  free(p->const_slots);
+  for (int i = 0; i < p->nloops; i++)
+    free(p->loops[i].label);
+  free(p->loops);
+  free(p);
+}
+
+void bc_disassemble(const BcProgram *p, FILE *out) {
+  for (int f = 0; f < p->nfuncs; f++) {
+    const BcFunc *bf = &p->funcs[f];
+    int end = f + 1 < p->nfuncs ? p->funcs[f + 1].entry : p->ncode;
+    fprintf(out, "%s: (%d registers)\n", bf->name, bf->nregs);
+    for (int pc = bf->entry; pc < end; pc += bc_width(&p->code[pc])) {
+      const Instr *in = &p->code[pc];
+      fprintf(out, "  %4d  %-10s", pc, opcode_names[in->op] + 3);
+      switch (in->op) {
+      case OP_LOADK:
+        fprintf(out, "r%d, K%d", in->a, in->b);
+        break;
+      case OP_JMP:
+        fprintf(out, "-> %d", JMP_TARGET(in));
+        break;
+      case OP_JMPF:
+        fprintf(out, "r%d -> %d", in->a, JMP_TARGET(in));
+        break;
+      case OP_CALL:
+        fprintf(out, "r%d, %s(r%d)", in->a, p->funcs[JMP_TARGET(in + 1)].name,
+                in->c);
+        break;
+      case OP_MOV:
+      case OP_I2D:
+        fprintf(out, "r%d, r%d", in->a, in->b);
+        break;
+      case OP_RET:
+      case OP_PRINTI:
+      case OP_PRINTD:
+        fprintf(out, "r%d", in->a);
+        break;
+      case OP_JNLTI:
+      case OP_JNLTD:
+        fprintf(out, "r%d, r%d -> %d", in->a, in->b, JMP_TARGET(in + 1));
+        break;
+      case OP_JNLTIK:
+      case OP_JNLTDK:
+        fprintf(out, "r%d, K%d -> %d", in->a, in->b, JMP_TARGET(in + 1));
+        break;
+      default:
+        if (in->op >= OP_ADDIK) {
+          fprintf(out, "r%d, r%d, K%d", in->a, in->b, in->c);
+          break;
+        }
+        fprintf(out, "r%d, r%d, r%d", in->a, in->b, in->c);
+        break;
+      }
+      fprintf(out, "\n");
+    }
+  }
+}
+
+/* --- VIRTUAL MACHINE --- */
+
+#define VM_STACK_SLOTS (1 << 20)
+#define VM_MAX_FRAMES 100000
+
+/* GCC and Clang dispatch through a label table (computed goto); other
+ * compilers, or -DVM_SWITCH_DISPATCH, use a plain switch. */
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+enum {
+  VM_OK,
+  VM_ERR_DIV_ZERO,
+  VM_ERR_STACK_OVERFLOW,
+  VM_ERR_INSTRUCTIONS,
+  VM_ERR_TIME,
+  VM_ERR_MEMORY
+};
+
+const char *vm_status_names[] = {"ok",
+                                 "division by zero",
+                                 "stack overflow",
+                                 "instruction limit exceeded",
+                                 "time limit exceeded",
+                                 "memory limit exceeded"};
+
+/* Per-run resource limits, 0 for none. They are only checked at loop
+ * back-edges and calls: a back-edge charges the length of the loop body and
+ * a call the length of the callee, an upper bound on the instructions run
+ * since the last check. Memory is the register stack in use. */
+typedef struct {
+  long long instructions;
+  double seconds;
+  long long bytes;
+} VmLimits;
+
+VmLimits vm_limits = {0, 0, 0};
+
+/* instructions between slow checks (totals and the clock) */
+#define VM_CHECK_INTERVAL (1 << 16)
+
+/* How a run ended and what it used. */
+typedef struct {
+  int status;
+  int func; /* function running when it stopped */
+  long long instructions;
+  double seconds;
+  long long peak_bytes;
+} VmUsage;
+
+typedef struct {
+  const Instr *ret; /* resume point in the caller */
+  Value *base;      /* caller's registers */
+  int dst;          /* caller register receiving the result */
+  int func;         /* callee */
+} VmFrame;
+
+typedef struct Jit Jit;
+
+typedef struct {
+  const BcProgram *prog;
+  Value *stack;
+  VmFrame *frames;
+  FILE *out;
+  /* tier-up state, NULL when the JIT is off: per function, calls and loop
+   * back-edges left before it is compiled */
+  Jit *jit;
+  int *hot;
+  int depth;   /* frame index of the running native function */
+  int nesting; /* native activations on the C stack */
+  Value ret;   /* value returned by the bottom frame of vm_execute() */
+  /* budget: tick counts down to the next vm_checkpoint(), which folds the
+   * window into used and checks the limits */
+  long long tick, window, used;
+  double started, deadline;
+  Value *stack_end; /* register stack limit: VM_STACK_SLOTS or the budget */
+  Value *peak;      /* highest register stack use */
+  VmUsage usage;    /* filled in by vm_run() */
+  /* dispatch profiler, NULL when off: executions per opcode and per
+   * (previous opcode, opcode) pair */
+  unsigned long long *op_counts;
+  unsigned long long *pair_counts;
+  long long result; /* main's return value */
+  int status;
+  int error_func; /* function executing when an error was raised */
+} VM;
+
+void vm_init(VM *vm, const BcProgram *prog, FILE *out) {
+  memset(vm, 0, sizeof(*vm));
+  vm->prog = prog;
+  vm->out = out;
+  vm->stack = malloc(VM_STACK_SLOTS * sizeof(Value));
+  vm->frames = malloc(VM_MAX_FRAMES * sizeof(VmFrame));
+  if (!vm->stack || !vm->frames) {
+    perror("vm");
+    exit(1);
+  }
+}
+
+void jit_free(Jit *jit);
+
+void vm_free(VM *vm) {
+  jit_free(vm->jit);
+  free(vm->hot);
+  free(vm->stack);
+  free(vm->frames);
+  free(vm->op_counts);
+  free(vm->pair_counts);
+}
+
+/* Sampling profiler: the SIGPROF handler only raises profile_pending, and
+ * the next checkpoint records where the run is. */
+volatile sig_atomic_t profile_pending = 0;
+void profile_sample(const VM *vm, int depth, int pc);
+
+/* Slow path of the budget, taken when tick runs out at frame depth and
+ * instruction pc: account for the window, check the instruction and time
+ * limits, and take a pending profiler sample. */
+int vm_checkpoint(VM *vm, int depth, int pc) {
+  vm->used += vm->window - vm->tick;
+  vm->window = vm->tick;
+  if (vm_limits.instructions && vm->used >= vm_limits.instructions)
+    return VM_ERR_INSTRUCTIONS;
+  if (vm->deadline && now_seconds() >= vm->deadline)
+    return VM_ERR_TIME;
+  if (profile_pending) {
+    profile_pending = 0;
+    profile_sample(vm, depth, pc);
+  }
+  vm->window = VM_CHECK_INTERVAL;
+  if (vm_limits.instructions && vm_limits.instructions - vm->used < vm->window)
+    vm->window = vm_limits.instructions - vm->used;
+  vm->tick = vm->window;
+  return VM_OK;
+}
+
+/* Point vm at another program, keeping its stack and frame arrays. */
+void vm_reset(VM *vm, const BcProgram *prog, FILE *out) {
+  Value *stack = vm->stack;
+  VmFrame *frames = vm->frames;
+  jit_free(vm->jit);
+  free(vm->hot);
+  free(vm->op_counts);
+  free(vm->pair_counts);
+  memset(vm, 0, sizeof(*vm));
+  vm->prog = prog;
+  vm->out = out;
+  vm->stack = stack;
+  vm->frames = frames;
+}
+
+void vm_enable_profiling(VM *vm) {
+  vm->op_counts = calloc(NUM_OPCODES, sizeof(unsigned long long));
+  vm->pair_counts =
+      calloc(NUM_OPCODES * NUM_OPCODES, sizeof(unsigned long long));
+  if (!vm->op_counts || !vm->pair_counts) {
+    perror("vm");
+    exit(1);
+  }
+}
+
+unsigned long long vm_dispatch_total(const VM *vm) {
+  unsigned long long total = 0;
+  for (int op = 0; op < NUM_OPCODES; op++)
+    total += vm->op_counts[op];
+  return total;
+}
+
+/* Opcode histogram plus the hottest adjacent pairs: the pairs are the
+ * candidates worth fusing into superinstructions. */
+void vm_print_profile(const VM *vm, FILE *out) {
+  unsigned long long total = vm_dispatch_total(vm);
+  fprintf(out, "\n=== DISPATCH PROFILE (%llu dispatches) ===\n", total);
+  fprintf(out, "%-10s %14s %7s\n", "opcode", "count", "share");
+  for (int op = 0; op < NUM_OPCODES; op++) {
+    if (vm->op_counts[op] == 0)
+      continue;
+    fprintf(out, "%-10s %14llu %6.2f%%\n", opcode_names[op] + 3,
+            vm->op_counts[op], 100.0 * vm->op_counts[op] / total);
+  }
+  fprintf(out, "\nHottest opcode pairs:\n");
+  bool *shown = calloc(NUM_OPCODES * NUM_OPCODES, sizeof(bool));
+  for (int rank = 0; rank < 10 && shown; rank++) {
+    int best = -1;
+    for (int k = 0; k < NUM_OPCODES * NUM_OPCODES; k++)
+      if (!shown[k] && vm->pair_counts[k] &&
+          (best < 0 || vm->pair_counts[k] > vm->pair_counts[best]))
+        best = k;
+    if (best < 0)
+      break;
+    shown[best] = true;
+    fprintf(out, "  %-8s -> %-8s %14llu\n",
+            opcode_names[best / NUM_OPCODES] + 3,
+            opcode_names[best % NUM_OPCODES] + 3, vm->pair_counts[best]);
+  }
+  free(shown);
+}
+
+/* Frame, memory and budget checks for a call at pc that puts func's frame
+ * at depth with its registers at base; charges the callee's length. */
+static int vm_enter_frame(VM *vm, int depth, int func, Value *base, int pc) {
+  const BcProgram *p = vm->prog;
+  const BcFunc *callee = &p->funcs[func];
+  if (depth >= VM_MAX_FRAMES ||
+      base + callee->nregs > vm->stack + VM_STACK_SLOTS)
+    return VM_ERR_STACK_OVERFLOW;
+  if (base + callee->nregs > vm->stack_end)
+    return VM_ERR_MEMORY;
+  if (base + callee->nregs > vm->peak)
+    vm->peak = base + callee->nregs;
+  int end = func + 1 < p->nfuncs ? p->funcs[func + 1].entry : p->ncode;
+  vm->tick -= end - callee->entry;
+  if (vm->tick > 0)
+    return VM_OK;
+  return depth > 0 ? vm_checkpoint(vm, depth - 1, pc)
+                   : vm_checkpoint(vm, 0, callee->entry);
+}
+
+/* Native code returns its status and the function's value (or, on an
+ * error, the failing function) in two registers. */
+typedef struct {
+  long long status;
+  Value v;
+} JitResult;
+
+static bool jit_ready(VM *vm, int f, const char *why);
+static JitResult jit_enter(VM *vm, int f, Value *R, int pc);
+
+/* Runs from ip in the frame bottom (already set up, registers at R) until
+ * bottom returns, leaving its value in vm->ret. Returns VM_OK or the error
+ * status. Native code re-enters here to call interpreted functions. */
+static int vm_execute(VM *vm, VmFrame *bottom, Value *R, const Instr *ip) {
+  const BcProgram *p = vm->prog;
+  const Instr *code = p->code;
+  const Value *K = p->consts;
+  VmFrame *fp = bottom; /* fp->func is the running function */
+  const Instr *in;
+  Value ret;
+  JitResult r;
+  int target = 0; /* set by every jump to back_edge */
+
+  int prev_op = 0;
+
+#ifdef VM_COMPUTED_GOTO
+#define BC_LABEL(op) &&L_##op,
+#define BC_COUNT(op) &&L_count,
+  static const void *labels[] = {BC_OPCODES(BC_LABEL)};
+  /* with the profiler on, every opcode detours through L_count first, so
+   * the plain table carries no profiling cost */
+  static const void *counting[] = {BC_OPCODES(BC_COUNT)};
+  const void *const *table = vm->op_counts ? counting : labels;
+#undef BC_LABEL
+#undef BC_COUNT
+#define CASE(op) L_##op:
+#define NEXT()                                                                 \
+  do {                                                                         \
+    in = ip++;                                                                 \
+    goto *table[in->op];                                                       \
+  } while (0)
+#else
+#define CASE(op) case op:
+#define NEXT() goto dispatch
+#endif
+/* A taken backward jump is a loop back-edge: it charges the loop body to
+ * the budget and counts toward compiling the running function, which then
+ * continues natively from the loop header. */
+#define JUMP(t)                                                                \
+  do {                                                                         \
+    target = (t);                                                              \
+    if (target <= in - code) {                                                 \
+      vm->tick -= in - code - target + 1;                                      \
+      if (vm->tick <= 0 || (vm->hot && --vm->hot[fp->func] <= 0))              \
+        goto back_edge;                                                        \
+    }                                                                          \
+    ip = code + target;                                                        \
+  } while (0)
+
+#ifdef VM_COMPUTED_GOTO
+  NEXT();
+#else
+dispatch:
+  in = ip++;
+  if (vm->op_counts) {
+    vm->op_counts[in->op]++;
+    vm->pair_counts[prev_op * NUM_OPCODES + in->op]++;
+    prev_op = in->op;
+  }
+  switch (in->op) {
+#endif
+
+  CASE(OP_LOADK) R[in->a] = K[in->b];
+  NEXT();
+  CASE(OP_MOV) R[in->a] = R[in->b];
+  NEXT();
+  CASE(OP_I2D) R[in->a].d = (double)R[in->b].i;
+  NEXT();
+  /* int arithmetic wraps like two's complement hardware */
+  CASE(OP_ADDI)
+  R[in->a].i = (long long)((unsigned long long)R[in->b].i +
+                           (unsigned long long)R[in->c].i);
+  NEXT();
+  CASE(OP_SUBI)
+  R[in->a].i = (long long)((unsigned long long)R[in->b].i -
+                           (unsigned long long)R[in->c].i);
+  NEXT();
+  CASE(OP_MULI)
+  R[in->a].i = (long long)((unsigned long long)R[in->b].i *
+                           (unsigned long long)R[in->c].i);
+  NEXT();
+  CASE(OP_DIVI) {
+    long long d = R[in->c].i;
+    if (d == 0) {
+      vm->status = VM_ERR_DIV_ZERO;
+      goto fail;
+    }
+    R[in->a].i = (d == -1) ? (long long)(0ull - (unsigned long long)R[in->b].i)
+                           : R[in->b].i / d;
+  }
+  NEXT();
+  CASE(OP_LTI) R[in->a].i = R[in->b].i < R[in->c].i;
+  NEXT();
+  CASE(OP_ADDD) R[in->a].d = R[in->b].d + R[in->c].d;
+  NEXT();
+  CASE(OP_SUBD) R[in->a].d = R[in->b].d - R[in->c].d;
+  NEXT();
+  CASE(OP_MULD) R[in->a].d = R[in->b].d * R[in->c].d;
+  NEXT();
+  CASE(OP_DIVD) R[in->a].d = R[in->b].d / R[in->c].d;
+  NEXT();
+  CASE(OP_LTD) R[in->a].i = R[in->b].d < R[in->c].d;
+  NEXT();
+  CASE(OP_JMP) JUMP(JMP_TARGET(in));
+  NEXT();
+  CASE(OP_JMPF)
+  if (!R[in->a].i)
+    JUMP(JMP_TARGET(in));
+  NEXT();
+  CASE(OP_CALL) {
+    int func = JMP_TARGET(ip);
+    ip++; /* past the callee word */
+    const BcFunc *callee = &p->funcs[func];
+    Value *nbase = R + p->funcs[fp->func].nregs;
+    if ((vm->status = vm_enter_frame(vm, (int)(fp + 1 - vm->frames), func,
+                                     nbase, (int)(in - code))) != VM_OK)
+      goto fail;
+    nbase[0] = R[in->c];
+    if (vm->hot && --vm->hot[func] <= 0 && jit_ready(vm, func, "calls")) {
+      /* native frames keep func and ret current for the profiler */
+      fp[1].func = func;
+      fp[1].ret = ip;
+      vm->depth = (int)(fp + 1 - vm->frames);
+      r = jit_enter(vm, func, nbase, callee->entry);
+      if (r.status != VM_OK)
+        goto native_fail;
+      R[in->a] = r.v;
+      NEXT();
+    }
+    fp++;
+    fp->ret = ip;
+    fp->base = R;
+    fp->dst = in->a;
+    fp->func = func;
+    R = nbase;
+    ip = code + callee->entry;
+  }
+  NEXT();
+  CASE(OP_RET) ret = R[in->a];
+do_return:
+  if (fp == bottom) {
+    vm->ret = ret;
+    return VM_OK;
+  }
+  R = fp->base;
+  ip = fp->ret;
+  R[fp->dst] = ret;
+  fp--;
+  NEXT();
+  CASE(OP_PRINTI) fprintf(vm->out, "%lld\n", R[in->a].i);
+  NEXT();
+  CASE(OP_PRINTD) fprintf(vm->out, "%g\n", R[in->a].d);
+  NEXT();
+  CASE(OP_ADDIK)
+  R[in->a].i = (long long)((unsigned long long)R[in->b].i +
+                           (unsigned long long)K[in->c].i);
+  NEXT();
+  CASE(OP_SUBIK)
+  R[in->a].i = (long long)((unsigned long long)R[in->b].i -
+                           (unsigned long long)K[in->c].i);
+  NEXT();
+  CASE(OP_MULIK)
+  R[in->a].i = (long long)((unsigned long long)R[in->b].i *
+                           (unsigned long long)K[in->c].i);
+  NEXT();
+  CASE(OP_DIVIK) R[in->a].i = R[in->b].i / K[in->c].i;
+  NEXT();
+  CASE(OP_LTIK) R[in->a].i = R[in->b].i < K[in->c].i;
+  NEXT();
+  CASE(OP_ADDDK) R[in->a].d = R[in->b].d + K[in->c].d;
+  NEXT();
+  CASE(OP_SUBDK) R[in->a].d = R[in->b].d - K[in->c].d;
+  NEXT();
+  CASE(OP_MULDK) R[in->a].d = R[in->b].d * K[in->c].d;
+  NEXT();
+  CASE(OP_DIVDK) R[in->a].d = R[in->b].d / K[in->c].d;
+  NEXT();
+  CASE(OP_LTDK) R[in->a].i = R[in->b].d < K[in->c].d;
+  NEXT();
+  /* fused compare-and-branch; ip already points at the target word */
+  CASE(OP_JNLTI)
+  if (R[in->a].i < R[in->b].i)
+    ip++;
+  else
+    JUMP(JMP_TARGET(ip));
+  NEXT();
+  CASE(OP_JNLTIK)
+  if (R[in->a].i < K[in->b].i)
+    ip++;
+  else
+    JUMP(JMP_TARGET(ip));
+  NEXT();
+  CASE(OP_JNLTD)
+  if (R[in->a].d < R[in->b].d)
+    ip++;
+  else
+    JUMP(JMP_TARGET(ip));
+  NEXT();
+  CASE(OP_JNLTDK)
+  if (R[in->a].d < K[in->b].d)
+    ip++;
+  else
+    JUMP(JMP_TARGET(ip));
+  NEXT();
+
+#ifdef VM_COMPUTED_GOTO
+L_count:
+  vm->op_counts[in->op]++;
+  vm->pair_counts[prev_op * NUM_OPCODES + in->op]++;
+  prev_op = in->op;
+  goto *labels[in->op];
+#endif
+
+#ifndef VM_COMPUTED_GOTO
+  }
+#endif
+
+back_edge:
+  if (vm->tick <= 0 &&
+      (vm->status = vm_checkpoint(vm, (int)(fp - vm->frames),
+                                  (int)(in - code))) != VM_OK)
+    goto fail;
+  if (!vm->hot || vm->hot[fp->func] > 0 || !jit_ready(vm, fp->func, "loop")) {
+    ip = code + target;
+    NEXT();
+  }
+  vm->depth = (int)(fp - vm->frames);
+  r = jit_enter(vm, fp->func, R, target);
+  if (r.status != VM_OK)
+    goto native_fail;
+  ret = r.v;
+  goto do_return;
+#undef CASE
+#undef NEXT
+#undef JUMP
+
+native_fail:
+  vm->status = (int)r.status;
+  vm->error_func = (int)r.v.i;
+  return vm->status;
+fail:
+  vm->error_func = fp->func;
+  return vm->status;
+}
+
+/* Runs main to completion or until a limit in vm_limits is hit. Returns
+ * VM_OK or the error status; vm->usage says what the run used. */
+int vm_run(VM *vm) {
+  const BcProgram *p = vm->prog;
+  long long slots = VM_STACK_SLOTS;
+  if (vm_limits.bytes && vm_limits.bytes / (long long)sizeof(Value) < slots)
+    slots = vm_limits.bytes / (long long)sizeof(Value);
+  vm->stack_end = vm->stack + slots;
+  vm->peak = vm->stack;
+  vm->used = 0;
+  vm->window = vm->tick = 0;
+  vm->started = now_seconds();
+  vm->deadline = vm_limits.seconds ? vm->started + vm_limits.seconds : 0;
+  vm->frames[0].func = p->main_func;
+  vm->frames[0].base = NULL;
+  vm->status = vm_enter_frame(vm, 0, p->main_func, vm->stack, -1);
+  vm->error_func = p->main_func;
+  if (vm->status == VM_OK)
+    vm->status = vm_execute(vm, vm->frames, vm->stack,
+                            p->code + p->funcs[p->main_func].entry);
+  if (vm->status == VM_OK)
+    vm->result = vm->ret.i;
+  vm->usage.status = vm->status;
+  vm->usage.func = vm->error_func;
+  vm->usage.instructions = vm->used + vm->window - vm->tick;
+  vm->usage.seconds = now_seconds() - vm->started;
+  vm->usage.peak_bytes = (long long)(vm->peak - vm->stack) * sizeof(Value);
+  return vm->status;
+}
+
+/* One JSON object describing how the run ended, for tools driving the VM */
+void vm_print_usage(const VM *vm, FILE *out) {
+  const VmUsage *u = &vm->usage;
+  fprintf(out,
+          "{\"status\": \"%s\", \"function\": \"%s\", \"instructions\": "
+          "%lld, \"seconds\": %.6f, \"peak_bytes\": %lld}\n",
+          vm_status_names[u->status], vm->prog->funcs[u->func].name,
+          u->instructions, u->seconds, u->peak_bytes);
+}
+
+
+/* Execution options, set from the command line */
+bool fuse_superinstructions = true;
+bool profile_dispatch = false;
+int opt_level = 1; /* 0: direct token compiler, 1: through the SSA IR */
+bool opt_report = false;
+bool use_jit = true; /* tier hot functions up to native code */
+bool show_usage = false;
+const char *profile_path = NULL; /* folded stacks from the sampler */
+int compile_jobs = 0; /* threads for optimization and codegen, 0: cores */
+
+/* --- TEMPLATE JIT --- */
+
+/* Hot functions are translated one bytecode instruction at a time into
+ * x86-64 machine code in mmap'ed pages. Native code keeps the interpreter's
+ * frame layout (rbx points at R[0] and every register stays in its stack
+ * slot), so the interpreter can switch to it at a loop header in the middle
+ * of an activation, and native code can call interpreted functions. Calls,
+ * printf and the frame-limit checks go through small C helpers.
+ *
+ * Native entry points take (R, vm, start address), keep R in rbx and the VM
+ * in r12, and return a JitResult in rax:rdx: the status, then the returned
+ * value or, on an error, the index of the failing function. */
+
+#if (defined(__x86_64__) || defined(_M_X64)) &&                              \
+    (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)) &&      \
+    !defined(VM_NO_JIT)
+#define VM_JIT 1
+#include <sys/mman.h>
+#endif
+
+#define JIT_HOT_THRESHOLD 1000 /* calls plus loop back-edges */
+#define JIT_MAX_NESTING 1000   /* native activations on the C stack */
+
+typedef JitResult (*JitEntry)(Value *R, VM *vm, const uint8_t *start);
+
+struct Jit {
+  uint8_t **code;   /* per function: executable pages, NULL until compiled */
+  size_t *size;     /* per function: bytes of machine code */
+  int **offset;     /* per function: native offset of each instruction */
+  const char **why; /* per function: what made it hot */
+  int nfuncs;
+};
+
+#ifdef VM_JIT
+enum { JIT_RAX, JIT_RCX, JIT_RDX, JIT_RSI = 6 }; /* xmm0/xmm1 share 0/1 */
+
+typedef struct {
+  uint8_t *buf;
+  int len, cap;
+  int *fix_at, *fix_pc; /* rel32 fields and their target pc (-1: exit) */
+  int nfix, fix_cap;
+} JitAsm;
+
+static void jit_byte(JitAsm *a, int b) {
+  if (a->len == a->cap) {
+    a->cap = a->cap ? a->cap * 2 : 1024;
+    a->buf = realloc(a->buf, a->cap);
+    if (!a->buf) {
+      perror("jit");
+      exit(1);
+    }
+  }
+  a->buf[a->len++] = (uint8_t)b;
+}
+
+static void jit_u32(JitAsm *a, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    jit_byte(a, (v >> (8 * i)) & 0xff);
+}
+
+static void jit_u64(JitAsm *a, uint64_t v) {
+  jit_u32(a, (uint32_t)v);
+  jit_u32(a, (uint32_t)(v >> 32));
+}
+
+/* Opcode bytes given as a string; none of them is zero. */
+static void jit_raw(JitAsm *a, const char *bytes) {
+  while (*bytes)
+    jit_byte(a, (uint8_t)*bytes++);
+}
+
+/* op reg, [rbx + 8 * slot] */
+static void jit_mem(JitAsm *a, const char *op, int reg, int slot) {
+  jit_raw(a, op);
+  jit_byte(a, 0x80 | (reg << 3) | 3);
+  jit_u32(a, (uint32_t)slot * 8);
+}
+
+/* movabs rax/rcx, imm64 */
+static void jit_imm64(JitAsm *a, int reg, uint64_t v) {
+  jit_byte(a, 0x48);
+  jit_byte(a, 0xb8 + reg);
+  jit_u64(a, v);
+}
+
+/* jmp or jcc to a bytecode pc (or -1 for the exit), fixed up at the end */
+static void jit_jump(JitAsm *a, const char *op, int pc) {
+  jit_raw(a, op);
+  if (a->nfix == a->fix_cap) {
+    a->fix_cap = a->fix_cap ? a->fix_cap * 2 : 64;
+    a->fix_at = realloc(a->fix_at, a->fix_cap * sizeof(int));
+    a->fix_pc = realloc(a->fix_pc, a->fix_cap * sizeof(int));
+    if (!a->fix_at || !a->fix_pc) {
+      perror("jit");
+      exit(1);
+    }
+  }
+  a->fix_at[a->nfix] = a->len;
+  a->fix_pc[a->nfix++] = pc;
+  jit_u32(a, 0);
+}
+
+/* Short forward jump over the next few bytes; jit_land() patches it. */
+static int jit_skip(JitAsm *a, int op) {
+  jit_byte(a, op);
+  jit_byte(a, 0);
+  return a->len - 1;
+}
+
+static void jit_land(JitAsm *a, int at) {
+  a->buf[at] = (uint8_t)(a->len - at - 1);
+}
+
+/* mov eax, status; mov edx, func; jmp exit */
+static void jit_error(JitAsm *a, int status, int func) {
+  jit_byte(a, 0xb8);
+  jit_u32(a, status);
+  jit_byte(a, 0xba);
+  jit_u32(a, func);
+  jit_jump(a, "\xe9", -1);
+}
+
+static void jit_call_c(JitAsm *a, uint64_t fn) {
+  jit_imm64(a, JIT_RAX, fn);
+  jit_raw(a, "\xff\xd0"); /* call rax */
+}
+
+static JitResult jit_call(VM *vm, Value *R, int caller, int pc);
+
+static JitResult jit_checkpoint(VM *vm, int func, int pc) {
+  JitResult r;
+  r.status = vm_checkpoint(vm, vm->depth, pc);
+  r.v.i = func;
+  return r;
+}
+
+/* Loop back-edge from pc to target: charge the budget like the interpreter
+ * and take the slow path through vm_checkpoint() when it runs out. */
+static void jit_back_edge(JitAsm *a, int f, int pc, int target) {
+  jit_raw(a, "\x49\x81\xac\x24"); /* sub qword [r12 + disp32], imm32 */
+  jit_u32(a, offsetof(VM, tick));
+  jit_u32(a, pc - target + 1);
+  jit_jump(a, "\x0f\x8f", target); /* jg */
+  jit_raw(a, "\x4c\x89\xe7");       /* mov rdi, r12 */
+  jit_byte(a, 0xbe);                 /* mov esi, f */
+  jit_u32(a, f);
+  jit_byte(a, 0xba); /* mov edx, pc */
+  jit_u32(a, pc);
+  jit_call_c(a, (uint64_t)(uintptr_t)jit_checkpoint);
+  jit_raw(a, "\x48\x85\xc0");
+  jit_jump(a, "\x0f\x85", -1);
+  jit_jump(a, "\xe9", target);
+}
+
+/* Conditional jump (jcc, or the short inverse condition skip) to target;
+ * backward ones are loop back-edges. */
+static void jit_branch(JitAsm *a, const char *jcc, int skip, int f, int pc,
+                       int target) {
+  if (target > pc) {
+    jit_jump(a, jcc, target);
+    return;
+  }
+  int over = jit_skip(a, skip);
+  jit_back_edge(a, f, pc, target);
+  jit_land(a, over);
+}
+
+static void jit_print_int(VM *vm, long long v) {
+  fprintf(vm->out, "%lld\n", v);
+}
+
+static void jit_print_dec(VM *vm, double d) { fprintf(vm->out, "%g\n", d); }
+
+/* Compare-and-set: rax = (flags say true) */
+static void jit_setcc(JitAsm *a, const char *setcc, int slot) {
+  jit_raw(a, setcc);
+  jit_raw(a, "\xc0\x0f\xb6\xc0"); /* setcc al; movzx eax, al */
+  jit_mem(a, "\x48\x89", JIT_RAX, slot);
+}
+
+/* Translate one bytecode instruction at pc of function f. */
+static void jit_instr(JitAsm *a, const BcProgram *p, int f, int pc) {
+  const Instr *in = &p->code[pc];
+  const Value *K = p->consts;
+  static const char *int_ops[] = {"\x48\x03", "\x48\x2b", "\x48\x0f\xaf"};
+  static const char *dec_ops[] = {"\xf2\x0f\x58", "\xf2\x0f\x5c",
+                                  "\xf2\x0f\x59", "\xf2\x0f\x5e"};
+  switch (in->op) {
+  case OP_LOADK:
+    jit_imm64(a, JIT_RAX, (uint64_t)K[in->b].i);
+    jit_mem(a, "\x48\x89", JIT_RAX, in->a);
+    break;
+  case OP_MOV:
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->b);
+    jit_mem(a, "\x48\x89", JIT_RAX, in->a);
+    break;
+  case OP_I2D:
+    /* pxor first: cvtsi2sd would otherwise wait on the old xmm0 */
+    jit_raw(a, "\x66\x0f\xef\xc0");
+    jit_mem(a, "\xf2\x48\x0f\x2a", 0, in->b); /* cvtsi2sd xmm0, m64 */
+    jit_mem(a, "\xf2\x0f\x11", 0, in->a);
+    break;
+  case OP_ADDI:
+  case OP_SUBI:
+  case OP_MULI:
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->b);
+    jit_mem(a, int_ops[in->op - OP_ADDI], JIT_RAX, in->c);
+    jit_mem(a, "\x48\x89", JIT_RAX, in->a);
+    break;
+  case OP_ADDIK:
+  case OP_SUBIK:
+  case OP_MULIK:
+    jit_imm64(a, JIT_RCX, (uint64_t)K[in->c].i);
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->b);
+    jit_raw(a, in->op == OP_ADDIK   ? "\x48\x01\xc8"      /* add rax, rcx */
+               : in->op == OP_SUBIK ? "\x48\x29\xc8"      /* sub rax, rcx */
+                                    : "\x48\x0f\xaf\xc1"); /* imul rax, rcx */
+    jit_mem(a, "\x48\x89", JIT_RAX, in->a);
+    break;
+  case OP_DIVI: {
+    /* zero is an error and x / -1 wraps instead of trapping */
+    jit_mem(a, "\x48\x8b", JIT_RCX, in->c);
+    jit_raw(a, "\x48\x85\xc9"); /* test rcx, rcx */
+    int nonzero = jit_skip(a, 0x75);
+    jit_error(a, VM_ERR_DIV_ZERO, f);
+    jit_land(a, nonzero);
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->b);
+    jit_raw(a, "\x48\x83\xf9\xff"); /* cmp rcx, -1 */
+    int divide = jit_skip(a, 0x75);
+    jit_raw(a, "\x48\xf7\xd8"); /* neg rax */
+    int done = jit_skip(a, 0xeb);
+    jit_land(a, divide);
+    jit_raw(a, "\x48\x99\x48\xf7\xf9"); /* cqo; idiv rcx */
+    jit_land(a, done);
+    jit_mem(a, "\x48\x89", JIT_RAX, in->a);
+    break;
+  }
+  case OP_DIVIK:
+    jit_imm64(a, JIT_RCX, (uint64_t)K[in->c].i);
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->b);
+    jit_raw(a, "\x48\x99\x48\xf7\xf9");
+    jit_mem(a, "\x48\x89", JIT_RAX, in->a);
+    break;
+  case OP_LTI:
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->b);
+    jit_mem(a, "\x48\x3b", JIT_RAX, in->c);
+    jit_setcc(a, "\x0f\x9c", in->a);
+    break;
+  case OP_LTIK:
+    jit_imm64(a, JIT_RCX, (uint64_t)K[in->c].i);
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->b);
+    jit_raw(a, "\x48\x39\xc8"); /* cmp rax, rcx */
+    jit_setcc(a, "\x0f\x9c", in->a);
+    break;
+  case OP_ADDD:
+  case OP_SUBD:
+  case OP_MULD:
+  case OP_DIVD:
+    jit_mem(a, "\xf2\x0f\x10", 0, in->b);
+    jit_mem(a, dec_ops[in->op - OP_ADDD], 0, in->c);
+    jit_mem(a, "\xf2\x0f\x11", 0, in->a);
+    break;
+  case OP_ADDDK:
+  case OP_SUBDK:
+  case OP_MULDK:
+  case OP_DIVDK:
+    jit_imm64(a, JIT_RAX, (uint64_t)K[in->c].i);
+    jit_raw(a, "\x66\x48\x0f\x6e\xc8"); /* movq xmm1, rax */
+    jit_mem(a, "\xf2\x0f\x10", 0, in->b);
+    jit_raw(a, dec_ops[in->op - OP_ADDDK]);
+    jit_byte(a, 0xc1); /* op xmm0, xmm1 */
+    jit_mem(a, "\xf2\x0f\x11", 0, in->a);
+    break;
+  /* b < c is c > b: unordered operands leave CF set, so NaN is false */
+  case OP_LTD:
+    jit_mem(a, "\xf2\x0f\x10", 0, in->c);
+    jit_mem(a, "\x66\x0f\x2e", 0, in->b); /* ucomisd xmm0, m64 */
+    jit_setcc(a, "\x0f\x97", in->a);
+    break;
+  case OP_LTDK:
+    jit_imm64(a, JIT_RAX, (uint64_t)K[in->c].i);
+    jit_raw(a, "\x66\x48\x0f\x6e\xc0"); /* movq xmm0, rax */
+    jit_mem(a, "\x66\x0f\x2e", 0, in->b);
+    jit_setcc(a, "\x0f\x97", in->a);
+    break;
+  case OP_JMP:
+    if (JMP_TARGET(in) > pc)
+      jit_jump(a, "\xe9", JMP_TARGET(in));
+    else
+      jit_back_edge(a, f, pc, JMP_TARGET(in));
+    break;
+  case OP_JMPF:
+    jit_mem(a, "\x48\x83", 7, in->a); /* cmp qword m64, 0 */
+    jit_byte(a, 0);
+    jit_branch(a, "\x0f\x84", 0x75, f, pc, JMP_TARGET(in)); /* je */
+    break;
+  case OP_JNLTI:
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->a);
+    jit_mem(a, "\x48\x3b", JIT_RAX, in->b);
+    jit_branch(a, "\x0f\x8d", 0x7c, f, pc, JMP_TARGET(in + 1)); /* jge */
+    break;
+  case OP_JNLTIK:
+    jit_imm64(a, JIT_RCX, (uint64_t)K[in->b].i);
+    jit_mem(a, "\x48\x8b", JIT_RAX, in->a);
+    jit_raw(a, "\x48\x39\xc8");
+    jit_branch(a, "\x0f\x8d", 0x7c, f, pc, JMP_TARGET(in + 1));
+    break;
+  case OP_JNLTD:
+    jit_mem(a, "\xf2\x0f\x10", 0, in->b);
+    jit_mem(a, "\x66\x0f\x2e", 0, in->a);
+    jit_branch(a, "\x0f\x86", 0x77, f, pc, JMP_TARGET(in + 1)); /* jbe */
+    break;
+  case OP_JNLTDK:
+    jit_imm64(a, JIT_RAX, (uint64_t)K[in->b].i);
+    jit_raw(a, "\x66\x48\x0f\x6e\xc0");
+    jit_mem(a, "\x66\x0f\x2e", 0, in->a);
+    jit_branch(a, "\x0f\x86", 0x77, f, pc, JMP_TARGET(in + 1));
+    break;
+  case OP_CALL:
+    jit_raw(a, "\x4c\x89\xe7\x48\x89\xde"); /* mov rdi, r12; mov rsi, rbx */
+    jit_byte(a, 0xba);
+    jit_u32(a, f);
+    jit_byte(a, 0xb9);
+    jit_u32(a, pc);
+    jit_call_c(a, (uint64_t)(uintptr_t)jit_call);
+    jit_raw(a, "\x48\x85\xc0"); /* test rax, rax */
+    jit_jump(a, "\x0f\x85", -1);
+    jit_mem(a, "\x48\x89", JIT_RDX, in->a);
+    break;
+  case OP_RET:
+    jit_mem(a, "\x48\x8b", JIT_RDX, in->a);
+    jit_raw(a, "\x31\xc0"); /* xor eax, eax */
+    jit_jump(a, "\xe9", -1);
+    break;
+  case OP_PRINTI:
+    jit_raw(a, "\x4c\x89\xe7");
+    jit_mem(a, "\x48\x8b", JIT_RSI, in->a);
+    jit_call_c(a, (uint64_t)(uintptr_t)jit_print_int);
+    break;
+  case OP_PRINTD:
+    jit_raw(a, "\x4c\x89\xe7");
+    jit_mem(a, "\xf2\x0f\x10", 0, in->a);
+    jit_call_c(a, (uint64_t)(uintptr_t)jit_print_dec);
+    break;
+  }
+}
+#endif
+
+/* Translate function f and map it executable. Returns false when the
+ * platform has no JIT or the pages cannot be mapped. */
+static bool jit_compile(VM *vm, int f, const char *why) {
+#ifdef VM_JIT
+  const BcProgram *p = vm->prog;
+  int entry = p->funcs[f].entry;
+  int end = f + 1 < p->nfuncs ? p->funcs[f + 1].entry : p->ncode;
+  int *offset = malloc((end - entry) * sizeof(int));
+  if (!offset) {
+    perror("jit");
+    exit(1);
+  }
+  JitAsm a = {0};
+  /* push rbp; push rbx; push r12; mov rbx, rdi; mov r12, rsi; jmp rdx */
+  jit_raw(&a, "\x55\x53\x41\x54\x48\x89\xfb\x49\x89\xf4\xff\xe2");
+  for (int pc = entry; pc < end;) {
+    int w = bc_width(&p->code[pc]);
+    offset[pc - entry] = a.len;
+    if (w == 2)
+      offset[pc + 1 - entry] = -1;
+    jit_instr(&a, p, f, pc);
+    pc += w;
+  }
+  int exit_at = a.len;
+  jit_raw(&a, "\x41\x5c\x5b\x5d\xc3"); /* pop r12; pop rbx; pop rbp; ret */
+  for (int i = 0; i < a.nfix; i++) {
+    int to = a.fix_pc[i] < 0 ? exit_at : offset[a.fix_pc[i] - entry];
+    uint32_t rel = (uint32_t)(to - (a.fix_at[i] + 4));
+    memcpy(a.buf + a.fix_at[i], &rel, 4);
+  }
+  free(a.fix_at);
+  free(a.fix_pc);
+
+  /* write the code, then flip the pages to read + execute */
+  uint8_t *code = mmap(NULL, a.len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    free(a.buf);
+    free(offset);
+    return false;
+  }
+  memcpy(code, a.buf, a.len);
+  free(a.buf);
+  if (mprotect(code, a.len, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, a.len);
+    free(offset);
+    return false;
+  }
+  vm->jit->code[f] = code;
+  vm->jit->size[f] = a.len;
+  vm->jit->offset[f] = offset;
+  vm->jit->why[f] = why;
+  return true;
+#else
+  (void)vm;
+  (void)f;
+  (void)why;
+  return false;
+#endif
+}
+
+/* Turn on tier-up: every function starts interpreted with a countdown of
+ * calls and loop back-edges. Returns false where there is no JIT. */
+bool vm_enable_jit(VM *vm) {
+#ifdef VM_JIT
+  int n = vm->prog->nfuncs;
+  vm->jit = calloc(1, sizeof(Jit));
+  vm->hot = malloc(n * sizeof(int));
+  if (!vm->jit || !vm->hot) {
+    perror("jit");
+    exit(1);
+  }
+  vm->jit->nfuncs = n;
+  vm->jit->code = calloc(n, sizeof(uint8_t *));
+  vm->jit->size = calloc(n, sizeof(size_t));
+  vm->jit->offset = calloc(n, sizeof(int *));
+  vm->jit->why = calloc(n, sizeof(char *));
+  if (!vm->jit->code || !vm->jit->size || !vm->jit->offset || !vm->jit->why) {
+    perror("jit");
+    exit(1);
+  }
+  for (int f = 0; f < n; f++)
+    vm->hot[f] = JIT_HOT_THRESHOLD;
+  return true;
+#else
+  (void)vm;
+  return false;
+#endif
+}
+
+void jit_free(Jit *jit) {
+  if (!jit)
+    return;
+  for (int f = 0; f < jit->nfuncs; f++) {
+#ifdef VM_JIT
+    if (jit->code[f])
+      munmap(jit->code[f], jit->size[f]);
+#endif
+    free(jit->offset[f]);
+  }
+  free(jit->code);
+  free(jit->size);
+  free(jit->offset);
+  free(jit->why);
+  free(jit);
+}
+
+/* Called when f's countdown runs out: compiles f the first time. True when
+ * native code may be entered now. */
+static bool jit_ready(VM *vm, int f, const char *why) {
+  if (!vm->jit->code[f] && !jit_compile(vm, f, why)) {
+    vm->hot[f] = INT_MAX; /* never retry */
+    return false;
+  }
+  vm->hot[f] = 0;
+  return vm->nesting < JIT_MAX_NESTING;
+}
+
+/* Run f natively from instruction pc on registers R. */
+static JitResult jit_enter(VM *vm, int f, Value *R, int pc) {
+  const uint8_t *code = vm->jit->code[f];
+  JitEntry fn = (JitEntry)(uintptr_t)code;
+  vm->nesting++;
+  int at = vm->jit->offset[f][pc - vm->prog->funcs[f].entry];
+  JitResult r = fn(R, vm, code + at);
+  vm->nesting--;
+  return r;
+}
+
+#ifdef VM_JIT
+/* OP_CALL from native code: the interpreter's frame checks, then the callee
+ * natively when it is (or just became) hot, otherwise interpreted. */
+static JitResult jit_call(VM *vm, Value *R, int caller, int pc) {
+  const BcProgram *p = vm->prog;
+  const Instr *in = &p->code[pc];
+  int func = JMP_TARGET(in + 1);
+  const BcFunc *callee = &p->funcs[func];
+  Value *nbase = R + p->funcs[caller].nregs;
+  int depth = vm->depth;
+  JitResult r;
+  r.status = vm_enter_frame(vm, depth + 1, func, nbase, pc);
+  if (r.status != VM_OK) {
+    r.v.i = caller;
+    return r;
+  }
+  nbase[0] = R[in->c];
+  vm->depth = depth + 1;
+  vm->frames[depth + 1].func = func;
+  vm->frames[depth + 1].ret = in + 2;
+  if ((vm->jit->code[func] || --vm->hot[func] <= 0) &&
+      jit_ready(vm, func, "calls")) {
+    r = jit_enter(vm, func, nbase, callee->entry);
+  } else {
+    VmFrame *fp = &vm->frames[depth + 1];
+    fp->base = NULL;
+    r.status = vm_execute(vm, fp, nbase, p->code + callee->entry);
+    if (r.status == VM_OK)
+      r.v = vm->ret;
+    else
+      r.v.i = vm->error_func;
+  }
+  vm->depth = depth;
+  return r;
+}
+#endif
+
+void jit_print_report(const VM *vm, FILE *out) {
+  int compiled = 0;
+  for (int f = 0; f < vm->jit->nfuncs; f++)
+    compiled += vm->jit->code[f] != NULL;
+  if (compiled == 0)
+    return;
+  fprintf(out, "\n=== JIT ===\n");
+  fprintf(out, "%-20s %8s %8s  %s\n", "function", "bytecode", "native",
+          "hot from");
+  for (int f = 0; f < vm->jit->nfuncs; f++) {
+    if (!vm->jit->code[f])
+      continue;
+    const BcProgram *p = vm->prog;
+    int end = f + 1 < p->nfuncs ? p->funcs[f + 1].entry : p->ncode;
+    fprintf(out, "%-20s %8d %8zu  %s\n", p->funcs[f].name,
+            end - p->funcs[f].entry, vm->jit->size[f], vm->jit->why[f]);
+  }
+}
+
+/* --- SAMPLING PROFILER --- */
+
+/* SIGPROF fires PROFILE_HZ times per second of CPU time and raises
+ * profile_pending; the next budget checkpoint (every VM_CHECK_INTERVAL
+ * charged instructions, in the interpreter or in JIT code) walks the VM
+ * frames and counts the stack as "main;loop_main01;stepFn" in folded form
+ * for flamegraph tools. With the profiler off the only cost is the
+ * checkpoint's flag test. */
+
+#define PROFILE_HZ 1000
+#define PROFILE_EDGE_FRAMES 32 /* frames kept at each end of deep stacks */
+
+typedef struct {
+  char *stack;
+  long long count;
+} ProfileEntry;
+
+typedef struct {
+  int head, end; /* instructions of the loop: header to last back-edge */
+  const char *label;
+} ProfileLoop;
+
+ProfileEntry *profile_table = NULL; /* open addressing on the stack string */
+int profile_cap = 0, profile_count = 0;
+long long profile_samples = 0;
+ProfileLoop *profile_loops = NULL;
+int profile_nloops = 0;
+char *profile_buf = NULL; /* the stack being built */
+int profile_len = 0, profile_buf_cap = 0;
+
+static void profile_signal(int sig) {
+  (void)sig;
+  profile_pending = 1;
+}
+
+static void profile_append(const char *s, int len) {
+  profile_buf = grow_array(profile_buf, &profile_buf_cap, profile_len + len + 2,
+                           1);
+  if (profile_len > 0)
+    profile_buf[profile_len++] = ';';
+  memcpy(profile_buf + profile_len, s, len);
+  profile_len += len;
+  profile_buf[profile_len] = '\0';
+}
+
+static void profile_count_stack(void) {
+  if ((profile_count + 1) * 2 > profile_cap) {
+    int old_cap = profile_cap;
+    ProfileEntry *old = profile_table;
+    profile_cap = profile_cap ? profile_cap * 2 : 256;
+    profile_table = calloc(profile_cap, sizeof(ProfileEntry));
+    if (!profile_table) {
+      perror("profile");
+      exit(1);
+    }
+    for (int i = 0; i < old_cap; i++) {
+      if (!old[i].stack)
+        continue;
+      unsigned h = hash_bytes(old[i].stack, (int)strlen(old[i].stack)) &
+                   (profile_cap - 1);
+      while (profile_table[h].stack)
+        h = (h + 1) & (profile_cap - 1);
+      profile_table[h] = old[i];
+    }
+    free(old);
+  }
+  unsigned h = hash_bytes(profile_buf, profile_len) & (profile_cap - 1);
+  while (profile_table[h].stack && strcmp(profile_table[h].stack, profile_buf))
+    h = (h + 1) & (profile_cap - 1);
+  if (!profile_table[h].stack) {
+    profile_table[h].stack = strdup(profile_buf);
+    profile_count++;
+  }
+  profile_table[h].count++;
+}
+
+/* One frame: the function, then the labeled loops around pc, outermost
+ * first (loops are sorted by header). */
+static void profile_frame(const VM *vm, int func, int pc) {
+  const char *name = vm->prog->funcs[func].name;
+  profile_append(name, (int)strlen(name));
+  for (int i = 0; i < profile_nloops; i++)
+    if (profile_loops[i].head <= pc && pc <= profile_loops[i].end)
+      profile_append(profile_loops[i].label,
+                     (int)strlen(profile_loops[i].label));
+}
+
+void profile_sample(const VM *vm, int depth, int pc) {
+  profile_len = 0;
+  for (int k = 0; k <= depth; k++) {
+    if (depth >= 2 * PROFILE_EDGE_FRAMES && k == PROFILE_EDGE_FRAMES) {
+      profile_append("[...]", 5);
+      k = depth - PROFILE_EDGE_FRAMES;
+    }
+    /* a caller sits on its CALL, two words before the resume point */
+    int at = k == depth ? pc
+                        : (int)(vm->frames[k + 1].ret - vm->prog->code) - 2;
+    profile_frame(vm, vm->frames[k].func, at);
+  }
+  profile_count_stack();
+  profile_samples++;
+}
+
+static int profile_loop_order(const void *a, const void *b) {
+  return ((const ProfileLoop *)a)->head - ((const ProfileLoop *)b)->head;
+}
+
+/* Find each labeled loop's extent from its back-edges and start the timer.
+ * Returns false when the timer cannot be set. */
+bool profile_start(const BcProgram *p) {
+  profile_loops = calloc(p->nloops + 1, sizeof(ProfileLoop));
+  if (!profile_loops) {
+    perror("profile");
+    exit(1);
+  }
+  profile_nloops = 0;
+  profile_samples = 0;
+  for (int i = 0; i < p->nloops; i++) {
+    ProfileLoop *l = &profile_loops[profile_nloops];
+    l->head = p->loops[i].head;
+    l->end = -1;
+    l->label = p->loops[i].label;
+    for (int pc = 0; pc < p->ncode; pc += bc_width(&p->code[pc])) {
+      const Instr *j = bc_jump_word(&p->code[pc]);
+      if (j && JMP_TARGET(j) == l->head && pc >= l->head && pc > l->end)
+        l->end = pc;
+    }
+    if (l->end >= 0)
+      profile_nloops++;
+  }
+  qsort(profile_loops, profile_nloops, sizeof(ProfileLoop), profile_loop_order);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = profile_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / PROFILE_HZ;
+  timer.it_value = timer.it_interval;
+  if (sigaction(SIGPROF, &sa, NULL) != 0 ||
+      setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    perror("profile");
+    return false;
+  }
+  return true;
+}
+
+static int profile_entry_order(const void *a, const void *b) {
+  const ProfileEntry *x = a, *y = b;
+  if (x->count != y->count)
+    return x->count < y->count ? 1 : -1;
+  return strcmp(x->stack, y->stack);
+}
+
+/* Stop the timer and write the folded stacks, hottest first. */
+void profile_stop(FILE *out) {
+  struct itimerval off;
+  memset(&off, 0, sizeof(off));
+  setitimer(ITIMER_PROF, &off, NULL);
+  signal(SIGPROF, SIG_DFL);
+  profile_pending = 0;
+
+  int n = 0;
+  for (int i = 0; i < profile_cap; i++)
+    if (profile_table[i].stack)
+      profile_table[n++] = profile_table[i];
+  if (n > 0)
+    qsort(profile_table, n, sizeof(ProfileEntry), profile_entry_order);
+  for (int i = 0; i < n; i++) {
+    fprintf(out, "%s %lld\n", profile_table[i].stack, profile_table[i].count);
+    free(profile_table[i].stack);
+  }
+  free(profile_table);
+  free(profile_loops);
+  free(profile_buf);
+  profile_table = NULL;
+  profile_loops = NULL;
+  profile_buf = NULL;
+  profile_cap = profile_count = profile_nloops = profile_buf_cap = 0;
+}
+
+/* --- SSA INTERMEDIATE REPRESENTATION --- */
+
+/* Bump allocator for the variable-sized pieces of one function's IR
+ * (predecessor lists, phi operands, names). Everything is released at once
+ * when the function is freed. */
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t used, cap;
+  char data[];
+} ArenaChunk;
+
+typedef struct {
+  ArenaChunk *head;
+} Arena;
+
+void *arena_alloc(Arena *a, size_t n) {
+  n = (n + 7) & ~(size_t)7;
+  if (!a->head || a->head->used + n > a->head->cap) {
+    size_t cap = n > 16384 ? n : 16384;
+    ArenaChunk *c = malloc(sizeof(ArenaChunk) + cap);
+    if (!c) {
+      perror("arena");
+      exit(1);
+    }
+    c->next = a->head;
+    c->used = 0;
+    c->cap = cap;
+    a->head = c;
+  }
+  void *p = a->head->data + a->head->used;
+  a->head->used += n;
+  return p;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+  size_t n = strlen(s) + 1;
+  char *p = arena_alloc(a, n);
+  memcpy(p, s, n);
+  return p;
+}
+
+void arena_free(Arena *a) {
+  while (a->head) {
+    ArenaChunk *next = a->head->next;
+    free(a->head);
+    a->head = next;
+  }
+}
+
+#define IR_OPCODES(X)                                                          \
+  X(IR_NOP)   /* removed; not linked into any block */                         \
+  X(IR_FWD)   /* replaced by value a (only during construction) */             \
+  X(IR_CONST) /* k */                                                          \
+  X(IR_PARAM)                                                                  \
+  X(IR_ADD)   /* a op b; the operand type is the type of a */                  \
+  X(IR_SUB)                                                                    \
+  X(IR_MUL)                                                                    \
+  X(IR_DIV)                                                                    \
+  X(IR_LT)    /* int result */                                                 \
+  X(IR_I2D)                                                                    \
+  X(IR_PHI)   /* args[i] flows in from preds[i] */                             \
+  X(IR_CALL)  /* aux = callee, a = argument */                                 \
+  X(IR_PRINT) /* a */                                                          \
+  X(IR_JMP)   /* -> succ[0] */                                                 \
+  X(IR_BR)    /* a ? succ[0] : succ[1] */                                      \
+  X(IR_RET)   /* a */
+
+#define IR_ENUM(op) op,
+#define IR_NAME(op) #op,
+enum { IR_OPCODES(IR_ENUM) NUM_IR_OPCODES };
+const char *ir_op_names[] = {IR_OPCODES(IR_NAME)};
+
+/* Instructions live in one flat array per function and are threaded into
+ * their block through prev/next indices. An instruction's index is also
+ * the SSA value it defines. */
+typedef struct {
+  uint8_t op;
+  char type; /* TY_INT, TY_DEC, or 0 when no value is produced */
+  int block;
+  int prev, next;
+  int a, b;  /* operands; PHI keeps its variable slot in b */
+  int aux;   /* CALL: callee; PHI: argument count */
+  int *args; /* PHI operands, arena-allocated */
+  Value k;   /* CONST */
+} IrInst;
+
+typedef struct {
+  int head, tail; /* instruction list, -1 when empty */
+  int succ[2];
+  int nsucc;
+  int *preds; /* arena-allocated */
+  int npreds, pred_cap;
+  bool sealed;
+  int *defs;         /* SSA construction: current value per variable slot */
+  const char *label; /* loop header: the loop's label, e.g. "loop_main01" */
+} IrBlock;
+
+typedef struct {
+  const char *name;
+  int func; /* index into funcs[] and BcProgram.funcs */
+  char ret_type, param_type;
+  int nvars;      /* variable slots, SSA construction only */
+  char *var_type; /* slot -> type */
+  IrInst *insts;
+  int ninsts, inst_cap;
+  IrBlock *blocks;
+  int nblocks, block_cap;
+  Arena arena;
+} IrFunc;
+
+typedef struct {
+  IrFunc *funcs;
+  int nfuncs;
+  int main_func;
+} IrModule;
+
+IrFunc *ir_f = NULL; /* function being built or transformed */
+
+int ir_new_block(IrFunc *f) {
+  if (f->nblocks == f->block_cap) {
+    f->block_cap = f->block_cap ? f->block_cap * 2 : 16;
+    f->blocks = realloc(f->blocks, f->block_cap * sizeof(IrBlock));
+    if (!f->blocks) {
+      perror("ir");
+      exit(1);
+    }
+  }
+  IrBlock *b = &f->blocks[f->nblocks];
+  memset(b, 0, sizeof(*b));
+  b->head = b->tail = -1;
+  if (f->nvars > 0) {
+    b->defs = arena_alloc(&f->arena, f->nvars * sizeof(int));
+    for (int i = 0; i < f->nvars; i++)
+      b->defs[i] = -1;
+  }
+  return f->nblocks++;
+}
+
+static void ir_add_pred(IrFunc *f, int block, int pred) {
+  IrBlock *b = &f->blocks[block];
+  if (b->npreds == b->pred_cap) {
+    int ncap = b->pred_cap ? b->pred_cap * 2 : 2;
+    int *np = arena_alloc(&f->arena, ncap * sizeof(int));
+    if (b->npreds)
+      memcpy(np, b->preds, b->npreds * sizeof(int));
+    b->preds = np;
+    b->pred_cap = ncap;
+  }
+  b->preds[b->npreds++] = pred;
+}
+
+void ir_add_edge(IrFunc *f, int from, int to) {
+  f->blocks[from].succ[f->blocks[from].nsucc++] = to;
+  ir_add_pred(f, to, from);
+}
+
+static int ir_new_inst(IrFunc *f, int op, char type, int a, int b) {
+  if (f->ninsts == f->inst_cap) {
+    f->inst_cap = f->inst_cap ? f->inst_cap * 2 : 64;
+    f->insts = realloc(f->insts, f->inst_cap * sizeof(IrInst));
+    if (!f->insts) {
+      perror("ir");
+      exit(1);
+    }
+  }
+  IrInst *in = &f->insts[f->ninsts];
+  memset(in, 0, sizeof(*in));
+  in->op = op;
+  in->type = type;
+  in->a = a;
+  in->b = b;
+  in->block = -1;
+  in->prev = in->next = -1;
+  return f->ninsts++;
+}
+
+/* Link instruction v into block after instruction `after` (-1: at head) */
+void ir_link(IrFunc *f, int block, int after, int v) {
+  IrBlock *b = &f->blocks[block];
+  IrInst *in = &f->insts[v];
+  in->block = block;
+  in->prev = after;
+  in->next = after < 0 ? b->head : f->insts[after].next;
+  if (in->next >= 0)
+    f->insts[in->next].prev = v;
+  else
+    b->tail = v;
+  if (after >= 0)
+    f->insts[after].next = v;
+  else
+    b->head = v;
+}
+
+void ir_unlink(IrFunc *f, int v) {
+  IrInst *in = &f->insts[v];
+  IrBlock *b = &f->blocks[in->block];
+  if (in->prev >= 0)
+    f->insts[in->prev].next = in->next;
+  else
+    b->head = in->next;
+  if (in->next >= 0)
+    f->insts[in->next].prev = in->prev;
+  else
+    b->tail = in->prev;
+  in->prev = in->next = -1;
+  in->block = -1;
+}
+
+int ir_append(IrFunc *f, int block, int op, char type, int a, int b) {
+  int v = ir_new_inst(f, op, type, a, b);
+  ir_link(f, block, f->blocks[block].tail, v);
+  return v;
+}
+
+int ir_const(IrFunc *f, int block, char type, Value k) {
+  int v = ir_append(f, block, IR_CONST, type, -1, -1);
+  f->insts[v].k = k;
+  return v;
+}
+
+static int ir_const_int(IrFunc *f, int block, char type, long long n) {
+  Value k;
+  if (type == TY_DEC)
+    k.d = (double)n;
+  else
+    k.i = n;
+  return ir_const(f, block, type, k);
+}
+
+/* Follow forwarding left behind by removed phis */
+int ir_resolve(IrFunc *f, int v) {
+  int r = v;
+  while (r >= 0 && f->insts[r].op == IR_FWD)
+    r = f->insts[r].a;
+  while (v >= 0 && f->insts[v].op == IR_FWD) {
+    int next = f->insts[v].a;
+    f->insts[v].a = r;
+    v = next;
+  }
+  return r;
+}
+
+bool ir_is_terminator(int op) {
+  return op == IR_JMP || op == IR_BR || op == IR_RET;
+}
+
+bool ir_block_terminated(IrFunc *f, int block) {
+  int t = f->blocks[block].tail;
+  return t >= 0 && ir_is_terminator(f->insts[t].op);
+}
+
+/* Call fn(f, &operand) for every value operand of v */
+#define IR_FOR_OPERANDS(f, v, fn)                                              \
+  do {                                                                         \
+    IrInst *in_ = &(f)->insts[v];                                              \
+    switch (in_->op) {                                                         \
+    case IR_PHI:                                                               \
+      for (int k_ = 0; k_ < in_->aux; k_++)                                    \
+        fn(f, &in_->args[k_]);                                                 \
+      break;                                                                   \
+    case IR_ADD:                                                               \
+    case IR_SUB:                                                               \
+    case IR_MUL:                                                               \
+    case IR_DIV:                                                               \
+    case IR_LT:                                                                \
+      fn(f, &in_->a);                                                          \
+      fn(f, &in_->b);                                                          \
+      break;                                                                   \
+    case IR_I2D:                                                               \
+    case IR_CALL:                                                              \
+    case IR_PRINT:                                                             \
+    case IR_BR:                                                                \
+    case IR_RET:                                                               \
+      fn(f, &in_->a);                                                          \
+      break;                                                                   \
+    default:                                                                   \
+      break;                                                                   \
+    }                                                                          \
+  } while (0)
+
+static void ir_resolve_operand(IrFunc *f, int *op) { *op = ir_resolve(f, *op); }
+
+/* --- SSA construction (Braun et al., "Simple and Efficient Construction of
+ * Static Single Assignment Form") --- */
+
+static int ir_read_var(IrFunc *f, int slot, int block);
+
+static int ir_try_remove_trivial_phi(IrFunc *f, int phi) {
+  int same = -1;
+  IrInst *p = &f->insts[phi];
+  for (int i = 0; i < p->aux; i++) {
+    int op = ir_resolve(f, p->args[i]);
+    if (op == same || op == phi)
+      continue;
+    if (same >= 0)
+      return phi; /* merges at least two values */
+    same = op;
+  }
+  if (same < 0) {
+    /* only reachable through itself: the variable is undefined here */
+    p->op = IR_CONST;
+    p->aux = 0;
+    p->k.i = 0;
+    return phi;
+  }
+  ir_unlink(f, phi);
+  p->op = IR_FWD;
+  p->a = same;
+  return same;
+}
+
+static int ir_add_phi_operands(IrFunc *f, int phi, int block) {
+  IrBlock *b = &f->blocks[block];
+  int n = b->npreds;
+  int *args = arena_alloc(&f->arena, (n ? n : 1) * sizeof(int));
+  for (int i = 0; i < n; i++)
+    args[i] = ir_read_var(f, f->insts[phi].b, f->blocks[block].preds[i]);
+  f->insts[phi].args = args;
+  f->insts[phi].aux = n;
+  return ir_try_remove_trivial_phi(f, phi);
+}
+
+static int ir_new_phi(IrFunc *f, int block, int slot) {
+  int v = ir_new_inst(f, IR_PHI, f->var_type[slot], -1, slot);
+  ir_link(f, block, -1, v);
+  f->insts[v].aux = -1; /* operands pending until the block is sealed */
+  return v;
+}
+
+static int ir_read_var(IrFunc *f, int slot, int block) {
+  /* walk single-predecessor chains iteratively; long straight-line
+   * functions would otherwise recurse once per block */
+  int start = block;
+  int v = -1;
+  for (;;) {
+    IrBlock *b = &f->blocks[block];
+    if (b->defs[slot] >= 0) {
+      v = ir_resolve(f, b->defs[slot]);
+      break;
+    }
+    if (b->sealed && b->npreds == 1) {
+      block = b->preds[0];
+      continue;
+    }
+    if (!b->sealed) {
+      v = ir_new_phi(f, block, slot);
+      b->defs[slot] = v;
+    } else if (b->npreds == 0) {
+      /* entry block (or unreachable code): undefined reads as zero */
+      v = ir_new_inst(f, IR_CONST, f->var_type[slot], -1, -1);
+      ir_link(f, block, -1, v);
+      b->defs[slot] = v;
+    } else {
+      int phi = ir_new_phi(f, block, slot);
+      b->defs[slot] = phi; /* break cycles before reading operands */
+      v = ir_add_phi_operands(f, phi, block);
+      f->blocks[block].defs[slot] = v;
+    }
+    break;
+  }
+  for (int c = start; c != block; c = f->blocks[c].preds[0])
+    f->blocks[c].defs[slot] = v;
+  return v;
+}
+
+void ir_seal(IrFunc *f, int block) {
+  for (int v = f->blocks[block].head; v >= 0;) {
+    int next = f->insts[v].next;
+    if (f->insts[v].op == IR_PHI && f->insts[v].aux < 0) {
+      int r = ir_add_phi_operands(f, v, block);
+      int slot = f->insts[v].b;
+      if (f->blocks[block].defs[slot] == v)
+        f->blocks[block].defs[slot] = r;
+    }
+    v = next;
+  }
+  f->blocks[block].sealed = true;
+}
+
+/* --- Lowering from the checked token stream --- */
+
+int ir_pos = 0;
+int ir_cur = 0; /* block receiving new instructions */
+int *ir_loop_exits = NULL;
+int ir_loop_depth = 0, ir_loop_cap = 0;
+
+static int ir_convert(int v, char from, char to) {
+  if (from == to || to == TY_INT)
+    return v;
+  return ir_append(ir_f, ir_cur, IR_I2D, TY_DEC, v, -1);
+}
+
+static int ir_lower_expr(int min_prec, char *type);
+
+static int ir_lower_term(char *type) {
+  int tok = ir_pos++;
+  switch (lexed[tok].kind) {
+  case T_VAR:
+    *type = syms[tok_ref[tok]].type;
+    return ir_read_var(ir_f, syms[tok_ref[tok]].slot, ir_cur);
+  case T_NUM:
+    *type = TY_INT;
+    return ir_const_int(ir_f, ir_cur, TY_INT,
+                        strtoll(name_of(lexed[tok].name), NULL, 10));
+  case T_FUNC: {
+    int callee = tok_ref[tok];
+    char at;
+    ir_pos++; /* ( */
+    int arg = ir_lower_expr(1, &at);
+    ir_pos++; /* ) */
+    arg = ir_convert(arg, at, funcs[callee].param_type);
+    int v = ir_append(ir_f, ir_cur, IR_CALL, funcs[callee].ret_type, arg, -1);
+    ir_f->insts[v].aux = callee;
+    *type = funcs[callee].ret_type;
+    return v;
+  }
+  default: { /* ( E ) */
+    int v = ir_lower_expr(1, type);
+    ir_pos++;
+    return v;
+  }
+  }
+}
+
+static int ir_binop(char op) {
+  switch (op) {
+  case '+':
+    return IR_ADD;
+  case '-':
+    return IR_SUB;
+  case '*':
+    return IR_MUL;
+  case '/':
+    return IR_DIV;
+  default:
+    return IR_LT;
+  }
+}
+
+static int ir_lower_expr(int min_prec, char *type) {
+  int lhs = ir_lower_term(type);
+  while (ir_pos < lexed_count && lexed[ir_pos].kind == T_OP) {
+    char op = sema_op(ir_pos);
+    int prec = op_precedence(op);
+    if (prec < min_prec)
+      break;
+    ir_pos++;
+    char rt;
+    int rhs = ir_lower_expr(prec + 1, &rt);
+    char t = (*type == TY_DEC || rt == TY_DEC) ? TY_DEC : TY_INT;
+    lhs = ir_convert(lhs, *type, t);
+    rhs = ir_convert(rhs, rt, t);
+    *type = op == '<' ? TY_INT : t;
+    lhs = ir_append(ir_f, ir_cur, ir_binop(op), *type, lhs, rhs);
+  }
+  return lhs;
+}
+
+static void ir_lower_assign(int s) {
+  char t;
+  int v = ir_lower_expr(1, &t);
+  v = ir_convert(v, t, syms[s].type);
+  ir_f->blocks[ir_cur].defs[syms[s].slot] = v;
+}
+
+/* Code following break or return lands in a fresh block without
+ * predecessors; unreachable-block elimination drops it. */
+static void ir_start_dead_block(void) {
+  ir_cur = ir_new_block(ir_f);
+  ir_seal(ir_f, ir_cur);
+}
+
+static void ir_lower_stmts(void);
+
+static void ir_lower_stmt(void) {
+  int tok = ir_pos;
+  IrFunc *f = ir_f;
+  switch (lexed[tok].kind) {
+  case T_TYPE: /* T V O E S */
+    ir_pos += 3;
+    ir_lower_assign(tok_ref[tok + 1]);
+    ir_pos++;
+    break;
+  case T_VAR: /* V O E S */
+    ir_pos += 2;
+    ir_lower_assign(tok_ref[tok]);
+    ir_pos++;
+    break;
+  case T_RETURN: { /* R E S */
+    char t;
+    ir_pos++;
+    int v = ir_lower_expr(1, &t);
+    v = ir_convert(v, t, f->ret_type);
+    ir_append(f, ir_cur, IR_RET, 0, v, -1);
+    ir_pos++;
+    ir_start_dead_block();
+    break;
+  }
+  case T_PRINTF: { /* P B V B S */
+    Symbol *s = &syms[tok_ref[tok + 2]];
+    int v = ir_read_var(f, s->slot, ir_cur);
+    ir_append(f, ir_cur, IR_PRINT, 0, v, -1);
+    ir_pos += 5;
+    break;
+  }
+  case T_BREAK: /* K S */
+    ir_append(f, ir_cur, IR_JMP, 0, -1, -1);
+    ir_add_edge(f, ir_cur, ir_loop_exits[ir_loop_depth - 1]);
+    ir_pos += 2;
+    ir_start_dead_block();
+    break;
+  case T_LOOP: { /* L W B T V O N S B B C B */
+    Symbol *v = &syms[tok_ref[tok + 4]];
+    f->blocks[ir_cur].defs[v->slot] = ir_const_int(f, ir_cur, v->type, 0);
+    int header = ir_new_block(f);
+    int body = ir_new_block(f);
+    int exit = ir_new_block(f);
+    const char *label = name_of(lexed[tok].name);
+    int llen = (int)strlen(label);
+    char *name = arena_alloc(&f->arena, llen + 1);
+    memcpy(name, label, llen + 1);
+    if (llen > 0 && name[llen - 1] == ':')
+      name[llen - 1] = '\0';
+    f->blocks[header].label = name;
+
+    ir_append(f, ir_cur, IR_JMP, 0, -1, -1);
+    ir_add_edge(f, ir_cur, header);
+
+    ir_cur = header;
+    int iv = ir_read_var(f, v->slot, header);
+    long long n = strtoll(name_of(lexed[tok + 6].name), NULL, 10);
+    int limit = ir_const_int(f, header, v->type, n);
+    int cond = ir_append(f, header, IR_LT, TY_INT, iv, limit);
+    ir_append(f, header, IR_BR, 0, cond, -1);
+    ir_add_edge(f, header, body);
+    ir_add_edge(f, header, exit);
+    ir_seal(f, body);
+
+    ir_loop_exits = grow_array(ir_loop_exits, &ir_loop_cap, ir_loop_depth + 1,
+                               sizeof(int));
+    ir_loop_exits[ir_loop_depth++] = exit;
+    ir_cur = body;
+    ir_pos += 10;
+    ir_lower_stmts();
+    ir_pos++; /* } */
+    ir_loop_depth--;
+
+    ir_append(f, ir_cur, IR_JMP, 0, -1, -1);
+    ir_add_edge(f, ir_cur, header);
+    ir_seal(f, header);
+    ir_seal(f, exit);
+    ir_cur = exit;
+    break;
+  }
+  default:
+    ir_pos++;
+    break;
+  }
+}
+
+static void ir_lower_stmts(void) {
+  while (ir_pos < lexed_count && lexed[ir_pos].kind != T_BRACKET)
+    ir_lower_stmt();
+}
+
+/* Replace every forwarded operand and drop the forwarding nodes */
+static void ir_resolve_forwarding(IrFunc *f) {
+  for (int v = 0; v < f->ninsts; v++) {
+    if (f->insts[v].op == IR_FWD)
+      continue;
+    IR_FOR_OPERANDS(f, v, ir_resolve_operand);
+  }
+  for (int v = 0; v < f->ninsts; v++)
+    if (f->insts[v].op == IR_FWD)
+      f->insts[v].op = IR_NOP;
+}
+
+void ir_lower_function(IrFunc *f, int fi) {
+  FuncInfo *info = &funcs[fi];
+  memset(f, 0, sizeof(*f));
+  f->func = fi;
+  f->name = arena_strdup(&f->arena, name_of(info->name));
+  f->ret_type = info->ret_type;
+  f->param_type = info->param_type;
+  f->nvars = info->nslots;
+  f->var_type = arena_alloc(&f->arena, f->nvars + 1);
+  for (int s = info->first_sym; s < info->end_sym; s++)
+    if (syms[s].kind != SYM_FUNC)
+      f->var_type[syms[s].slot] = syms[s].type;
+
+  ir_f = f;
+  ir_loop_depth = 0;
+  ir_cur = ir_new_block(f);
+  ir_seal(f, ir_cur);
+  if (info->param_sym >= 0)
+    f->blocks[ir_cur].defs[syms[info->param_sym].slot] =
+        ir_append(f, ir_cur, IR_PARAM, info->param_type, -1, -1);
+  ir_pos = info->body_tok + 1;
+  ir_lower_stmts();
+  /* falling off the end returns 0 */
+  int zero = ir_const_int(f, ir_cur, f->ret_type, 0);
+  ir_append(f, ir_cur, IR_RET, 0, zero, -1);
+  ir_resolve_forwarding(f);
+  for (int b = 0; b < f->nblocks; b++)
+    f->blocks[b].defs = NULL; /* construction state lives in the arena */
+  f->nvars = 0;
+  ir_f = NULL;
+}
+
+IrModule *ir_build_module(void) {
+  IrModule *m = calloc(1, sizeof(IrModule));
+  m->nfuncs = func_count;
+  m->funcs = calloc(func_count, sizeof(IrFunc));
+  for (int fi = 0; fi < func_count; fi++) {
+    ir_lower_function(&m->funcs[fi], fi);
+    if (funcs[fi].is_main)
+      m->main_func = fi;
+  }
+  return m;
+}
+
+void ir_free_function(IrFunc *f) {
+  free(f->insts);
+  free(f->blocks);
+  arena_free(&f->arena);
+}
+
+void ir_free_module(IrModule *m) {
+  if (!m)
+    return;
+  for (int i = 0; i < m->nfuncs; i++)
+    ir_free_function(&m->funcs[i]);
+  free(m->funcs);
+  free(m);
+}
+
+/* --- TRACING --- */
+
+/* --trace-out writes a Chrome trace (chrome://tracing, Perfetto) with one
+ * span per phase, per file and per thread. Each thread appends to a buffer
+ * of its own, pushed onto a global list with a compare-and-swap the first
+ * time the thread records anything, so tracing never makes the workers
+ * wait on each other. The buffers are written out at exit. */
+#define TRACE_ARG_LEN 64
+
+typedef struct {
+  const char *name; /* a string literal */
+  char arg[TRACE_ARG_LEN]; /* file or function, copied */
+  double start, end;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+  TraceEvent *events;
+  int count, cap;
+  int tid;
+  char thread_name[32];
+  struct TraceBuffer *next;
+} TraceBuffer;
+
+const char *trace_path = NULL; /* --trace-out; tracing is off when NULL */
+double trace_epoch;
+_Atomic(TraceBuffer *) trace_buffers = NULL;
+atomic_int trace_thread_count;
+static _Thread_local TraceBuffer *trace_buf;
+
+static TraceBuffer *trace_buffer(void) {
+  if (trace_buf)
+    return trace_buf;
+  TraceBuffer *b = calloc(1, sizeof(TraceBuffer));
+  if (!b) {
+    perror("trace");
+    exit(1);
+  }
+  b->tid = atomic_fetch_add(&trace_thread_count, 1) + 1;
+  b->next = atomic_load(&trace_buffers);
+  while (!atomic_compare_exchange_weak(&trace_buffers, &b->next, b))
+    ;
+  return trace_buf = b;
+}
+
+/* Names the calling thread's track, unless it already has a name */
+void trace_name_thread(const char *name, int n) {
+  if (!trace_path)
+    return;
+  TraceBuffer *b = trace_buffer();
+  if (!b->thread_name[0])
+    snprintf(b->thread_name, sizeof(b->thread_name), name, n);
+}
+
+/* The start of a span, or 0 when tracing is off */
+double trace_begin(void) { return trace_path ? now_seconds() : 0; }
+
+/* Records the span from start to now and returns now, which starts the
+ * next span of a sequence. arg may be NULL. */
+double trace_end(const char *name, const char *arg, double start) {
+  if (!trace_path)
+    return 0;
+  TraceBuffer *b = trace_buffer();
+  b->events =
+      grow_array(b->events, &b->cap, b->count + 1, sizeof(TraceEvent));
+  TraceEvent *e = &b->events[b->count++];
+  e->name = name;
+  snprintf(e->arg, sizeof(e->arg), "%s", arg ? arg : "");
+  e->start = start;
+  e->end = now_seconds();
+  return e->end;
+}
+
+static void trace_write_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', out);
+    if ((unsigned char)*s >= ' ')
+      fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+/* Registered with atexit; every other thread has been joined by then */
+void trace_flush(void) {
+  FILE *out = fopen(trace_path, "w");
+  if (!out) {
+    perror(trace_path);
+    return;
+  }
+  fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  const char *sep = "";
+  for (TraceBuffer *b = atomic_load(&trace_buffers); b; b = b->next) {
+    char name[32];
+    snprintf(name, sizeof(name), "thread %d", b->tid);
+    fprintf(out,
+            "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"tid\": %d, \"args\": {\"name\": ",
+            sep, b->tid);
+    trace_write_string(out, b->thread_name[0] ? b->thread_name : name);
+    fprintf(out, "}}");
+    sep = ",\n";
+    for (int i = 0; i < b->count; i++) {
+      TraceEvent *e = &b->events[i];
+      fprintf(out,
+              ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+              "\"ts\": %.3f, \"dur\": %.3f",
+              e->name, b->tid, (e->start - trace_epoch) * 1e6,
+              (e->end - e->start) * 1e6);
+      if (e->arg[0]) {
+        fprintf(out, ", \"args\": {\"on\": ");
+        trace_write_string(out, e->arg);
+        fputc('}', out);
+      }
+      fputc('}', out);
+    }
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+}
+
+/* Turns tracing on for the rest of the process */
+void trace_start(const char *path) {
+  trace_path = path;
+  trace_epoch = now_seconds();
+  trace_name_thread("main", 0);
+  atexit(trace_flush);
+}
+
+/* --- TASK SCHEDULER --- */
+
+/* Functions are optimized and lowered on a thread pool. Work is a graph of
+ * tasks; a task becomes ready once every task it depends on has finished.
+ * Tasks leave their results in per-task slots that the caller merges in a
+ * fixed order, so the output never depends on the thread count. */
+#define TASKS_MIN_PARALLEL 32 /* fewer tasks run on the calling thread */
+
+typedef struct {
+  int ntasks;
+  int *edges; /* (task, dependent) pairs */
+  int nedges, edge_cap;
+  int *waiting;    /* unfinished dependencies per task */
+  int *next_start; /* dependents of t: next[next_start[t]..next_start[t+1]) */
+  int *next;
+  int *ready; /* FIFO of runnable tasks */
+  int ready_head, ready_tail;
+  int unfinished;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  void (*run)(void *ctx, int task);
+  void *ctx;
+} TaskGraph;
+
+void tasks_init(TaskGraph *tg, int ntasks) {
+  memset(tg, 0, sizeof(*tg));
+  tg->ntasks = ntasks;
+}
+
+/* Task `task` may not start before `on` has finished. Tasks must be
+ * numbered so that `on` < `task`. */
+void tasks_depend(TaskGraph *tg, int task, int on) {
+  tg->edges =
+      grow_array(tg->edges, &tg->edge_cap, tg->nedges * 2 + 2, sizeof(int));
+  tg->edges[tg->nedges * 2] = on;
+  tg->edges[tg->nedges * 2 + 1] = task;
+  tg->nedges++;
+}
+
+static void *tasks_worker(void *arg) {
+  TaskGraph *tg = arg;
+  trace_name_thread("compile worker", 0);
+  pthread_mutex_lock(&tg->lock);
+  for (;;) {
+    while (tg->ready_head == tg->ready_tail && tg->unfinished > 0)
+      pthread_cond_wait(&tg->wake, &tg->lock);
+    if (tg->ready_head == tg->ready_tail)
+      break;
+    int t = tg->ready[tg->ready_head++];
+    pthread_mutex_unlock(&tg->lock);
+    tg->run(tg->ctx, t);
+    pthread_mutex_lock(&tg->lock);
+    bool woke = false;
+    for (int i = tg->next_start[t]; i < tg->next_start[t + 1]; i++)
+      if (--tg->waiting[tg->next[i]] == 0) {
+        tg->ready[tg->ready_tail++] = tg->next[i];
+        woke = true;
+      }
+    if (--tg->unfinished == 0 || woke)
+      pthread_cond_broadcast(&tg->wake);
+  }
+  pthread_mutex_unlock(&tg->lock);
+  return NULL;
+}
+
+/* Number of threads for ntasks tasks under --jobs */
+int tasks_threads(int ntasks) {
+  if (ntasks < TASKS_MIN_PARALLEL)
+    return 1;
+  int n = compile_jobs;
+  if (n <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    n = cores > 0 ? (int)cores : 1;
+  }
+  return n < ntasks ? n : ntasks;
+}
+
+/* Run every task on nthreads threads, the calling thread included. With
+ * one thread the tasks run in index order. */
+void tasks_run(TaskGraph *tg, int nthreads, void (*run)(void *, int),
+               void *ctx) {
+  int n = tg->ntasks;
+  if (nthreads <= 1) {
+    for (int t = 0; t < n; t++)
+      run(ctx, t);
+    return;
+  }
+  tg->run = run;
+  tg->ctx = ctx;
+  tg->waiting = calloc(n, sizeof(int));
+  tg->next_start = calloc(n + 1, sizeof(int));
+  tg->next = malloc((tg->nedges + 1) * sizeof(int));
+  tg->ready = malloc(n * sizeof(int));
+  pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+  if (!tg->waiting || !tg->next_start || !tg->next || !tg->ready ||
+      !threads) {
+    perror("tasks");
+    exit(1);
+  }
+  for (int e = 0; e < tg->nedges; e++) {
+    tg->next_start[tg->edges[e * 2] + 1]++;
+    tg->waiting[tg->edges[e * 2 + 1]]++;
+  }
+  for (int t = 0; t < n; t++)
+    tg->next_start[t + 1] += tg->next_start[t];
+  int *fill = tg->ready; /* borrowed as insertion cursors */
+  memcpy(fill, tg->next_start, n * sizeof(int));
+  for (int e = 0; e < tg->nedges; e++)
+    tg->next[fill[tg->edges[e * 2]]++] = tg->edges[e * 2 + 1];
+  for (int t = 0; t < n; t++)
+    if (tg->waiting[t] == 0)
+      tg->ready[tg->ready_tail++] = t;
+  tg->unfinished = n;
+  pthread_mutex_init(&tg->lock, NULL);
+  pthread_cond_init(&tg->wake, NULL);
+  int started = 1;
+  while (started < nthreads &&
+         pthread_create(&threads[started], NULL, tasks_worker, tg) == 0)
+    started++;
+  tasks_worker(tg);
+  for (int k = 1; k < started; k++)
+    pthread_join(threads[k], NULL);
+  pthread_mutex_destroy(&tg->lock);
+  pthread_cond_destroy(&tg->wake);
+  free(threads);
+}
+
+void tasks_free(TaskGraph *tg) {
+  free(tg->edges);
+  free(tg->waiting);
+  free(tg->next_start);
+  free(tg->next);
+  free(tg->ready);
+}
+
+/* --- SSA OPTIMIZATION PASSES --- */
+
+typedef struct {
+  int blocks_removed;  /* unreachable basic blocks */
+  int phis_removed;    /* trivial phis left after block removal */
+  int insts_removed;   /* dead instructions */
+  int consts_folded;   /* values replaced by constants */
+  int branches_folded; /* conditional branches decided at compile time */
+  int chains_folded;   /* operator chains folded */
+  int insts_hoisted;   /* loop-invariant computations hoisted */
+  int muls_reduced;    /* induction multiplications strength-reduced */
+  int calls_inlined;   /* call sites replaced by the callee's body */
+  int values_reused;   /* computations replaced by an equal dominating one */
+} IrStats;
+
+/* Pass results are collected per thread (see ir_optimize_module) */
+_Thread_local IrStats ir_stats;
+
+/* Drop blocks that cannot be reached from the entry (code after break or
+ * return) together with their phi operands, then renumber the survivors.
+ * Returns the number of blocks removed. */
+int ir_remove_unreachable(IrFunc *f) {
+  int n = f->nblocks;
+  int *map = malloc(n * sizeof(int));
+  int *stack = malloc(n * sizeof(int));
+  if (!map || !stack) {
+    perror("ir");
+    exit(1);
+  }
+  for (int b = 0; b < n; b++)
+    map[b] = -1;
+  int sp = 0;
+  map[0] = 0;
+  stack[sp++] = 0;
+  while (sp > 0) {
+    IrBlock *b = &f->blocks[stack[--sp]];
+    for (int i = 0; i < b->nsucc; i++)
+      if (map[b->succ[i]] < 0) {
+        map[b->succ[i]] = 0;
+        stack[sp++] = b->succ[i];
+      }
+  }
+
+  for (int b = 0; b < n; b++) {
+    IrBlock *blk = &f->blocks[b];
+    if (map[b] < 0)
+      continue;
+    for (int v = blk->head; v >= 0; v = f->insts[v].next) {
+      IrInst *in = &f->insts[v];
+      if (in->op != IR_PHI)
+        continue;
+      int k = 0;
+      for (int i = 0; i < in->aux; i++)
+        if (map[blk->preds[i]] >= 0)
+          in->args[k++] = in->args[i];
+      in->aux = k;
+    }
+    int k = 0;
+    for (int i = 0; i < blk->npreds; i++)
+      if (map[blk->preds[i]] >= 0)
+        blk->preds[k++] = blk->preds[i];
+    blk->npreds = k;
+  }
+  for (int v = 0; v < f->ninsts; v++)
+    if (f->insts[v].block >= 0 && map[f->insts[v].block] < 0) {
+      f->insts[v].op = IR_NOP;
+      f->insts[v].block = -1;
+    }
+
+  int nb = 0;
+  for (int b = 0; b < n; b++)
+    if (map[b] >= 0) {
+      map[b] = nb;
+      f->blocks[nb++] = f->blocks[b];
+    }
+  for (int b = 0; b < nb; b++) {
+    IrBlock *blk = &f->blocks[b];
+    for (int i = 0; i < blk->nsucc; i++)
+      blk->succ[i] = map[blk->succ[i]];
+    for (int i = 0; i < blk->npreds; i++)
+      blk->preds[i] = map[blk->preds[i]];
+  }
+  for (int v = 0; v < f->ninsts; v++)
+    if (f->insts[v].block >= 0)
+      f->insts[v].block = map[f->insts[v].block];
+  f->nblocks = nb;
+  free(map);
+  free(stack);
+  return n - nb;
+}
+
+/* Removing predecessors can leave phis that merge a single value; replace
+ * them until none are left. Returns the number removed. */
+int ir_remove_trivial_phis(IrFunc *f) {
+  int removed = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int v = 0; v < f->ninsts; v++) {
+      IrInst *in = &f->insts[v];
+      if (in->op != IR_PHI)
+        continue;
+      int same = -1;
+      bool trivial = true;
+      for (int i = 0; i < in->aux && trivial; i++) {
+        int op = ir_resolve(f, in->args[i]);
+        if (op == same || op == v)
+          continue;
+        if (same >= 0)
+          trivial = false;
+        same = op;
+      }
+      if (!trivial || same < 0)
+        continue;
+      ir_unlink(f, v);
+      in->op = IR_FWD;
+      in->a = same;
+      removed++;
+      changed = true;
+    }
+  }
+  if (removed)
+    ir_resolve_forwarding(f);
+  return removed;
+}
+
+/* Instructions that must stay even when their value is unused. Integer
+ * division by a non-constant (or zero) divisor can raise a runtime error. */
+static bool ir_has_side_effect(const IrFunc *f, int v) {
+  const IrInst *in = &f->insts[v];
+  switch (in->op) {
+  case IR_CALL:
+  case IR_PRINT:
+  case IR_JMP:
+  case IR_BR:
+  case IR_RET:
+    return true;
+  case IR_DIV:
+    return in->type == TY_INT &&
+           (f->insts[in->b].op != IR_CONST || f->insts[in->b].k.i == 0);
+  default:
+    return false;
+  }
+}
+
+/* Mark-and-sweep dead code elimination; dead phi cycles go too. Returns
+ * the number of instructions removed. */
+int ir_dce(IrFunc *f) {
+  bool *live = calloc(f->ninsts, sizeof(bool));
+  int *work = malloc(f->ninsts * sizeof(int));
+  if (!live || !work) {
+    perror("ir");
+    exit(1);
+  }
+  int sp = 0;
+  for (int v = 0; v < f->ninsts; v++)
+    if (f->insts[v].block >= 0 && ir_has_side_effect(f, v)) {
+      live[v] = true;
+      work[sp++] = v;
+    }
+#define IR_MARK(f, p)                                                          \
+  do {                                                                         \
+    if (*(p) >= 0 && !live[*(p)]) {                                            \
+      live[*(p)] = true;                                                       \
+      work[sp++] = *(p);                                                       \
+    }                                                                          \
+  } while (0)
+  while (sp > 0) {
+    int v = work[--sp];
+    IR_FOR_OPERANDS(f, v, IR_MARK);
+  }
+#undef IR_MARK
+  int removed = 0;
+  for (int v = 0; v < f->ninsts; v++)
+    if (f->insts[v].block >= 0 && !live[v]) {
+      ir_unlink(f, v);
+      f->insts[v].op = IR_NOP;
+      removed++;
+    }
+  free(live);
+  free(work);
+  return removed;
+}
+
+/* Evaluate op on constant operands of the given operand type with the VM's
+ * semantics. Returns false when the result must be left to run time
+ * (int division by zero is a runtime error). */
+bool ir_fold(int op, char type, Value a, Value b, Value *out) {
+  if (op == IR_I2D) {
+    out->d = (double)a.i;
+    return true;
+  }
+  if (type == TY_DEC) {
+    switch (op) {
+    case IR_ADD:
+      out->d = a.d + b.d;
+      return true;
+    case IR_SUB:
+      out->d = a.d - b.d;
+      return true;
+    case IR_MUL:
+      out->d = a.d * b.d;
+      return true;
+    case IR_DIV:
+      out->d = a.d / b.d;
+      return true;
+    case IR_LT:
+      out->i = a.d < b.d;
+      return true;
+    }
+    return false;
+  }
+  unsigned long long x = (unsigned long long)a.i, y = (unsigned long long)b.i;
+  switch (op) {
+  case IR_ADD:
+    out->i = (long long)(x + y);
+    return true;
+  case IR_SUB:
+    out->i = (long long)(x - y);
+    return true;
+  case IR_MUL:
+    out->i = (long long)(x * y);
+    return true;
+  case IR_DIV:
+    if (b.i == 0)
+      return false;
+    out->i = b.i == -1 ? (long long)(0ull - x) : a.i / b.i;
+    return true;
+  case IR_LT:
+    out->i = a.i < b.i;
+    return true;
+  }
+  return false;
+}
+
+/* Remove the i-th incoming edge of block along with its phi operands */
+void ir_remove_pred(IrFunc *f, int block, int i) {
+  IrBlock *b = &f->blocks[block];
+  for (int v = b->head; v >= 0; v = f->insts[v].next) {
+    IrInst *in = &f->insts[v];
+    if (in->op != IR_PHI)
+      continue;
+    memmove(&in->args[i], &in->args[i + 1],
+            (in->aux - i - 1) * sizeof(int));
+    in->aux--;
+  }
+  memmove(&b->preds[i], &b->preds[i + 1], (b->npreds - i - 1) * sizeof(int));
+  b->npreds--;
+}
+
+/* Sparse conditional constant propagation (Wegman & Zadeck): values start
+ * unknown and only move down the lattice unknown -> constant -> varying,
+ * and only blocks reached along executable edges are evaluated, so a
+ * constant that decides a branch also keeps the untaken side from
+ * polluting the phis after it. */
+enum { LAT_TOP, LAT_CONST, LAT_BOTTOM };
+
+typedef struct {
+  IrFunc *f;
+  uint8_t *lat;
+  Value *val;
+  bool *block_exec;
+  int *edge_at;     /* block -> first flag in edge_exec (one per pred) */
+  bool *edge_exec;
+  int *user_at;     /* value -> first user in users */
+  int *users;
+  int *ssa_work, nssa;
+  int *flow_work, nflow; /* (block, pred index) pairs */
+} Sccp;
+
+static void sccp_set(Sccp *s, int v, int lat, Value k) {
+  if (lat == LAT_CONST && s->lat[v] == LAT_CONST && s->val[v].i != k.i)
+    lat = LAT_BOTTOM; /* two different constants */
+  if (lat <= s->lat[v])
+    return;
+  s->lat[v] = lat;
+  s->val[v] = k;
+  s->ssa_work[s->nssa++] = v;
+}
+
+static void sccp_edge(Sccp *s, int from, int to) {
+  IrBlock *b = &s->f->blocks[to];
+  for (int i = 0; i < b->npreds; i++)
+    if (b->preds[i] == from && !s->edge_exec[s->edge_at[to] + i]) {
+      s->edge_exec[s->edge_at[to] + i] = true;
+      s->flow_work[s->nflow * 2] = to;
+      s->flow_work[s->nflow * 2 + 1] = i;
+      s->nflow++;
+    }
+}
+
+static void sccp_visit(Sccp *s, int v) {
+  IrFunc *f = s->f;
+  IrInst *in = &f->insts[v];
+  Value k;
+  k.i = 0;
+  switch (in->op) {
+  case IR_CONST:
+    sccp_set(s, v, LAT_CONST, in->k);
+    break;
+  case IR_PARAM:
+  case IR_CALL:
+    sccp_set(s, v, LAT_BOTTOM, k);
+    break;
+  case IR_PHI: {
+    int lat = LAT_TOP;
+    for (int i = 0; i < in->aux && lat != LAT_BOTTOM; i++) {
+      if (!s->edge_exec[s->edge_at[in->block] + i])
+        continue;
+      int a = in->args[i];
+      if (s->lat[a] == LAT_TOP)
+        continue;
+      if (s->lat[a] == LAT_BOTTOM ||
+          (lat == LAT_CONST && s->val[a].i != k.i)) {
+        lat = LAT_BOTTOM;
+      } else {
+        lat = LAT_CONST;
+        k = s->val[a];
+      }
+    }
+    sccp_set(s, v, lat, k);
+    break;
+  }
+  case IR_I2D:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_DIV:
+  case IR_LT: {
+    int la = s->lat[in->a];
+    int lb = in->op == IR_I2D ? LAT_CONST : s->lat[in->b];
+    Value b = in->op == IR_I2D ? k : s->val[in->b];
+    char type = f->insts[in->a].type;
+    if (la == LAT_CONST && lb == LAT_CONST) {
+      if (ir_fold(in->op, type, s->val[in->a], b, &k))
+        sccp_set(s, v, LAT_CONST, k);
+      else
+        sccp_set(s, v, LAT_BOTTOM, k);
+    } else if (in->op == IR_MUL && type == TY_INT &&
+               ((la == LAT_CONST && s->val[in->a].i == 0) ||
+                (lb == LAT_CONST && b.i == 0))) {
+      sccp_set(s, v, LAT_CONST, k); /* int x * 0 */
+    } else if (la == LAT_BOTTOM || lb == LAT_BOTTOM) {
+      sccp_set(s, v, LAT_BOTTOM, k);
+    }
+    break;
+  }
+  case IR_JMP:
+    sccp_edge(s, in->block, f->blocks[in->block].succ[0]);
+    break;
+  case IR_BR: {
+    IrBlock *b = &f->blocks[in->block];
+    int c = s->lat[in->a];
+    if (c == LAT_BOTTOM || (c == LAT_CONST && s->val[in->a].i))
+      sccp_edge(s, in->block, b->succ[0]);
+    if (c == LAT_BOTTOM || (c == LAT_CONST && !s->val[in->a].i))
+      sccp_edge(s, in->block, b->succ[1]);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+/* Returns the number of values replaced by constants; branches decided
+ * at compile time become jumps and are counted in *branches. */
+int ir_sccp(IrFunc *f, int *branches) {
+  Sccp s;
+  memset(&s, 0, sizeof(s));
+  s.f = f;
+  int n = f->ninsts, nb = f->nblocks;
+  s.lat = calloc(n, sizeof(uint8_t));
+  s.val = calloc(n, sizeof(Value));
+  s.block_exec = calloc(nb, sizeof(bool));
+  s.edge_at = malloc((nb + 1) * sizeof(int));
+  s.user_at = calloc(n + 1, sizeof(int));
+  s.ssa_work = malloc((2 * n + 1) * sizeof(int));
+  if (!s.lat || !s.val || !s.block_exec || !s.edge_at || !s.user_at ||
+      !s.ssa_work) {
+    perror("ir");
+    exit(1);
+  }
+  int nedges = 0;
+  for (int b = 0; b < nb; b++) {
+    s.edge_at[b] = nedges;
+    nedges += f->blocks[b].npreds;
+  }
+  s.edge_at[nb] = nedges;
+  s.edge_exec = calloc(nedges + 1, sizeof(bool));
+  s.flow_work = malloc((nedges + 1) * 2 * sizeof(int));
+
+  /* def-use lists in one array */
+#define SCCP_COUNT(f, p) s.user_at[*(p) + 1]++
+  for (int v = 0; v < n; v++)
+    if (f->insts[v].block >= 0)
+      IR_FOR_OPERANDS(f, v, SCCP_COUNT);
+#undef SCCP_COUNT
+  for (int v = 0; v < n; v++)
+    s.user_at[v + 1] += s.user_at[v];
+  s.users = malloc((s.user_at[n] + 1) * sizeof(int));
+  int *fill = malloc((n + 1) * sizeof(int));
+  if (!s.edge_exec || !s.flow_work || !s.users || !fill) {
+    perror("ir");
+    exit(1);
+  }
+  memcpy(fill, s.user_at, n * sizeof(int));
+  int user = 0;
+#define SCCP_FILL(f, p) s.users[fill[*(p)]++] = user
+  for (user = 0; user < n; user++)
+    if (f->insts[user].block >= 0)
+      IR_FOR_OPERANDS(f, user, SCCP_FILL);
+#undef SCCP_FILL
+  free(fill);
+
+  /* each value is queued at most twice (TOP -> CONST -> BOTTOM) */
+  s.block_exec[0] = true;
+  for (int v = f->blocks[0].head; v >= 0; v = f->insts[v].next)
+    sccp_visit(&s, v);
+  while (s.nflow > 0 || s.nssa > 0) {
+    while (s.nflow > 0) {
+      s.nflow--;
+      int b = s.flow_work[s.nflow * 2];
+      if (s.block_exec[b]) {
+        /* another edge into a visited block: only its phis change */
+        for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next)
+          if (f->insts[v].op == IR_PHI)
+            sccp_visit(&s, v);
+        continue;
+      }
+      s.block_exec[b] = true;
+      for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next)
+        sccp_visit(&s, v);
+    }
+    while (s.nssa > 0) {
+      int v = s.ssa_work[--s.nssa];
+      for (int u = s.user_at[v]; u < s.user_at[v + 1]; u++) {
+        int w = s.users[u];
+        if (s.block_exec[f->insts[w].block])
+          sccp_visit(&s, w);
+      }
+    }
+  }
+
+  int folded = 0;
+  *branches = 0;
+  for (int v = 0; v < n; v++) {
+    IrInst *in = &f->insts[v];
+    if (in->block < 0 || !s.block_exec[in->block])
+      continue;
+    if (in->op == IR_BR && s.lat[in->a] == LAT_CONST) {
+      IrBlock *b = &f->blocks[in->block];
+      int taken = s.val[in->a].i ? b->succ[0] : b->succ[1];
+      int other = s.val[in->a].i ? b->succ[1] : b->succ[0];
+      if (other != taken) {
+        IrBlock *ob = &f->blocks[other];
+        for (int i = 0; i < ob->npreds; i++)
+          if (ob->preds[i] == in->block) {
+            ir_remove_pred(f, other, i);
+            break;
+          }
+      }
+      b->succ[0] = taken;
+      b->nsucc = 1;
+      in->op = IR_JMP;
+      in->a = -1;
+      (*branches)++;
+    } else if (in->type && in->op != IR_CONST && in->op != IR_CALL &&
+               s.lat[v] == LAT_CONST) {
+      in->op = IR_CONST;
+      in->k = s.val[v];
+      in->a = in->b = -1;
+      in->aux = 0;
+      in->args = NULL;
+      folded++;
+    }
+  }
+
+  free(s.lat);
+  free(s.val);
+  free(s.block_exec);
+  free(s.edge_at);
+  free(s.edge_exec);
+  free(s.user_at);
+  free(s.users);
+  free(s.ssa_work);
+  free(s.flow_work);
+  return folded;
+}
+
+static bool ir_is_const(const IrFunc *f, int v, long long *k) {
+  if (f->insts[v].op != IR_CONST)
+    return false;
+  *k = f->insts[v].k.i;
+  return true;
+}
+
+/* Fold constants through int operator chains: (x + 1) + 2 becomes x + 3,
+ * (x - 1) + 1 becomes x, (x * 2) * 3 becomes x * 6. Constant left operands
+ * of + and * move to the right first. Wrapping int arithmetic makes this
+ * exact; dec chains are left alone since rounding differs. Returns the
+ * number of instructions rewritten. */
+int ir_fold_chains(IrFunc *f) {
+  int rewritten = 0;
+  long long c1, c2;
+  for (int b = 0; b < f->nblocks; b++)
+    for (int v = f->blocks[b].head; v >= 0;) {
+      IrInst *in = &f->insts[v];
+      int next = in->next;
+      if (in->type != TY_INT ||
+          (in->op != IR_ADD && in->op != IR_SUB && in->op != IR_MUL)) {
+        v = next;
+        continue;
+      }
+      if (in->op != IR_SUB && ir_is_const(f, in->a, &c1) &&
+          !ir_is_const(f, in->b, &c2)) {
+        int t = in->a;
+        in->a = in->b;
+        in->b = t;
+      }
+      IrInst *x = &f->insts[in->a];
+      if (!ir_is_const(f, in->b, &c2) || x->type != TY_INT ||
+          (x->op != IR_ADD && x->op != IR_SUB && x->op != IR_MUL) ||
+          !ir_is_const(f, x->b, &c1)) {
+        v = next;
+        continue;
+      }
+      unsigned long long k;
+      if (in->op != IR_MUL && (x->op == IR_ADD || x->op == IR_SUB)) {
+        k = (x->op == IR_ADD ? (unsigned long long)c1
+                             : 0ull - (unsigned long long)c1) +
+            (in->op == IR_ADD ? (unsigned long long)c2
+                              : 0ull - (unsigned long long)c2);
+        if (k == 0) {
+          ir_unlink(f, v);
+          in->op = IR_FWD;
+          in->a = x->a;
+          rewritten++;
+          v = next;
+          continue;
+        }
+        in->op = IR_ADD;
+      } else if (in->op == IR_MUL && x->op == IR_MUL) {
+        k = (unsigned long long)c1 * (unsigned long long)c2;
+      } else {
+        v = next;
+        continue;
+      }
+      int y = x->a;
+      int c = ir_new_inst(f, IR_CONST, TY_INT, -1, -1);
+      in = &f->insts[v];
+      f->insts[c].k.i = (long long)k;
+      ir_link(f, b, in->prev, c);
+      in->a = y;
+      in->b = c;
+      rewritten++;
+      v = next;
+    }
+  if (rewritten)
+    ir_resolve_forwarding(f);
+  return rewritten;
+}
+
+/* --- LOOP OPTIMIZATIONS --- */
+
+/* Reverse postorder, exploring the false edge first so a loop body follows
+ * its header and the exit comes after the body. Returns the block count. */
+static int ir_layout(const IrFunc *f, int *order) {
+  int n = f->nblocks;
+  bool *seen = calloc(n, sizeof(bool));
+  int *stack = malloc(n * sizeof(int));
+  int *next = malloc(n * sizeof(int)); /* successor index still to visit */
+  if (!seen || !stack || !next) {
+    perror("ir");
+    exit(1);
+  }
+  int sp = 0, count = 0;
+  stack[sp++] = 0;
+  seen[0] = true;
+  next[0] = f->blocks[0].nsucc - 1;
+  while (sp > 0) {
+    int b = stack[sp - 1];
+    if (next[b] >= 0) {
+      int s = f->blocks[b].succ[next[b]--];
+      if (!seen[s]) {
+        seen[s] = true;
+        next[s] = f->blocks[s].nsucc - 1;
+        stack[sp++] = s;
+      }
+      continue;
+    }
+    order[count++] = b;
+    sp--;
+  }
+  for (int i = 0; i < count / 2; i++) {
+    int t = order[i];
+    order[i] = order[count - 1 - i];
+    order[count - 1 - i] = t;
+  }
+  free(seen);
+  free(stack);
+  free(next);
+  return count;
+}
+
+/* Immediate dominators by the iterative algorithm of Cooper, Harvey and
+ * Kennedy. Every block must be reachable. */
+static void ir_dominators(const IrFunc *f, const int *order, int norder,
+                          int *rpo, int *idom) {
+  for (int b = 0; b < f->nblocks; b++)
+    idom[b] = -1;
+  for (int i = 0; i < norder; i++)
+    rpo[order[i]] = i;
+  idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < norder; i++) {
+      int b = order[i], nd = -1;
+      const IrBlock *blk = &f->blocks[b];
+      for (int k = 0; k < blk->npreds; k++) {
+        int p = blk->preds[k];
+        if (idom[p] < 0)
+          continue;
+        if (nd < 0) {
+          nd = p;
+          continue;
+        }
+        int x = p, y = nd;
+        while (x != y) {
+          while (rpo[x] > rpo[y])
+            x = idom[x];
+          while (rpo[y] > rpo[x])
+            y = idom[y];
+        }
+        nd = x;
+      }
+      if (idom[b] != nd) {
+        idom[b] = nd;
+        changed = true;
+      }
+    }
+  }
+}
+
+static bool ir_dominates(const int *idom, int a, int b) {
+  while (b != a && b != 0)
+    b = idom[b];
+  return b == a;
+}
+
+typedef struct {
+  int header;
+  int preheader; /* the one block entering from outside, or -1 */
+  int latch;     /* the one back-edge source, or -1 */
+  bool *body;
+  int size;
+} IrLoop;
+
+/* Per-loop results, reported under the loop's label */
+typedef struct {
+  char *label;
+  char *func;
+  int hoisted; /* invariant computations moved to the preheader */
+  int reduced; /* multiplications replaced by an added step */
+} IrLoopStats;
+
+_Thread_local IrLoopStats *ir_loop_stats = NULL;
+_Thread_local int ir_loop_stats_count = 0, ir_loop_stats_cap = 0;
+
+void ir_reset_loop_stats(void) {
+  for (int i = 0; i < ir_loop_stats_count; i++) {
+    free(ir_loop_stats[i].label);
+    free(ir_loop_stats[i].func);
+  }
+  ir_loop_stats_count = 0;
+}
+
+/* Natural loops: a back edge goes to a block dominating its source. Loops
+ * sharing a header are merged. Returns the loops, innermost first. */
+static IrLoop *ir_find_loops(IrFunc *f, const int *idom, int *nloops) {
+  int nb = f->nblocks;
+  IrLoop *loops = NULL;
+  int n = 0, cap = 0;
+  int *work = malloc(nb * sizeof(int));
+  if (!work) {
+    perror("ir");
+    exit(1);
+  }
+  for (int h = 0; h < nb; h++) {
+    IrBlock *hb = &f->blocks[h];
+    IrLoop *loop = NULL;
+    for (int k = 0; k < hb->npreds; k++) {
+      int l = hb->preds[k];
+      if (!ir_dominates(idom, h, l))
+        continue;
+      if (!loop) {
+        loops = grow_array(loops, &cap, n + 1, sizeof(IrLoop));
+        loop = &loops[n++];
+        loop->header = h;
+        loop->preheader = -1;
+        loop->latch = l;
+        loop->body = calloc(nb, sizeof(bool));
+        loop->body[h] = true;
+        loop->size = 1;
+      } else {
+        loop->latch = -1;
+      }
+      int sp = 0;
+      if (!loop->body[l]) {
+        loop->body[l] = true;
+        loop->size++;
+        work[sp++] = l;
+      }
+      while (sp > 0) {
+        IrBlock *b = &f->blocks[work[--sp]];
+        for (int i = 0; i < b->npreds; i++)
+          if (!loop->body[b->preds[i]]) {
+            loop->body[b->preds[i]] = true;
+            loop->size++;
+            work[sp++] = b->preds[i];
+          }
+      }
+    }
+    if (!loop)
+      continue;
+    for (int k = 0; k < hb->npreds; k++) {
+      int p = hb->preds[k];
+      if (loop->body[p])
+        continue;
+      loop->preheader = loop->preheader == -1 ? p : -2;
+    }
+    if (loop->preheader >= 0 && f->blocks[loop->preheader].nsucc != 1)
+      loop->preheader = -1;
+    if (loop->preheader < 0)
+      loop->preheader = -1;
+  }
+  free(work);
+  /* an inner loop's body is a strict subset of its outer loop's */
+  for (int i = 1; i < n; i++)
+    for (int j = i; j > 0 && loops[j].size < loops[j - 1].size; j--) {
+      IrLoop t = loops[j];
+      loops[j] = loops[j - 1];
+      loops[j - 1] = t;
+    }
+  *nloops = n;
+  return loops;
+}
+
+/* Pure instructions whose operands are all defined outside the loop move
+ * to the end of the preheader. Visiting the body in reverse postorder
+ * hoists whole invariant chains in one sweep. int division stays unless
+ * the divisor is a nonzero constant: the loop might not run at all.
+ * Constants move too (they only cost a register) but are not counted. */
+static int ir_hoist_invariants(IrFunc *f, IrLoop *loop, const int *order,
+                               int norder) {
+  int pre = loop->preheader;
+  int hoisted = 0;
+  for (int i = 0; i < norder; i++) {
+    int b = order[i];
+    if (!loop->body[b])
+      continue;
+    for (int v = f->blocks[b].head; v >= 0;) {
+      IrInst *in = &f->insts[v];
+      int next = in->next;
+      bool pure = in->op == IR_CONST || in->op == IR_I2D ||
+                  (in->op >= IR_ADD && in->op <= IR_LT &&
+                   (in->op != IR_DIV || !ir_has_side_effect(f, v)));
+      bool invariant = pure;
+      if (pure && in->op != IR_CONST) {
+        invariant = !loop->body[f->insts[in->a].block];
+        if (in->op != IR_I2D)
+          invariant = invariant && !loop->body[f->insts[in->b].block];
+      }
+      if (invariant) {
+        ir_unlink(f, v);
+        ir_link(f, pre, f->insts[f->blocks[pre].tail].prev, v);
+        if (in->op != IR_CONST)
+          hoisted++;
+      }
+      v = next;
+    }
+  }
+  return hoisted;
+}
+
+static int ir_new_const(IrFunc *f, int block, int after, long long k) {
+  int c = ir_new_inst(f, IR_CONST, TY_INT, -1, -1);
+  f->insts[c].k.i = k;
+  ir_link(f, block, after, c);
+  return c;
+}
+
+/* Strength reduction of int induction variables. For a header phi i whose
+ * value along the back edge is i + c, every i * k in the loop becomes a new
+ * phi j that starts at init * k and grows by c * k next to i's update.
+ * Wrapping arithmetic keeps j == i * k exact. */
+static int ir_reduce_strength(IrFunc *f, IrLoop *loop, const int *order,
+                              int norder) {
+  int h = loop->header, pre = loop->preheader, latch = loop->latch;
+  if (latch < 0 || f->blocks[h].npreds != 2)
+    return 0;
+  int ip = f->blocks[h].preds[0] == pre ? 0 : 1;
+  int il = 1 - ip;
+  int reduced = 0;
+  for (int i = f->blocks[h].head; i >= 0; i = f->insts[i].next) {
+    if (f->insts[i].op != IR_PHI || f->insts[i].type != TY_INT)
+      continue;
+    int nxt = f->insts[i].args[il];
+    IrInst *u = &f->insts[nxt];
+    if ((u->op != IR_ADD && u->op != IR_SUB) || u->a != i ||
+        f->insts[u->b].op != IR_CONST || !loop->body[u->block])
+      continue;
+    unsigned long long step = (unsigned long long)f->insts[u->b].k.i;
+    if (u->op == IR_SUB)
+      step = 0ull - step;
+    for (int o = 0; o < norder; o++) {
+      int b = order[o];
+      if (!loop->body[b])
+        continue;
+      for (int m = f->blocks[b].head, next_m; m >= 0; m = next_m) {
+        IrInst *mul = &f->insts[m];
+        next_m = mul->next;
+        if (mul->op != IR_MUL || mul->type != TY_INT || mul->a != i ||
+            f->insts[mul->b].op != IR_CONST)
+          continue;
+        unsigned long long k = (unsigned long long)f->insts[mul->b].k.i;
+        int init = f->insts[i].args[ip];
+        int pre_at = f->insts[f->blocks[pre].tail].prev;
+        int start;
+        if (f->insts[init].op == IR_CONST) {
+          start = ir_new_const(
+              f, pre, pre_at,
+              (long long)((unsigned long long)f->insts[init].k.i * k));
+        } else {
+          int kc = ir_new_const(f, pre, pre_at, (long long)k);
+          start = ir_new_inst(f, IR_MUL, TY_INT, init, kc);
+          ir_link(f, pre, kc, start);
+        }
+        int j = ir_new_inst(f, IR_PHI, TY_INT, -1, -1);
+        ir_link(f, h, -1, j);
+        int *args = arena_alloc(&f->arena, 2 * sizeof(int));
+        int sc = ir_new_const(f, f->insts[nxt].block, nxt,
+                              (long long)(step * k));
+        int jn = ir_new_inst(f, IR_ADD, TY_INT, j, sc);
+        ir_link(f, f->insts[nxt].block, sc, jn);
+        args[ip] = start;
+        args[il] = jn;
+        f->insts[j].args = args;
+        f->insts[j].aux = 2;
+        mul = &f->insts[m];
+        ir_unlink(f, m);
+        mul->op = IR_FWD;
+        mul->a = j;
+        reduced++;
+      }
+    }
+  }
+  if (reduced)
+    ir_resolve_forwarding(f);
+  return reduced;
+}
+
+void ir_optimize_loops(IrFunc *f) {
+  int nb = f->nblocks;
+  int *order = malloc(nb * sizeof(int));
+  int *rpo = malloc(nb * sizeof(int));
+  int *idom = malloc(nb * sizeof(int));
+  if (!order || !rpo || !idom) {
+    perror("ir");
+    exit(1);
+  }
+  int norder = ir_layout(f, order);
+  ir_dominators(f, order, norder, rpo, idom);
+  int nloops;
+  IrLoop *loops = ir_find_loops(f, idom, &nloops);
+  for (int i = 0; i < nloops; i++) {
+    IrLoop *loop = &loops[i];
+    const char *label = f->blocks[loop->header].label;
+    char name[32];
+    if (!label) {
+      snprintf(name, sizeof(name), "loop@b%d", loop->header);
+      label = name;
+    }
+    ir_loop_stats = grow_array(ir_loop_stats, &ir_loop_stats_cap,
+                               ir_loop_stats_count + 1, sizeof(IrLoopStats));
+    IrLoopStats *st = &ir_loop_stats[ir_loop_stats_count++];
+    st->label = strdup(label);
+    st->func = strdup(f->name);
+    st->hoisted = st->reduced = 0;
+    if (loop->preheader < 0)
+      continue;
+    st->hoisted = ir_hoist_invariants(f, loop, order, norder);
+    st->reduced = ir_reduce_strength(f, loop, order, norder);
+    ir_stats.insts_hoisted += st->hoisted;
+    ir_stats.muls_reduced += st->reduced;
+  }
+  for (int i = 0; i < nloops; i++)
+    free(loops[i].body);
+  free(loops);
+  free(order);
+  free(rpo);
+  free(idom);
+}
+
+void ir_print_loop_stats(FILE *out) {
+  fprintf(out, "\n=== LOOP OPTIMIZATIONS ===\n");
+  fprintf(out, "%-24s %-20s %8s %8s\n", "Loop", "Function", "Hoisted",
+          "Reduced");
+  for (int i = 0; i < ir_loop_stats_count; i++) {
+    const IrLoopStats *st = &ir_loop_stats[i];
+    fprintf(out, "%-24s %-20s %8d %8d\n", st->label, st->func, st->hoisted,
+            st->reduced);
+  }
+}
+
+/* --- GLOBAL VALUE NUMBERING --- */
+
+/* Pure instructions that compute the same operator over the same operands
+ * are one value. The dominator tree is walked in preorder with a scoped
+ * hash table: a value found in the table was computed in a dominating
+ * block (or earlier in this one) and replaces the new computation. The
+ * table is open-addressed with linear probing; entries are undone in LIFO
+ * order on leaving a subtree, which never breaks a probe chain. */
+typedef struct {
+  const IrFunc *f;
+  int *slots; /* value number, -1 when empty */
+  unsigned mask;
+  int *undo; /* slots filled, innermost last */
+  int nundo;
+} IrValueTable;
+
+static bool ir_gvn_candidate(const IrInst *in) {
+  switch (in->op) {
+  case IR_CONST:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_DIV:
+  case IR_LT:
+  case IR_I2D:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static unsigned ir_gvn_hash(const IrInst *in) {
+  uint64_t h = (uint64_t)in->op * 0x9e3779b97f4a7c15ull ^ (uint64_t)in->type;
+  if (in->op == IR_CONST) {
+    uint64_t bits;
+    memcpy(&bits, &in->k, sizeof(bits));
+    h ^= bits;
+  } else {
+    h ^= (uint64_t)(unsigned)in->a << 32 | (unsigned)in->b;
+  }
+  h *= 0xff51afd7ed558ccdull;
+  return (unsigned)(h ^ h >> 32);
+}
+
+/* The type is part of the key, so an int and a dec constant with the same
+ * value stay apart, and constants compare by bit pattern (0.0 and -0.0
+ * differ). */
+static bool ir_gvn_equal(const IrInst *x, const IrInst *y) {
+  if (x->op != y->op || x->type != y->type)
+    return false;
+  if (x->op == IR_CONST)
+    return memcmp(&x->k, &y->k, sizeof(Value)) == 0;
+  return x->a == y->a && (x->op == IR_I2D || x->b == y->b);
+}
+
+/* Returns the value already computing what v computes, or adds v */
+static int ir_gvn_lookup(IrValueTable *t, int v) {
+  const IrInst *in = &t->f->insts[v];
+  unsigned i = ir_gvn_hash(in) & t->mask;
+  while (t->slots[i] >= 0) {
+    if (ir_gvn_equal(&t->f->insts[t->slots[i]], in))
+      return t->slots[i];
+    i = (i + 1) & t->mask;
+  }
+  t->slots[i] = v;
+  t->undo[t->nundo++] = i;
+  return v;
+}
+
+/* Returns the number of computations replaced by an earlier one */
+int ir_gvn(IrFunc *f) {
+  int nb = f->nblocks;
+  int *order = malloc(nb * sizeof(int));
+  int *rpo = malloc(nb * sizeof(int));
+  int *idom = malloc(nb * sizeof(int));
+  int *child = malloc(nb * sizeof(int)); /* first child in dominator tree */
+  int *sibling = malloc(nb * sizeof(int));
+  int *stack = malloc(nb * sizeof(int));
+  int *mark = malloc(nb * sizeof(int)); /* undo depth on entering a block */
+  IrValueTable t = {f};
+  unsigned cap = 16;
+  while (cap < 2u * (unsigned)f->ninsts)
+    cap *= 2;
+  t.slots = malloc(cap * sizeof(int));
+  t.undo = malloc(f->ninsts * sizeof(int));
+  if (!order || !rpo || !idom || !child || !sibling || !stack || !mark ||
+      !t.slots || !t.undo) {
+    perror("ir");
+    exit(1);
+  }
+  t.mask = cap - 1;
+  for (unsigned i = 0; i < cap; i++)
+    t.slots[i] = -1;
+
+  int norder = ir_layout(f, order);
+  ir_dominators(f, order, norder, rpo, idom);
+  for (int b = 0; b < nb; b++)
+    child[b] = sibling[b] = -1;
+  for (int i = norder - 1; i > 0; i--) {
+    int b = order[i];
+    sibling[b] = child[idom[b]];
+    child[idom[b]] = b;
+  }
+
+  int replaced = 0, sp = 0;
+  stack[sp++] = 0;
+  mark[0] = -1;
+  while (sp > 0) {
+    int b = stack[sp - 1];
+    if (mark[b] >= 0) { /* subtree done */
+      while (t.nundo > mark[b])
+        t.slots[t.undo[--t.nundo]] = -1;
+      mark[b] = -1;
+      sp--;
+      continue;
+    }
+    mark[b] = t.nundo;
+    for (int v = f->blocks[b].head, next; v >= 0; v = next) {
+      IrInst *in = &f->insts[v];
+      next = in->next;
+      if (!ir_gvn_candidate(in))
+        continue;
+      if (in->op != IR_CONST) {
+        in->a = ir_resolve(f, in->a);
+        if (in->op != IR_I2D)
+          in->b = ir_resolve(f, in->b);
+        /* commutative operators get a canonical operand order that keeps
+         * a constant on the right */
+        if (in->op == IR_ADD || in->op == IR_MUL) {
+          bool ka = f->insts[in->a].op == IR_CONST;
+          bool kb = f->insts[in->b].op == IR_CONST;
+          if (ka != kb ? ka : in->a > in->b) {
+            int x = in->a;
+            in->a = in->b;
+            in->b = x;
+          }
+        }
+      }
+      int w = ir_gvn_lookup(&t, v);
+      if (w == v)
+        continue;
+      ir_unlink(f, v);
+      in->op = IR_FWD;
+      in->a = w;
+      replaced++;
+    }
+    for (int c = child[b]; c >= 0; c = sibling[c]) {
+      mark[c] = -1;
+      stack[sp++] = c;
+    }
+  }
+  if (replaced)
+    ir_resolve_forwarding(f);
+  free(order);
+  free(rpo);
+  free(idom);
+  free(child);
+  free(sibling);
+  free(stack);
+  free(mark);
+  free(t.slots);
+  free(t.undo);
+  return replaced;
+}
+
+/* --- INLINING --- */
+
+/* Functions are optimized callees first (see ir_optimize_module), so a call
+ * site sees the size its callee has after folding, and the inlined body
+ * goes through the caller's constant propagation with the actual argument
+ * in place of the parameter. */
+#define IR_INLINE_SIZE 12        /* callee size inlined at every call site */
+#define IR_INLINE_BONUS 8        /* added for a constant argument or a loop */
+#define IR_INLINE_MAX_CALLER 2000 /* caller size where inlining stops */
+
+/* One call site's decision, reported under --opt-report */
+typedef struct {
+  char *caller;
+  char *callee;
+  int size, limit;
+  const char *reason; /* why the call was kept, NULL when inlined */
+} IrInlineDecision;
+
+_Thread_local IrInlineDecision *ir_inline_log = NULL;
+_Thread_local int ir_inline_log_count = 0, ir_inline_log_cap = 0;
+
+void ir_reset_inline_log(void) {
+  for (int i = 0; i < ir_inline_log_count; i++) {
+    free(ir_inline_log[i].caller);
+    free(ir_inline_log[i].callee);
+  }
+  ir_inline_log_count = 0;
+}
+
+/* Instructions that do work at run time */
+static int ir_function_size(const IrFunc *f) {
+  int size = 0;
+  for (int b = 0; b < f->nblocks; b++)
+    for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next)
+      if (f->insts[v].op != IR_CONST && f->insts[v].op != IR_PARAM)
+        size++;
+  return size;
+}
+
+/* A runtime error names the function it happened in, so code that can
+ * raise one stays in its own frame. */
+static bool ir_may_trap(const IrFunc *f) {
+  for (int b = 0; b < f->nblocks; b++)
+    for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next)
+      if (f->insts[v].op == IR_DIV && ir_has_side_effect(f, v))
+        return true;
+  return false;
+}
+
+/* Strongly connected components of the call graph (Tarjan). Components
+ * complete callees first, which is the order functions are optimized in;
+ * a call inside one component is (mutually) recursive. */
+typedef struct {
+  const IrModule *m;
+  int *index, *low, *stack, *comp;
+  bool *on_stack;
+  int sp, counter, ncomp;
+  int *order, norder;
+} IrCallGraph;
+
+static void ir_call_graph_visit(IrCallGraph *g, int fi) {
+  g->index[fi] = g->low[fi] = g->counter++;
+  g->stack[g->sp++] = fi;
+  g->on_stack[fi] = true;
+  const IrFunc *f = &g->m->funcs[fi];
+  for (int b = 0; b < f->nblocks; b++)
+    for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next) {
+      if (f->insts[v].op != IR_CALL)
+        continue;
+      int c = f->insts[v].aux;
+      if (g->index[c] < 0) {
+        ir_call_graph_visit(g, c);
+        if (g->low[c] < g->low[fi])
+          g->low[fi] = g->low[c];
+      } else if (g->on_stack[c] && g->index[c] < g->low[fi]) {
+        g->low[fi] = g->index[c];
+      }
+    }
+  if (g->low[fi] != g->index[fi])
+    return;
+  int w;
+  do {
+    w = g->stack[--g->sp];
+    g->on_stack[w] = false;
+    g->comp[w] = g->ncomp;
+    g->order[g->norder++] = w;
+  } while (w != fi);
+  g->ncomp++;
+}
+
+/* Fills order with every function, callees before callers, and comp with
+ * each function's component. */
+void ir_call_graph(const IrModule *m, int *order, int *comp) {
+  int n = m->nfuncs;
+  IrCallGraph g = {m};
+  g.index = malloc(n * sizeof(int));
+  g.low = malloc(n * sizeof(int));
+  g.stack = malloc(n * sizeof(int));
+  g.on_stack = calloc(n, sizeof(bool));
+  if (!g.index || !g.low || !g.stack || !g.on_stack) {
+    perror("ir");
+    exit(1);
+  }
+  g.comp = comp;
+  g.order = order;
+  for (int i = 0; i < n; i++)
+    g.index[i] = -1;
+  for (int i = 0; i < n; i++)
+    if (g.index[i] < 0)
+      ir_call_graph_visit(&g, i);
+  free(g.index);
+  free(g.low);
+  free(g.stack);
+  free(g.on_stack);
+}
+
+static _Thread_local const int *ir_value_map; /* callee -> caller value */
+
+static void ir_map_operand(IrFunc *f, int *op) {
+  (void)f;
+  *op = ir_value_map[*op];
+}
+
+/* Replace call v in f by a copy of g's body. The call's block is split
+ * after the call; the copied returns jump to the second half, where a phi
+ * merges the results when there is more than one. */
+static void ir_inline_call(IrFunc *f, int v, const IrFunc *g) {
+  int call_block = f->insts[v].block;
+  int arg = f->insts[v].a;
+
+  int cont = ir_new_block(f);
+  IrBlock *cb = &f->blocks[call_block], *nb = &f->blocks[cont];
+  nb->head = f->insts[v].next;
+  nb->tail = nb->head >= 0 ? cb->tail : -1;
+  for (int w = nb->head; w >= 0; w = f->insts[w].next)
+    f->insts[w].block = cont;
+  if (nb->head >= 0)
+    f->insts[nb->head].prev = -1;
+  f->insts[v].next = -1;
+  cb->tail = v;
+  nb->nsucc = cb->nsucc;
+  for (int i = 0; i < cb->nsucc; i++) {
+    nb->succ[i] = cb->succ[i];
+    IrBlock *s = &f->blocks[cb->succ[i]];
+    for (int k = 0; k < s->npreds; k++)
+      if (s->preds[k] == call_block)
+        s->preds[k] = cont;
+  }
+  cb->nsucc = 0;
+
+  int *bmap = malloc(g->nblocks * sizeof(int));
+  int *vmap = malloc(g->ninsts * sizeof(int));
+  int *rets = malloc(g->nblocks * sizeof(int));
+  if (!bmap || !vmap || !rets) {
+    perror("ir");
+    exit(1);
+  }
+  for (int b = 0; b < g->nblocks; b++) {
+    bmap[b] = ir_new_block(f);
+    if (g->blocks[b].label)
+      f->blocks[bmap[b]].label = arena_strdup(&f->arena, g->blocks[b].label);
+  }
+  for (int w = 0; w < g->ninsts; w++)
+    vmap[w] = -1;
+  int nrets = 0;
+  for (int b = 0; b < g->nblocks; b++)
+    for (int w = g->blocks[b].head; w >= 0; w = g->insts[w].next) {
+      const IrInst *in = &g->insts[w];
+      if (in->op == IR_PARAM) {
+        vmap[w] = arg;
+        continue;
+      }
+      if (in->op == IR_RET) {
+        rets[nrets++] = in->a;
+        ir_append(f, bmap[b], IR_JMP, 0, -1, -1);
+        continue;
+      }
+      int nv = ir_new_inst(f, in->op, in->type, in->a, in->b);
+      IrInst *out = &f->insts[nv];
+      out->aux = in->aux;
+      out->k = in->k;
+      if (in->op == IR_PHI) {
+        out->args = arena_alloc(&f->arena, in->aux * sizeof(int));
+        memcpy(out->args, in->args, in->aux * sizeof(int));
+      }
+      ir_link(f, bmap[b], f->blocks[bmap[b]].tail, nv);
+      vmap[w] = nv;
+    }
+  ir_value_map = vmap;
+  for (int b = 0; b < g->nblocks; b++)
+    for (int w = f->blocks[bmap[b]].head; w >= 0; w = f->insts[w].next)
+      if (f->insts[w].op != IR_JMP)
+        IR_FOR_OPERANDS(f, w, ir_map_operand);
+  ir_value_map = NULL;
+
+  /* predecessor order is kept so phi operands still line up */
+  for (int b = 0; b < g->nblocks; b++) {
+    const IrBlock *gb = &g->blocks[b];
+    for (int k = 0; k < gb->npreds; k++)
+      ir_add_pred(f, bmap[b], bmap[gb->preds[k]]);
+    if (gb->tail >= 0 && g->insts[gb->tail].op == IR_RET) {
+      ir_add_edge(f, bmap[b], cont);
+      continue;
+    }
+    f->blocks[bmap[b]].nsucc = gb->nsucc;
+    for (int i = 0; i < gb->nsucc; i++)
+      f->blocks[bmap[b]].succ[i] = bmap[gb->succ[i]];
+  }
+  ir_append(f, call_block, IR_JMP, 0, -1, -1);
+  ir_add_edge(f, call_block, bmap[0]);
+
+  int result;
+  if (nrets == 1) {
+    result = vmap[rets[0]];
+  } else if (nrets == 0) { /* never returns; cont is unreachable */
+    result = ir_const_int(f, cont, g->ret_type, 0);
+  } else {
+    result = ir_new_inst(f, IR_PHI, g->ret_type, -1, -1);
+    ir_link(f, cont, -1, result);
+    int *args = arena_alloc(&f->arena, nrets * sizeof(int));
+    for (int i = 0; i < nrets; i++)
+      args[i] = vmap[rets[i]];
+    f->insts[result].args = args;
+    f->insts[result].aux = nrets;
+  }
+  ir_unlink(f, v);
+  f->insts[v].op = IR_FWD;
+  f->insts[v].a = result;
+  free(bmap);
+  free(vmap);
+  free(rets);
+}
+
+/* Inline the calls f makes into already optimized callees. A callee is
+ * inlined when its size is within IR_INLINE_SIZE, raised by
+ * IR_INLINE_BONUS each for a constant argument and a call inside a loop;
+ * calls within a recursive cycle are never inlined. Every call site's
+ * decision is logged. Returns the number of calls inlined. */
+int ir_inline_calls(IrModule *m, IrFunc *f, const int *comp) {
+  int nb = f->nblocks;
+  int *order = malloc(nb * sizeof(int));
+  int *rpo = malloc(nb * sizeof(int));
+  int *idom = malloc(nb * sizeof(int));
+  bool *in_loop = calloc(nb, sizeof(bool));
+  if (!order || !rpo || !idom || !in_loop) {
+    perror("ir");
+    exit(1);
+  }
+  int norder = ir_layout(f, order);
+  ir_dominators(f, order, norder, rpo, idom);
+  int nloops;
+  IrLoop *loops = ir_find_loops(f, idom, &nloops);
+  for (int i = 0; i < nloops; i++) {
+    for (int b = 0; b < nb; b++)
+      in_loop[b] |= loops[i].body[b];
+    free(loops[i].body);
+  }
+  free(loops);
+
+  /* call sites are collected first: inlined bodies are not revisited.
+   * Inlining splits blocks, so whether a site is in a loop is noted now. */
+  int *sites = NULL, nsites = 0, sites_cap = 0;
+  for (int o = 0; o < norder; o++)
+    for (int v = f->blocks[order[o]].head; v >= 0; v = f->insts[v].next)
+      if (f->insts[v].op == IR_CALL) {
+        sites = grow_array(sites, &sites_cap, nsites * 2 + 2, sizeof(int));
+        sites[nsites * 2] = v;
+        sites[nsites * 2 + 1] = in_loop[order[o]];
+        nsites++;
+      }
+
+  int size = ir_function_size(f), inlined = 0;
+  for (int i = 0; i < nsites; i++) {
+    int v = sites[i * 2];
+    const IrFunc *g = &m->funcs[f->insts[v].aux];
+    int limit = IR_INLINE_SIZE;
+    if (f->insts[f->insts[v].a].op == IR_CONST)
+      limit += IR_INLINE_BONUS;
+    if (sites[i * 2 + 1])
+      limit += IR_INLINE_BONUS;
+    int gsize = ir_function_size(g);
+    const char *reason = NULL;
+    if (comp[g->func] == comp[f->func])
+      reason = "recursive";
+    else if (gsize > limit)
+      reason = "too large";
+    else if (size + gsize > IR_INLINE_MAX_CALLER)
+      reason = "caller too large";
+    else if (ir_may_trap(g))
+      reason = "may divide by zero";
+    else if (g->blocks[0].npreds > 0)
+      reason = "entry is a loop header";
+
+    ir_inline_log = grow_array(ir_inline_log, &ir_inline_log_cap,
+                               ir_inline_log_count + 1,
+                               sizeof(IrInlineDecision));
+    IrInlineDecision *d = &ir_inline_log[ir_inline_log_count++];
+    d->caller = strdup(f->name);
+    d->callee = strdup(g->name);
+    d->size = gsize;
+    d->limit = limit;
+    d->reason = reason;
+    if (reason)
+      continue;
+    ir_inline_call(f, v, g);
+    size += gsize;
+    inlined++;
+  }
+  if (inlined)
+    ir_resolve_forwarding(f);
+  free(sites);
+  free(order);
+  free(rpo);
+  free(idom);
+  free(in_loop);
+  return inlined;
+}
+
+void ir_print_inline_log(FILE *out) {
+  fprintf(out, "\n=== INLINING ===\n");
+  fprintf(out, "%-20s %-20s %6s %6s  %s\n", "Caller", "Callee", "Size",
+          "Limit", "Decision");
+  for (int i = 0; i < ir_inline_log_count; i++) {
+    const IrInlineDecision *d = &ir_inline_log[i];
+    fprintf(out, "%-20s %-20s %6d %6d  %s\n", d->caller, d->callee, d->size,
+            d->limit, d->reason ? d->reason : "inlined");
+  }
+}
+
+void ir_optimize_function(IrFunc *f) {
+  int branches;
+  ir_stats.blocks_removed += ir_remove_unreachable(f);
+  ir_stats.phis_removed += ir_remove_trivial_phis(f);
+  ir_stats.consts_folded += ir_sccp(f, &branches);
+  ir_stats.branches_folded += branches;
+  /* branches decided at compile time leave more unreachable blocks */
+  ir_stats.blocks_removed += ir_remove_unreachable(f);
+  ir_stats.phis_removed += ir_remove_trivial_phis(f);
+  ir_stats.chains_folded += ir_fold_chains(f);
+  ir_stats.values_reused += ir_gvn(f);
+  ir_optimize_loops(f);
+  ir_stats.insts_removed += ir_dce(f);
+}
+
+/* What the passes reported for one function, moved out of the thread that
+ * optimized it */
+typedef struct {
+  IrStats stats;
+  IrInlineDecision *inlined;
+  int ninlined;
+  IrLoopStats *loops;
+  int nloops;
+} IrPassLog;
+
+static void ir_take_log(IrPassLog *log) {
+  log->stats = ir_stats;
+  log->inlined = ir_inline_log;
+  log->ninlined = ir_inline_log_count;
+  log->loops = ir_loop_stats;
+  log->nloops = ir_loop_stats_count;
+  memset(&ir_stats, 0, sizeof(ir_stats));
+  ir_inline_log = NULL;
+  ir_inline_log_count = ir_inline_log_cap = 0;
+  ir_loop_stats = NULL;
+  ir_loop_stats_count = ir_loop_stats_cap = 0;
+}
+
+static void ir_merge_log(IrPassLog *log) {
+  ir_stats.blocks_removed += log->stats.blocks_removed;
+  ir_stats.phis_removed += log->stats.phis_removed;
+  ir_stats.insts_removed += log->stats.insts_removed;
+  ir_stats.consts_folded += log->stats.consts_folded;
+  ir_stats.branches_folded += log->stats.branches_folded;
+  ir_stats.chains_folded += log->stats.chains_folded;
+  ir_stats.insts_hoisted += log->stats.insts_hoisted;
+  ir_stats.muls_reduced += log->stats.muls_reduced;
+  ir_stats.calls_inlined += log->stats.calls_inlined;
+  ir_stats.values_reused += log->stats.values_reused;
+  ir_inline_log =
+      grow_array(ir_inline_log, &ir_inline_log_cap,
+                 ir_inline_log_count + log->ninlined, sizeof(IrInlineDecision));
+  for (int i = 0; i < log->ninlined; i++)
+    ir_inline_log[ir_inline_log_count++] = log->inlined[i];
+  ir_loop_stats =
+      grow_array(ir_loop_stats, &ir_loop_stats_cap,
+                 ir_loop_stats_count + log->nloops, sizeof(IrLoopStats));
+  for (int i = 0; i < log->nloops; i++)
+    ir_loop_stats[ir_loop_stats_count++] = log->loops[i];
+  free(log->inlined);
+  free(log->loops);
+}
+
+typedef struct {
+  IrModule *m;
+  int *order, *comp;
+  int *comp_start; /* component c is order[comp_start[c]..comp_start[c+1]) */
+  IrPassLog *logs; /* per position in order */
+} IrOptimizeJob;
+
+/* One task per call-graph component: its functions in call-graph order */
+static void ir_optimize_component(void *ctx, int c) {
+  IrOptimizeJob *job = ctx;
+  for (int i = job->comp_start[c]; i < job->comp_start[c + 1]; i++) {
+    IrFunc *f = &job->m->funcs[job->order[i]];
+    double span = trace_begin();
+    /* loop discovery for the heuristic needs every block reachable */
+    ir_stats.blocks_removed += ir_remove_unreachable(f);
+    ir_stats.calls_inlined += ir_inline_calls(job->m, f, job->comp);
+    ir_optimize_function(f);
+    ir_take_log(&job->logs[i]);
+    trace_end("optimize", f->name, span);
+  }
+}
+
+/* Callees are inlined and optimized before their callers. Components of
+ * the call graph are independent once their callees are done, so they are
+ * scheduled on a thread pool; the reports are merged in call-graph order. */
+void ir_optimize_module(IrModule *m) {
+  int n = m->nfuncs;
+  IrOptimizeJob job = {m};
+  job.order = malloc(n * sizeof(int));
+  job.comp = malloc(n * sizeof(int));
+  job.comp_start = calloc(n + 1, sizeof(int));
+  job.logs = calloc(n, sizeof(IrPassLog));
+  if (!job.order || !job.comp || !job.comp_start || !job.logs) {
+    perror("ir");
+    exit(1);
+  }
+  ir_call_graph(m, job.order, job.comp);
+  /* components are numbered callees first and contiguous in order */
+  int ncomp = n > 0 ? job.comp[job.order[n - 1]] + 1 : 0;
+  for (int i = 0; i < n; i++)
+    job.comp_start[job.comp[job.order[i]] + 1] = i + 1;
+
+  TaskGraph tg;
+  tasks_init(&tg, ncomp);
+  for (int fi = 0; fi < n; fi++) {
+    const IrFunc *f = &m->funcs[fi];
+    for (int b = 0; b < f->nblocks; b++)
+      for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next)
+        if (f->insts[v].op == IR_CALL &&
+            job.comp[f->insts[v].aux] != job.comp[fi])
+          tasks_depend(&tg, job.comp[fi], job.comp[f->insts[v].aux]);
+  }
+  tasks_run(&tg, tasks_threads(ncomp), ir_optimize_component, &job);
+  tasks_free(&tg);
+  for (int i = 0; i < n; i++)
+    ir_merge_log(&job.logs[i]);
+  free(job.order);
+  free(job.comp);
+  free(job.comp_start);
+  free(job.logs);
+}
+
+void ir_print_function(const IrFunc *f, FILE *out) {
+  if (f->param_type)
+    fprintf(out, "function %s(%s) -> %s\n", f->name, type_name(f->param_type),
+            type_name(f->ret_type));
+  else
+    fprintf(out, "function %s() -> %s\n", f->name, type_name(f->ret_type));
+  for (int b = 0; b < f->nblocks; b++) {
+    const IrBlock *blk = &f->blocks[b];
+    fprintf(out, "  b%d:", b);
+    if (blk->label)
+      fprintf(out, " %s", blk->label);
+    if (blk->npreds > 0) {
+      fprintf(out, "  ; preds");
+      for (int i = 0; i < blk->npreds; i++)
+        fprintf(out, " b%d", blk->preds[i]);
+    }
+    fprintf(out, "\n");
+    for (int v = blk->head; v >= 0; v = f->insts[v].next) {
+      const IrInst *in = &f->insts[v];
+      const char *name = ir_op_names[in->op] + 3;
+      fprintf(out, "    ");
+      if (in->type)
+        fprintf(out, "v%d = ", v);
+      switch (in->op) {
+      case IR_CONST:
+        if (in->type == TY_DEC)
+          fprintf(out, "CONST dec %g", in->k.d);
+        else
+          fprintf(out, "CONST int %lld", in->k.i);
+        break;
+      case IR_PARAM:
+        fprintf(out, "PARAM %s", type_name(in->type));
+        break;
+      case IR_PHI:
+        fprintf(out, "PHI %s", type_name(in->type));
+        for (int i = 0; i < in->aux; i++)
+          fprintf(out, " [v%d, b%d]", in->args[i], blk->preds[i]);
+        break;
+      case IR_CALL:
+        fprintf(out, "CALL %s %s(v%d)", type_name(in->type),
+                name_of(funcs[in->aux].name), in->a);
+        break;
+      case IR_JMP:
+        fprintf(out, "JMP b%d", blk->succ[0]);
+        break;
+      case IR_BR:
+        fprintf(out, "BR v%d ? b%d : b%d", in->a, blk->succ[0], blk->succ[1]);
+        break;
+      case IR_PRINT:
+      case IR_RET:
+        fprintf(out, "%s v%d", name, in->a);
+        break;
+      case IR_I2D:
+        fprintf(out, "I2D v%d", in->a);
+        break;
+      default:
+        fprintf(out, "%s %s v%d, v%d", name,
+                type_name(f->insts[in->a].type), in->a, in->b);
+        break;
+      }
+      fprintf(out, "\n");
+    }
+  }
+}
+
+void ir_print_module(const IrModule *m, FILE *out) {
+  for (int i = 0; i < m->nfuncs; i++)
+    ir_print_function(&m->funcs[i], out);
+  fprintf(out,
+          "; folded %d constants, %d branches, %d operator chains\n",
+          ir_stats.consts_folded, ir_stats.branches_folded,
+          ir_stats.chains_folded);
+  fprintf(out,
+          "; removed %d unreachable blocks, %d trivial phis, %d dead "
+          "instructions\n",
+          ir_stats.blocks_removed, ir_stats.phis_removed,
+          ir_stats.insts_removed);
+  fprintf(out, "; reused %d equal values\n", ir_stats.values_reused);
+  fprintf(out, "; inlined %d calls\n", ir_stats.calls_inlined);
+  for (int i = 0; i < ir_inline_log_count; i++)
+    fprintf(out, "; %s in %s: %s (size %d, limit %d)\n",
+            ir_inline_log[i].callee, ir_inline_log[i].caller,
+            ir_inline_log[i].reason ? ir_inline_log[i].reason : "inlined",
+            ir_inline_log[i].size, ir_inline_log[i].limit);
+  for (int i = 0; i < ir_loop_stats_count; i++)
+    fprintf(out, "; %s in %s: hoisted %d, strength-reduced %d\n",
+            ir_loop_stats[i].label, ir_loop_stats[i].func,
+            ir_loop_stats[i].hoisted, ir_loop_stats[i].reduced);
+}
+
+/* --- SSA TO BYTECODE --- */
+
+/* An edge from a two-way branch into a block with phis gets its own block,
+ * so phi moves always have a place to go. */
+void ir_split_critical_edges(IrFunc *f) {
+  int n = f->nblocks;
+  for (int b = 0; b < n; b++) {
+    if (f->blocks[b].nsucc != 2)
+      continue;
+    for (int i = 0; i < 2; i++) {
+      int s = f->blocks[b].succ[i];
+      int v = f->blocks[s].head;
+      while (v >= 0 && f->insts[v].op != IR_PHI)
+        v = f->insts[v].next;
+      if (v < 0)
+        continue;
+      int e = ir_new_block(f);
+      ir_append(f, e, IR_JMP, 0, -1, -1);
+      f->blocks[e].succ[0] = s;
+      f->blocks[e].nsucc = 1;
+      ir_add_pred(f, e, b);
+      f->blocks[b].succ[i] = e;
+      IrBlock *sb = &f->blocks[s];
+      for (int k = 0; k < sb->npreds; k++)
+        if (sb->preds[k] == b) {
+          sb->preds[k] = e;
+          break;
+        }
+    }
+  }
+}
+
+/* Per-function code generation state */
+typedef struct {
+  IrFunc *f;
+  int *order, norder;
+  int *layout_index; /* block -> position in order */
+  int *pos;          /* instruction -> linear position */
+  int *from, *to;    /* block -> first / last linear position */
+  int *uses;         /* instruction -> number of operand uses */
+  uint8_t *kform;    /* 1: b is a K operand, 2: a is (commutative) */
+  bool *folded;      /* constants living only in K operands */
+  bool *fused;       /* LT evaluated by the branch that follows it */
+  int *range_at;     /* value -> first live range; range_at[n]: total */
+  int *ranges;       /* [start, end) pairs */
+  int *reg;
+  int nregs;
+  int *block_pc;
+  int *fixups; /* pairs: jump word, target block */
+  int nfixups, fixup_cap;
+} IrCodegen;
+
+static bool ir_defines_value(const IrCodegen *g, int v) {
+  const IrInst *in = &g->f->insts[v];
+  return in->block >= 0 && in->type && !g->folded[v] && !g->fused[v];
+}
+
+static bool ir_is_arith(int op) { return op >= IR_ADD && op <= IR_LT; }
+
+/* Pick constant operands and compare-and-branch pairs */
+static void ir_select(IrCodegen *g) {
+  IrFunc *f = g->f;
+  for (int v = 0; v < f->ninsts; v++) {
+    IrInst *in = &f->insts[v];
+    if (in->block < 0)
+      continue;
+#define IR_COUNT(f, p) g->uses[*(p)]++
+    IR_FOR_OPERANDS(f, v, IR_COUNT);
+#undef IR_COUNT
+    if (!fuse_superinstructions || !ir_is_arith(in->op))
+      continue;
+    const IrInst *a = &f->insts[in->a], *b = &f->insts[in->b];
+    if (b->op == IR_CONST &&
+        (in->op != IR_DIV || b->type == TY_DEC ||
+         (b->k.i != 0 && b->k.i != -1)))
+      g->kform[v] = 1;
+    else if (a->op == IR_CONST && (in->op == IR_ADD || in->op == IR_MUL))
+      g->kform[v] = 2;
+  }
+
+  /* a constant needs a register unless every use takes it as K */
+  for (int v = 0; v < f->ninsts; v++)
+    g->folded[v] = f->insts[v].op == IR_CONST && f->insts[v].block >= 0;
+  for (int v = 0; v < f->ninsts; v++) {
+    IrInst *in = &f->insts[v];
+    if (in->block < 0 || in->op == IR_PHI)
+      continue;
+    if (ir_is_arith(in->op)) {
+      if (g->kform[v] != 2)
+        g->folded[in->a] = false;
+      if (g->kform[v] != 1)
+        g->folded[in->b] = false;
+    } else if (in->op == IR_I2D || in->op == IR_CALL ||
+               in->op == IR_PRINT || in->op == IR_BR || in->op == IR_RET) {
+      g->folded[in->a] = false;
+    }
+  }
+
+  if (!fuse_superinstructions)
+    return;
+  for (int b = 0; b < f->nblocks; b++) {
+    int br = f->blocks[b].tail;
+    if (br < 0 || f->insts[br].op != IR_BR)
+      continue;
+    int lt = f->insts[br].a;
+    if (f->insts[lt].op != IR_LT || f->insts[lt].block != b ||
+        g->uses[lt] != 1)
+      continue;
+    int v = f->insts[lt].next;
+    while (v != br && g->folded[v])
+      v = f->insts[v].next;
+    if (v == br)
+      g->fused[lt] = true;
+  }
+}
+
+/* Operands read by instruction v at its position; a fused branch reads
+ * the operands of its comparison instead. */
+static int ir_reads(const IrCodegen *g, int v, int *out) {
+  const IrInst *in = &g->f->insts[v];
+  if (in->op == IR_BR && g->fused[in->a]) {
+    v = in->a;
+    in = &g->f->insts[v];
+  }
+  int n = 0;
+  if (ir_is_arith(in->op)) {
+    if (g->kform[v] != 2)
+      out[n++] = in->a;
+    if (g->kform[v] != 1)
+      out[n++] = in->b;
+  } else if (in->op == IR_I2D || in->op == IR_CALL || in->op == IR_PRINT ||
+             in->op == IR_BR || in->op == IR_RET) {
+    out[n++] = in->a;
+  }
+  return n;
+}
+
+/* live_out(b): live-in of every successor plus the phi operands flowing in
+ * along each edge */
+static void ir_live_out(const IrCodegen *g, int b, const uint64_t *live_in,
+                        uint64_t *out, int words) {
+  const IrFunc *f = g->f;
+  const IrBlock *blk = &f->blocks[b];
+  memset(out, 0, words * sizeof(uint64_t));
+  for (int i = 0; i < blk->nsucc; i++) {
+    int s = blk->succ[i];
+    const uint64_t *in = live_in + (size_t)s * words;
+    for (int w = 0; w < words; w++)
+      out[w] |= in[w];
+    const IrBlock *sb = &f->blocks[s];
+    int j = 0;
+    while (j < sb->npreds && sb->preds[j] != b)
+      j++;
+    for (int v = sb->head; v >= 0; v = f->insts[v].next) {
+      const IrInst *phi = &f->insts[v];
+      if (phi->op != IR_PHI || j >= phi->aux)
+        continue;
+      int a = phi->args[j];
+      if (!g->folded[a])
+        out[a / 64] |= 1ull << (a % 64);
+    }
+  }
+}
+
+/* Backward liveness over the layout, then the live ranges of each value:
+ * at most one half-open range [start, end) per block, in layout order. A
+ * value read by an instruction ends there, so the instruction's result may
+ * reuse its register. Live-out values also cover the phi moves at the end
+ * of the block. */
+static void ir_build_intervals(IrCodegen *g) {
+  IrFunc *f = g->f;
+  int n = f->ninsts;
+  int words = (n + 63) / 64;
+  uint64_t *live_in = calloc((size_t)f->nblocks * words, sizeof(uint64_t));
+  uint64_t *live = malloc(words * sizeof(uint64_t));
+  int *cur_end = malloc(n * sizeof(int));
+  if (!live_in || !live || !cur_end) {
+    perror("ir");
+    exit(1);
+  }
+  int reads[2];
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = g->norder - 1; i >= 0; i--) {
+      int b = g->order[i];
+      ir_live_out(g, b, live_in, live, words);
+      for (int v = f->blocks[b].tail; v >= 0; v = f->insts[v].prev) {
+        if (ir_defines_value(g, v))
+          live[v / 64] &= ~(1ull << (v % 64));
+        if (f->insts[v].op == IR_PHI || g->fused[v])
+          continue;
+        int nr = ir_reads(g, v, reads);
+        for (int k = 0; k < nr; k++)
+          live[reads[k] / 64] |= 1ull << (reads[k] % 64);
+      }
+      uint64_t *in = live_in + (size_t)b * words;
+      if (memcmp(in, live, words * sizeof(uint64_t)) != 0) {
+        memcpy(in, live, words * sizeof(uint64_t));
+        changed = true;
+      }
+    }
+  }
+
+  /* collect (value, start, end) triples, then bucket them by value */
+  int nt = 0, tcap = 0;
+  int *triples = NULL;
+#define IR_RANGE(v, s, e)                                                      \
+  do {                                                                         \
+    triples = grow_array(triples, &tcap, nt * 3 + 3, sizeof(int));             \
+    triples[nt * 3] = (v);                                                     \
+    triples[nt * 3 + 1] = (s);                                                 \
+    triples[nt * 3 + 2] = (e);                                                 \
+    nt++;                                                                      \
+  } while (0)
+  for (int v = 0; v < n; v++)
+    cur_end[v] = -1;
+  for (int i = 0; i < g->norder; i++) {
+    int b = g->order[i];
+    ir_live_out(g, b, live_in, live, words);
+    for (int w = 0; w < words; w++)
+      for (uint64_t m = live[w]; m; m &= m - 1)
+        cur_end[w * 64 + __builtin_ctzll(m)] = g->to[b] + 1;
+    for (int v = f->blocks[b].tail; v >= 0; v = f->insts[v].prev) {
+      if (f->insts[v].op == IR_PHI || g->folded[v] || g->fused[v])
+        continue;
+      if (ir_defines_value(g, v)) {
+        IR_RANGE(v, g->pos[v], cur_end[v] >= 0 ? cur_end[v] : g->pos[v] + 1);
+        cur_end[v] = -1;
+        live[v / 64] &= ~(1ull << (v % 64));
+      }
+      int nr = ir_reads(g, v, reads);
+      for (int k = 0; k < nr; k++)
+        if (cur_end[reads[k]] < 0) {
+          cur_end[reads[k]] = g->pos[v];
+          live[reads[k] / 64] |= 1ull << (reads[k] % 64);
+        }
+    }
+    for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next)
+      if (f->insts[v].op == IR_PHI) {
+        IR_RANGE(v, g->from[b],
+                 cur_end[v] >= 0 ? cur_end[v] : g->from[b] + 1);
+        cur_end[v] = -1;
+        live[v / 64] &= ~(1ull << (v % 64));
+      }
+    for (int w = 0; w < words; w++)
+      for (uint64_t m = live[w]; m; m &= m - 1) {
+        int v = w * 64 + __builtin_ctzll(m);
+        IR_RANGE(v, g->from[b], cur_end[v]);
+        cur_end[v] = -1;
+      }
+  }
+#undef IR_RANGE
+
+  for (int v = 0; v <= n; v++)
+    g->range_at[v] = 0;
+  for (int t = 0; t < nt; t++)
+    g->range_at[triples[t * 3] + 1]++;
+  for (int v = 0; v < n; v++)
+    g->range_at[v + 1] += g->range_at[v];
+  g->ranges = malloc((nt > 0 ? nt : 1) * 2 * sizeof(int));
+  if (!g->ranges) {
+    perror("ir");
+    exit(1);
+  }
+  for (int v = 0; v < n; v++)
+    cur_end[v] = g->range_at[v];
+  for (int t = 0; t < nt; t++) {
+    int k = cur_end[triples[t * 3]]++;
+    g->ranges[k * 2] = triples[t * 3 + 1];
+    g->ranges[k * 2 + 1] = triples[t * 3 + 2];
+  }
+  free(triples);
+  free(cur_end);
+  free(live_in);
+  free(live);
+}
+
+static bool ir_ranges_intersect(const IrCodegen *g, int u, int v) {
+  int i = g->range_at[u], ie = g->range_at[u + 1];
+  int j = g->range_at[v], je = g->range_at[v + 1];
+  while (i < ie && j < je) {
+    const int *a = &g->ranges[i * 2], *b = &g->ranges[j * 2];
+    if (a[0] < b[1] && b[0] < a[1])
+      return true;
+    if (a[1] <= b[1])
+      i++;
+    else
+      j++;
+  }
+  return false;
+}
+
+/* Linear scan over values in order of definition. There is no spilling:
+ * the bytecode has 65536 registers. Each register keeps the values still
+ * assigned to it, so a value can move into another's lifetime hole. A phi
+ * and its operands prefer one register so the moves on loop edges
+ * disappear. */
+static void ir_allocate_registers(IrCodegen *g) {
+  IrFunc *f = g->f;
+  int *hint_phi = malloc(f->ninsts * sizeof(int));
+  int cap = 16;
+  /* per register: values whose last range has not ended yet */
+  int **owners = calloc(cap, sizeof(int *));
+  int *nowners = calloc(cap, sizeof(int));
+  int *owner_cap = calloc(cap, sizeof(int));
+  if (!hint_phi || !owners || !nowners || !owner_cap) {
+    perror("ir");
+    exit(1);
+  }
+  for (int v = 0; v < f->ninsts; v++) {
+    hint_phi[v] = -1;
+    g->reg[v] = -1;
+  }
+  for (int v = 0; v < f->ninsts; v++)
+    if (f->insts[v].op == IR_PHI)
+      for (int i = 0; i < f->insts[v].aux; i++)
+        hint_phi[f->insts[v].args[i]] = v;
+
+  /* register 0 receives the argument */
+  g->nregs = 0;
+  if (f->param_type) {
+    g->nregs = 1;
+    for (int v = f->blocks[0].head; v >= 0; v = f->insts[v].next)
+      if (f->insts[v].op == IR_PARAM && ir_defines_value(g, v)) {
+        g->reg[v] = 0;
+        owners[0] = grow_array(owners[0], &owner_cap[0], 1, sizeof(int));
+        owners[0][nowners[0]++] = v;
+      }
+  }
+  /* layout order with phis first is sorted by start */
+  for (int i = 0; i < g->norder; i++) {
+    int b = g->order[i];
+    for (int pass = 0; pass < 2; pass++)
+      for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next) {
+        IrInst *in = &f->insts[v];
+        if ((in->op == IR_PHI) != (pass == 0) || !ir_defines_value(g, v) ||
+            g->reg[v] >= 0)
+          continue;
+        int start = g->ranges[g->range_at[v] * 2];
+        for (int r = 0; r < g->nregs; r++) {
+          int k = 0;
+          for (int o = 0; o < nowners[r]; o++) {
+            int u = owners[r][o];
+            if (g->ranges[g->range_at[u + 1] * 2 - 1] > start)
+              owners[r][k++] = u;
+          }
+          nowners[r] = k;
+        }
+        int hint = -1;
+        if (in->op == IR_PHI) {
+          for (int k = 0; k < in->aux && hint < 0; k++)
+            hint = g->reg[in->args[k]];
+        } else if (hint_phi[v] >= 0) {
+          hint = g->reg[hint_phi[v]];
+        }
+        int r = -1;
+        for (int c = -1; c < g->nregs && r < 0; c++) {
+          int cand = c < 0 ? hint : c;
+          if (cand < 0)
+            continue;
+          bool ok = true;
+          for (int o = 0; o < nowners[cand] && ok; o++)
+            ok = !ir_ranges_intersect(g, owners[cand][o], v);
+          if (ok)
+            r = cand;
+        }
+        if (r < 0) {
+          if (g->nregs == cap) {
+            owners = realloc(owners, cap * 2 * sizeof(int *));
+            nowners = realloc(nowners, cap * 2 * sizeof(int));
+            owner_cap = realloc(owner_cap, cap * 2 * sizeof(int));
+            if (!owners || !nowners || !owner_cap) {
+              perror("ir");
+              exit(1);
+            }
+            for (int k = cap; k < cap * 2; k++) {
+              owners[k] = NULL;
+              nowners[k] = owner_cap[k] = 0;
+            }
+            cap *= 2;
+          }
+          r = g->nregs++;
+        }
+        g->reg[v] = r;
+        owners[r] = grow_array(owners[r], &owner_cap[r], nowners[r] + 1,
+                               sizeof(int));
+        owners[r][nowners[r]++] = v;
+      }
+  }
+  for (int r = 0; r < cap; r++)
+    free(owners[r]);
+  free(owners);
+  free(nowners);
+  free(owner_cap);
+  free(hint_phi);
+}
+
+static void ir_emit_jump(IrCodegen *g, int op, int a, int target) {
+  int at = bc_emit(op, a, 0, 0);
+  g->fixups = grow_array(g->fixups, &g->fixup_cap, g->nfixups * 2 + 2,
+                         sizeof(int));
+  g->fixups[g->nfixups * 2] = at;
+  g->fixups[g->nfixups * 2 + 1] = target;
+  g->nfixups++;
+}
+
+/* Phi moves on the edge b -> s as one parallel copy: emit a move once no
+ * other pending move still reads its destination; break cycles through a
+ * scratch register. */
+static void ir_emit_phi_moves(IrCodegen *g, int b, int s) {
+  IrFunc *f = g->f;
+  const IrBlock *sb = &f->blocks[s];
+  int j = 0;
+  while (j < sb->npreds && sb->preds[j] != b)
+    j++;
+  int n = 0, cap = 0;
+  int *moves = NULL; /* triples: dst, src register (-1: constant), value */
+  for (int v = sb->head; v >= 0; v = f->insts[v].next) {
+    const IrInst *phi = &f->insts[v];
+    if (phi->op != IR_PHI || g->reg[v] < 0)
+      continue;
+    int a = phi->args[j];
+    int src = g->folded[a] ? -1 : g->reg[a];
+    if (src == g->reg[v])
+      continue;
+    moves = grow_array(moves, &cap, (n + 1) * 3, sizeof(int));
+    moves[n * 3] = g->reg[v];
+    moves[n * 3 + 1] = src;
+    moves[n * 3 + 2] = a;
+    n++;
+  }
+  int scratch = -1;
+  while (n > 0) {
+    int ready = -1;
+    for (int i = 0; i < n && ready < 0; i++) {
+      ready = i;
+      for (int k = 0; k < n; k++)
+        if (k != i && moves[k * 3 + 1] == moves[i * 3]) {
+          ready = -1;
+          break;
+        }
+    }
+    if (ready < 0) {
+      /* every destination is still read: park one in the scratch */
+      if (scratch < 0)
+        scratch = g->nregs++;
+      int d = moves[0];
+      bc_emit(OP_MOV, scratch, d, 0);
+      for (int k = 0; k < n; k++)
+        if (moves[k * 3 + 1] == d)
+          moves[k * 3 + 1] = scratch;
+      continue;
+    }
+    int *m = &moves[ready * 3];
+    if (m[1] < 0)
+      bc_emit(OP_LOADK, m[0], bc_const(f->insts[m[2]].k), 0);
+    else
+      bc_emit(OP_MOV, m[0], m[1], 0);
+    memcpy(m, &moves[(n - 1) * 3], 3 * sizeof(int));
+    n--;
+  }
+  free(moves);
+}
+
+static void ir_emit_function(IrCodegen *g) {
+  IrFunc *f = g->f;
+  int *R = g->reg;
+  for (int i = 0; i < g->norder; i++) {
+    int b = g->order[i];
+    int next = i + 1 < g->norder ? g->order[i + 1] : -1;
+    const IrBlock *blk = &f->blocks[b];
+    g->block_pc[b] = bc->ncode;
+    for (int v = blk->head; v >= 0; v = f->insts[v].next) {
+      const IrInst *in = &f->insts[v];
+      if (in->op == IR_PHI || g->folded[v] || g->fused[v])
+        continue;
+      switch (in->op) {
+      case IR_CONST:
+        bc_emit(OP_LOADK, R[v], bc_const(in->k), 0);
+        break;
+      case IR_PARAM:
+        break;
+      case IR_ADD:
+      case IR_SUB:
+      case IR_MUL:
+      case IR_DIV:
+      case IR_LT: {
+        bool dec = f->insts[in->a].type == TY_DEC;
+        int off = in->op - IR_ADD;
+        if (g->kform[v] == 1)
+          bc_emit((dec ? OP_ADDDK : OP_ADDIK) + off, R[v], R[in->a],
+                  bc_const(f->insts[in->b].k));
+        else if (g->kform[v] == 2)
+          bc_emit((dec ? OP_ADDDK : OP_ADDIK) + off, R[v], R[in->b],
+                  bc_const(f->insts[in->a].k));
+        else
+          bc_emit((dec ? OP_ADDD : OP_ADDI) + off, R[v], R[in->a], R[in->b]);
+        break;
+      }
+      case IR_I2D:
+        bc_emit(OP_I2D, R[v], R[in->a], 0);
+        break;
+      case IR_CALL:
+        bc_emit_call(R[v], in->aux, R[in->a]);
+        break;
+      case IR_PRINT:
+        bc_emit(f->insts[in->a].type == TY_DEC ? OP_PRINTD : OP_PRINTI,
+                R[in->a], 0, 0);
+        break;
+      case IR_RET:
+        bc_emit(OP_RET, R[in->a], 0, 0);
+        break;
+      case IR_JMP:
+        ir_emit_phi_moves(g, b, blk->succ[0]);
+        if (blk->succ[0] != next)
+          ir_emit_jump(g, OP_JMP, 0, blk->succ[0]);
+        break;
+      case IR_BR:
+        if (g->fused[in->a]) {
+          const IrInst *lt = &f->insts[in->a];
+          bool dec = f->insts[lt->a].type == TY_DEC;
+          if (g->kform[in->a] == 1)
+            bc_emit(dec ? OP_JNLTDK : OP_JNLTIK, R[lt->a],
+                    bc_const(f->insts[lt->b].k), 0);
+          else
+            bc_emit(dec ? OP_JNLTD : OP_JNLTI, R[lt->a], R[lt->b], 0);
+          ir_emit_jump(g, OP_JMP, 0, blk->succ[1]);
+        } else {
+          ir_emit_jump(g, OP_JMPF, R[in->a], blk->succ[1]);
+        }
+        if (blk->succ[0] != next)
+          ir_emit_jump(g, OP_JMP, 0, blk->succ[0]);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  for (int i = 0; i < g->nfixups; i++)
+    bc_patch(g->fixups[i * 2], g->block_pc[g->fixups[i * 2 + 1]]);
+}
+
+/* Layout, operand selection and live ranges of f, shared by the bytecode
+ * and native back ends */
+static void ir_codegen_prepare(IrCodegen *g, IrFunc *f) {
+  ir_split_critical_edges(f);
+  memset(g, 0, sizeof(*g));
+  g->f = f;
+  int n = f->ninsts, nb = f->nblocks;
+  g->order = malloc(nb * sizeof(int));
+  g->from = malloc(nb * sizeof(int));
+  g->to = malloc(nb * sizeof(int));
+  g->block_pc = malloc(nb * sizeof(int));
+  g->pos = calloc(n, sizeof(int));
+  g->uses = calloc(n, sizeof(int));
+  g->kform = calloc(n, sizeof(uint8_t));
+  g->folded = calloc(n, sizeof(bool));
+  g->fused = calloc(n, sizeof(bool));
+  g->range_at = malloc((n + 1) * sizeof(int));
+  g->reg = malloc(n * sizeof(int));
+  if (!g->order || !g->from || !g->to || !g->block_pc || !g->pos ||
+      !g->uses || !g->kform || !g->folded || !g->fused || !g->range_at ||
+      !g->reg) {
+    perror("ir");
+    exit(1);
+  }
+
+  g->norder = ir_layout(f, g->order);
+  int p = 0;
+  for (int i = 0; i < g->norder; i++) {
+    int b = g->order[i];
+    g->from[b] = p;
+    p += 2;
+    for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next) {
+      g->pos[v] = p;
+      p += 2;
+    }
+    g->to[b] = p;
+    p += 2;
+  }
+  ir_select(g);
+  ir_build_intervals(g);
+}
+
+static void ir_codegen_release(IrCodegen *g) {
+  free(g->order);
+  free(g->from);
+  free(g->to);
+  free(g->block_pc);
+  free(g->pos);
+  free(g->uses);
+  free(g->kform);
+  free(g->folded);
+  free(g->fused);
+  free(g->range_at);
+  free(g->ranges);
+  free(g->reg);
+  free(g->fixups);
+}
+
+static void ir_codegen_function(IrFunc *f, BcFunc *bf) {
+  IrCodegen g;
+  ir_codegen_prepare(&g, f);
+  ir_allocate_registers(&g);
+
+  bf->entry = bc->ncode;
+  ir_emit_function(&g);
+  for (int i = 0; i < g.norder; i++)
+    if (f->blocks[g.order[i]].label)
+      bc_add_loop(g.block_pc[g.order[i]], f->blocks[g.order[i]].label);
+  if (g.nregs > 0xffff) {
+    fprintf(stderr, "bytecode: function needs too many registers\n");
+    exit(1);
+  }
+  bf->nregs = g.nregs > 0 ? g.nregs : 1;
+  bf->nlocals = bf->nregs; /* no single-use temporaries for bc_fuse */
+  ir_codegen_release(&g);
+}
+
+typedef struct {
+  IrModule *m;
+  BcProgram *prog;
+  BcProgram *parts; /* each function's code, constants and loops */
+} IrCodegenJob;
+
+/* Each function is lowered into a program of its own, starting at pc 0 */
+static void ir_codegen_task(void *ctx, int i) {
+  IrCodegenJob *job = ctx;
+  double span = trace_begin();
+  bc = &job->parts[i];
+  ir_codegen_function(&job->m->funcs[i], &job->prog->funcs[i]);
+  bc = NULL;
+  trace_end("codegen", job->m->funcs[i].name, span);
+}
+
+/* Append a function compiled on its own to bc, moving jump targets and
+ * loop heads past the code already there and renumbering its constants
+ * into the shared pool. Constants are added in the function's own order,
+ * so the pool comes out as if everything had been emitted in one go. */
+static void ir_link_part(BcProgram *part, BcFunc *bf) {
+  int base = bc->ncode;
+  int *kmap = malloc((part->nconsts + 1) * sizeof(int));
+  if (!kmap) {
+    perror("bytecode");
+    exit(1);
+  }
+  for (int k = 0; k < part->nconsts; k++)
+    kmap[k] = bc_const(part->consts[k]);
+  for (int pc = 0; pc < part->ncode; pc++)
+    bc_emit(part->code[pc].op, part->code[pc].a, part->code[pc].b,
+            part->code[pc].c);
+  for (int pc = base; pc < bc->ncode; pc += bc_width(&bc->code[pc])) {
+    Instr *in = &bc->code[pc];
+    if (in->op == OP_LOADK || in->op == OP_JNLTIK || in->op == OP_JNLTDK)
+      in->b = (uint16_t)kmap[in->b];
+    else if (in->op >= OP_ADDIK && in->op <= OP_LTDK)
+      in->c = (uint16_t)kmap[in->c];
+    const Instr *j = bc_jump_word(in);
+    if (j)
+      bc_patch((int)(j - bc->code), base + JMP_TARGET(j));
+  }
+  for (int l = 0; l < part->nloops; l++) {
+    bc->loops = grow_array(bc->loops, &bc->loop_cap, bc->nloops + 1,
+                           sizeof(BcLoop));
+    bc->loops[bc->nloops].head = base + part->loops[l].head;
+    bc->loops[bc->nloops++].label = part->loops[l].label;
+  }
+  bf->entry = base;
+  free(kmap);
+  free(part->code);
+  free(part->consts);
+  free(part->const_slots);
+  free(part->loops);
+}
+
+/* Lower an optimized module to bytecode. Function indices are preserved.
+ * Functions are compiled in parallel and linked in index order, so the
+ * program is the same for any number of threads. */
+BcProgram *ir_codegen(IrModule *m) {
+  IrCodegenJob job = {m};
+  job.prog = calloc(1, sizeof(BcProgram));
+  job.prog->funcs = calloc(m->nfuncs, sizeof(BcFunc));
+  job.parts = calloc(m->nfuncs, sizeof(BcProgram));
+  if (!job.prog || !job.prog->funcs || !job.parts) {
+    perror("bytecode");
+    exit(1);
+  }
+  job.prog->nfuncs = m->nfuncs;
+  job.prog->main_func = m->main_func;
+  for (int i = 0; i < m->nfuncs; i++) {
+    BcFunc *bf = &job.prog->funcs[i];
+    bf->name = strdup(m->funcs[i].name);
+    bf->ret_type = m->funcs[i].ret_type;
+    bf->param_type = m->funcs[i].param_type;
+  }
+  TaskGraph tg;
+  tasks_init(&tg, m->nfuncs);
+  tasks_run(&tg, tasks_threads(m->nfuncs), ir_codegen_task, &job);
+  tasks_free(&tg);
+  bc = job.prog;
+  for (int i = 0; i < m->nfuncs; i++)
+    ir_link_part(&job.parts[i], &job.prog->funcs[i]);
+  bc = NULL;
+  free(job.parts);
+  return job.prog;
+}
+
+/* --- X86-64 BACKEND --- */
+
+/* Ahead-of-time compilation of the optimized IR to x86-64 System V
+ * assembly (GAS syntax) for the stock cc. Layout, constant operands,
+ * compare-and-branch pairs and live ranges come from the bytecode code
+ * generator; registers are assigned by a separate linear scan with two
+ * classes (general-purpose for int, SSE2 for dec) and spilling. printf
+ * goes through libc, and runtime errors print the same message as the VM
+ * and exit with status 1. */
+
+#define X86_NGPR 8   /* allocatable general-purpose registers */
+#define X86_NSAVED 5 /* the first X86_NSAVED of them survive calls */
+#define X86_NXMM 14
+#define X86_STACK_LIMIT (4 << 20) /* bytes of native stack before overflow */
+
+/* rax, rcx, rdx, rdi, rsi and xmm0-1 stay free for instruction sequences,
+ * argument passing and idiv. */
+static const char *x86_gpr[X86_NGPR] = {"%rbx", "%r12", "%r13", "%r14",
+                                        "%r15", "%r8",  "%r9",  "%r10"};
+static const char *x86_xmm[X86_NXMM] = {
+    "%xmm2",  "%xmm3",  "%xmm4",  "%xmm5",  "%xmm6",  "%xmm7",  "%xmm8",
+    "%xmm9",  "%xmm10", "%xmm11", "%xmm12", "%xmm13", "%xmm14", "%xmm15"};
+
+/* Parallel-copy locations: registers of both classes, stack slots, and the
+ * registers that park a value while a cycle of phi moves is broken */
+#define X86_XMM_ID 100
+#define X86_PARK_GPR 200
+#define X86_PARK_XMM 201
+#define X86_CONST_SRC INT_MIN
+
+typedef struct {
+  IrCodegen g;
+  const IrModule *m;
+  FILE *out;
+  int fi;    /* function index, used in labels */
+  int *loc;  /* value -> register index in its class, or -1 - stack slot */
+  int nslots;
+  int nsaved; /* callee-saved registers pushed by the prologue */
+  int *kpool; /* dec constants used as memory operands */
+  int nk, kcap;
+  bool div_check, overflow_check;
+} X86Codegen;
+
+static bool x86_is_dec(const X86Codegen *x, int v) {
+  return x->g.f->insts[v].type == TY_DEC;
+}
+
+static bool x86_fits_imm32(long long k) { return k >= INT_MIN && k <= INT_MAX; }
+
+static const char *x86_slot(const X86Codegen *x, int slot) {
+  static _Thread_local char buf[4][24];
+  static _Thread_local int turn;
+  char *s = buf[turn++ & 3];
+  snprintf(s, sizeof(buf[0]), "-%d(%%rbp)", 8 * (x->nsaved + slot + 1));
+  return s;
+}
+
+/* The rip-relative label of dec constant v, added to the pool */
+static const char *x86_const_label(X86Codegen *x, int v) {
+  static _Thread_local char buf[4][40];
+  static _Thread_local int turn;
+  int i = 0;
+  while (i < x->nk && x->kpool[i] != v)
+    i++;
+  if (i == x->nk) {
+    x->kpool = grow_array(x->kpool, &x->kcap, x->nk + 1, sizeof(int));
+    x->kpool[x->nk++] = v;
+  }
+  char *s = buf[turn++ & 3];
+  snprintf(s, sizeof(buf[0]), ".LK%d_%d(%%rip)", x->fi, v);
+  return s;
+}
+
+/* Operand text for value v: its register or slot, or an immediate or
+ * pooled constant when v is a constant. An int constant too wide for an
+ * immediate is loaded into `wide` first. */
+static const char *x86_src(X86Codegen *x, int v, const char *wide) {
+  const IrInst *in = &x->g.f->insts[v];
+  if (in->op == IR_CONST) {
+    if (in->type == TY_DEC)
+      return x86_const_label(x, v);
+    static _Thread_local char buf[4][32];
+    static _Thread_local int turn;
+    char *s = buf[turn++ & 3];
+    if (x86_fits_imm32(in->k.i)) {
+      snprintf(s, sizeof(buf[0]), "$%lld", in->k.i);
+      return s;
+    }
+    fprintf(x->out, "\tmovabsq\t$%lld, %s\n", in->k.i, wide);
+    return wide;
+  }
+  int l = x->loc[v];
+  if (l < 0)
+    return x86_slot(x, -1 - l);
+  return x86_is_dec(x, v) ? x86_xmm[l] : x86_gpr[l];
+}
+
+static bool x86_in_reg(const X86Codegen *x, int v) {
+  return x->g.f->insts[v].op != IR_CONST && x->loc[v] >= 0;
+}
+
+static bool x86_same_loc(const X86Codegen *x, int u, int v) {
+  return x->g.f->insts[u].op != IR_CONST && x->g.f->insts[v].op != IR_CONST &&
+         x->loc[u] == x->loc[v] && x86_is_dec(x, u) == x86_is_dec(x, v);
+}
+
+/* movq / movsd that skips self-moves and routes memory-to-memory copies
+ * through the class's first scratch register */
+static void x86_move(X86Codegen *x, bool dec, const char *dst, const char *src) {
+  if (strcmp(dst, src) == 0)
+    return;
+  bool dmem = dst[0] != '%', smem = src[0] != '%' && src[0] != '$';
+  if (dmem && smem) {
+    const char *t = dec ? "%xmm0" : "%rax";
+    fprintf(x->out, "\t%s\t%s, %s\n", dec ? "movsd" : "movq", src, t);
+    src = t;
+  }
+  if (dec && !dmem && src[0] == '%')
+    fprintf(x->out, "\tmovapd\t%s, %s\n", src, dst);
+  else
+    fprintf(x->out, "\t%s\t%s, %s\n", dec ? "movsd" : "movq", src, dst);
+}
+
+/* Whether one of v's live ranges spans a call position strictly inside it,
+ * so v must survive a call (calls and printf clobber every caller-saved
+ * register) */
+static bool x86_crosses_call(const IrCodegen *g, int v, const int *calls,
+                             int ncalls) {
+  for (int i = g->range_at[v]; i < g->range_at[v + 1]; i++) {
+    int s = g->ranges[i * 2], e = g->ranges[i * 2 + 1];
+    int lo = 0, hi = ncalls;
+    while (lo < hi) { /* first call after s */
+      int mid = (lo + hi) / 2;
+      if (calls[mid] <= s)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < ncalls && calls[lo] < e)
+      return true;
+  }
+  return false;
+}
+
+static int x86_value_end(const IrCodegen *g, int v) {
+  return g->ranges[g->range_at[v + 1] * 2 - 1];
+}
+
+/* Linear scan over values in order of definition, like
+ * ir_allocate_registers but with a fixed register file per class. A value
+ * live across a call may only use a callee-saved register; dec values have
+ * none and go to the stack. When no register is free, the conflicting
+ * values of the register that stays busy longest are spilled instead if
+ * they outlive the new value. */
+static void x86_allocate(X86Codegen *x) {
+  IrCodegen *g = &x->g;
+  IrFunc *f = g->f;
+  int n = f->ninsts;
+  int *hint_phi = malloc(n * sizeof(int));
+  int *calls = malloc(n * sizeof(int));
+  int *owners[X86_NGPR + X86_NXMM], nowners[X86_NGPR + X86_NXMM];
+  int owner_cap[X86_NGPR + X86_NXMM];
+  if (!hint_phi || !calls) {
+    perror("x86");
+    exit(1);
+  }
+  memset(owners, 0, sizeof(owners));
+  memset(nowners, 0, sizeof(nowners));
+  memset(owner_cap, 0, sizeof(owner_cap));
+  int ncalls = 0;
+  for (int i = 0; i < g->norder; i++)
+    for (int v = f->blocks[g->order[i]].head; v >= 0; v = f->insts[v].next)
+      if (f->insts[v].op == IR_CALL || f->insts[v].op == IR_PRINT)
+        calls[ncalls++] = g->pos[v];
+  for (int v = 0; v < n; v++) {
+    hint_phi[v] = -1;
+    x->loc[v] = INT_MIN;
+  }
+  for (int v = 0; v < n; v++)
+    if (f->insts[v].op == IR_PHI && f->insts[v].block >= 0)
+      for (int i = 0; i < f->insts[v].aux; i++)
+        hint_phi[f->insts[v].args[i]] = v;
+
+  int cand[X86_NXMM];
+  for (int i = 0; i < g->norder; i++) {
+    int b = g->order[i];
+    for (int pass = 0; pass < 2; pass++)
+      for (int v = f->blocks[b].head; v >= 0; v = f->insts[v].next) {
+        IrInst *in = &f->insts[v];
+        if ((in->op == IR_PHI) != (pass == 0) || in->op == IR_CONST ||
+            !ir_defines_value(g, v))
+          continue;
+        bool dec = in->type == TY_DEC;
+        int base = dec ? X86_NGPR : 0;
+        int start = g->ranges[g->range_at[v] * 2], end = x86_value_end(g, v);
+        int nc = 0;
+        if (x86_crosses_call(g, v, calls, ncalls)) {
+          for (int r = 0; !dec && r < X86_NSAVED; r++)
+            cand[nc++] = r;
+        } else if (dec) {
+          for (int r = 0; r < X86_NXMM; r++)
+            cand[nc++] = r;
+        } else { /* caller-saved first, keeping callee-saved ones free */
+          for (int r = X86_NSAVED; r < X86_NGPR; r++)
+            cand[nc++] = r;
+          for (int r = 0; r < X86_NSAVED; r++)
+            cand[nc++] = r;
+        }
+        for (int c = 0; c < nc; c++) {
+          int r = base + cand[c], k = 0;
+          for (int o = 0; o < nowners[r]; o++)
+            if (x86_value_end(g, owners[r][o]) > start)
+              owners[r][k++] = owners[r][o];
+          nowners[r] = k;
+        }
+        int hint = -1;
+        if (in->op == IR_PHI) {
+          for (int k = 0; k < in->aux && hint < 0; k++)
+            if (x->loc[in->args[k]] != INT_MIN)
+              hint = x->loc[in->args[k]];
+        } else if (hint_phi[v] >= 0 && x->loc[hint_phi[v]] != INT_MIN) {
+          hint = x->loc[hint_phi[v]];
+        }
+        int r = -1, victim = -1, victim_end = end;
+        for (int c = -1; c < nc && r < 0; c++) {
+          int cr = c < 0 ? hint : cand[c];
+          if (cr < 0)
+            continue;
+          bool allowed = c >= 0;
+          for (int k = 0; k < nc && !allowed; k++)
+            allowed = cand[k] == cr;
+          if (!allowed)
+            continue;
+          int last = -1;
+          for (int o = 0; o < nowners[base + cr]; o++) {
+            int u = owners[base + cr][o];
+            if (ir_ranges_intersect(g, u, v) &&
+                x86_value_end(g, u) > last)
+              last = x86_value_end(g, u);
+          }
+          if (last < 0)
+            r = cr;
+          else if (c >= 0 && last > victim_end) {
+            victim = cr;
+            victim_end = last;
+          }
+        }
+        if (r < 0 && victim >= 0) {
+          int *list = owners[base + victim], k = 0;
+          for (int o = 0; o < nowners[base + victim]; o++) {
+            int u = list[o];
+            if (ir_ranges_intersect(g, u, v))
+              x->loc[u] = -1 - x->nslots++;
+            else
+              list[k++] = u;
+          }
+          nowners[base + victim] = k;
+          r = victim;
+        }
+        if (r < 0) {
+          x->loc[v] = -1 - x->nslots++;
+          continue;
+        }
+        x->loc[v] = r;
+        owners[base + r] = grow_array(owners[base + r], &owner_cap[base + r],
+                                      nowners[base + r] + 1, sizeof(int));
+        owners[base + r][nowners[base + r]++] = v;
+      }
+  }
+  x->nsaved = 0;
+  for (int v = 0; v < n; v++)
+    if (x->loc[v] >= 0 && x->loc[v] < X86_NSAVED && !x86_is_dec(x, v) &&
+        x->loc[v] + 1 > x->nsaved)
+      x->nsaved = x->loc[v] + 1;
+  for (int r = 0; r < X86_NGPR + X86_NXMM; r++)
+    free(owners[r]);
+  free(hint_phi);
+  free(calls);
+}
+
+static const char *x86_move_loc(X86Codegen *x, int id) {
+  if (id == X86_PARK_GPR)
+    return "%rdx";
+  if (id == X86_PARK_XMM)
+    return "%xmm1";
+  if (id < 0)
+    return x86_slot(x, -1 - id);
+  return id >= X86_XMM_ID ? x86_xmm[id - X86_XMM_ID] : x86_gpr[id];
+}
+
+static int x86_move_id(const X86Codegen *x, int v) {
+  int l = x->loc[v];
+  return l >= 0 && x86_is_dec(x, v) ? X86_XMM_ID + l : l;
+}
+
+/* The phi moves on edge b -> s as one parallel copy (see
+ * ir_emit_phi_moves), between registers and stack slots */
+static void x86_phi_moves(X86Codegen *x, int b, int s) {
+  IrFunc *f = x->g.f;
+  const IrBlock *sb = &f->blocks[s];
+  int j = 0;
+  while (j < sb->npreds && sb->preds[j] != b)
+    j++;
+  int n = 0, cap = 0;
+  int *moves = NULL; /* triples: dst id, src id, value */
+  for (int v = sb->head; v >= 0; v = f->insts[v].next) {
+    const IrInst *phi = &f->insts[v];
+    if (phi->op != IR_PHI || x->loc[v] == INT_MIN)
+      continue;
+    int a = phi->args[j];
+    int src = f->insts[a].op == IR_CONST ? X86_CONST_SRC : x86_move_id(x, a);
+    if (src == x86_move_id(x, v))
+      continue;
+    moves = grow_array(moves, &cap, (n + 1) * 3, sizeof(int));
+    moves[n * 3] = x86_move_id(x, v);
+    moves[n * 3 + 1] = src;
+    moves[n * 3 + 2] = a;
+    n++;
+  }
+  while (n > 0) {
+    int ready = -1;
+    for (int i = 0; i < n && ready < 0; i++) {
+      ready = i;
+      for (int k = 0; k < n; k++)
+        if (k != i && moves[k * 3 + 1] == moves[i * 3]) {
+          ready = -1;
+          break;
+        }
+    }
+    if (ready < 0) {
+      int d = moves[0];
+      bool dec = x86_is_dec(x, moves[2]);
+      int park = dec ? X86_PARK_XMM : X86_PARK_GPR;
+      x86_move(x, dec, x86_move_loc(x, park), x86_move_loc(x, d));
+      for (int k = 0; k < n; k++)
+        if (moves[k * 3 + 1] == d)
+          moves[k * 3 + 1] = park;
+      continue;
+    }
+    int *m = &moves[ready * 3];
+    bool dec = x86_is_dec(x, m[2]);
+    const char *dst = x86_move_loc(x, m[0]);
+    if (m[1] != X86_CONST_SRC) {
+      x86_move(x, dec, dst, x86_move_loc(x, m[1]));
+    } else if (dec) {
+      x86_move(x, true, dst, x86_src(x, m[2], NULL));
+    } else {
+      const char *src = x86_src(x, m[2], "%rax");
+      if (dst[0] != '%' && src[0] == '$')
+        fprintf(x->out, "\tmovq\t%s, %s\n", src, dst);
+      else
+        x86_move(x, false, dst, src);
+    }
+    memcpy(m, &moves[(n - 1) * 3], 3 * sizeof(int));
+    n--;
+  }
+  free(moves);
+}
+
+static void x86_label(const X86Codegen *x, int b, char *buf, size_t size) {
+  snprintf(buf, size, ".L%d_%d", x->fi, b);
+}
+
+static void x86_jump(X86Codegen *x, const char *op, int b) {
+  char label[32];
+  x86_label(x, b, label, sizeof(label));
+  fprintf(x->out, "\t%s\t%s\n", op, label);
+}
+
+/* dst = a op b for ADD, SUB, MUL in either class */
+static void x86_arith(X86Codegen *x, int v) {
+  const IrInst *in = &x->g.f->insts[v];
+  bool dec = x86_is_dec(x, v);
+  static const char *iops[] = {"addq", "subq", "imulq"};
+  static const char *dops[] = {"addsd", "subsd", "mulsd"};
+  const char *op = (dec ? dops : iops)[in->op - IR_ADD];
+  bool commutative = in->op != IR_SUB;
+  const char *dst = x86_src(x, v, NULL);
+  const char *w = x86_in_reg(x, v) ? dst : dec ? "%xmm0" : "%rax";
+  int a = in->a, b = in->b;
+  if (x86_in_reg(x, v) && x86_same_loc(x, b, v) && !x86_same_loc(x, a, v)) {
+    if (commutative) {
+      int t = a;
+      a = b;
+      b = t;
+    } else {
+      w = dec ? "%xmm0" : "%rax";
+    }
+  }
+  x86_move(x, dec, w, x86_src(x, a, "%rax"));
+  fprintf(x->out, "\t%s\t%s, %s\n", op, x86_src(x, b, "%rcx"), w);
+  x86_move(x, dec, dst, w);
+}
+
+/* Integer division with the VM's semantics: a zero divisor is a runtime
+ * error and x / -1 wraps instead of trapping */
+static void x86_divide(X86Codegen *x, int v) {
+  const IrInst *in = &x->g.f->insts[v];
+  const char *dst = x86_src(x, v, NULL);
+  if (x86_is_dec(x, v)) {
+    const char *w = x86_in_reg(x, v) && !x86_same_loc(x, in->b, v) ? dst
+                                                                    : "%xmm0";
+    x86_move(x, true, w, x86_src(x, in->a, NULL));
+    fprintf(x->out, "\tdivsd\t%s, %s\n", x86_src(x, in->b, NULL), w);
+    x86_move(x, true, dst, w);
+    return;
+  }
+  x86_move(x, false, "%rax", x86_src(x, in->a, "%rax"));
+  x86_move(x, false, "%rcx", x86_src(x, in->b, "%rcx"));
+  if (x->g.kform[v] == 1) { /* constant divisor, neither 0 nor -1 */
+    fprintf(x->out, "\tcqto\n\tidivq\t%%rcx\n");
+  } else {
+    x->div_check = true;
+    fprintf(x->out, "\ttestq\t%%rcx, %%rcx\n");
+    fprintf(x->out, "\tje\t.L%d_div0\n", x->fi);
+    fprintf(x->out, "\tcmpq\t$-1, %%rcx\n");
+    fprintf(x->out, "\tjne\t1f\n");
+    fprintf(x->out, "\tnegq\t%%rax\n");
+    fprintf(x->out, "\tjmp\t2f\n");
+    fprintf(x->out, "1:\tcqto\n\tidivq\t%%rcx\n2:\n");
+  }
+  x86_move(x, false, dst, "%rax");
+}
+
+/* Compare for IR_LT v; returns the condition code that holds when a < b */
+static const char *x86_compare(X86Codegen *x, int v) {
+  const IrInst *in = &x->g.f->insts[v];
+  if (x86_is_dec(x, in->a)) {
+    /* b > a is false for unordered operands, unlike a < b via CF */
+    const char *b = x86_src(x, in->b, NULL);
+    if (!x86_in_reg(x, in->b)) {
+      fprintf(x->out, "\tmovsd\t%s, %%xmm1\n", b);
+      b = "%xmm1";
+    }
+    fprintf(x->out, "\tucomisd\t%s, %s\n", x86_src(x, in->a, NULL), b);
+    return "a";
+  }
+  const char *a = x86_src(x, in->a, "%rax");
+  if (a[0] != '%') {
+    fprintf(x->out, "\tmovq\t%s, %%rax\n", a);
+    a = "%rax";
+  }
+  fprintf(x->out, "\tcmpq\t%s, %s\n", x86_src(x, in->b, "%rcx"), a);
+  return "l";
+}
+
+static void x86_epilogue(X86Codegen *x) {
+  if (x->nsaved == 0) {
+    fprintf(x->out, "\tleave\n\tret\n");
+    return;
+  }
+  fprintf(x->out, "\tleaq\t-%d(%%rbp), %%rsp\n", 8 * x->nsaved);
+  for (int r = x->nsaved - 1; r >= 0; r--)
+    fprintf(x->out, "\tpopq\t%s\n", x86_gpr[r]);
+  fprintf(x->out, "\tpopq\t%%rbp\n\tret\n");
+}
+
+static void x86_emit_function(X86Codegen *x, bool is_main) {
+  IrCodegen *g = &x->g;
+  IrFunc *f = g->f;
+  FILE *out = x->out;
+  fprintf(out, "\n\t.type\t%s, @function\n%s:\n", f->name, f->name);
+  fprintf(out, "\tpushq\t%%rbp\n\tmovq\t%%rsp, %%rbp\n");
+  if (is_main) {
+    fprintf(out, "\tmovq\t%%rsp, rt_stack_base(%%rip)\n");
+  } else {
+    x->overflow_check = true;
+    fprintf(out, "\tmovq\trt_stack_base(%%rip), %%rax\n");
+    fprintf(out, "\tsubq\t%%rsp, %%rax\n");
+    fprintf(out, "\tcmpq\t$%d, %%rax\n", X86_STACK_LIMIT);
+    fprintf(out, "\tja\t.L%d_overflow\n", x->fi);
+  }
+  for (int r = 0; r < x->nsaved; r++)
+    fprintf(out, "\tpushq\t%s\n", x86_gpr[r]);
+  int frame = 8 * x->nslots;
+  if ((8 * x->nsaved + frame) % 16)
+    frame += 8;
+  if (frame)
+    fprintf(out, "\tsubq\t$%d, %%rsp\n", frame);
+
+  for (int i = 0; i < g->norder; i++) {
+    int b = g->order[i];
+    int next = i + 1 < g->norder ? g->order[i + 1] : -1;
+    const IrBlock *blk = &f->blocks[b];
+    char label[32];
+    x86_label(x, b, label, sizeof(label));
+    fprintf(out, "%s:\n", label);
+    for (int v = blk->head; v >= 0; v = f->insts[v].next) {
+      const IrInst *in = &f->insts[v];
+      if (in->op == IR_PHI || g->folded[v] || g->fused[v])
+        continue;
+      bool dec = in->type == TY_DEC;
+      switch (in->op) {
+      case IR_CONST: /* every use reads the constant itself */
+        break;
+      case IR_PARAM:
+        x86_move(x, dec, x86_src(x, v, NULL), dec ? "%xmm0" : "%rdi");
+        break;
+      case IR_ADD:
+      case IR_SUB:
+      case IR_MUL:
+        x86_arith(x, v);
+        break;
+      case IR_DIV:
+        x86_divide(x, v);
+        break;
+      case IR_LT:
+        fprintf(out, "\tset%s\t%%al\n", x86_compare(x, v));
+        fprintf(out, "\tmovzbl\t%%al, %%eax\n");
+        x86_move(x, false, x86_src(x, v, NULL), "%rax");
+        break;
+      case IR_I2D: {
+        const char *dst = x86_src(x, v, NULL);
+        const char *w = x86_in_reg(x, v) ? dst : "%xmm0";
+        const char *a = x86_src(x, in->a, "%rax");
+        if (a[0] == '$') {
+          fprintf(out, "\tmovq\t%s, %%rax\n", a);
+          a = "%rax";
+        }
+        fprintf(out, "\tcvtsi2sdq\t%s, %s\n", a, w);
+        x86_move(x, true, dst, w);
+        break;
+      }
+      case IR_CALL:
+        if (x86_is_dec(x, in->a))
+          x86_move(x, true, "%xmm0", x86_src(x, in->a, NULL));
+        else
+          x86_move(x, false, "%rdi", x86_src(x, in->a, "%rdi"));
+        fprintf(out, "\tcall\t%s\n", x->m->funcs[in->aux].name);
+        if (x->loc[v] != INT_MIN)
+          x86_move(x, dec, x86_src(x, v, NULL), dec ? "%xmm0" : "%rax");
+        break;
+      case IR_PRINT:
+        if (x86_is_dec(x, in->a)) {
+          x86_move(x, true, "%xmm0", x86_src(x, in->a, NULL));
+          fprintf(out, "\tleaq\t.Lfmt_dec(%%rip), %%rdi\n");
+          fprintf(out, "\tmovl\t$1, %%eax\n");
+        } else {
+          x86_move(x, false, "%rsi", x86_src(x, in->a, "%rsi"));
+          fprintf(out, "\tleaq\t.Lfmt_int(%%rip), %%rdi\n");
+          fprintf(out, "\txorl\t%%eax, %%eax\n");
+        }
+        fprintf(out, "\tcall\tprintf@PLT\n");
+        break;
+      case IR_RET:
+        if (x86_is_dec(x, in->a))
+          x86_move(x, true, "%xmm0", x86_src(x, in->a, NULL));
+        else
+          x86_move(x, false, "%rax", x86_src(x, in->a, "%rax"));
+        x86_epilogue(x);
+        break;
+      case IR_JMP:
+        x86_phi_moves(x, b, blk->succ[0]);
+        if (blk->succ[0] != next)
+          x86_jump(x, "jmp", blk->succ[0]);
+        break;
+      case IR_BR:
+        if (g->fused[in->a]) {
+          const char *cc = x86_compare(x, in->a);
+          x86_jump(x, cc[0] == 'a' ? "jbe" : "jge", blk->succ[1]);
+        } else {
+          const char *c = x86_src(x, in->a, "%rax");
+          if (c[0] == '$') {
+            fprintf(out, "\tmovq\t%s, %%rax\n", c);
+            c = "%rax";
+          }
+          if (c[0] == '%')
+            fprintf(out, "\ttestq\t%s, %s\n", c, c);
+          else
+            fprintf(out, "\tcmpq\t$0, %s\n", c);
+          x86_jump(x, "je", blk->succ[1]);
+        }
+        if (blk->succ[0] != next)
+          x86_jump(x, "jmp", blk->succ[0]);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  if (x->div_check)
+    fprintf(out,
+            ".L%d_div0:\n\tleaq\t.L%d_msg_div0(%%rip), %%rdi\n\tcall\trt_fail\n",
+            x->fi, x->fi);
+  if (x->overflow_check)
+    fprintf(out,
+            ".L%d_overflow:\n\tleaq\t.L%d_msg_overflow(%%rip), "
+            "%%rdi\n\tcall\trt_fail\n",
+            x->fi, x->fi);
+  fprintf(out, "\t.size\t%s, .-%s\n", f->name, f->name);
+}
+
+/* Runtime support shared by every function: the error exit, the printf
+ * formats and the stack base the overflow check measures against */
+static void x86_emit_runtime(FILE *out) {
+  fprintf(out, "\n\t.type\trt_fail, @function\n"
+               "rt_fail:\n"
+               "\tpushq\t%%rbx\n"
+               "\tmovq\t%%rdi, %%rbx\n"
+               "\tmovq\tstdout@GOTPCREL(%%rip), %%rax\n"
+               "\tmovq\t(%%rax), %%rdi\n"
+               "\tcall\tfflush@PLT\n"
+               "\tmovq\tstderr@GOTPCREL(%%rip), %%rax\n"
+               "\tmovq\t(%%rax), %%rsi\n"
+               "\tmovq\t%%rbx, %%rdi\n"
+               "\tcall\tfputs@PLT\n"
+               "\tmovl\t$1, %%edi\n"
+               "\tcall\texit@PLT\n"
+               "\t.size\trt_fail, .-rt_fail\n");
+  fprintf(out, "\n\t.section\t.rodata\n"
+               ".Lfmt_int:\n\t.string\t\"%%lld\\n\"\n"
+               ".Lfmt_dec:\n\t.string\t\"%%g\\n\"\n");
+  fprintf(out, "\n\t.local\trt_stack_base\n"
+               "\t.comm\trt_stack_base, 8, 8\n"
+               "\t.section\t.note.GNU-stack,\"\",@progbits\n");
+}
+
+/* Write an optimized module as one assembly file */
+typedef struct {
+  IrModule *m;
+  char **text; /* each function's assembly */
+  size_t *size;
+} X86Job;
+
+static void x86_emit_task(void *ctx, int i) {
+  X86Job *job = ctx;
+  IrModule *m = job->m;
+  double span = trace_begin();
+  FILE *out = open_memstream(&job->text[i], &job->size[i]);
+  if (!out) {
+    perror("x86");
+    exit(1);
+  }
+  IrFunc *f = &m->funcs[i];
+  /* the argument register is read before anything can clobber it */
+  for (int v = f->blocks[0].head; v >= 0; v = f->insts[v].next)
+    if (f->insts[v].op == IR_PARAM) {
+      ir_unlink(f, v);
+      ir_link(f, 0, -1, v);
+      break;
+    }
+  X86Codegen x;
+  memset(&x, 0, sizeof(x));
+  x.m = m;
+  x.out = out;
+  x.fi = i;
+  ir_codegen_prepare(&x.g, f);
+  x.loc = malloc(f->ninsts * sizeof(int));
+  if (!x.loc) {
+    perror("x86");
+    exit(1);
+  }
+  x86_allocate(&x);
+  bool is_main = i == m->main_func;
+  if (is_main)
+    fprintf(out, "\n\t.globl\tmain");
+  x86_emit_function(&x, is_main);
+
+  fprintf(out, "\t.section\t.rodata\n");
+  if (x.div_check)
+    fprintf(out, ".L%d_msg_div0:\n\t.string\t\"runtime error: %s in %s\\n\"\n",
+            i, vm_status_names[VM_ERR_DIV_ZERO], f->name);
+  if (x.overflow_check)
+    fprintf(out,
+            ".L%d_msg_overflow:\n\t.string\t\"runtime error: %s in %s\\n\"\n",
+            i, vm_status_names[VM_ERR_STACK_OVERFLOW], f->name);
+  if (x.nk)
+    fprintf(out, "\t.align\t8\n");
+  for (int k = 0; k < x.nk; k++) {
+    uint64_t bits;
+    memcpy(&bits, &f->insts[x.kpool[k]].k.d, sizeof(bits));
+    fprintf(out, ".LK%d_%d:\n\t.quad\t0x%016llx\n", i, x.kpool[k],
+            (unsigned long long)bits);
+  }
+  fprintf(out, "\t.text\n");
+  free(x.loc);
+  free(x.kpool);
+  ir_codegen_release(&x.g);
+  fclose(out);
+  trace_end("emit asm", f->name, span);
+}
+
+/* Functions are emitted in parallel into buffers written out in order */
+void x86_emit_module(IrModule *m, FILE *out) {
+  fprintf(out, "# generated from the SSA IR\n\t.text\n");
+  X86Job job = {m};
+  job.text = calloc(m->nfuncs, sizeof(char *));
+  job.size = calloc(m->nfuncs, sizeof(size_t));
+  if (!job.text || !job.size) {
+    perror("x86");
+    exit(1);
+  }
+  TaskGraph tg;
+  tasks_init(&tg, m->nfuncs);
+  tasks_run(&tg, tasks_threads(m->nfuncs), x86_emit_task, &job);
+  tasks_free(&tg);
+  for (int i = 0; i < m->nfuncs; i++) {
+    fwrite(job.text[i], 1, job.size[i], out);
+    free(job.text[i]);
+  }
+  free(job.text);
+  free(job.size);
+  x86_emit_runtime(out);
+}
+
+/* Build and optimize the IR of the current front-end state, printing it
+ * and the optimization report as requested. */
+IrModule *compile_module(bool show_ir) {
+  memset(&ir_stats, 0, sizeof(ir_stats));
+  ir_reset_loop_stats();
+  ir_reset_inline_log();
+  IrModule *m = ir_build_module();
+  ir_optimize_module(m);
+  if (show_ir) {
+    printf("\n=== SSA IR ===\n");
+    ir_print_module(m, stdout);
+  }
+  if (opt_report) {
+    ir_print_inline_log(stderr);
+    ir_print_loop_stats(stderr);
+  }
+  return m;
+}
+
+/* Compile the current front-end state at opt_level, optionally printing
+ * the optimized IR. */
+BcProgram *compile_program(bool show_ir) {
+  if (opt_level == 0) {
+    BcProgram *prog = bc_compile();
+    if (fuse_superinstructions)
+      bc_fuse(prog);
+    return prog;
+  }
+  IrModule *m = compile_module(show_ir);
+  BcProgram *prog = ir_codegen(m);
+  ir_free_module(m);
+  return prog;
+}
+
+/* Compile the current front-end state and run it, reporting runtime errors
+ * on stderr. Returns main's exit code, or 1 on a runtime error. */
+int execute_program(FILE *out, bool show_ir, bool show_bytecode) {
+  STAT_TIMER(t);
+  double span = trace_begin();
+  BcProgram *prog = compile_program(show_ir);
+  STAT_LAP(compile, t);
+  span = trace_end("compile", NULL, span);
+  if (show_bytecode) {
+    printf("\n=== BYTECODE ===\n");
+    bc_disassemble(prog, stdout);
+  }
+  VM vm;
+  vm_init(&vm, prog, out);
+  if (profile_dispatch)
+    vm_enable_profiling(&vm);
+  else if (use_jit)
+    vm_enable_jit(&vm);
+  FILE *profile_out = NULL;
+  if (profile_path) {
+    profile_out = fopen(profile_path, "w");
+    if (!profile_out)
+      perror(profile_path);
+    else if (!profile_start(prog)) {
+      fclose(profile_out);
+      profile_out = NULL;
+    }
+  }
+  int status = vm_run(&vm);
+  int rc = (int)vm.result;
+  STAT_LAP(run, t);
+  trace_end("run", NULL, span);
+  if (profile_out) {
+    profile_stop(profile_out);
+    fclose(profile_out);
+    fprintf(stderr, "profile: %lld samples written to %s\n", profile_samples,
+            profile_path);
+  }
+  if (status != VM_OK) {
+    fflush(out);
+    fprintf(stderr, "runtime error: %s in %s\n", vm_status_names[status],
+            prog->funcs[vm.error_func].name);
+    rc = 1;
+  }
+  if (profile_dispatch)
+    vm_print_profile(&vm, stderr);
+  if (opt_report && vm.jit)
+    jit_print_report(&vm, stderr);
+  if (show_usage)
+    vm_print_usage(&vm, stderr);
+  vm_free(&vm);
+  bc_free(prog);
+  return rc;
+}
+
+/* Compile the current front-end state through the IR to an assembly file
+ * for cc (always optimized: the native back end starts from the IR) */
+int emit_assembly(const char *path, bool show_ir) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    perror(path);
+    return 1;
+  }
+  IrModule *m = compile_module(show_ir);
+  x86_emit_module(m, out);
+  ir_free_module(m);
+  return fclose(out) == 0 ? 0 : 1;
+}
+
+/* --- C EMITTER --- */
+
+/* --emit-c translates the checked token stream into C for the host
+ * compiler, writing straight to the output file while it walks the tokens
+ * like the bytecode compiler. The VM's semantics are kept explicit:
+ * - int arithmetic goes through wrapping helpers, since signed overflow is
+ *   undefined in C
+ * - int division checks for zero and wraps x / -1
+ * - calls count frames against the VM's limit
+ * - a statement with a call is split into temporaries, so operands are
+ *   evaluated left to right as in the VM (C leaves the order unspecified)
+ */
+FILE *c_out = NULL;
+int c_func;          /* function being emitted */
+int c_indent;        /* nesting depth of the statement being emitted */
+int c_temps;         /* temporaries used so far in c_func */
+bool *c_renamed = NULL; /* symbol -> name shared with another local */
+int c_renamed_cap = 0;
+
+static void c_line(void) {
+  for (int i = 0; i < c_indent; i++)
+    fputs("  ", c_out);
+}
+
+static const char *c_type_name(char t) {
+  return t == TY_DEC ? "double" : "long long";
+}
+
+/* A local's name, suffixed with its slot when the function declares the
+ * same name more than once (loop scopes may shadow) */
+static void c_var(int sym) {
+  fputs(name_of(syms[sym].name), c_out);
+  if (c_renamed[sym])
+    fprintf(c_out, "_%d", syms[sym].slot);
+}
+
+/* An expression as a tree, built once per statement so that every
+ * operator and operand type is found in one pass. A node is a term token
+ * (V or N; F with its argument in l; '(' with the inner expression in l)
+ * or an operator token with its operands in l and r. */
+typedef struct {
+  int tok, l, r;
+  char type;
+} CNode;
+
+CNode *c_nodes = NULL;
+int c_node_count = 0, c_node_cap = 0;
+
+static int c_node(int tok, int l, int r, char type) {
+  c_nodes = grow_array(c_nodes, &c_node_cap, c_node_count + 1, sizeof(CNode));
+  c_nodes[c_node_count] = (CNode){tok, l, r, type};
+  return c_node_count++;
+}
+
+static int c_tree(int *pos, int min_prec);
+
+static int c_tree_term(int *pos) {
+  int tok = (*pos)++;
+  switch (lexed[tok].kind) {
+  case T_VAR:
+    return c_node(tok, -1, -1, syms[tok_ref[tok]].type);
+  case T_NUM:
+    return c_node(tok, -1, -1, TY_INT);
+  default: { /* F B E B or B E B */
+    bool call = lexed[tok].kind == T_FUNC;
+    if (call)
+      (*pos)++;
+    int inner = c_tree(pos, 1);
+    (*pos)++;
+    return c_node(tok, inner, -1,
+                  call ? funcs[tok_ref[tok]].ret_type : c_nodes[inner].type);
+  }
+  }
+}
+
+/* Precedence climbing as in sema_expr: operators associate left */
+static int c_tree(int *pos, int min_prec) {
+  int l = c_tree_term(pos);
+  while (lexed[*pos].kind == T_OP) {
+    int op = *pos, prec = op_precedence(sema_op(op));
+    if (prec < min_prec)
+      break;
+    (*pos)++;
+    int r = c_tree(pos, prec + 1);
+    char t = sema_op(op) == '<'                   ? TY_INT
+             : c_nodes[l].type == TY_DEC ||
+                     c_nodes[r].type == TY_DEC ? TY_DEC
+                                               : TY_INT;
+    l = c_node(op, l, r, t);
+  }
+  return l;
+}
+
+/* The type an operator node computes in: dec if either operand is */
+static char c_operand_type(const CNode *e) {
+  return c_nodes[e->l].type == TY_DEC || c_nodes[e->r].type == TY_DEC
+             ? TY_DEC
+             : TY_INT;
+}
+
+static bool c_has_call(int lo, int hi) {
+  for (int i = lo; i < hi; i++)
+    if (lexed[i].kind == T_FUNC)
+      return true;
+  return false;
+}
+
+/* Index of the '..' ending the expression that starts at lo */
+static int c_expr_end(int lo) {
+  while (lexed[lo].kind != T_STMT)
+    lo++;
+  return lo;
+}
+
+static void c_number(int tok, char want) {
+  long long n = strtoll(name_of(lexed[tok].name), NULL, 10);
+  if (want == TY_DEC)
+    fprintf(c_out, "%lld.0", n);
+  else
+    fprintf(c_out, "%lld", n);
+}
+
+/* The call's depth check runs after the argument is evaluated, and a
+ * stack overflow is reported in the calling function, as in the VM */
+static void c_call_open(int tok) {
+  int callee = tok_ref[tok];
+  fprintf(c_out, "%s(rt_call_%c(", name_of(funcs[callee].name),
+          funcs[callee].param_type);
+}
+
+static void c_call_close(void) {
+  fprintf(c_out, ", \"%s\"))", name_of(funcs[c_func].name));
+}
+
+static void c_binop(char op, char t) {
+  if (op == '<' || t == TY_DEC)
+    fprintf(c_out, "(");
+  else
+    fprintf(c_out, "%s(", op == '+'   ? "rt_add"
+                          : op == '-' ? "rt_sub"
+                          : op == '*' ? "rt_mul"
+                                      : "rt_div");
+}
+
+static void c_binop_mid(char op, char t) {
+  if (op == '<' || t == TY_DEC)
+    fprintf(c_out, " %c ", op);
+  else
+    fputs(", ", c_out);
+}
+
+static void c_binop_close(char op, char t) {
+  if (op == '/' && t == TY_INT)
+    fprintf(c_out, ", \"%s\"", name_of(funcs[c_func].name));
+  fputs(")", c_out);
+}
+
+/* Emit expression node n as one C expression converted to `want` (0: as
+ * is) */
+static void c_expr(int n, char want) {
+  const CNode *e = &c_nodes[n];
+  if (want == TY_DEC && e->type == TY_INT) {
+    if (lexed[e->tok].kind == T_NUM) {
+      c_number(e->tok, TY_DEC);
+      return;
+    }
+    fputs("(double)", c_out);
+  }
+  switch (lexed[e->tok].kind) {
+  case T_VAR:
+    c_var(tok_ref[e->tok]);
+    return;
+  case T_NUM:
+    c_number(e->tok, TY_INT);
+    return;
+  case T_FUNC:
+    c_call_open(e->tok);
+    c_expr(e->l, funcs[tok_ref[e->tok]].param_type);
+    c_call_close();
+    return;
+  case T_BRACKET:
+    fputs("(", c_out);
+    c_expr(e->l, 0);
+    fputs(")", c_out);
+    return;
+  }
+  char op = sema_op(e->tok), ot = c_operand_type(e);
+  c_binop(op, ot);
+  c_expr(e->l, ot);
+  c_binop_mid(op, ot);
+  c_expr(e->r, ot);
+  c_binop_close(op, ot);
+}
+
+/* An operand of three-address code: a token (variable or number) when
+ * >= 0, temporary -1 - h otherwise */
+static void c_operand(int h, char from, char want) {
+  if (h >= 0 && lexed[h].kind == T_NUM) {
+    c_number(h, want);
+    return;
+  }
+  if (want == TY_DEC && from == TY_INT)
+    fputs("(double)", c_out);
+  if (h >= 0)
+    c_var(tok_ref[h]);
+  else
+    fprintf(c_out, "t%d", -1 - h);
+}
+
+/* Evaluate node n into temporaries in the VM's order: left operand, right
+ * operand, then the operator; a call's argument before the call */
+static int c_temporaries(int n) {
+  const CNode *e = &c_nodes[n];
+  switch (lexed[e->tok].kind) {
+  case T_VAR:
+  case T_NUM:
+    return e->tok;
+  case T_FUNC: {
+    int callee = tok_ref[e->tok];
+    int a = c_temporaries(e->l);
+    int t = c_temps++;
+    c_line();
+    fprintf(c_out, "%s t%d = ", c_type_name(funcs[callee].ret_type), t);
+    c_call_open(e->tok);
+    c_operand(a, c_nodes[e->l].type, funcs[callee].param_type);
+    c_call_close();
+    fputs(";\n", c_out);
+    return -1 - t;
+  }
+  case T_BRACKET:
+    return c_temporaries(e->l);
+  }
+  char op = sema_op(e->tok), ot = c_operand_type(e);
+  char lt = c_nodes[e->l].type, rt = c_nodes[e->r].type;
+  int l = c_temporaries(e->l);
+  int r = c_temporaries(e->r);
+  int t = c_temps++;
+  c_line();
+  fprintf(c_out, "%s t%d = ", c_type_name(op == '<' ? TY_INT : ot), t);
+  c_binop(op, ot);
+  c_operand(l, lt, ot);
+  c_binop_mid(op, ot);
+  c_operand(r, rt, ot);
+  c_binop_close(op, ot);
+  fputs(";\n", c_out);
+  return -1 - t;
+}
+
+/* Emit `<prefix>value<suffix>;` for the expression starting at lo, converted
+ * to type t; returns the index of its '..' */
+static int c_value_stmt(int lo, char t, const char *prefix,
+                        const char *suffix, int sym) {
+  int hi = lo;
+  c_node_count = 0;
+  int root = c_tree(&hi, 1);
+  if (c_has_call(lo, hi)) {
+    int h = c_temporaries(root);
+    c_line();
+    if (sym >= 0)
+      c_var(sym);
+    fputs(prefix, c_out);
+    c_operand(h, c_nodes[root].type, t);
+  } else {
+    c_line();
+    if (sym >= 0)
+      c_var(sym);
+    fputs(prefix, c_out);
+    c_expr(root, t);
+  }
+  fprintf(c_out, "%s;\n", suffix);
+  return hi;
+}
+
+static void c_return(int lo) {
+  char t = funcs[c_func].ret_type;
+  if (funcs[c_func].is_main)
+    c_value_stmt(lo, t, "return (int)(", ")", -1);
+  else
+    c_value_stmt(lo, t,
+                 t == TY_DEC ? "return rt_return_d(" : "return rt_return_i(",
+                 ")", -1);
+}
+
+static int c_pos;
+
+static void c_stmts(void);
+
+static void c_stmt(void) {
+  int tok = c_pos;
+  switch (lexed[tok].kind) {
+  case T_TYPE: /* T V O E S */
+    c_pos = c_value_stmt(tok + 3, syms[tok_ref[tok + 1]].type, " = ", "",
+                         tok_ref[tok + 1]) +
+            1;
+    break;
+  case T_VAR: /* V O E S */
+    c_pos = c_value_stmt(tok + 2, syms[tok_ref[tok]].type, " = ", "",
+                         tok_ref[tok]) +
+            1;
+    break;
+  case T_RETURN: /* R E S */
+    c_return(tok + 1);
+    c_pos = c_expr_end(tok + 1) + 1;
+    break;
+  case T_PRINTF: { /* P B V B S */
+    int s = tok_ref[tok + 2];
+    c_line();
+    fprintf(c_out, "printf(\"%s\\n\", ",
+            syms[s].type == TY_DEC ? "%g" : "%lld");
+    c_var(s);
+    fputs(");\n", c_out);
+    c_pos += 5;
+    break;
+  }
+  case T_BREAK: /* K S */
+    c_line();
+    fputs("break;\n", c_out);
+    c_pos += 2;
+    break;
+  case T_LOOP: { /* L W B T V O N S B B C B */
+    int s = tok_ref[tok + 4];
+    const char *label = name_of(lexed[tok].name);
+    int llen = (int)strlen(label);
+    if (llen > 0 && label[llen - 1] == ':')
+      llen--;
+    c_line();
+    c_var(s);
+    fprintf(c_out, " = 0; /* %.*s */\n", llen, label);
+    c_line();
+    fputs("while (", c_out);
+    c_var(s);
+    fputs(" < ", c_out);
+    c_number(tok + 6, syms[s].type);
+    fputs(") {\n", c_out);
+    c_pos += 10;
+    c_indent++;
+    c_stmts();
+    c_indent--;
+    c_pos++; /* } */
+    c_line();
+    fputs("}\n", c_out);
+    break;
+  }
+  default:
+    c_pos++;
+    break;
+  }
+}
+
+static void c_stmts(void) {
+  while (c_pos < lexed_count && lexed[c_pos].kind != T_BRACKET)
+    c_stmt();
+}
+
+static void c_signature(int fi) {
+  const FuncInfo *info = &funcs[fi];
+  if (info->is_main) {
+    fputs("int main(void)", c_out);
+    return;
+  }
+  fprintf(c_out, "static %s %s(", c_type_name(info->ret_type),
+          name_of(info->name));
+  if (info->param_sym >= 0) {
+    fprintf(c_out, "%s ", c_type_name(info->param_type));
+    c_var(info->param_sym);
+  } else {
+    fputs("void", c_out);
+  }
+  fputs(")", c_out);
+}
+
+static void c_function(int fi) {
+  const FuncInfo *info = &funcs[fi];
+  c_func = fi;
+  c_temps = 0;
+  fputs("\n", c_out);
+  c_signature(fi);
+  fputs(" {\n", c_out);
+  for (int s = info->first_sym; s < info->end_sym; s++)
+    if (syms[s].kind == SYM_VAR) {
+      fprintf(c_out, "  %s ", c_type_name(syms[s].type));
+      c_var(s);
+      fputs(" = 0;\n", c_out);
+    }
+  c_indent = 1;
+  c_pos = info->body_tok + 1;
+  c_stmts();
+  /* falling off the end returns 0 */
+  if (info->is_main)
+    fputs("  return 0;\n", c_out);
+  else
+    fprintf(c_out, "  return rt_return_%c(0);\n", info->ret_type);
+  fputs("}\n", c_out);
+}
+
+/* Wrapping int arithmetic, the VM's division and call-depth checks, and
+ * its runtime error message and exit status */
+static void c_runtime(void) {
+  fprintf(c_out,
+          "#include <stdio.h>\n"
+          "#include <stdlib.h>\n"
+          "\n"
+          "#define RT_MAX_DEPTH %d\n"
+          "\n"
+          "static int rt_depth;\n"
+          "\n"
+          "static void rt_fail(const char *what, const char *func) {\n"
+          "  fflush(stdout);\n"
+          "  fprintf(stderr, \"runtime error: %%s in %%s\\n\", what, func);\n"
+          "  exit(1);\n"
+          "}\n"
+          "\n"
+          "static inline long long rt_add(long long a, long long b) {\n"
+          "  return (long long)((unsigned long long)a + (unsigned long long)b);\n"
+          "}\n"
+          "\n"
+          "static inline long long rt_sub(long long a, long long b) {\n"
+          "  return (long long)((unsigned long long)a - (unsigned long long)b);\n"
+          "}\n"
+          "\n"
+          "static inline long long rt_mul(long long a, long long b) {\n"
+          "  return (long long)((unsigned long long)a * (unsigned long long)b);\n"
+          "}\n"
+          "\n"
+          "static inline long long rt_div(long long a, long long b, const char *func) {\n"
+          "  if (b == 0)\n"
+          "    rt_fail(\"%s\", func);\n"
+          "  return b == -1 ? (long long)(0ull - (unsigned long long)a) : a / b;\n"
+          "}\n",
+          VM_MAX_FRAMES - 1, vm_status_names[VM_ERR_DIV_ZERO]);
+  for (int k = 0; k < 2; k++) {
+    const char *t = c_type_name(k ? TY_DEC : TY_INT);
+    char c = k ? TY_DEC : TY_INT;
+    fprintf(c_out,
+            "\n"
+            "static inline %s rt_call_%c(%s arg, const char *caller) {\n"
+            "  if (++rt_depth > RT_MAX_DEPTH)\n"
+            "    rt_fail(\"%s\", caller);\n"
+            "  return arg;\n"
+            "}\n"
+            "\n"
+            "static inline %s rt_return_%c(%s value) {\n"
+            "  rt_depth--;\n"
+            "  return value;\n"
+            "}\n",
+            t, c, t, vm_status_names[VM_ERR_STACK_OVERFLOW], t, c, t);
+  }
+}
+
+/* Write the checked program as C to path */
+int emit_c(const char *path, const char *source) {
+  c_out = fopen(path, "w");
+  if (!c_out) {
+    perror(path);
+    return 1;
+  }
+  c_renamed = grow_array(c_renamed, &c_renamed_cap, sym_count + 1,
+                         sizeof(bool));
+  int *uses = calloc(name_count + 1, sizeof(int)); /* per function */
+  if (!uses) {
+    perror("emit-c");
+    exit(1);
+  }
+  for (int fi = 0; fi < func_count; fi++) {
+    const FuncInfo *info = &funcs[fi];
+    for (int s = info->first_sym; s < info->end_sym; s++)
+      if (syms[s].kind != SYM_FUNC)
+        uses[syms[s].name]++;
+    for (int s = info->first_sym; s < info->end_sym; s++)
+      c_renamed[s] = syms[s].kind != SYM_FUNC && uses[syms[s].name] > 1;
+    for (int s = info->first_sym; s < info->end_sym; s++)
+      uses[syms[s].name] = 0;
+  }
+  free(uses);
+  fprintf(c_out, "/* generated from %s */\n", source);
+  c_runtime();
+  fputs("\n", c_out);
+  for (int fi = 0; fi < func_count; fi++)
+    if (!funcs[fi].is_main) {
+      c_signature(fi);
+      fputs(";\n", c_out);
+    }
+  for (int fi = 0; fi < func_count; fi++)
+    c_function(fi);
+  return fclose(c_out) == 0 ? 0 : 1;
+}
+
+/* --- BINARY TOKEN FILES --- */
+
+/* The .tok writer and the compiler's uses of the reader; the format and
+ * the reader are in binfile.h, which tools can build against alone */
+
+static void tok_put_varint(FILE *out, uint32_t v) {
+  for (; v >= 0x80; v >>= 7)
+    fputc((int)(v & 0x7f) | 0x80, out);
+  fputc((int)v, out);
+}
+
+/* Write the tokens of the last lex to path: the file's own, without the
+ * modules spliced into lexed[]. Returns 0 on success. */
+int write_tok_file(const char *path) {
+  int ntokens = own_token_count();
+  int *string_of = malloc((name_count + 1) * sizeof(int));
+  int *strings = malloc((ntokens + 1) * sizeof(int));
+  char *spans = NULL;
+  size_t spans_size = 0;
+  FILE *sp = open_memstream(&spans, &spans_size);
+  if (!string_of || !strings || !sp) {
+    perror("tok");
+    exit(1);
+  }
+  memset(string_of, -1, name_count * sizeof(int));
+  int nstrings = 0, line = 1, col = 0;
+  for (int i = 0; i < ntokens; i++) {
+    TokenInfo *t = &lexed[own_token(i)];
+    if (string_of[t->name] < 0) {
+      string_of[t->name] = nstrings;
+      strings[nstrings++] = t->name;
+    }
+    tok_put_varint(sp, (uint32_t)(t->line - line));
+    tok_put_varint(sp, (uint32_t)(t->line == line ? t->col - col : t->col));
+    tok_put_varint(sp, (uint32_t)name_len[t->name]);
+    tok_put_varint(sp, (uint32_t)string_of[t->name]);
+    line = t->line;
+    col = t->col;
+  }
+  fclose(sp);
+
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    perror(path);
+    free(string_of);
+    free(strings);
+    free(spans);
+    return 1;
+  }
+  uint32_t spans_at = sizeof(TokHeader) + ntokens;
+  uint32_t index_at = (uint32_t)(spans_at + spans_size + 3) & ~3u;
+  uint32_t blob_at = index_at + 4 * nstrings, blob_size = 0;
+  for (int s = 0; s < nstrings; s++)
+    blob_size += name_len[strings[s]] + 1;
+  uint8_t header[sizeof(TokHeader)];
+  memcpy(header, TOK_MAGIC, 4);
+  uint32_t fields[] = {TOK_VERSION, ntokens, nstrings, spans_at,
+                       index_at,    blob_at, blob_at + blob_size};
+  for (int k = 0; k < 7; k++)
+    tok_put32(header + 4 + 4 * k, fields[k]);
+  fwrite(header, 1, sizeof(header), out);
+  for (int i = 0; i < ntokens; i++)
+    fputc(lexed[own_token(i)].kind, out);
+  fwrite(spans, 1, spans_size, out);
+  for (uint32_t at = spans_at + spans_size; at < index_at; at++)
+    fputc(0, out);
+  for (int s = 0, at = 0; s < nstrings; s++) {
+    uint8_t word[4];
+    tok_put32(word, at);
+    fwrite(word, 1, 4, out);
+    at += name_len[strings[s]] + 1;
+  }
+  for (int s = 0; s < nstrings; s++)
+    fwrite(name_of(strings[s]), 1, name_len[strings[s]] + 1, out);
+  int rc = ferror(out) ? 1 : 0;
+  fclose(out);
+  free(string_of);
+  free(strings);
+  free(spans);
+  return rc;
+}
+
+
+/* Load a .tok file in place of lexing and load_tokens: tokens[] for the
+ * parser, lexed[] for semantic analysis and the #include "file" lines for
+ * link_includes. Returns false if unreadable. */
+bool load_tok_file(const char *path) {
+  TokFile tf;
+  if (!tok_open(&tf, path))
+    return false;
+  int *name = malloc((tf.nstrings + 1) * sizeof(int));
+  tokens = grow_array(tokens, &tokens_cap, tf.ntokens + 1, 1);
+  lexed = grow_array(lexed, &lexed_cap, tf.ntokens + 1, sizeof(TokenInfo));
+  if (!name) {
+    perror("tok");
+    exit(1);
+  }
+  for (int s = 0; s < tf.nstrings; s++) {
+    const char *text = tok_string(&tf, s);
+    name[s] = intern(text, strlen(text));
+  }
+  TokCursor c;
+  TokToken t;
+  tok_cursor(&tf, &c);
+  lexed_count = lexed_include_count = 0;
+  splice_from = splice_to = 0;
+  int file = intern(path, strlen(path));
+  while (tok_next(&tf, &c, &t)) {
+    lexed[lexed_count++] =
+        (TokenInfo){t.kind, name[t.string], t.line, t.col, file};
+    if (t.kind == T_INCLUDE)
+      note_include(tok_string(&tf, t.string), t.line);
+  }
+  memcpy(tokens, tf.kinds, tf.ntokens);
+  tcount = tf.ntokens;
+  tokens[tcount] = '\0';
+  bool ok = lexed_count == tf.ntokens;
+  if (!ok)
+    fprintf(stderr, "%s: corrupt token spans\n", path);
+  free(name);
+  tok_close(&tf);
+  return ok;
+}
+
+/* --dump-tok: a .tok file as text, through the reader */
+int dump_tok_file(const char *path) {
+  TokFile tf;
+  if (!tok_open(&tf, path))
+    return 1;
+  printf("%s: version %d, %d tokens, %d strings, %zu bytes\n", path,
+         TOK_VERSION, tf.ntokens, tf.nstrings, tf.size);
+  TokCursor c;
+  TokToken t;
+  tok_cursor(&tf, &c);
+  while (tok_next(&tf, &c, &t))
+    printf("%5d:%-4d %c %s\n", t.line, t.col, t.kind,
+           tok_string(&tf, t.string));
+  int rc = c.i == tf.ntokens ? 0 : 1;
+  tok_close(&tf);
+  return rc;
+}
+
+/* --- PARSE TREE FILES --- */
+
+/* The .tree writer and --dump-tree; the format and the reader are in
+ * binfile.h */
+
+static const Production *production_by_id(int prod_id) {
+  for (int i = 0; i < NUM_PRODUCTIONS; i++)
+    if (grammar[i].prod_id == prod_id)
+      return &grammar[i];
+  return NULL;
+}
+
+/* Symbols of a production's right-hand side, without the spaces */
+static int production_symbols(int prod_id, char *out) {
+  int n = 0;
+  for (const char *p = production_by_id(prod_id)->rhs; *p; p++)
+    if (*p != ' ')
+      out[n++] = *p;
+  return n;
+}
+
+/* A node being built; mirrors the on-disk fields */
+typedef struct {
+  char symbol;
+  int prod, nchildren, first_child, first_token, ntokens;
+} TreeBuild;
+
+/* Replay the derivation of the last parse into nodes, children after
+ * their parent. The parser steps over included modules, so the tree and
+ * its token indexes cover the file's own tokens. Returns the node count,
+ * or -1 if the log does not match the tokens. */
+static int build_tree(TreeBuild **out) {
+  char rhs[MAX_PROD];
+  int nnodes = 1;
+  for (int k = 0; k < derivation_count; k++)
+    nnodes += production_symbols(derivation[k], rhs);
+  TreeBuild *nodes = calloc(nnodes, sizeof(TreeBuild));
+  int *work = NULL, work_cap = 0, work_top = 0;
+  if (!nodes) {
+    perror("tree");
+    exit(1);
+  }
+  /* the parser's own stack discipline: expand the leftmost symbol */
+  nodes[0].symbol = 'Z';
+  nodes[0].prod = -1;
+  int count = 1, next_prod = 0, next_token = 0;
+  work = grow_array(work, &work_cap, 1, sizeof(int));
+  work[work_top++] = 0;
+  while (work_top > 0) {
+    TreeBuild *node = &nodes[work[--work_top]];
+    node->first_token = next_token;
+    if (node->prod == 0) {
+      node->ntokens = 1;
+      next_token++;
+      continue;
+    }
+    if (next_prod >= derivation_count)
+      break;
+    node->prod = derivation[next_prod++];
+    node->nchildren = production_symbols(node->prod, rhs);
+    node->first_child = count;
+    work = grow_array(work, &work_cap, work_top + node->nchildren,
+                      sizeof(int));
+    for (int c = 0; c < node->nchildren; c++) {
+      bool leaf = get_nonterm_index(rhs[c]) < 0;
+      nodes[count + c] = (TreeBuild){rhs[c], leaf ? 0 : -1};
+      work[work_top + node->nchildren - 1 - c] = count + c;
+    }
+    work_top += node->nchildren;
+    count += node->nchildren;
+  }
+  free(work);
+  if (work_top > 0 || next_prod != derivation_count ||
+      next_token != own_token_count() || count != nnodes) {
+    free(nodes);
+    return -1;
+  }
+  for (int i = nnodes - 1; i >= 0; i--)
+    for (int c = 0; nodes[i].prod > 0 && c < nodes[i].nchildren; c++)
+      nodes[i].ntokens += nodes[nodes[i].first_child + c].ntokens;
+  *out = nodes;
+  return nnodes;
+}
+
+/* Write the parse tree of the last accepted parse, which must have run
+ * with record_derivation set, to path; returns 0 on success */
+int write_tree_file(const char *path) {
+  TreeBuild *nodes;
+  int nnodes = derivation_count > 0 ? build_tree(&nodes) : -1;
+  if (nnodes < 0) {
+    fprintf(stderr, "%s: no parse tree to write\n", path);
+    return 1;
+  }
+  FILE *out = fopen(path, "wb");
+  int ntokens = own_token_count();
+  int *text_of = malloc((name_count + 1) * sizeof(int));
+  int *strings = malloc((ntokens + 1) * sizeof(int));
+  if (!text_of || !strings) {
+    perror("tree");
+    exit(1);
+  }
+  if (!out) {
+    perror(path);
+    free(nodes);
+    free(text_of);
+    free(strings);
+    return 1;
+  }
+  memset(text_of, -1, name_count * sizeof(int));
+  uint32_t nstrings = 0, blob_size = 0;
+  for (int t = 0; t < ntokens; t++) {
+    int name = lexed[own_token(t)].name;
+    if (text_of[name] < 0) {
+      text_of[name] = blob_size;
+      strings[nstrings++] = name;
+      blob_size += name_len[name] + 1;
+    }
+  }
+  uint32_t nodes_at = sizeof(TreeHeader);
+  uint32_t blob_at = nodes_at + TREE_NODE_SIZE * nnodes;
+  uint8_t header[sizeof(TreeHeader)];
+  memcpy(header, TREE_MAGIC, 4);
+  uint32_t fields[] = {TREE_VERSION, nnodes,  ntokens,
+                       nstrings,     nodes_at, blob_at,
+                       blob_at + blob_size};
+  for (int k = 0; k < 7; k++)
+    tok_put32(header + 4 + 4 * k, fields[k]);
+  fwrite(header, 1, sizeof(header), out);
+  for (int i = 0; i < nnodes; i++) {
+    TreeBuild *n = &nodes[i];
+    bool at_end = n->first_token >= ntokens;
+    TokenInfo *first =
+        &lexed[own_token(at_end ? ntokens - 1 : n->first_token)];
+    TokenInfo *last =
+        n->ntokens ? &lexed[own_token(n->first_token + n->ntokens - 1)]
+                   : first;
+    uint32_t line = first->line, col = first->col;
+    uint32_t end_line = last->line, end_col = last->col;
+    if (n->ntokens || at_end)
+      end_col += name_len[last->name];
+    if (at_end) /* empty, at the end of input */
+      line = end_line, col = end_col;
+    uint8_t node[TREE_NODE_SIZE];
+    node[0] = (uint8_t)n->symbol;
+    node[1] = (uint8_t)n->prod;
+    node[2] = (uint8_t)n->nchildren;
+    node[3] = (uint8_t)(n->nchildren >> 8);
+    int leaf_name = n->prod ? 0 : lexed[own_token(n->first_token)].name;
+    uint32_t words[] = {n->prod ? n->first_child : text_of[leaf_name],
+                        n->first_token, n->ntokens, line, col,
+                        end_line, end_col};
+    for (int k = 0; k < 7; k++)
+      tok_put32(node + 4 + 4 * k, words[k]);
+    fwrite(node, 1, sizeof(node), out);
+  }
+  for (uint32_t s = 0; s < nstrings; s++)
+    fwrite(name_of(strings[s]), 1, name_len[strings[s]] + 1, out);
+  int rc = ferror(out) ? 1 : 0;
+  fclose(out);
+  free(nodes);
+  free(text_of);
+  free(strings);
+  return rc;
+}
+
+
+/* --dump-tree: a .tree file as an indented outline, through the reader */
+int dump_tree_file(const char *path) {
+  TreeFile tf;
+  if (!tree_open(&tf, path))
+    return 1;
+  printf("%s: version %d, %d nodes, %d tokens, %zu bytes\n", path,
+         TREE_VERSION, tf.nnodes, tf.ntokens, tf.size);
+  /* preorder with an explicit stack: statement lists nest deeply */
+  int *node = NULL, *depth = NULL, node_cap = 0, depth_cap = 0, top = 0;
+  node = grow_array(node, &node_cap, 1, sizeof(int));
+  depth = grow_array(depth, &depth_cap, 1, sizeof(int));
+  node[top] = 0;
+  depth[top++] = 0;
+  while (top > 0) {
+    int i = node[--top], d = depth[top];
+    TreeSpan sp = tree_span(&tf, i);
+    printf("%*s%c", 2 * (d < 30 ? d : 30), "", tree_symbol(&tf, i));
+    if (tree_is_leaf(&tf, i)) {
+      printf(" '%s'", tree_text(&tf, i));
+    } else {
+      const Production *p = production_by_id(tree_production(&tf, i));
+      printf(" #%d -> %s", tree_production(&tf, i),
+             p && *p->rhs ? p->rhs : "epsilon");
+    }
+    printf("  %d:%d-%d:%d\n", sp.line, sp.col, sp.end_line, sp.end_col);
+    int n = tree_child_count(&tf, i);
+    node = grow_array(node, &node_cap, top + n, sizeof(int));
+    depth = grow_array(depth, &depth_cap, top + n, sizeof(int));
+    for (int k = n - 1; k >= 0; k--) {
+      node[top] = tree_child(&tf, i, k);
+      depth[top++] = d + 1;
+    }
+  }
+  free(node);
+  free(depth);
+  tree_close(&tf);
+  return 0;
+}
+
+/* --- INCLUDES --- */
+
+/* An #include "file" line names a module: a file of #include lines
+ * followed by functions only. The name is resolved against the directory
+ * of the file that includes it. A module is read, lexed and parsed once per
+ * process and kept, so every file of a batch that includes it shares that
+ * work. Linking splices the modules' tokens in after the including file's
+ * #include lines, each module once and after the modules it includes, and
+ * the parser steps over them; semantic checks then run on the whole unit.
+ * Spliced tokens keep their module as their file, so diagnostics name it,
+ * and --tok-out and --tree-out leave them out. */
+
+typedef struct {
+  char *path; /* realpath; the cache key */
+  char *name; /* as the first includer spelled it, for messages */
+  char *text; /* contents, read ahead of lexing */
+  size_t size;
+  int read_error; /* errno from reading, or 0 */
+  bool lexed, ok; /* ok: it lexed and parsed */
+  TokenInfo *toks; /* tokens after its #include lines */
+  int ntoks;
+  IncludeLine *includes;
+  int nincludes;
+  int *deps; /* module per include line, -1 if it does not resolve */
+  int linked;  /* last unit that took it */
+  bool link_ok; /* and whether its includes linked there */
+} Module;
+
+Module *modules = NULL;
+int module_count = 0, module_cap = 0;
+bool include_modules = true; /* off: #include "file" lines are ignored */
+
+static int link_unit = 0;
+static int *link_chain = NULL, link_chain_cap = 0; /* includes being linked */
+static int *link_order = NULL, link_order_cap = 0, link_order_count = 0;
+
+/* The module at path (a realpath), added unread if it is new. A batch
+ * names few modules, so a linear search is enough. */
+static int module_find(const char *path, const char *name) {
+  for (int m = 0; m < module_count; m++)
+    if (strcmp(modules[m].path, path) == 0)
+      return m;
+  modules = grow_array(modules, &module_cap, module_count + 1, sizeof(Module));
+  modules[module_count] = (Module){strdup(path), strdup(name)};
+  return module_count++;
+}
+
+/* Resolve an include of name from the module from; -1 if no such file */
+static int module_resolve(int from, int name) {
+  const char *dir = modules[from].name, *slash = strrchr(dir, '/');
+  const char *file = name_of(name);
+  int dir_len = file[0] != '/' && slash ? (int)(slash - dir) + 1 : 0;
+  char joined[PATH_MAX], path[PATH_MAX];
+  snprintf(joined, sizeof(joined), "%.*s%s", dir_len, dir, file);
+  if (!realpath(joined, path))
+    return -1;
+  return module_find(path, joined);
+}
+
+static void module_read_task(void *ctx, int task) {
+  Module *m = &modules[((int *)ctx)[task]];
+  FILE *in = fopen(m->path, "rb");
+  if (!in) {
+    m->read_error = errno;
+    return;
+  }
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  rewind(in);
+  m->text = malloc(size > 0 ? size : 1);
+  if (!m->text || size < 0 || fread(m->text, 1, size, in) != (size_t)size) {
+    m->read_error = errno ? errno : EIO;
+    free(m->text);
+    m->text = NULL;
+  }
+  m->size = size;
+  fclose(in);
+}
+
+/* Read the unread modules among ids on the task pool */
+static void modules_read_ahead(const int *ids, int n) {
+  int *unread = malloc((n + 1) * sizeof(int)), count = 0;
+  if (!unread) {
+    perror("include");
+    exit(1);
+  }
+  for (int i = 0; i < n; i++) {
+    Module *m = ids[i] >= 0 ? &modules[ids[i]] : NULL;
+    if (m && !m->lexed && !m->text && !m->read_error) {
+      m->read_error = -1; /* queued, for duplicate ids */
+      unread[count++] = ids[i];
+    }
+  }
+  for (int i = 0; i < count; i++)
+    modules[unread[i]].read_error = 0;
+  TaskGraph tg;
+  tasks_init(&tg, count);
+  tasks_run(&tg, tasks_threads(count), module_read_task, unread);
+  tasks_free(&tg);
+  free(unread);
+}
+
+/* Lex and parse module m once and keep its tokens and includes. This
+ * reuses the lexer and parser globals; callers save what they need. */
+static void module_lex(int id) {
+  Module *m = &modules[id];
+  double span = trace_begin();
+  m->lexed = true;
+  if (m->read_error || !m->text) {
+    fprintf(stderr, "%s: %s\n", m->name,
+            strerror(m->read_error > 0 ? m->read_error : EIO));
+    return;
+  }
+  FILE *in = m->size ? fmemopen(m->text, m->size, "r") : NULL;
+  int rc = in ? run_lexer_stream(in, m->name) : 1;
+  if (in)
+    fclose(in);
+  free(m->text);
+  m->text = NULL;
+  if (rc != 0 || lexed_count == 0) {
+    fflush(stdout); /* its diagnostics first */
+    fprintf(stderr, "%s: REJECTED\n", m->name);
+    return;
+  }
+  load_lexed_tokens();
+  tpos = 0;
+  m->ok = parse_symbols("JQ");
+  if (!m->ok) {
+    fflush(stdout);
+    fprintf(stderr, "%s: REJECTED\n", m->name);
+  }
+  int head = leading_includes(lexed, lexed_count);
+  m->ntoks = lexed_count - head;
+  m->toks = malloc((m->ntoks + 1) * sizeof(TokenInfo));
+  m->nincludes = lexed_include_count;
+  m->includes = malloc((m->nincludes + 1) * sizeof(IncludeLine));
+  m->deps = malloc((m->nincludes + 1) * sizeof(int));
+  if (!m->toks || !m->includes || !m->deps) {
+    perror("include");
+    exit(1);
+  }
+  memcpy(m->toks, lexed + head, m->ntoks * sizeof(TokenInfo));
+  memcpy(m->includes, lexed_includes, m->nincludes * sizeof(IncludeLine));
+  /* resolving may add modules and move the array */
+  for (int i = 0, n = m->nincludes; i < n; i++) {
+    int dep = module_resolve(id, lexed_includes[i].name);
+    modules[id].deps[i] = dep;
+  }
+  trace_end("include", modules[id].name, span);
+}
+
+static bool module_link(int id, int depth);
+
+/* Link the modules that from includes, at chain depth depth */
+static bool module_link_includes(int from, const IncludeLine *includes,
+                                 const int *deps, int n, int depth) {
+  link_chain =
+      grow_array(link_chain, &link_chain_cap, depth + 1, sizeof(int));
+  link_chain[depth] = from;
+  modules_read_ahead(deps, n);
+  bool ok = true;
+  for (int i = 0; i < n; i++) {
+    const char *name = modules[from].name;
+    int dep = deps[i], k = 0;
+    while (k <= depth && link_chain[k] != dep)
+      k++;
+    if (dep < 0) {
+      fprintf(stderr, "%s:%d: cannot open include file \"%s\"\n", name,
+              includes[i].line, name_of(includes[i].name));
+    } else if (k <= depth) {
+      fprintf(stderr, "%s:%d: include cycle:", name, includes[i].line);
+      for (; k <= depth; k++)
+        fprintf(stderr, " %s ->", modules[link_chain[k]].name);
+      fprintf(stderr, " %s\n", modules[dep].name);
+    } else if (module_link(dep, depth + 1)) {
+      continue;
+    } else {
+      fprintf(stderr, "%s:%d: cannot include \"%s\"\n", name,
+              includes[i].line, name_of(includes[i].name));
+    }
+    ok = false;
+  }
+  return ok;
+}
+
+/* Add module id, after what it includes, to the unit being linked */
+static bool module_link(int id, int depth) {
+  if (modules[id].linked == link_unit)
+    return modules[id].link_ok;
+  if (!modules[id].lexed)
+    module_lex(id);
+  Module *m = &modules[id];
+  if (!m->ok)
+    return false;
+  m->linked = link_unit;
+  m->link_ok = false;
+  if (!module_link_includes(id, m->includes, m->deps, m->nincludes, depth))
+    return false;
+  modules[id].link_ok = true;
+  link_order = grow_array(link_order, &link_order_cap, link_order_count + 1,
+                          sizeof(int));
+  link_order[link_order_count++] = id;
+  return true;
+}
+
+/* After lexing path: load the modules its #include "file" lines name and
+ * splice their tokens into lexed[] and token_file. Returns false, with
+ * messages on stderr, when a module is missing, rejected or part of a
+ * cycle. */
+bool link_includes(const char *path) {
+  parse_skip_from = parse_skip_to = -1;
+  if (!include_modules || lexed_include_count == 0)
+    return true;
+  int n = lexed_include_count, ntoks = lexed_count;
+  TokenInfo *toks = malloc((ntoks + 1) * sizeof(TokenInfo));
+  IncludeLine *includes = malloc(n * sizeof(IncludeLine));
+  int *deps = malloc(n * sizeof(int));
+  if (!toks || !includes || !deps) {
+    perror("include");
+    exit(1);
+  }
+  memcpy(toks, lexed, ntoks * sizeof(TokenInfo));
+  memcpy(includes, lexed_includes, n * sizeof(IncludeLine));
+  char real[PATH_MAX];
+  int root = module_find(realpath(path, real) ? real : path, path);
+  for (int i = 0; i < n; i++)
+    deps[i] = module_resolve(root, includes[i].name);
+  link_unit++;
+  link_order_count = 0;
+  modules[root].linked = link_unit;
+  bool ok = module_link_includes(root, includes, deps, n, 0);
+
+  /* the #include lines, then the modules, then the rest of the file */
+  int head = leading_includes(toks, ntoks), spliced = 0;
+  for (int k = 0; k < link_order_count; k++)
+    spliced += modules[link_order[k]].ntoks;
+  lexed = grow_array(lexed, &lexed_cap, ntoks + spliced + 1,
+                     sizeof(TokenInfo));
+  memcpy(lexed, toks, head * sizeof(TokenInfo));
+  lexed_count = head;
+  for (int k = 0; k < link_order_count; k++) {
+    Module *m = &modules[link_order[k]];
+    memcpy(lexed + lexed_count, m->toks, m->ntoks * sizeof(TokenInfo));
+    lexed_count += m->ntoks;
+  }
+  memcpy(lexed + lexed_count, toks + head,
+         (ntoks - head) * sizeof(TokenInfo));
+  lexed_count += ntoks - head;
+  splice_from = head;
+  splice_to = head + spliced;
+  FILE *ftok = token_file ? fopen(token_file, "w") : NULL;
+  if (token_file && !ftok) {
+    fprintf(stderr, "Cannot open token output file '%s'\n", token_file);
+    ok = false;
+  } else if (ftok) {
+    for (int i = 0; i < lexed_count; i++)
+      fprintf(ftok, "%c ", lexed[i].kind);
+    fclose(ftok);
+  }
+  if (ok) {
+    parse_skip_from = head;
+    parse_skip_to = head + spliced;
+  }
+  free(toks);
+  free(includes);
+  free(deps);
+  return ok;
+}
+
+/* --- VM BENCHMARKS --- */
+
+#define BENCH_FILE "bench_input.c"
+#define BENCH_NATIVE "bench_native"
+
+/* Parse and check the loaded tokens; name labels the trace spans */
+static int front_end_parse(const char *name) {
+  STAT_TIMER(t);
+  double span = trace_begin();
+  int parsed = parse_with_visualization();
+  STAT_LAP(parse, t);
+  span = trace_end("parse", name, span);
+  if (!parsed) {
+    derivation_count = 0; /* no tree for a rejected parse */
+    return 0;
+  }
+  int errors = run_semantic_checks();
+  STAT_LAP(check, t);
+  trace_end("check", name, span);
+  return errors == 0;
+}
+
+/* Lex, parse and check a source stream; returns 1 when it is accepted */
+int compile_front_end_stream(FILE *in, const char *name) {
+  STAT_TIMER(t);
+  double span = trace_begin();
+  if (run_lexer_stream(in, name) != 0)
+    return 0;
+  STAT_LAP(lex, t);
+  span = trace_end("lex", name, span);
+  if (!link_includes(name))
+    return 0;
+  if (token_file)
+    load_tokens(token_file);
+  else
+    load_lexed_tokens();
+  tpos = 0;
+  STAT_LAP(load, t);
+  trace_end("load", name, span);
+  return front_end_parse(name);
+}
+
+/* The front end from a .tok file, without lexing */
+static int compile_front_end_tok(const char *path) {
+  STAT_TIMER(t);
+  double span = trace_begin();
+  if (!load_tok_file(path) || !link_includes(path))
+    return 0;
+  if (splice_to > splice_from)
+    load_lexed_tokens();
+  tpos = 0;
+  STAT_LAP(load, t);
+  trace_end("load", path, span);
+  return front_end_parse(path);
+}
+
+/* Lex, parse and check one source file, or a .tok file the lexer wrote;
+ * returns 1 when it is accepted. */
+int compile_front_end(const char *path) {
+  size_t n = strlen(path);
+  if (n > 4 && strcmp(path + n - 4, ".tok") == 0)
+    return compile_front_end_tok(path);
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    fprintf(stderr, "Cannot open input file '%s'\n", path);
+    return 0;
+  }
+  int accepted = compile_front_end_stream(in, path);
+  fclose(in);
+  return accepted;
+}
+
+#define VERIFY_C "verify_c"
+
+static bool files_equal(const char *a, const char *b) {
+  FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+  bool same = fa && fb;
+  while (same) {
+    int ca = fgetc(fa), cb = fgetc(fb);
+    same = ca == cb;
+    if (ca == EOF)
+      break;
+  }
+  if (fa)
+    fclose(fa);
+  if (fb)
+    fclose(fb);
+  return same;
+}
+
+/* Build each program with --emit-c and cc -O2 and compare the binary's
+ * output and exit status with the interpreter's. Returns 1 if any
+ * differ. */
+int verify_emitted_c(char **files, int nfiles) {
+  int failed = 0;
+  for (int i = 0; i < nfiles; i++) {
+    const char *path = files[i];
+    printf("%-32s ", path);
+    fflush(stdout);
+    if (!compile_front_end(path)) {
+      printf("REJECTED\n");
+      failed++;
+      continue;
+    }
+    FILE *out = fopen(VERIFY_C ".vm", "w");
+    if (!out) {
+      perror(VERIFY_C ".vm");
+      return 1;
+    }
+    int vm_rc = execute_program(out, false, false) & 0xff;
+    fclose(out);
+    if (emit_c(VERIFY_C ".c", path) != 0 ||
+        system("cc -O2 -o " VERIFY_C " " VERIFY_C ".c") != 0) {
+      printf("FAILED to build\n");
+      failed++;
+      continue;
+    }
+    int status = system("./" VERIFY_C " > " VERIFY_C ".out 2> /dev/null");
+    int rc = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    bool same_out = files_equal(VERIFY_C ".vm", VERIFY_C ".out");
+    if (same_out && rc == vm_rc) {
+      printf("ok\n");
+    } else {
+      printf("MISMATCH (%s)\n", same_out ? "exit status" : "output");
+      failed++;
+    }
+  }
+  remove(VERIFY_C);
+  remove(VERIFY_C ".c");
+  remove(VERIFY_C ".vm");
+  remove(VERIFY_C ".out");
+  printf("%d of %d programs match the interpreter\n", nfiles - failed,
+         nfiles);
+  return failed ? 1 : 0;
+}
+
+/* Loop-heavy programs: an int accumulator, dec arithmetic, and a nested
+ * loop calling a small ...Fn helper every iteration. */
+static long long bench_write_program(FILE *f, int kind, int scale) {
+  int outer = 100 * scale, inner = 10000;
+  fprintf(f, "#include <stdio.h>\n");
+  if (kind == 2)
+    fprintf(f, "int stepFn(int _n1a) { return _n1a + 1.. }\n");
+  fprintf(f, "int main() {\n");
+  if (kind == 1)
+    fprintf(f, "  dec _acc1a = 1..\n");
+  else
+    fprintf(f, "  int _acc1a = 0..\n");
+  fprintf(f, "  loop_outer01: while (int _i1a < %d..) {\n", outer);
+  fprintf(f, "    loop_inner02: while (int _j1a < %d..) {\n", inner);
+  switch (kind) {
+  case 0:
+    fprintf(f, "      _acc1a = _acc1a + _j1a..\n");
+    fprintf(f, "      _j1a = _j1a + 1..\n");
+    break;
+  case 1:
+    fprintf(f, "      _acc1a = _acc1a * 3 / 4 + _j1a..\n");
+    fprintf(f, "      _j1a = _j1a + 1..\n");
+    break;
+  default:
+    fprintf(f, "      _acc1a = _acc1a + stepFn(_j1a)..\n");
+    fprintf(f, "      _j1a = stepFn(_j1a)..\n");
+    break;
+  }
+  fprintf(f, "    }\n");
+  fprintf(f, "    _i1a = _i1a + 1..\n");
+  fprintf(f, "  }\n");
+  fprintf(f, "  printf(_acc1a)..\n");
+  fprintf(f, "  return 0..\n");
+  fprintf(f, "}\n");
+  return (long long)outer * inner;
+}
+
+/* Run prog once; returns seconds, or -1 on a runtime error (or, with jit,
+ * when the platform has no JIT). With counts, the dispatch profiler is on
+ * and *dispatches receives the total. */
+static double bench_run(const BcProgram *prog, FILE *sink,
+                        unsigned long long *dispatches, bool jit) {
+  VM vm;
+  vm_init(&vm, prog, sink);
+  if (dispatches)
+    vm_enable_profiling(&vm);
+  if (jit && !vm_enable_jit(&vm)) {
+    vm_free(&vm);
+    return -1;
+  }
+  double t0 = now_seconds();
+  int status = vm_run(&vm);
+  double dt = now_seconds() - t0;
+  if (dispatches)
+    *dispatches = vm_dispatch_total(&vm);
+  vm_free(&vm);
+  return status == VM_OK ? dt : -1;
+}
+
+/* Build the current program natively with cc and time one run of the
+ * binary, process start included. Returns seconds, or -1 when cc is
+ * missing or the run fails. */
+static double bench_native(void) {
+  FILE *out = fopen(BENCH_NATIVE ".s", "w");
+  if (!out)
+    return -1;
+  IrModule *m = compile_module(false);
+  x86_emit_module(m, out);
+  ir_free_module(m);
+  fclose(out);
+  if (system("cc -o " BENCH_NATIVE " " BENCH_NATIVE ".s") != 0)
+    return -1;
+  double t0 = now_seconds();
+  int rc = system("./" BENCH_NATIVE " > /dev/null");
+  double dt = now_seconds() - t0;
+  return rc == 0 ? dt : -1;
+}
+
+int run_vm_benchmarks(int scale) {
+  const char *names[] = {"int_sum", "dec_arith", "call_loop"};
+  FILE *sink = fopen("/dev/null", "w");
+  if (!sink)
+    sink = stdout;
+#ifdef VM_COMPUTED_GOTO
+  printf("VM dispatch: computed goto\n");
+#else
+  printf("VM dispatch: switch\n");
+#endif
+  printf("%-12s %12s | %44s | %26s\n", "", "", "ns/iter", "disp/iter");
+  printf("%-12s %12s | %8s %8s %8s %8s %8s | %8s %8s %8s\n", "benchmark",
+         "iterations", "-O0", "+fuse", "-O1", "jit", "native", "-O0", "+fuse",
+         "-O1");
+  for (int kind = 0; kind < 3; kind++) {
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (!f) {
+      perror(BENCH_FILE);
+      return 1;
+    }
+    long long iters = bench_write_program(f, kind, scale);
+    fclose(f);
+    if (!compile_front_end(BENCH_FILE)) {
+      fprintf(stderr, "benchmark %s failed to compile\n", names[kind]);
+      return 1;
+    }
+    /* token compiler without and with superinstructions, then SSA */
+    BcProgram *progs[3];
+    progs[0] = bc_compile();
+    progs[1] = bc_compile();
+    bc_fuse(progs[1]);
+    int level = opt_level;
+    opt_level = 1;
+    progs[2] = compile_program(false);
+    opt_level = level;
+    double t[3];
+    unsigned long long d[3];
+    for (int k = 0; k < 3; k++) {
+      t[k] = bench_run(progs[k], sink, NULL, false);
+      if (t[k] < 0 || bench_run(progs[k], sink, &d[k], false) < 0) {
+        fprintf(stderr, "benchmark %s: runtime error\n", names[kind]);
+        return 1;
+      }
+    }
+    double jit = bench_run(progs[2], sink, NULL, true);
+    double native = bench_native();
+    printf("%-12s %12lld | %8.2f %8.2f %8.2f ", names[kind], iters,
+           t[0] * 1e9 / iters, t[1] * 1e9 / iters, t[2] * 1e9 / iters);
+    for (int k = 0; k < 2; k++) {
+      double s = k == 0 ? jit : native;
+      if (s < 0)
+        printf("%8s ", "n/a");
+      else
+        printf("%8.2f ", s * 1e9 / iters);
+    }
+    printf("| %8.2f %8.2f %8.2f\n", (double)d[0] / iters,
+           (double)d[1] / iters, (double)d[2] / iters);
+    for (int k = 0; k < 3; k++)
+      bc_free(progs[k]);
+  }
+  if (sink != stdout)
+    fclose(sink);
+  return 0;
+}
+
+/* --- PROGRAM GENERATOR --- */
+
+/* Seeded generator of source programs for benchmarks and tests: the same
+ * parameters always produce the same file. Every call goes to a function
+ * defined earlier, loops step their header variable up to a small bound
+ * and division is by a nonzero literal, so generated programs are accepted
+ * and run to completion, unless errors asks for syntax errors to be
+ * injected (near-valid input). */
+typedef struct {
+  unsigned long long seed;
+  int funcs;    /* ...Fn functions before main */
+  int stmts;    /* average statements per block */
+  int depth;    /* expression nesting, up to GEN_MAX_DEPTH */
+  int nesting;  /* labeled whiles inside each other */
+  int comments; /* percent of statements followed by a comment */
+  int errors;   /* syntax errors to inject */
+} GenParams;
+
+#define GEN_MAX_DEPTH 6   /* keeps lines within MAXLINE */
+
+const GenParams gen_defaults = {1, 20, 8, 3, 2, 10, 0};
+
+typedef struct {
+  int id;
+  char type;
+  bool loop; /* a while header variable: only the loop steps it */
+} GenVar;
+
+typedef struct {
+  FILE *out;
+  GenParams p;
+  unsigned long long rng;
+  GenVar *vars; /* in scope, innermost last */
+  int nvars, var_cap;
+  char *ret, *param; /* types of the functions defined so far */
+  int nfuncs;
+  int next_var, next_label;
+} Gen;
+
+static unsigned long long gen_next(Gen *g) { /* splitmix64 */
+  unsigned long long z = (g->rng += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static int gen_below(Gen *g, int n) { return (int)(gen_next(g) % n); }
+
+static void gen_letters(Gen *g, int n) {
+  do {
+    fputc('a' + n % 26, g->out);
+    n /= 26;
+  } while (n > 0);
+}
+
+static void gen_var_name(Gen *g, int id) {
+  fprintf(g->out, "_v%d", id % 10);
+  gen_letters(g, id / 10);
+}
+
+static void gen_func_name(Gen *g, int fi) {
+  fputc('f', g->out);
+  gen_letters(g, fi);
+  fprintf(g->out, "Fn");
+}
+
+static const char *gen_type(char t) { return t == TY_INT ? "int" : "dec"; }
+
+static int gen_declare(Gen *g, char type, bool loop) {
+  g->vars = grow_array(g->vars, &g->var_cap, g->nvars + 1, sizeof(GenVar));
+  GenVar *v = &g->vars[g->nvars++];
+  v->id = g->next_var++;
+  v->type = type;
+  v->loop = loop;
+  return v->id;
+}
+
+/* A random variable in scope usable where want is expected, or -1 */
+static int gen_pick_var(Gen *g, char want, bool assignable) {
+  if (g->nvars == 0)
+    return -1;
+  int start = gen_below(g, g->nvars);
+  for (int k = 0; k < g->nvars; k++) {
+    const GenVar *v = &g->vars[(start + k) % g->nvars];
+    if ((want == TY_DEC || v->type == TY_INT) && !(assignable && v->loop))
+      return (start + k) % g->nvars;
+  }
+  return -1;
+}
+
+/* Writes an expression assignable to want (int widens to dec) and returns
+ * its type */
+static char gen_expr(Gen *g, int depth, char want) {
+  if (depth <= 0 || gen_below(g, 10) < 3) {
+    int v = gen_below(g, 10) < 6 ? gen_pick_var(g, want, false) : -1;
+    if (v < 0) {
+      fprintf(g->out, "%d", gen_below(g, 10));
+      return TY_INT;
+    }
+    gen_var_name(g, g->vars[v].id);
+    return g->vars[v].type;
+  }
+  int c = gen_below(g, 20);
+  if (c < 3 && g->nfuncs > 0) {
+    int f = gen_below(g, g->nfuncs);
+    if (want == TY_DEC || g->ret[f] == TY_INT) {
+      gen_func_name(g, f);
+      fputc('(', g->out);
+      gen_expr(g, depth - 1, g->param[f]);
+      fputc(')', g->out);
+      return g->ret[f];
+    }
+  }
+  if (c < 5) {
+    fputc('(', g->out);
+    char t = gen_expr(g, depth - 1, want);
+    fputc(')', g->out);
+    return t;
+  }
+  char a = gen_expr(g, depth - 1, want);
+  if (c < 7) {
+    fprintf(g->out, " / %d", 1 + gen_below(g, 9));
+    return a;
+  }
+  char op = "+-*+-*<"[gen_below(g, 7)];
+  fprintf(g->out, " %c ", op);
+  char b = gen_expr(g, depth - 1, want);
+  if (op == '<')
+    return TY_INT;
+  return a == TY_DEC || b == TY_DEC ? TY_DEC : TY_INT;
+}
+
+static void gen_indent(Gen *g, int level) {
+  fprintf(g->out, "%*s", 2 * level, "");
+}
+
+static void gen_comment(Gen *g, int level) {
+  if (gen_below(g, 100) >= g->p.comments)
+    return;
+  gen_indent(g, level);
+  if (gen_below(g, 2))
+    fprintf(g->out, "// note %d\n", gen_below(g, 1000));
+  else
+    fprintf(g->out, "/* step %d of the\n%*s   computation */\n",
+            gen_below(g, 1000), 2 * level, "");
+}
+
+static void gen_block(Gen *g, int level, int nesting, bool in_loop,
+                      char ret) {
+  int mark = g->nvars;
+  int n = 1 + gen_below(g, 2 * g->p.stmts);
+  for (int i = 0; i < n; i++) {
+    int c = gen_below(g, 100), v;
+    gen_indent(g, level);
+    if (c < 30 || g->nvars == 0) {
+      char t = gen_below(g, 2) ? TY_INT : TY_DEC;
+      fprintf(g->out, "%s ", gen_type(t));
+      /* in scope only after its initializer */
+      gen_var_name(g, g->next_var);
+      fprintf(g->out, " = ");
+      gen_expr(g, g->p.depth, t);
+      gen_declare(g, t, false);
+    } else if (c < 55 && (v = gen_pick_var(g, TY_DEC, true)) >= 0) {
+      GenVar var = g->vars[v];
+      gen_var_name(g, var.id);
+      fprintf(g->out, " = ");
+      gen_expr(g, g->p.depth, var.type);
+    } else if (c < 70 && nesting > 0) {
+      char t = gen_below(g, 3) ? TY_INT : TY_DEC;
+      int label = g->next_label++;
+      fprintf(g->out, "loop_");
+      gen_letters(g, label / 100);
+      fprintf(g->out, "%02d: while (%s ", label % 100, gen_type(t));
+      int loop_mark = g->nvars;
+      int id = gen_declare(g, t, true);
+      gen_var_name(g, id);
+      fprintf(g->out, " < %d..) {\n", 1 + gen_below(g, 5));
+      gen_block(g, level + 1, nesting - 1, true, ret);
+      gen_indent(g, level + 1);
+      gen_var_name(g, id);
+      fprintf(g->out, " = ");
+      gen_var_name(g, id);
+      fprintf(g->out, " + %d..\n", 1 + gen_below(g, 2));
+      gen_indent(g, level);
+      fprintf(g->out, "}\n");
+      g->nvars = loop_mark;
+      continue;
+    } else if (c < 80 && (v = gen_pick_var(g, TY_DEC, false)) >= 0) {
+      fprintf(g->out, "printf(");
+      gen_var_name(g, g->vars[v].id);
+      fprintf(g->out, ")");
+    } else if (c < 84 && in_loop) {
+      fprintf(g->out, "break");
+    } else if (c < 86) {
+      fprintf(g->out, "return ");
+      gen_expr(g, g->p.depth, ret);
+    } else {
+      char t = gen_below(g, 2) ? TY_INT : TY_DEC;
+      fprintf(g->out, "%s ", gen_type(t));
+      gen_var_name(g, gen_declare(g, t, false));
+      fprintf(g->out, " = %d", gen_below(g, 100));
+    }
+    fprintf(g->out, "..\n");
+    gen_comment(g, level);
+  }
+  g->nvars = mark;
+}
+
+static void gen_source(Gen *g) {
+  fprintf(g->out, "/*\n * Generated program: seed %llu, %d functions\n */\n\n",
+          g->p.seed, g->p.funcs);
+  fprintf(g->out, "#include <stdio.h>\n\n");
+  for (int f = 0; f < g->p.funcs; f++) {
+    char ret = gen_below(g, 2) ? TY_INT : TY_DEC;
+    char param = gen_below(g, 2) ? TY_INT : TY_DEC;
+    fprintf(g->out, "%s ", gen_type(ret));
+    gen_func_name(g, f);
+    fprintf(g->out, "(%s ", gen_type(param));
+    g->nvars = 0;
+    gen_var_name(g, gen_declare(g, param, false));
+    fprintf(g->out, ") {\n");
+    gen_block(g, 1, g->p.nesting, false, ret);
+    fprintf(g->out, "  return ");
+    gen_expr(g, g->p.depth, ret);
+    fprintf(g->out, "..\n}\n\n");
+    /* only now callable: no recursion */
+    g->ret[f] = ret;
+    g->param[f] = param;
+    g->nfuncs++;
+  }
+  g->nvars = 0;
+  fprintf(g->out, "int main() {\n");
+  gen_block(g, 1, g->p.nesting, false, TY_INT);
+  fprintf(g->out, "  return 0..\n}\n");
+}
+
+/* Breaks the program at errors statement terminators chosen at random:
+ * the terminator is dropped, gets a dangling operator, or a stray ')' */
+static void gen_inject_errors(Gen *g, const char *text, size_t size) {
+  size_t *at = malloc((g->p.errors + 1) * sizeof(size_t));
+  if (!at) {
+    perror("generate");
+    exit(1);
+  }
+  int n = 0;
+  for (int e = 0; e < g->p.errors && size > 2; e++) {
+    size_t k = gen_next(g) % size;
+    const char *dots = strstr(text + k, "..");
+    if (!dots)
+      dots = strstr(text, "..");
+    if (!dots)
+      break;
+    at[n++] = dots - text;
+  }
+  /* insertion sort; duplicates count once */
+  for (int i = 1; i < n; i++)
+    for (int j = i; j > 0 && at[j] < at[j - 1]; j--) {
+      size_t t = at[j];
+      at[j] = at[j - 1];
+      at[j - 1] = t;
+    }
+  size_t pos = 0;
+  for (int i = 0; i < n; i++) {
+    if (i > 0 && at[i] == at[i - 1])
+      continue;
+    fwrite(text + pos, 1, at[i] - pos, g->out);
+    static const char *broken[] = {"  ", " +..", " ).."};
+    fputs(broken[gen_below(g, 3)], g->out);
+    pos = at[i] + 2;
+  }
+  fwrite(text + pos, 1, size - pos, g->out);
+  free(at);
+}
+
+/* Write one program for p to out */
+int generate_program(FILE *out, const GenParams *p) {
+  Gen g = {out, *p, p->seed};
+  if (g.p.depth > GEN_MAX_DEPTH)
+    g.p.depth = GEN_MAX_DEPTH;
+  if (g.p.stmts < 1)
+    g.p.stmts = 1;
+  g.ret = malloc(g.p.funcs + 1);
+  g.param = malloc(g.p.funcs + 1);
+  if (!g.ret || !g.param) {
+    perror("generate");
+    return 1;
+  }
+  char *text = NULL;
+  size_t size = 0;
+  if (g.p.errors > 0) {
+    g.out = open_memstream(&text, &size);
+    if (!g.out) {
+      perror("generate");
+      return 1;
+    }
+  }
+  gen_source(&g);
+  if (g.p.errors > 0) {
+    fclose(g.out);
+    g.out = out;
+    gen_inject_errors(&g, text, size);
+    free(text);
+  }
+  free(g.vars);
+  free(g.ret);
+  free(g.param);
+  return 0;
+}
+
+/* Parse "seed=7,funcs=500,..." over the defaults; returns false on an
+ * unknown key */
+bool parse_gen_spec(const char *spec, GenParams *p) {
+  static const struct {
+    const char *key;
+    size_t offset;
+  } keys[] = {
+      {"funcs", offsetof(GenParams, funcs)},
+      {"stmts", offsetof(GenParams, stmts)},
+      {"depth", offsetof(GenParams, depth)},
+      {"nesting", offsetof(GenParams, nesting)},
+      {"comments", offsetof(GenParams, comments)},
+      {"errors", offsetof(GenParams, errors)},
+  };
+  while (*spec) {
+    const char *eq = strchr(spec, '=');
+    if (!eq)
+      return false;
+    size_t len = eq - spec;
+    char *end;
+    long long value = strtoll(eq + 1, &end, 10);
+    if (len == 4 && memcmp(spec, "seed", 4) == 0) {
+      p->seed = (unsigned long long)value;
+    } else {
+      size_t k = 0;
+      while (k < sizeof(keys) / sizeof(keys[0]) &&
+             !(strlen(keys[k].key) == len &&
+               memcmp(keys[k].key, spec, len) == 0))
+        k++;
+      if (k == sizeof(keys) / sizeof(keys[0]))
+        return false;
+      *(int *)((char *)p + keys[k].offset) = (int)value;
+    }
+    spec = *end == ',' ? end + 1 : end;
+    if (*end && *end != ',')
+      return false;
+  }
+  return true;
+}
+
+/* --- FRONT-END BENCHMARKS --- */
+
+/* Generated workloads through the lexer, dfa_classify alone, token
+ * loading, the LL(1) driver and semantic analysis. Each workload runs in a
+ * child process so its peak RSS is its own; phases repeat until they have
+ * run for fe_min_seconds. */
+#define BENCH_FE_FILE "bench_front_end.c"
+#define BENCH_FE_REPORT "bench_front_end.json"
+
+const char *fe_path = BENCH_FE_FILE; /* source the phases run on */
+double fe_min_seconds = 0.2;
+
+const char *bench_report = NULL; /* --bench-report, JSON */
+
+typedef struct {
+  const char *name;
+  GenParams params; /* funcs is multiplied by the scale */
+} FeWorkload;
+
+static const FeWorkload fe_workloads[] = {
+    {"wide", {1, 200, 4, 2, 1, 5, 0}},
+    {"deep_expr", {2, 20, 8, 6, 1, 5, 0}},
+    {"nested_loops", {3, 40, 4, 2, 6, 5, 0}},
+    {"commented", {4, 50, 8, 3, 2, 90, 0}},
+    {"near_valid", {5, 100, 8, 3, 2, 10, 5}},
+};
+
+#define FE_PHASES(X)                                                           \
+  X(lex)      /* run_lexer: source to the token table */                       \
+  X(classify) /* dfa_classify over every lexeme */                             \
+  X(load)     /* the token kinds the parser reads, from the table */           \
+  X(parse)    /* parse_with_visualization */                                   \
+  X(check)    /* run_semantic_checks */
+
+#define FE_ENUM(phase) FE_##phase,
+#define FE_NAME(phase) #phase,
+enum { FE_PHASES(FE_ENUM) FE_NUM_PHASES };
+const char *fe_phase_names[] = {FE_PHASES(FE_NAME)};
+
+typedef struct {
+  double seconds[FE_NUM_PHASES]; /* per run, 0 when skipped */
+  long long bytes, tokens, steps;
+  bool accepted;
+} FeResult;
+
+static volatile char fe_sink;
+
+static void fe_run_phase(int phase) {
+  switch (phase) {
+  case FE_lex:
+    run_lexer(fe_path);
+    break;
+  case FE_classify:
+    for (int i = 0; i < lexed_count; i++) {
+      int id = lexed[i].name;
+      fe_sink = dfa_classify(name_of(id), name_len[id], false);
+    }
+    break;
+  case FE_load:
+    if (token_file)
+      load_tokens(token_file);
+    else
+      load_lexed_tokens();
+    break;
+  case FE_parse:
+    tpos = 0;
+    fe_sink = (char)parse_with_visualization();
+    break;
+  case FE_check:
+    fe_sink = (char)run_semantic_checks();
+    break;
+  }
+}
+
+/* Seconds per run of phase, repeated for at least fe_min_seconds */
+static double fe_time_phase(int phase) {
+  int runs = 0;
+  double t0 = now_seconds(), dt;
+  do {
+    fe_run_phase(phase);
+    runs++;
+    dt = now_seconds() - t0;
+  } while (dt < fe_min_seconds);
+  return dt / runs;
+}
+
+/* Runs in a child process: the parser reports errors on stdout */
+static void fe_measure(FeResult *r) {
+  memset(r, 0, sizeof(*r));
+  FILE *f = fopen(fe_path, "rb");
+  if (f) {
+    fseek(f, 0, SEEK_END);
+    r->bytes = ftell(f);
+    fclose(f);
+  }
+  r->seconds[FE_lex] = fe_time_phase(FE_lex);
+  r->tokens = lexed_count;
+  r->seconds[FE_classify] = fe_time_phase(FE_classify);
+  r->seconds[FE_load] = fe_time_phase(FE_load);
+  r->seconds[FE_parse] = fe_time_phase(FE_parse);
+  r->steps = parse_steps;
+  tpos = 0;
+  r->accepted = parse_with_visualization();
+  if (r->accepted) {
+    r->seconds[FE_check] = fe_time_phase(FE_check);
+    r->accepted = run_semantic_checks() == 0;
+  }
+}
+
+/* Units per second for a phase: bytes for the lexer, parse steps for the
+ * parser, tokens otherwise */
+static double fe_rate(const FeResult *r, int phase) {
+  if (r->seconds[phase] <= 0)
+    return 0;
+  long long units = phase == FE_parse ? r->steps : r->tokens;
+  return units / r->seconds[phase];
+}
+
+int run_front_end_benchmarks(int scale) {
+  const char *report = bench_report ? bench_report : BENCH_FE_REPORT;
+  FILE *json = fopen(report, "w");
+  if (!json) {
+    perror(report);
+    return 1;
+  }
+  fprintf(json, "{\n  \"benchmark\": \"front_end\",\n  \"scale\": %d,\n",
+          scale);
+  fprintf(json, "  \"workloads\": [");
+  printf("%-13s %9s %8s | %8s %8s | %8s %8s %8s %8s | %8s\n", "", "",
+         "", "lex", "", "classify", "load", "parse", "check", "peak");
+  printf("%-13s %9s %8s | %8s %8s | %8s %8s %8s %8s | %8s\n", "workload",
+         "bytes", "tokens", "MB/s", "Mtok/s", "Mtok/s", "Mtok/s",
+         "Mstep/s", "Mtok/s", "RSS MB");
+  int nworkloads = sizeof(fe_workloads) / sizeof(fe_workloads[0]);
+  for (int w = 0; w < nworkloads; w++) {
+    const FeWorkload *wl = &fe_workloads[w];
+    GenParams p = wl->params;
+    p.funcs *= scale;
+    FILE *f = fopen(BENCH_FE_FILE, "w");
+    if (!f) {
+      perror(BENCH_FE_FILE);
+      return 1;
+    }
+    generate_program(f, &p);
+    fclose(f);
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+      perror("pipe");
+      return 1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      if (!freopen("/dev/null", "w", stdout))
+        _exit(1);
+      FeResult r;
+      fe_measure(&r);
+      _exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+    }
+    close(fds[1]);
+    FeResult r;
+    bool ok = read(fds[0], &r, sizeof(r)) == sizeof(r);
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || !ok) {
+      fprintf(stderr, "benchmark %s failed\n", wl->name);
+      return 1;
+    }
+    double peak_mb = usage.ru_maxrss / 1024.0; /* KiB on Linux */
+
+    printf("%-13s %9lld %8lld | %8.1f %8.2f | ", wl->name, r.bytes, r.tokens,
+           r.bytes / r.seconds[FE_lex] / 1e6, fe_rate(&r, FE_lex) / 1e6);
+    for (int ph = FE_classify; ph < FE_NUM_PHASES; ph++) {
+      if (r.seconds[ph] > 0)
+        printf("%8.2f ", fe_rate(&r, ph) / 1e6);
+      else
+        printf("%8s ", "n/a");
+    }
+    printf("| %8.1f\n", peak_mb);
+
+    fprintf(json, "%s\n    {\"name\": \"%s\", \"seed\": %llu, ", w ? "," : "",
+            wl->name, p.seed);
+    fprintf(json,
+            "\"funcs\": %d, \"stmts\": %d, \"depth\": %d, \"nesting\": %d, "
+            "\"comments\": %d, \"errors\": %d,\n",
+            p.funcs, p.stmts, p.depth, p.nesting, p.comments, p.errors);
+    fprintf(json,
+            "     \"bytes\": %lld, \"tokens\": %lld, \"parse_steps\": %lld, "
+            "\"accepted\": %s, \"peak_rss_kb\": %ld,\n",
+            r.bytes, r.tokens, r.steps, r.accepted ? "true" : "false",
+            (long)usage.ru_maxrss);
+    fprintf(json, "     \"lex_bytes_per_s\": %.0f",
+            r.bytes / r.seconds[FE_lex]);
+    for (int ph = 0; ph < FE_NUM_PHASES; ph++)
+      fprintf(json, ", \"%s_%s_per_s\": %.0f", fe_phase_names[ph],
+              ph == FE_parse ? "steps" : "tokens", fe_rate(&r, ph));
+    fprintf(json, "}");
+  }
+  fprintf(json, "\n  ]\n}\n");
+  fclose(json);
+  printf("report written to %s\n", report);
+  return 0;
+}
+
+/* --- GOLDEN CORPUS --- */
+
+/* Regression gate over source files whose header comment documents what
+ * the front end must produce, as the examples do:
+ *
+ *   Expected Token Sequence:
+ *   I T M B B B ...
+ *   Expected Result: ACCEPTED
+ *
+ * Files are checked in parallel, each in a child process that keeps its
+ * tokens in memory. Speed is measured on the corpus as a whole, alone in
+ * one more child: every phase of every file, in passes filling a window of
+ * GOLDEN_WINDOW seconds, best of GOLDEN_REPEATS windows. Against a baseline
+ * recorded the same way, a phase fails the run only when it drops more than
+ * golden_max_regression percent plus the noise, how far the median window
+ * fell below the best, so an unchanged binary on a busy machine passes. */
+#define GOLDEN_BASELINE "golden_baseline.txt"
+#define GOLDEN_WINDOW 0.4
+#define GOLDEN_REPEATS 5
+#define GOLDEN_MAX_TOKENS 4096 /* expected tokens read from one header */
+
+const char *golden_baseline = NULL; /* --baseline, GOLDEN_BASELINE if unset */
+bool golden_update = false;         /* --update-baseline */
+double golden_max_regression = 20;  /* --max-regression, percent */
+
+typedef struct {
+  FeResult fe;
+  bool readable;
+  int expected_tokens; /* -1 when the header gives no sequence */
+  int expect_accept;   /* -1 when the header gives no result */
+  int mismatch;        /* first differing token, -1 when all match */
+  char want, got;      /* the tokens at mismatch, 0 past the end */
+} GoldenResult;
+
+/* A header line of single-letter tokens ("I T F B ..."), appended to
+ * want; returns false for any other line */
+static bool golden_token_line(const char *p, char *want, int *n) {
+  int added = 0;
+  for (; *p && *p != '\n'; p++) {
+    if (isspace((unsigned char)*p))
+      continue;
+    if (!isupper((unsigned char)*p) || (p[1] && !isspace((unsigned char)p[1])))
+      return false;
+    if (*n < GOLDEN_MAX_TOKENS)
+      want[(*n)++] = *p;
+    added++;
+  }
+  return added > 0;
+}
+
+/* Reads the expectations from the comment that opens path */
+static void golden_expectations(const char *path, char *want, int *nwant,
+                                int *accept) {
+  *nwant = *accept = -1;
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return;
+  char line[MAXLINE];
+  bool in_sequence = false;
+  while (fgets(line, sizeof(line), f)) {
+    char *p = line;
+    while (*p == ' ' || *p == '\t' || *p == '/' || *p == '*')
+      p++;
+    if (in_sequence)
+      in_sequence = golden_token_line(p, want, nwant);
+    if (strstr(p, "Expected Token Sequence:")) {
+      in_sequence = true;
+      *nwant = 0;
+    }
+    char *result = strstr(p, "Expected Result:");
+    if (result)
+      *accept = strstr(result, "ACCEPTED")   ? 1
+                : strstr(result, "REJECTED") ? 0
+                                             : -1;
+    if (strstr(line, "*/"))
+      break;
+  }
+  fclose(f);
+}
+
+/* Runs in a child process */
+static void golden_check(const char *path, GoldenResult *r) {
+  char want[GOLDEN_MAX_TOKENS];
+  FILE *f = fopen(path, "r");
+  r->readable = f != NULL;
+  if (!f)
+    return;
+  fclose(f);
+  golden_expectations(path, want, &r->expected_tokens, &r->expect_accept);
+  fe_path = path;
+  memset(&r->fe, 0, sizeof(r->fe));
+  for (int ph = FE_lex; ph <= FE_parse; ph++)
+    fe_run_phase(ph);
+  r->fe.tokens = lexed_count;
+  r->fe.steps = parse_steps;
+  tpos = 0;
+  r->fe.accepted =
+      parse_with_visualization() && run_semantic_checks() == 0;
+  r->mismatch = -1;
+  int n = r->expected_tokens;
+  for (int i = 0; n >= 0 && (i < n || i < lexed_count); i++) {
+    char w = i < n ? want[i] : 0, g = i < lexed_count ? lexed[i].kind : 0;
+    if (w != g) {
+      r->mismatch = i;
+      r->want = w;
+      r->got = g;
+      break;
+    }
+  }
+}
+
+typedef struct {
+  double rate[FE_NUM_PHASES];   /* best window, units per second */
+  double noise[FE_NUM_PHASES];  /* median window below the best, percent */
+} GoldenTiming;
+
+double golden_base[FE_NUM_PHASES]; /* corpus rates; 0 when not recorded */
+
+/* Lines of "phase units-per-second"; # starts a comment */
+static bool golden_load_baseline(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  char line[MAXLINE], phase[32];
+  double rate;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || sscanf(line, "%31s %lf", phase, &rate) != 2)
+      continue;
+    for (int ph = 0; ph < FE_NUM_PHASES; ph++)
+      if (strcmp(fe_phase_names[ph], phase) == 0)
+        golden_base[ph] = rate;
+  }
+  fclose(f);
+  return true;
+}
+
+static int golden_rate_order(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Runs in a child process: the corpus files that checked out, every phase
+ * timed separately and summed over the corpus. Semantic checks run only
+ * on files the parser accepts. */
+static void golden_time_corpus(char **files, int nfiles,
+                               const GoldenResult *results, const bool *ran,
+                               GoldenTiming *t) {
+  double rates[FE_NUM_PHASES][GOLDEN_REPEATS];
+  memset(t, 0, sizeof(*t));
+  for (int rep = 0; rep < GOLDEN_REPEATS; rep++) {
+    double seconds[FE_NUM_PHASES] = {0}, units[FE_NUM_PHASES] = {0};
+    double t0 = now_seconds();
+    do {
+      for (int i = 0; i < nfiles; i++) {
+        if (!ran[i] || !results[i].readable)
+          continue;
+        fe_path = files[i];
+        for (int ph = 0; ph < FE_NUM_PHASES; ph++) {
+          if (ph == FE_check && !results[i].fe.accepted)
+            break;
+          double start = now_seconds();
+          fe_run_phase(ph);
+          seconds[ph] += now_seconds() - start;
+          units[ph] += ph == FE_parse ? parse_steps : lexed_count;
+        }
+      }
+    } while (now_seconds() - t0 < GOLDEN_WINDOW);
+    for (int ph = 0; ph < FE_NUM_PHASES; ph++)
+      rates[ph][rep] = seconds[ph] > 0 ? units[ph] / seconds[ph] : 0;
+  }
+  for (int ph = 0; ph < FE_NUM_PHASES; ph++) {
+    qsort(rates[ph], GOLDEN_REPEATS, sizeof(double), golden_rate_order);
+    t->rate[ph] = rates[ph][GOLDEN_REPEATS - 1];
+    if (t->rate[ph] > 0)
+      t->noise[ph] = (1 - rates[ph][GOLDEN_REPEATS / 2] / t->rate[ph]) * 100;
+  }
+}
+
+/* Time the corpus in a child process, alone; false if it failed */
+static bool golden_timing(char **files, int nfiles,
+                          const GoldenResult *results, const bool *ran,
+                          GoldenTiming *t) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return false;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    token_file = NULL;
+    if (!freopen("/dev/null", "w", stdout))
+      _exit(1);
+    GoldenTiming timing;
+    golden_time_corpus(files, nfiles, results, ran, &timing);
+    _exit(write(fds[1], &timing, sizeof(timing)) == sizeof(timing) ? 0 : 1);
+  }
+  close(fds[1]);
+  bool ok = read(fds[0], t, sizeof(*t)) == sizeof(*t);
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  return ok;
+}
+
+/* Prints the corpus speed per phase and returns whether it passed */
+static bool golden_report_timing(const GoldenTiming *t, bool compare) {
+  bool pass = true;
+  for (int ph = 0; ph < FE_NUM_PHASES; ph++) {
+    if (t->rate[ph] <= 0)
+      continue;
+    const char *unit = ph == FE_parse ? "Mstep/s" : "Mtok/s";
+    printf("%-4s %-28s %8.2f %-7s noise %4.1f%%", "", fe_phase_names[ph],
+           t->rate[ph] / 1e6, unit, t->noise[ph]);
+    double base = golden_base[ph];
+    if (compare && base > 0) {
+      double change = (t->rate[ph] / base - 1) * 100;
+      bool slow = change < -(golden_max_regression + t->noise[ph]);
+      printf("  baseline %8.2f %+6.1f%%%s", base / 1e6, change,
+             slow ? "  FAIL" : "");
+      pass = pass && !slow;
+    }
+    printf("\n");
+  }
+  return pass;
+}
+
+/* Prints one file's line and returns whether it passed */
+static bool golden_report(const char *path, const GoldenResult *r) {
+  bool pass = true;
+  char why[512] = "";
+  size_t len = 0;
+  if (r->expected_tokens < 0 && r->expect_accept < 0)
+    len += snprintf(why + len, sizeof(why) - len, "; no expectations");
+  if (r->mismatch >= 0) {
+    pass = false;
+    len += snprintf(why + len, sizeof(why) - len,
+                    "; token %d: expected %c, got %c", r->mismatch + 1,
+                    r->want ? r->want : '$', r->got ? r->got : '$');
+  }
+  if (r->expect_accept >= 0 && r->expect_accept != r->fe.accepted) {
+    pass = false;
+    len += snprintf(why + len, sizeof(why) - len, "; expected %s",
+                    r->expect_accept ? "ACCEPTED" : "REJECTED");
+  }
+  printf("%-4s %-28s %5lld tokens  %-8s%s\n", pass ? "ok" : "FAIL", path,
+         r->fe.tokens, r->fe.accepted ? "ACCEPTED" : "REJECTED", why);
+  return pass;
+}
+
+/* Check every file on up to jobs processes (0: one per core) and print the
+ * results in input order. Returns 0 when all passed. */
+int run_golden(char **files, int nfiles, int jobs) {
+  if (jobs <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cores > 0 ? (int)cores : 1;
+  }
+  GoldenResult *results = calloc(nfiles + 1, sizeof(GoldenResult));
+  bool *ran = calloc(nfiles + 1, sizeof(bool));
+  pid_t *pids = calloc(nfiles + 1, sizeof(pid_t));
+  int *fds = calloc(nfiles + 1, sizeof(int));
+  if (!results || !ran || !pids || !fds) {
+    perror("golden");
+    return 1;
+  }
+  const char *baseline = golden_baseline ? golden_baseline : GOLDEN_BASELINE;
+  bool compare = !golden_update && golden_load_baseline(baseline);
+
+  double t0 = now_seconds();
+  int next = 0, running = 0;
+  while (next < nfiles || running > 0) {
+    while (running < jobs && next < nfiles) {
+      int i = next++, pipefd[2];
+      if (pipe(pipefd) != 0) {
+        perror("pipe");
+        return 1;
+      }
+      fflush(stdout);
+      pids[i] = fork();
+      if (pids[i] < 0) {
+        perror("fork");
+        return 1;
+      }
+      if (pids[i] == 0) {
+        close(pipefd[0]);
+        token_file = NULL; /* the checks run side by side */
+        if (!freopen("/dev/null", "w", stdout))
+          _exit(1);
+        GoldenResult r;
+        golden_check(files[i], &r);
+        _exit(write(pipefd[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+      }
+      close(pipefd[1]);
+      fds[i] = pipefd[0];
+      running++;
+    }
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+      break;
+    for (int i = 0; i < next; i++)
+      if (pids[i] == pid) {
+        ran[i] = read(fds[i], &results[i], sizeof(GoldenResult)) ==
+                 sizeof(GoldenResult);
+        close(fds[i]);
+        running--;
+        break;
+      }
+  }
+  double elapsed = now_seconds() - t0;
+
+  int passed = 0;
+  for (int i = 0; i < nfiles; i++) {
+    if (!ran[i] || !results[i].readable) {
+      printf("%-4s %-28s %s\n", "FAIL", files[i],
+             ran[i] ? "cannot be read" : "crashed");
+      continue;
+    }
+    passed += golden_report(files[i], &results[i]);
+  }
+  printf("%d of %d files passed in %.2fs on %d processes\n", passed, nfiles,
+         elapsed, jobs < nfiles ? jobs : nfiles);
+
+  GoldenTiming timing;
+  bool timed = golden_timing(files, nfiles, results, ran, &timing);
+  bool fast = timed && golden_report_timing(&timing, compare);
+  printf("corpus speed: best of %d windows of %.2fs", GOLDEN_REPEATS,
+         GOLDEN_WINDOW);
+  if (compare)
+    printf(" (baseline %s, %.0f%% plus noise allowed)", baseline,
+           golden_max_regression);
+  printf("%s\n", !timed ? ", FAILED" : fast ? "" : ", SLOWER");
+
+  if (golden_update) {
+    FILE *out = fopen(baseline, "w");
+    if (!out) {
+      perror(baseline);
+      return 1;
+    }
+    fprintf(out, "# golden baseline: phase units-per-second over %d files\n",
+            nfiles);
+    for (int ph = 0; timed && ph < FE_NUM_PHASES; ph++)
+      if (timing.rate[ph] > 0)
+        fprintf(out, "%s %.0f\n", fe_phase_names[ph], timing.rate[ph]);
+    fclose(out);
+    printf("baseline written to %s\n", baseline);
+  }
+  free(results);
+  free(ran);
+  free(pids);
+  free(fds);
+  return passed == nfiles && fast ? 0 : 1;
+}
+
+/* --- DFA HEATMAP --- */
+
+/* Which DFA states and input classes real traffic exercises. The lexer
+ * counts every next_state lookup (the dfa_heat statistic); over a corpus
+ * the counts are printed as a heatmap, and a renumbering hint ranks the
+ * states by how often their row is read, so the hot rows of next_state
+ * can be packed together. */
+#ifdef STATS
+#define DFA_HEAT_GLYPHS ".:-=+*#%@" /* log scale, taken at least once */
+
+static int dfa_heat_bits(long long n) {
+  int bits = 0;
+  while (n >> bits)
+    bits++;
+  return bits;
+}
+
+/* One character per input class, in next_state column order */
+static const char dfa_input_labels[] = "#includes<to.h>rbkwafmpF_9A+=,:(){}?";
+
+/* Hottest first; D0 stays the start state and DEAD stays last */
+static long long *dfa_heat_rows;
+static int dfa_heat_compare(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  if (x == D0 || y == DEAD)
+    return x == y ? 0 : -1;
+  if (y == D0 || x == DEAD)
+    return 1;
+  if (dfa_heat_rows[x] != dfa_heat_rows[y])
+    return dfa_heat_rows[x] > dfa_heat_rows[y] ? -1 : 1;
+  return x - y;
+}
+#endif
+
+/* Lex every file, print the heatmap and write the hint to hint_path */
+int run_dfa_heatmap(const char *hint_path, char **files, int nfiles) {
+#ifdef STATS
+  memset(stats.dfa_heat, 0, sizeof(stats.dfa_heat));
+  dfa_heat_on = true;
+  int lexed_files = 0;
+  for (int i = 0; i < nfiles; i++)
+    lexed_files += run_lexer(files[i]) == 0;
+  dfa_heat_on = false;
+
+  long long rows[NUM_STATES] = {0}, max = 0, total = 0;
+  bool reached[NUM_STATES] = {false};
+  int taken = 0, live = 0, dead_taken = 0;
+  for (int s = 0; s < NUM_STATES; s++)
+    for (int c = 0; c < NUM_INPUTS; c++) {
+      long long n = stats.dfa_heat[s][c];
+      rows[s] += n;
+      total += n;
+      max = n > max ? n : max;
+      live += next_state[s][c] != DEAD;
+      if (!n)
+        continue;
+      taken++;
+      dead_taken += next_state[s][c] == DEAD;
+      reached[s] = reached[next_state[s][c]] = true;
+    }
+
+  printf("DFA heatmap: %lld lookups over %d of %d files\n", total,
+         lexed_files, nfiles);
+  printf("state %s   lookups\n", dfa_input_labels);
+  int top = dfa_heat_bits(max) > 1 ? dfa_heat_bits(max) - 1 : 1;
+  for (int s = 0; s < NUM_STATES; s++) {
+    if (!rows[s])
+      continue;
+    printf("D%-4d ", s);
+    for (int c = 0; c < NUM_INPUTS; c++) {
+      long long n = stats.dfa_heat[s][c];
+      int glyph = (dfa_heat_bits(n) - 1) * (strlen(DFA_HEAT_GLYPHS) - 1) / top;
+      putchar(n ? DFA_HEAT_GLYPHS[glyph] : ' ');
+    }
+    printf(" %9lld\n", rows[s]);
+  }
+  int nreached = 0;
+  for (int s = 0; s < NUM_STATES; s++)
+    nreached += reached[s];
+  printf("%d of %d states reached, %d of %d live transitions taken, "
+         "%d lookups ran into DEAD\n",
+         nreached, NUM_STATES, taken - dead_taken, live, dead_taken);
+
+  int order[NUM_STATES];
+  for (int s = 0; s < NUM_STATES; s++)
+    order[s] = s;
+  dfa_heat_rows = rows;
+  qsort(order, NUM_STATES, sizeof(int), dfa_heat_compare);
+  int hot = 0;
+  for (long long covered = 0; hot < NUM_STATES && covered * 100 < total * 99;)
+    covered += rows[order[hot++]];
+  printf("%d hot rows (%zu bytes of next_state) serve 99%% of lookups\n", hot,
+         hot * sizeof(next_state[0]));
+
+  FILE *out = fopen(hint_path, "w");
+  if (!out) {
+    perror(hint_path);
+    return 1;
+  }
+  fprintf(out, "# DFA state renumbering hint from %d files: rows of\n",
+          lexed_files);
+  fprintf(out, "# next_state by lookups, hottest first. D0 stays the start\n");
+  fprintf(out, "# state and DEAD (D%d) stays last.\n", DEAD);
+  fprintf(out, "# old new lookups\n");
+  for (int i = 0; i < NUM_STATES; i++)
+    fprintf(out, "%d %d %lld\n", order[i], i, rows[order[i]]);
+  fclose(out);
+  printf("renumbering hint written to %s\n", hint_path);
+  return lexed_files == nfiles ? 0 : 1;
+#else
+  (void)hint_path, (void)files, (void)nfiles;
+  fprintf(stderr, "the DFA heatmap needs the counters NO_STATS removes\n");
+  return 1;
+#endif
+}
+
+/* --- FUZZING --- */
+
+/* Searches for inputs that make the front end slow rather than crash it.
+ * Built with -DFUZZING, the file provides LLVMFuzzerTestOneInput instead
+ * of main (clang -fsanitize=fuzzer, or AFL++ through its libFuzzer
+ * driver). Besides code coverage, libFuzzer sees the work done per input
+ * byte: parse steps, DFA transitions and buffer allocations, each binned
+ * on a log scale into extra counters, so an input that reaches a costlier
+ * bin counts as new coverage and the corpus climbs towards superlinear
+ * cases. --fuzz-cost replays what it finds as regression cases. Tokens stay
+ * in memory, and every input starts from empty names and buffers, so its
+ * cost depends on that input alone. */
+#define FUZZ_COST_BINS 20      /* per measure, log2 of cost per 16 bytes */
+#define FUZZ_MAX_PER_BYTE 16.0 /* --fuzz-cost budget for each measure */
+
+typedef struct {
+  long long bytes, steps, transitions, allocations;
+  double seconds;
+  bool accepted;
+} FuzzCost;
+
+/* Free the names and the buffers whose growth the allocations measure
+ * counts, so the next input grows them from nothing */
+static void fuzz_reset(void) {
+  intern_reset();
+  free(lexed);
+  lexed = NULL;
+  lexed_count = lexed_cap = 0;
+  free(tokens);
+  tokens = NULL;
+  tokens_cap = tcount = 0;
+  free(stack);
+  stack = NULL;
+  stack_top = -1;
+  stack_cap = 0;
+}
+
+/* The front end over in, with the counters it moved; no token file is
+ * written and no #include "file" is read */
+static void fuzz_measure(FILE *in, const char *name, FuzzCost *c) {
+  const char *saved_token_file = token_file;
+  bool saved_include_modules = include_modules;
+  token_file = NULL;
+  include_modules = false;
+  fuzz_reset();
+#ifdef STATS
+  long long transitions = stats.dfa_transitions;
+  long long allocations = stats.allocations;
+#endif
+  parse_steps = 0;
+  double t0 = now_seconds();
+  c->accepted = compile_front_end_stream(in, name);
+  c->seconds = now_seconds() - t0;
+  c->steps = parse_steps;
+#ifdef STATS
+  c->transitions = stats.dfa_transitions - transitions;
+  c->allocations = stats.allocations - allocations;
+#else
+  c->transitions = c->allocations = 0;
+#endif
+  token_file = saved_token_file;
+  include_modules = saved_include_modules;
+}
+
+#ifdef FUZZING
+__attribute__((section("__libfuzzer_extra_counters"))) static uint8_t
+    fuzz_counters[3 * FUZZ_COST_BINS];
+
+static void fuzz_bin(int measure, long long cost, long long bytes) {
+  long long per16 = cost * 16 / (bytes > 0 ? bytes : 1);
+  int bin = 0;
+  while (per16 >> bin && bin < FUZZ_COST_BINS - 1)
+    bin++;
+  fuzz_counters[measure * FUZZ_COST_BINS + bin] = 1;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  (void)argc, (void)argv;
+  verbose = false;
+  /* parse and semantic errors go to stdout */
+  if (!freopen("/dev/null", "w", stdout))
+    perror("fuzz");
+  init_dfa();
+  return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size == 0)
+    return 0;
+  FILE *in = fmemopen((void *)data, size, "r");
+  if (!in)
+    return 0;
+  FuzzCost c;
+  fuzz_measure(in, "fuzz", &c);
+  fclose(in);
+  fuzz_bin(0, c.steps, size);
+  fuzz_bin(1, c.transitions, size);
+  fuzz_bin(2, c.allocations, size);
+  return 0;
+}
+#endif
+
+/* Replay inputs (fuzzer finds kept as regression cases) and fail any whose
+ * work per byte goes over FUZZ_MAX_PER_BYTE. Each runs twice and fails if
+ * the counts differ: a cost carried over from an earlier input would. */
+int run_fuzz_cost(char **files, int nfiles) {
+  int failed = 0;
+  printf("%-32s %8s %9s %9s %9s %9s\n", "file", "bytes", "steps/B", "dfa/B",
+         "allocs/B", "ns/B");
+  for (int i = 0; i < nfiles; i++) {
+    FILE *in = fopen(files[i], "r");
+    if (!in) {
+      perror(files[i]);
+      failed++;
+      continue;
+    }
+    fseek(in, 0, SEEK_END);
+    long long bytes = ftell(in);
+    rewind(in);
+    FuzzCost c, again;
+    fflush(stdout);
+    int saved = dup(1), null = open("/dev/null", O_WRONLY);
+    dup2(null, 1); /* parse errors are expected */
+    fuzz_measure(in, files[i], &c);
+    rewind(in);
+    fuzz_measure(in, files[i], &again);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    close(null);
+    fclose(in);
+    double per = bytes > 0 ? 1.0 / bytes : 0;
+    double steps = c.steps * per, dfa = c.transitions * per;
+    double allocs = c.allocations * per;
+    bool over = steps > FUZZ_MAX_PER_BYTE || dfa > FUZZ_MAX_PER_BYTE ||
+                allocs > FUZZ_MAX_PER_BYTE;
+    bool repeats = c.steps == again.steps &&
+                   c.transitions == again.transitions &&
+                   c.allocations == again.allocations;
+    printf("%-32s %8lld %9.3f %9.3f %9.3f %9.1f%s%s\n", files[i], bytes,
+           steps, dfa, allocs, c.seconds * 1e9 * per,
+           over ? "  OVER BUDGET" : "", repeats ? "" : "  NOT REPEATABLE");
+    failed += over || !repeats;
+  }
+  return failed ? 1 : 0;
+}
+
+/* --- BATCH EXECUTION --- */
+
+/* Many compiled programs run across worker threads. Each worker owns a VM
+ * and an output buffer and takes jobs from its own deque, stealing from
+ * the others when it runs dry; results are printed in input order once all
+ * workers have finished. */
+
+/* Chase-Lev work-stealing deque of job indices. The owner pushes and pops
+ * at the bottom, thieves take from the top. Jobs are all pushed before the
+ * workers start, so the array never grows. */
+typedef struct {
+  _Alignas(64) atomic_long top;
+  _Alignas(64) atomic_long bottom;
+  int *items;
+  long cap;
+} WsDeque;
+
+static void ws_push(WsDeque *d, int job) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  d->items[b % d->cap] = job;
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+/* Owner side; -1 when empty. */
+static int ws_pop(WsDeque *d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  if (t > b) {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return -1;
+  }
+  int job = d->items[b % d->cap];
+  if (t == b) {
+    /* last item: race the thieves for it */
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+      job = -1;
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+/* Thief side; -1 when empty, -2 when another thread won the race. */
+static int ws_steal(WsDeque *d) {
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b)
+    return -1;
+  int job = d->items[t % d->cap];
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return -2;
+  return job;
+}
+
+typedef struct {
+  const char *path;
+  BcProgram *prog; /* NULL when the front end rejected the file */
+  int rc, status;
+  int worker;        /* whose buffer holds the output */
+  long out_at, out_len;
+} BatchJob;
+
+typedef struct {
+  int id;
+  pthread_t thread;
+  WsDeque deque;
+  VM vm;
+  FILE *out;
+  char *buf;
+  size_t size;
+  int ran, stolen;
+} BatchWorker;
+
+BatchJob *batch_jobs = NULL;
+BatchWorker *batch_workers = NULL;
+int batch_nworkers = 0;
+
+static void batch_run_job(BatchWorker *w, int j) {
+  BatchJob *job = &batch_jobs[j];
+  job->worker = w->id;
+  job->out_at = ftell(w->out);
+  double span = trace_begin();
+  vm_reset(&w->vm, job->prog, w->out);
+  if (use_jit)
+    vm_enable_jit(&w->vm);
+  job->status = vm_run(&w->vm);
+  job->rc = (int)w->vm.result;
+  if (job->status != VM_OK) {
+    fprintf(w->out, "runtime error: %s in %s\n",
+            vm_status_names[job->status],
+            job->prog->funcs[w->vm.error_func].name);
+    job->rc = 1;
+  }
+  job->out_len = ftell(w->out) - job->out_at;
+  w->ran++;
+  trace_end("run", job->path, span);
+}
+
+static void *batch_worker(void *arg) {
+  BatchWorker *w = arg;
+  trace_name_thread("batch worker %d", w->id);
+  for (;;) {
+    int j = ws_pop(&w->deque);
+    /* own deque empty: sweep the others until a full pass finds nothing */
+    for (bool busy = true; j < 0 && busy;) {
+      busy = false;
+      for (int k = 1; k < batch_nworkers && j < 0; k++) {
+        BatchWorker *victim = &batch_workers[(w->id + k) % batch_nworkers];
+        j = ws_steal(&victim->deque);
+        busy |= j == -2;
+      }
+    }
+    if (j < 0)
+      return NULL;
+    if (batch_jobs[j].worker != w->id)
+      w->stolen++;
+    batch_run_job(w, j);
+  }
+}
+
+/* Compile every file (the front end is single-threaded), run the accepted
+ * ones on nworkers threads (0: one per core), then print each program's
+ * output and exit code in input order. Returns 1 if any program was
+ * rejected or failed. */
+int run_batch(char **files, int nfiles, int nworkers) {
+  if (nworkers <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = cores > 0 ? (int)cores : 1;
+  }
+  if (nworkers > nfiles)
+    nworkers = nfiles > 0 ? nfiles : 1;
+  batch_jobs = calloc(nfiles > 0 ? nfiles : 1, sizeof(BatchJob));
+  batch_workers = calloc(nworkers, sizeof(BatchWorker));
+  if (!batch_jobs || !batch_workers) {
+    perror("batch");
+    return 1;
+  }
+  batch_nworkers = nworkers;
+
+  double t0 = now_seconds();
+  for (int i = 0; i < nfiles; i++) {
+    batch_jobs[i].path = files[i];
+    if (compile_front_end(files[i])) {
+      double span = trace_begin();
+      batch_jobs[i].prog = compile_program(false);
+      trace_end("compile", files[i], span);
+    }
+  }
+  double t1 = now_seconds();
+
+  for (int k = 0; k < nworkers; k++) {
+    BatchWorker *w = &batch_workers[k];
+    w->id = k;
+    w->deque.cap = nfiles / nworkers + 1;
+    w->deque.items = malloc(w->deque.cap * sizeof(int));
+    w->out = open_memstream(&w->buf, &w->size);
+    if (!w->deque.items || !w->out) {
+      perror("batch");
+      return 1;
+    }
+    vm_init(&w->vm, NULL, w->out);
+  }
+  /* deal the jobs round-robin; worker records the initial owner, so a
+   * job run elsewhere counts as stolen */
+  for (int i = 0, k = 0; i < nfiles; i++) {
+    if (!batch_jobs[i].prog)
+      continue;
+    batch_jobs[i].worker = k;
+    ws_push(&batch_workers[k].deque, i);
+    k = (k + 1) % nworkers;
+  }
+  for (int k = 1; k < nworkers; k++)
+    if (pthread_create(&batch_workers[k].thread, NULL, batch_worker,
+                       &batch_workers[k]) != 0) {
+      perror("batch");
+      return 1;
+    }
+  batch_worker(&batch_workers[0]);
+  for (int k = 1; k < nworkers; k++)
+    pthread_join(batch_workers[k].thread, NULL);
+  double t2 = now_seconds();
+
+  int failed = 0, stolen = 0;
+  for (int k = 0; k < nworkers; k++) {
+    fclose(batch_workers[k].out); /* buf and size are final now */
+    stolen += batch_workers[k].stolen;
+  }
+  for (int i = 0; i < nfiles; i++) {
+    BatchJob *job = &batch_jobs[i];
+    if (!job->prog) {
+      printf("=== %s: REJECTED\n", job->path);
+      failed++;
+      continue;
+    }
+    printf("=== %s: exit %d\n", job->path, job->rc);
+    fwrite(batch_workers[job->worker].buf + job->out_at, 1, job->out_len,
+           stdout);
+    failed += job->status != VM_OK;
+    bc_free(job->prog);
+  }
+  fprintf(stderr,
+          "batch: %d programs, compile %.3f s, run %.3f s on %d workers "
+          "(%.0f programs/s, %d stolen)\n",
+          nfiles, t1 - t0, t2 - t1, nworkers,
+          t2 > t1 ? nfiles / (t2 - t1) : 0.0, stolen);
+  for (int k = 0; k < nworkers; k++) {
+    vm_free(&batch_workers[k].vm);
+    free(batch_workers[k].deque.items);
+    free(batch_workers[k].buf);
+  }
+  free(batch_workers);
+  free(batch_jobs);
+  batch_workers = NULL;
+  batch_jobs = NULL;
+  return failed ? 1 : 0;
+}
+
+// --- DISPLAY FUNCTIONS ---
+
+void display_nfa_rules() {
+  printf("\n=== NFA PATTERN RULES ===\n");
+  printf("Token Type    | Pattern\n");
+  printf("------------- | -------\n");
+  printf("VARIABLE      | _[a-zA-Z]+[0-9][a-zA-Z]\n");
+  printf("FUNCTION      | [a-zA-Z]+Fn\n");
+  printf("LOOP_LABEL    | loop_[a-zA-Z]+[0-9][0-9]:\n");
+  printf("NUMBER        | [0-9]+\n");
+  printf("KEYWORD       | int|dec|printf|while|break|return|main\n");
+  printf("STATEMENT_END | ..\n");
+  printf("BRACKET       | ( | ) | { | }\n");
+  printf("OPERATOR      | ; | , | = | + | < | - | * | / | :\n");
+  printf("\n");
+}
+
+void display_dfa_matrix() {
+  printf("\n=== UNIFIED DFA TRANSITION MATRIX ===\n");
+  printf("Input Categories: 0=alpha, 1=digit, 2=_, 3=\", 4=., 5=bracket, 6=:, "
+         "7=other\n\n");
+  printf("State | alpha digit  _    \"    .    brkt :    othr | Accept\n");
+  printf("------+-------------------------------------------+-------\n");
+
+  const char *state_desc[] = {"START",      "alpha",   "digit",    "underscore",
+                              "dot1",       "bracket", "operator", "..",
+                              "unused",     "alpha+",  "id+digit", "_+alpha",
+                              "_alpha+dig", "VARIABLE"};
+
+  for (int i = 0; i < 14; i++) {
+    printf("%2d %-10s|", i, state_desc[i]);
+    for (int j = 0; j < NUM_INPUTS; j++) {
+      int next = next_state[i][j];
+      if (next == DEAD)
+        printf("  --  ");
+      else
+        printf("  %2d  ", next);
+    }
+    printf("| ");
+    if (accepting_tokens[i] != '\0')
+      printf("%c", accepting_tokens[i]);
+    printf("\n");
+  }
+  printf("\n");
+}
+
+void display_first_follow_sets() {
+  printf("\n=== FIRST AND FOLLOW SETS ===\n");
+  printf("Non-Terminal | FIRST Set           | FOLLOW Set\n");
+  printf("------------ | ------------------- | -------------------\n");
+  printf("Z            | {I,T}               | {$}\n");
+  printf("J            | {I, epsilon}        | {T}\n");
+  printf("Q            | {T, epsilon}        | {T}\n");
+  printf("U            | {T}                 | {T}\n");
+  printf("A            | {T}                 | {$}\n");
+  printf("C            | {T,V,R,P,K,O,eps}   | {B}\n");
+  printf("D            | {T,V,R,P,K,O}       | {T,V,R,P,K,O,B}\n");
+  printf("E            | {V,N,F,B}           | {S,B,O}\n");
+  printf("H            | {O, epsilon}        | {S,B}\n");
+  printf("G            | {V,N,F,B}           | {S,B,O}\n");
+  printf("\n");
+}
+
+void display_parsing_table() {
+  printf("\n=== LL(1) PARSING TABLE ===\n");
+  printf("Rows: Non-terminals (Z,Q,U,A,C,D,E,H,G,J)\n");
   printf("Cols: Terminals (I,T,F,V,N,P,R,K,M,B,O,S,W,$)\n\n");
 
-  const char *nonterms[] = {"S", "Q", "U", "A", "C", "D", "E", "H", "G"};
+  const char *nonterms[] = {"Z", "Q", "U", "A", "C",
+                            "D", "E", "H", "G", "J"};
   const char *terms[] = {"I", "T", "F", "V", "N", "P", "R", "K",
                          "M", "B", "O", "S", "W", "L", "$"};
 
@@ -1375,7 +10998,7 @@ void display_parsing_table() {
   }
   printf("\n");
 
-  for (int i = 0; i < 9; i++) {
+  for (int i = 0; i < 10; i++) {
     printf(" %s |", nonterms[i]);
     for (int j = 0; j < 15; j++) {
       int prod = parsing_table[i][j];
@@ -1391,10 +11014,344 @@ void display_parsing_table() {
   printf("\n");
 }
 
+void display_symbol_table() {
+  printf("\n=== SYMBOL TABLE ===\n");
+  printf("%-20s %-6s %-5s %-6s %-20s %-5s %s\n", "Name", "Kind", "Type",
+         "Scope", "Function", "Slot", "Line");
+  printf("-------------------- ------ ----- ------ -------------------- ----- "
+         "----\n");
+  const char *kinds[] = {"var", "param", "func"};
+  for (int i = 0; i < sym_count; i++) {
+    Symbol *s = &syms[i];
+    printf("%-20s %-6s %-5s %-6d %-20s ", name_of(s->name), kinds[s->kind],
+           type_name(s->type), s->depth, name_of(funcs[s->func].name));
+    if (s->slot >= 0)
+      printf("%-5d", s->slot);
+    else
+      printf("%-5s", "-");
+    printf(" %d\n", lexed[s->tok].line);
+  }
+  printf("\n");
+}
+
+/* The --stats report, as a table or as JSON */
+void display_stats(FILE *out, bool json) {
+#ifdef STATS
+  const char *sep = "";
+  if (json) {
+    fprintf(out, "{\"seconds\": {");
+    for (int ph = 0; ph < STAT_NUM_PHASES; ph++)
+      fprintf(out, "%s\"%s\": %.6f", ph ? ", " : "", stat_phase_names[ph],
+              stats.seconds[ph]);
+    fprintf(out,
+            "}, \"dfa_transitions\": %lld, \"dfa_dead_exits\": %lld, "
+            "\"keyword_fallbacks\": %lld, \"allocations\": %lld, "
+            "\"max_stack_depth\": %d, \"tokens\": {",
+            stats.dfa_transitions, stats.dfa_dead_exits,
+            stats.keyword_fallbacks, stats.allocations,
+            stats.max_stack_depth);
+    for (int k = 0; k < 128; k++)
+      if (stats.tokens[k]) {
+        fprintf(out, "%s\"%c\": %lld", sep, k, stats.tokens[k]);
+        sep = ", ";
+      }
+    fprintf(out, "}, \"productions\": {");
+    sep = "";
+    for (int p = 0; p < STAT_MAX_PROD; p++)
+      if (stats.productions[p]) {
+        fprintf(out, "%s\"%d\": %lld", sep, p, stats.productions[p]);
+        sep = ", ";
+      }
+    fprintf(out, "}}\n");
+    return;
+  }
+  fprintf(out, "\n=== STATISTICS ===\n");
+  for (int ph = 0; ph < STAT_NUM_PHASES; ph++)
+    fprintf(out, "%-22s %12.6f s\n", stat_phase_names[ph], stats.seconds[ph]);
+  fprintf(out, "%-22s %12lld\n", "dfa transitions", stats.dfa_transitions);
+  fprintf(out, "%-22s %12lld\n", "dfa dead exits", stats.dfa_dead_exits);
+  fprintf(out, "%-22s %12lld\n", "keyword fallbacks",
+          stats.keyword_fallbacks);
+  fprintf(out, "%-22s %12lld\n", "buffer allocations", stats.allocations);
+  fprintf(out, "%-22s %12d\n", "max parse stack depth",
+          stats.max_stack_depth);
+  fprintf(out, "Tokens by kind:\n");
+  for (int k = 0; k < 128; k++)
+    if (stats.tokens[k])
+      fprintf(out, "  %c %31lld\n", k, stats.tokens[k]);
+  fprintf(out, "Productions applied:\n");
+  for (int i = 0; i < NUM_PRODUCTIONS; i++) {
+    Production *p = &grammar[i];
+    if (stats.productions[p->prod_id])
+      fprintf(out, "  %2d. %c -> %-23s %8lld\n", p->prod_id, p->lhs,
+              *p->rhs ? p->rhs : "epsilon", stats.productions[p->prod_id]);
+  }
+#else
+  (void)json;
+  fprintf(out, "statistics were compiled out (NO_STATS)\n");
+#endif
+}
+
+// --- COMMAND LINE ---
+void print_usage(const char *prog) {
+  printf("Usage: %s                      interactive mode\n", prog);
+  printf("       %s [options] FILE       compile and run FILE\n", prog);
+  printf("Options:\n");
+  printf("  -O0 | -O1         compile from tokens, or through the SSA IR\n");
+  printf("                    with its optimizations (default -O1)\n");
+  printf("  --dump-ir         print the optimized SSA IR before running\n");
+  printf("  --opt-report      print inlining, loop and JIT reports to stderr\n");
+  printf("  --dump-bytecode   print the compiled bytecode before running\n");
+  printf("  --emit-asm OUT    write x86-64 assembly to OUT instead of running\n");
+  printf("  --emit-c OUT      write portable C to OUT instead of running\n");
+  printf("  --verify-c FILE...  build each FILE with --emit-c and cc -O2 and\n");
+  printf("                    compare with the interpreter\n");
+  printf("  --batch FILE...   run many programs in parallel, output in order\n");
+  printf("  --jobs N          worker threads for --batch and for optimizing\n");
+  printf("                    and compiling functions (default: all cores)\n");
+  printf("  --check           stop after semantic analysis\n");
+  printf("  --no-fuse         emit no superinstructions\n");
+  printf("  --no-jit          never tier hot functions up to native code\n");
+  printf("  --max-instructions N  stop a run after about N instructions\n");
+  printf("  --max-time SECONDS    stop a run after SECONDS of wall time\n");
+  printf("  --max-memory BYTES    cap the register stack (K, M, G suffixes)\n");
+  printf("  --usage           print how the run ended as JSON on stderr\n");
+  printf("  --profile OUT     sample the run and write folded stacks to OUT\n");
+  printf("  --profile-dispatch  count dispatched opcodes and opcode pairs\n");
+  printf("  --tok-out OUT     also write the lexer output as a binary .tok\n");
+  printf("                    file; FILE may be a .tok file to skip lexing\n");
+  printf("  --dump-tok FILE   print a .tok file's tokens with positions\n");
+  printf("  --tree-out OUT    write the parse tree as a flat binary file\n");
+  printf("  --dump-tree FILE  print a parse tree file as an outline\n");
+  printf("  --trace-out OUT   write a Chrome trace of every phase to OUT\n");
+  printf("  --stats           print front-end counters and time per phase\n");
+  printf("                    on stderr (--stats-json for JSON)\n");
+  printf("  --bench-vm [N]    run generated loop benchmarks (scale N)\n");
+  printf("  --bench-front-end [N]  time the lexer, parser and checks on\n");
+  printf("                    generated programs (scale N)\n");
+  printf("  --bench-report OUT  JSON report of --bench-front-end (default\n");
+  printf("                    %s)\n", BENCH_FE_REPORT);
+  printf("  --golden FILE...  check each FILE against the tokens and result\n");
+  printf("                    in its header comment and the speed baseline\n");
+  printf("  --baseline FILE   speed baseline for --golden (default %s)\n",
+         GOLDEN_BASELINE);
+  printf("  --update-baseline record the --golden speeds as the baseline\n");
+  printf("  --max-regression PCT  slowdown --golden tolerates (default 20)\n");
+  printf("  --dfa-heatmap HINTS FILE...  count DFA transitions over FILEs,\n");
+  printf("                    print a heatmap and write a state renumbering\n");
+  printf("                    hint to HINTS\n");
+  printf("  --fuzz-cost FILE...  front-end work per byte of each FILE;\n");
+  printf("                    fails over %.0f steps, transitions or\n",
+         FUZZ_MAX_PER_BYTE);
+  printf("                    allocations per byte\n");
+  printf("  --generate OUT [SPEC]  write a generated program, SPEC as in\n");
+  printf("                    seed=1,funcs=20,stmts=8,depth=3,nesting=2,\n");
+  printf("                    comments=10,errors=0\n");
+  printf("  --verbose         narrate lexing and parsing as in interactive mode\n");
+}
+
+/* A --max-* count of 0 or more, with a K, M or G suffix (times 1024 each)
+ * when units is set. Returns false, with a message, for anything else. */
+static bool parse_limit_count(const char *opt, const char *arg, bool units,
+                              long long *out) {
+  char *end;
+  errno = 0;
+  long long n = strtoll(arg, &end, 10);
+  const char *unit =
+      units && *end ? strchr("KMG", toupper((unsigned char)*end)) : NULL;
+  bool ok = end != arg && errno == 0 && n >= 0 && !*(unit ? end + 1 : end);
+  for (const char *u = "KMG"; ok && unit && u <= unit; u++) {
+    ok = n <= LLONG_MAX / 1024;
+    n *= ok ? 1024 : 1;
+  }
+  if (!ok) {
+    fprintf(stderr, "invalid %s '%s': expected %s, 0 for no limit\n", opt,
+            arg,
+            units ? "BYTES with an optional K, M or G suffix" : "a count");
+    return false;
+  }
+  *out = n;
+  return true;
+}
+
+/* --max-time: seconds of 0 or more */
+static bool parse_limit_seconds(const char *arg, double *out) {
+  char *end;
+  double s = strtod(arg, &end);
+  if (end == arg || *end || !(s >= 0)) {
+    fprintf(stderr,
+            "invalid --max-time '%s': expected SECONDS, 0 for no limit\n",
+            arg);
+    return false;
+  }
+  *out = s;
+  return true;
+}
+
+int run_command_line(int argc, char **argv) {
+  const char *input = NULL, *asm_out = NULL, *c_path = NULL;
+  const char *tok_out = NULL, *tree_out = NULL;
+  bool dump_ir = false, dump_bytecode = false, check_only = false;
+  bool show_stats = false, stats_json = false;
+  int jobs = 0;
+  verbose = false;
+  token_file = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-O0") == 0) {
+      opt_level = 0;
+    } else if (strcmp(argv[i], "-O1") == 0) {
+      opt_level = 1;
+    } else if (strcmp(argv[i], "--dump-ir") == 0) {
+      dump_ir = true;
+    } else if (strcmp(argv[i], "--opt-report") == 0) {
+      opt_report = true;
+    } else if (strcmp(argv[i], "--dump-bytecode") == 0) {
+      dump_bytecode = true;
+    } else if (strcmp(argv[i], "--emit-asm") == 0 && i + 1 < argc) {
+      asm_out = argv[++i];
+    } else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+      c_path = argv[++i];
+    } else if (strcmp(argv[i], "--verify-c") == 0) {
+      return verify_emitted_c(argv + i + 1, argc - i - 1);
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = compile_jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      return run_batch(argv + i + 1, argc - i - 1, jobs);
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check_only = true;
+    } else if (strcmp(argv[i], "--no-fuse") == 0) {
+      fuse_superinstructions = false;
+    } else if (strcmp(argv[i], "--no-jit") == 0) {
+      use_jit = false;
+    } else if (strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) {
+      i++;
+      if (!parse_limit_count(argv[i - 1], argv[i], false,
+                             &vm_limits.instructions)) {
+        print_usage(argv[0]);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "--max-time") == 0 && i + 1 < argc) {
+      if (!parse_limit_seconds(argv[++i], &vm_limits.seconds)) {
+        print_usage(argv[0]);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+      i++;
+      if (!parse_limit_count(argv[i - 1], argv[i], true, &vm_limits.bytes)) {
+        print_usage(argv[0]);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "--usage") == 0) {
+      show_usage = true;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "--profile-dispatch") == 0) {
+      profile_dispatch = true;
+    } else if (strcmp(argv[i], "--tok-out") == 0 && i + 1 < argc) {
+      tok_out = argv[++i];
+    } else if (strcmp(argv[i], "--dump-tok") == 0 && i + 1 < argc) {
+      return dump_tok_file(argv[i + 1]);
+    } else if (strcmp(argv[i], "--tree-out") == 0 && i + 1 < argc) {
+      tree_out = argv[++i];
+      record_derivation = true;
+    } else if (strcmp(argv[i], "--dump-tree") == 0 && i + 1 < argc) {
+      return dump_tree_file(argv[i + 1]);
+    } else if (strcmp(argv[i], "--trace-out") == 0 && i + 1 < argc) {
+      trace_start(argv[++i]);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+    } else if (strcmp(argv[i], "--stats-json") == 0) {
+      show_stats = stats_json = true;
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      verbose = true;
+      token_file = TOKFILE;
+    } else if (strcmp(argv[i], "--bench-vm") == 0) {
+      int scale = 10;
+      if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+        scale = atoi(argv[++i]);
+      return run_vm_benchmarks(scale);
+    } else if (strcmp(argv[i], "--bench-front-end") == 0) {
+      int scale = 10;
+      if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+        scale = atoi(argv[++i]);
+      return run_front_end_benchmarks(scale);
+    } else if (strcmp(argv[i], "--golden") == 0) {
+      return run_golden(argv + i + 1, argc - i - 1, jobs);
+    } else if (strcmp(argv[i], "--dfa-heatmap") == 0 && i + 1 < argc) {
+      return run_dfa_heatmap(argv[i + 1], argv + i + 2, argc - i - 2);
+    } else if (strcmp(argv[i], "--fuzz-cost") == 0) {
+      return run_fuzz_cost(argv + i + 1, argc - i - 1);
+    } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      golden_baseline = argv[++i];
+    } else if (strcmp(argv[i], "--update-baseline") == 0) {
+      golden_update = true;
+    } else if (strcmp(argv[i], "--max-regression") == 0 && i + 1 < argc) {
+      golden_max_regression = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-report") == 0 && i + 1 < argc) {
+      bench_report = argv[++i];
+    } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+      const char *path = argv[++i];
+      GenParams p = gen_defaults;
+      if (i + 1 < argc && strchr(argv[i + 1], '=') &&
+          !parse_gen_spec(argv[++i], &p)) {
+        fprintf(stderr, "bad generator spec '%s'\n", argv[i]);
+        return 2;
+      }
+      FILE *out = fopen(path, "w");
+      if (!out) {
+        perror(path);
+        return 1;
+      }
+      int rc = generate_program(out, &p);
+      fclose(out);
+      return rc;
+    } else if (strcmp(argv[i], "--help") == 0) {
+      print_usage(argv[0]);
+      return 0;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "unknown option '%s'\n", argv[i]);
+      print_usage(argv[0]);
+      return 2;
+    } else {
+      input = argv[i];
+    }
+  }
+  if (!input) {
+    print_usage(argv[0]);
+    return 2;
+  }
+  int rc, accepted = compile_front_end(input);
+  if (tok_out && lexed_count > 0 && write_tok_file(tok_out) != 0)
+    return 1;
+  if (tree_out && derivation_count > 0 && write_tree_file(tree_out) != 0)
+    return 1;
+  if (!accepted) {
+    fflush(stdout); /* diagnostics go to stdout, before the verdict */
+    fprintf(stderr, "%s: REJECTED\n", input);
+    rc = 1;
+  } else if (check_only)
+    rc = 0;
+  else if (asm_out)
+    rc = emit_assembly(asm_out, dump_ir);
+  else if (c_path)
+    rc = emit_c(c_path, input);
+  else
+    rc = execute_program(stdout, dump_ir, dump_bytecode);
+  if (show_stats) {
+    fflush(stdout);
+    display_stats(stderr, stats_json);
+  }
+  return rc;
+}
+
 // --- MAIN ---
-int main() {
+#ifndef FUZZING
+int main(int argc, char **argv) {
   init_dfa();
 
+  if (argc > 1)
+    return run_command_line(argc, argv);
+
   printf("\n");
   printf("############################################################\n");
   printf("###   CUSTOM LANGUAGE COMPILER - CSE332 LAB PROJECT     ###\n");
@@ -1406,7 +11363,7 @@ int main() {
   display_dfa_matrix();
 
   printf("\n=== GRAMMAR PRODUCTIONS ===\n");
-  printf("1.  S -> I Q A\n");
+  printf("1.  Z -> J Q A\n");
   printf("2.  Q -> U Q\n");
   printf("3.  Q -> epsilon\n");
   printf("4.  U -> T F B T V B B C B\n");
@@ -1426,6 +11383,8 @@ int main() {
   printf("18. G -> F B E B\n");
   printf("19. G -> B E B\n");
   printf("20. D -> L W B T V O N S B B C B\n");
+  printf("21. J -> I J\n");
+  printf("22. J -> epsilon\n");
   printf("\n");
 
   display_parsing_table();
@@ -1481,7 +11440,7 @@ int main() {
     printf("############################################################\n");
 
     printf("\n=== LOADING TOKENS FOR PARSING ===\n");
-    load_tokens(TOKFILE);
+    load_tokens(token_file);
     // Reset tpos for safety
     tpos = 0;
 
@@ -1496,6 +11455,18 @@ int main() {
     printf("\n=== RUNNING LL(1) PARSER ===\n");
     int ok = parse_with_visualization();
 
+    if (ok) {
+      printf("\n############################################################\n");
+      printf("###   SEMANTIC ANALYSIS (SYMBOL TABLE)                 ###\n");
+      printf("############################################################\n");
+      int serr = run_semantic_checks();
+      display_symbol_table();
+      if (serr > 0) {
+        printf("%d semantic error(s)\n", serr);
+        ok = 0;
+      }
+    }
+
     printf("\n############################################################\n");
     if (ok) {
       printf("###   RESULT: ACCEPTED ✓                                ###\n");
@@ -1503,7 +11474,16 @@ int main() {
       printf("###   RESULT: REJECTED ✗                                ###\n");
     }
     printf("############################################################\n");
+
+    if (ok) {
+      printf("\n############################################################\n");
+      printf("###   EXECUTION (REGISTER BYTECODE VM)                 ###\n");
+      printf("############################################################\n");
+      int rc = execute_program(stdout, true, true);
+      printf("\n[main returned %d]\n", rc);
+    }
   }
 
   return 0;
 }
+#endif
@@ -0,0 +1,209 @@
+/************************************************************
+ * binfile.c – Readers for the compiler's binary .tok and .tree files
+ ************************************************************/
+
+#include "binfile.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Map path read-only; NULL, with a message on stderr, if it cannot be
+ * opened or is shorter than a header of min bytes */
+static const uint8_t *map_file(const char *path, size_t min, size_t *size,
+                               const char *what) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+  const uint8_t *base = NULL;
+  if (st.st_size >= (off_t)min)
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (!base || base == MAP_FAILED) {
+    fprintf(stderr, "%s: not a %s file\n", path, what);
+    return NULL;
+  }
+  *size = st.st_size;
+  return base;
+}
+
+/* --- TOKEN FILES --- */
+
+void tok_close(TokFile *tf) {
+  if (tf->base)
+    munmap((void *)tf->base, tf->size);
+  tf->base = NULL;
+}
+
+bool tok_open(TokFile *tf, const char *path) {
+  memset(tf, 0, sizeof(*tf));
+  const uint8_t *base =
+      map_file(path, sizeof(TokHeader), &tf->size, "token");
+  if (!base)
+    return false;
+  tf->base = base;
+  uint32_t ntokens = tok_get32(base + 8), nstrings = tok_get32(base + 12);
+  uint32_t spans_at = tok_get32(base + 16), index_at = tok_get32(base + 20);
+  uint32_t blob_at = tok_get32(base + 24), size = tok_get32(base + 28);
+  if (memcmp(base, TOK_MAGIC, 4) != 0 ||
+      tok_get32(base + 4) != TOK_VERSION || size != tf->size ||
+      spans_at != sizeof(TokHeader) + ntokens || index_at < spans_at ||
+      blob_at != index_at + 4ull * nstrings || blob_at > size ||
+      (nstrings && base[size - 1] != 0)) {
+    fprintf(stderr, "%s: not a version %d token file\n", path, TOK_VERSION);
+    tok_close(tf);
+    return false;
+  }
+  tf->ntokens = ntokens;
+  tf->nstrings = nstrings;
+  tf->kinds = (const char *)base + sizeof(TokHeader);
+  tf->spans = base + spans_at;
+  tf->spans_end = base + index_at;
+  tf->index = base + index_at;
+  tf->blob = (const char *)base + blob_at;
+  tf->blob_size = size - blob_at;
+  for (int s = 0; s < tf->nstrings; s++)
+    if (tok_get32(tf->index + 4 * s) >= tf->blob_size) {
+      fprintf(stderr, "%s: corrupt string index\n", path);
+      tok_close(tf);
+      return false;
+    }
+  return true;
+}
+
+const char *tok_string(const TokFile *tf, int id) {
+  return tf->blob + tok_get32(tf->index + 4 * id);
+}
+
+static bool tok_varint(TokCursor *c, const uint8_t *end, uint32_t *v) {
+  *v = 0;
+  for (int shift = 0; c->p < end && shift < 35; shift += 7) {
+    uint8_t b = *c->p++;
+    *v |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+void tok_cursor(const TokFile *tf, TokCursor *c) {
+  c->p = tf->spans;
+  c->i = 0;
+  c->line = 1;
+  c->col = 0;
+}
+
+bool tok_next(const TokFile *tf, TokCursor *c, TokToken *t) {
+  uint32_t dline, col, len, string;
+  if (c->i >= tf->ntokens || !tok_varint(c, tf->spans_end, &dline) ||
+      !tok_varint(c, tf->spans_end, &col) ||
+      !tok_varint(c, tf->spans_end, &len) ||
+      !tok_varint(c, tf->spans_end, &string) ||
+      string >= (uint32_t)tf->nstrings)
+    return false;
+  c->col = dline ? (int)col : c->col + (int)col;
+  c->line += dline;
+  t->kind = tf->kinds[c->i++];
+  t->line = c->line;
+  t->col = c->col;
+  t->len = len;
+  t->string = string;
+  return true;
+}
+
+/* --- PARSE TREE FILES --- */
+
+static const uint8_t *tree_node(const TreeFile *tf, int i) {
+  return tf->nodes + (size_t)TREE_NODE_SIZE * i;
+}
+
+char tree_symbol(const TreeFile *tf, int i) {
+  return (char)tree_node(tf, i)[0];
+}
+
+int tree_production(const TreeFile *tf, int i) { return tree_node(tf, i)[1]; }
+
+bool tree_is_leaf(const TreeFile *tf, int i) {
+  return tree_production(tf, i) == 0;
+}
+
+int tree_child_count(const TreeFile *tf, int i) {
+  const uint8_t *n = tree_node(tf, i);
+  return n[2] | n[3] << 8;
+}
+
+int tree_child(const TreeFile *tf, int i, int k) {
+  return (int)tok_get32(tree_node(tf, i) + 4) + k;
+}
+
+const char *tree_text(const TreeFile *tf, int i) {
+  return tf->blob + tok_get32(tree_node(tf, i) + 4);
+}
+
+int tree_first_token(const TreeFile *tf, int i) {
+  return (int)tok_get32(tree_node(tf, i) + 8);
+}
+
+int tree_token_count(const TreeFile *tf, int i) {
+  return (int)tok_get32(tree_node(tf, i) + 12);
+}
+
+TreeSpan tree_span(const TreeFile *tf, int i) {
+  const uint8_t *n = tree_node(tf, i);
+  return (TreeSpan){(int)tok_get32(n + 16), (int)tok_get32(n + 20),
+                    (int)tok_get32(n + 24), (int)tok_get32(n + 28)};
+}
+
+void tree_close(TreeFile *tf) {
+  if (tf->base)
+    munmap((void *)tf->base, tf->size);
+  tf->base = NULL;
+}
+
+bool tree_open(TreeFile *tf, const char *path) {
+  memset(tf, 0, sizeof(*tf));
+  const uint8_t *base =
+      map_file(path, sizeof(TreeHeader), &tf->size, "parse tree");
+  if (!base)
+    return false;
+  tf->base = base;
+  uint32_t nnodes = tok_get32(base + 8), nodes_at = tok_get32(base + 20);
+  uint32_t blob_at = tok_get32(base + 24), size = tok_get32(base + 28);
+  if (memcmp(base, TREE_MAGIC, 4) != 0 ||
+      tok_get32(base + 4) != TREE_VERSION || size != tf->size ||
+      nnodes == 0 || nodes_at != sizeof(TreeHeader) ||
+      blob_at != nodes_at + (uint64_t)TREE_NODE_SIZE * nnodes ||
+      blob_at >= size || base[size - 1] != 0) {
+    fprintf(stderr, "%s: not a version %d parse tree file\n", path,
+            TREE_VERSION);
+    tree_close(tf);
+    return false;
+  }
+  tf->nnodes = nnodes;
+  tf->ntokens = tok_get32(base + 12);
+  tf->nstrings = tok_get32(base + 16);
+  tf->nodes = base + nodes_at;
+  tf->blob = (const char *)base + blob_at;
+  tf->blob_size = size - blob_at;
+  for (int i = 0; i < tf->nnodes; i++) {
+    uint32_t at = tok_get32(tree_node(tf, i) + 4);
+    bool ok = tree_is_leaf(tf, i)
+                  ? tree_child_count(tf, i) == 0 && at < tf->blob_size
+                  : at > (uint32_t)i &&
+                        at + tree_child_count(tf, i) <= (uint32_t)tf->nnodes;
+    if (!ok) {
+      fprintf(stderr, "%s: corrupt node %d\n", path, i);
+      tree_close(tf);
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,174 @@
+/************************************************************
+ * binfile.h – Readers for the compiler's binary .tok and .tree files
+ ************************************************************/
+
+/* The lexer's output (--tok-out) and the parse tree (--tree-out) as flat
+ * files that tools map and read in place. binfile.c needs only the C
+ * library and POSIX mmap, not the compiler, so a tool builds from this
+ * pair alone:
+ *
+ *   cc -O2 -o binstat binstat.c binfile.c
+ *
+ * All integers in both formats are little-endian. */
+#ifndef BINFILE_H
+#define BINFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static inline void tok_put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint32_t tok_get32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* --- TOKEN FILES --- */
+
+/* A .tok file keeps the lexer's output for tools and for later runs that
+ * skip lexing:
+ *
+ *   TokHeader   magic "TOK\x1a", version, counts and section offsets
+ *   kinds       one token kind byte per token
+ *   spans       per token, varints: line delta from the previous token,
+ *               column (a delta on the same line), lexeme length and
+ *               string id
+ *   index       uint32 offset of each string in the blob
+ *   blob        the distinct lexemes, NUL-terminated, in order of first use
+ *
+ * The tokens are those of one source file, without the modules its
+ * #include lines name, so they are in source order and a line delta is
+ * never negative. Readers map the file and use kinds, index and blob in
+ * place; only the spans are decoded, front to back, with tok_next. */
+#define TOK_MAGIC "TOK\x1a"
+#define TOK_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t ntokens, nstrings;
+  uint32_t spans_at, index_at, blob_at, size;
+} TokHeader;
+
+/* A mapped .tok file */
+typedef struct {
+  const uint8_t *base;
+  size_t size;
+  int ntokens, nstrings;
+  const char *kinds;   /* ntokens kind bytes */
+  const uint8_t *spans, *spans_end;
+  const uint8_t *index; /* nstrings little-endian uint32 */
+  const char *blob;
+  size_t blob_size;
+} TokFile;
+
+/* One decoded token */
+typedef struct {
+  char kind;
+  int line, col, len;
+  int string; /* id for tok_string */
+} TokToken;
+
+/* Read cursor over the spans */
+typedef struct {
+  const uint8_t *p;
+  int i, line, col;
+} TokCursor;
+
+/* Map path and check its header. Returns false, with a message on stderr,
+ * if it is not a readable .tok file of this version. */
+bool tok_open(TokFile *tf, const char *path);
+void tok_close(TokFile *tf);
+
+/* The lexeme with the given string id, NUL-terminated, in the mapping */
+const char *tok_string(const TokFile *tf, int id);
+
+void tok_cursor(const TokFile *tf, TokCursor *c);
+
+/* Decode the next token; false at the end or on a corrupt span */
+bool tok_next(const TokFile *tf, TokCursor *c, TokToken *t);
+
+/* --- PARSE TREE FILES --- */
+
+/* A .tree file is the parse tree of an accepted parse, for tools that
+ * should not link the compiler or parse again. Like a .tok file it covers
+ * one source file: the parser steps over included modules, and token
+ * indexes count that file's tokens only. There are no pointers:
+ * nodes refer to each other by index, so the file is used in place after
+ * mmap:
+ *
+ *   TreeHeader  magic "PTR\x1a", version, counts and section offsets
+ *   nodes       TREE_NODE_SIZE bytes per node; node 0 is the root Z
+ *   blob        the distinct lexemes of the leaves, NUL-terminated
+ *
+ * A node is
+ *
+ *   0   uint8   symbol: a nonterminal, or the token kind of a leaf
+ *   1   uint8   production id in the compiler's grammar; 0 for a leaf
+ *   2   uint16  number of children
+ *   4   uint32  first child, the others follow it; for a leaf, the offset
+ *               of its lexeme in the blob
+ *   8   uint32  first token and
+ *   12  uint32  number of tokens covered, indexes into the token stream
+ *   16  uint32  line and
+ *   20  uint32  column where the node starts,
+ *   24  uint32  line and
+ *   28  uint32  column just past its last token
+ *
+ * Children always follow their parent, so a walk from the root ends. An
+ * empty production covers no tokens and starts and ends where the next
+ * token starts. */
+#define TREE_MAGIC "PTR\x1a"
+#define TREE_VERSION 1
+#define TREE_NODE_SIZE 32
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t nnodes, ntokens, nstrings;
+  uint32_t nodes_at, blob_at, size;
+} TreeHeader;
+
+/* A mapped .tree file */
+typedef struct {
+  const uint8_t *base;
+  size_t size;
+  int nnodes, ntokens, nstrings;
+  const uint8_t *nodes;
+  const char *blob;
+  size_t blob_size;
+} TreeFile;
+
+/* Where a node starts and ends in the source */
+typedef struct {
+  int line, col, end_line, end_col;
+} TreeSpan;
+
+/* Map path and check it: the header, and that every child index and
+ * lexeme offset is in range, so the accessors need no checks. Returns
+ * false, with a message on stderr, if it is not a usable .tree file. */
+bool tree_open(TreeFile *tf, const char *path);
+void tree_close(TreeFile *tf);
+
+/* Field accessors; each reads node i in the mapping */
+char tree_symbol(const TreeFile *tf, int i);
+int tree_production(const TreeFile *tf, int i);
+bool tree_is_leaf(const TreeFile *tf, int i);
+int tree_child_count(const TreeFile *tf, int i);
+
+/* Child k of node i, as a node index */
+int tree_child(const TreeFile *tf, int i, int k);
+
+/* The lexeme of a leaf, NUL-terminated, in the mapping */
+const char *tree_text(const TreeFile *tf, int i);
+
+/* The tokens a node covers: first index and count */
+int tree_first_token(const TreeFile *tf, int i);
+int tree_token_count(const TreeFile *tf, int i);
+
+TreeSpan tree_span(const TreeFile *tf, int i);
+
+#endif
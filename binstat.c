@@ -0,0 +1,95 @@
+/************************************************************
+ * binstat.c – Summaries of .tok and .tree files, through binfile.h only
+ ************************************************************/
+
+/* A tool outside the compiler: it links binfile.c and nothing else.
+ *
+ *   cc -O2 -o binstat binstat.c binfile.c
+ *   ./binstat prog.tok prog.tree
+ *
+ * For a .tok file it counts tokens by kind and distinct lexemes; for a
+ * .tree file it counts nodes by symbol and reports the depth of the tree
+ * and the widest node. */
+
+#include "binfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_counts(const long *count) {
+  for (int c = 0; c < 128; c++)
+    if (count[c])
+      printf("  %c %8ld\n", c, count[c]);
+}
+
+static int tok_stats(const char *path) {
+  TokFile tf;
+  if (!tok_open(&tf, path))
+    return 1;
+  long count[128] = {0};
+  int lines = 0;
+  TokCursor c;
+  TokToken t;
+  tok_cursor(&tf, &c);
+  while (tok_next(&tf, &c, &t)) {
+    count[(unsigned char)t.kind & 127]++;
+    lines = t.line;
+  }
+  printf("%s: %d tokens, %d distinct lexemes, %d lines\n", path,
+         tf.ntokens, tf.nstrings, lines);
+  print_counts(count);
+  int rc = c.i == tf.ntokens ? 0 : 1;
+  if (rc)
+    fprintf(stderr, "%s: corrupt token spans\n", path);
+  tok_close(&tf);
+  return rc;
+}
+
+static int tree_stats(const char *path) {
+  TreeFile tf;
+  if (!tree_open(&tf, path))
+    return 1;
+  long count[128] = {0};
+  int leaves = 0, max_depth = 0, widest = 0;
+  /* children follow their parent, so one pass in index order sees every
+   * parent's depth before its children's */
+  int *depth = calloc(tf.nnodes, sizeof(int));
+  if (!depth) {
+    perror("binstat");
+    exit(1);
+  }
+  for (int i = 0; i < tf.nnodes; i++) {
+    count[(unsigned char)tree_symbol(&tf, i) & 127]++;
+    leaves += tree_is_leaf(&tf, i);
+    max_depth = depth[i] > max_depth ? depth[i] : max_depth;
+    int n = tree_child_count(&tf, i);
+    widest = n > tree_child_count(&tf, widest) ? i : widest;
+    for (int k = 0; k < n; k++)
+      depth[tree_child(&tf, i, k)] = depth[i] + 1;
+  }
+  TreeSpan sp = tree_span(&tf, widest);
+  printf("%s: %d nodes, %d leaves, %d tokens, depth %d\n", path, tf.nnodes,
+         leaves, tf.ntokens, max_depth);
+  printf("widest node %d: %c with %d children at %d:%d\n", widest,
+         tree_symbol(&tf, widest), tree_child_count(&tf, widest), sp.line,
+         sp.col);
+  print_counts(count);
+  free(depth);
+  tree_close(&tf);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s FILE.tok|FILE.tree...\n", argv[0]);
+    return 2;
+  }
+  int rc = 0;
+  for (int i = 1; i < argc; i++) {
+    size_t n = strlen(argv[i]);
+    bool tree = n > 5 && strcmp(argv[i] + n - 5, ".tree") == 0;
+    rc |= tree ? tree_stats(argv[i]) : tok_stats(argv[i]);
+  }
+  return rc;
+}
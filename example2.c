@@ -29,7 +29,7 @@ int main() {
   dec _input3k = 10.. dec _result4m = 2..
 
       loop_main01 : while (int _m7x < 3..) {
-    printf(_rt4c)..break..
+    printf(_result4m)..break..
   }
 
   return 0..
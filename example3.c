@@ -27,4 +27,4 @@
 
 #include <stdio.h>
 
-int main(){dec _input3k = 10.. dec _result4m = 2.. printf(_rt4c)..return 0..}
+int main(){dec _input3k = 10.. dec _result4m = 2.. printf(_result4m)..return 0..}